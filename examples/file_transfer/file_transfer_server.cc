@@ -1,42 +1,10 @@
-#include <fcntl.h>
-
 #include <thread>
-#include <unordered_map>
 
 #include "config.h"
+#include "cppev/file_cache.h"
 #include "cppev/logger.h"
 #include "cppev/tcp.h"
 
-class filecache final
-{
-public:
-    // 懒加载文件内容到内存缓冲区
-    // 先找在加载
-    const cppev::buffer *lazyload(const std::string &filename)
-    {
-        std::unique_lock<std::mutex> lock(lock_);
-        if (hash_.count(filename) != 0)
-        {
-            return &(hash_[filename]->rbuffer());
-        }
-        LOG_INFO << "start loading file";
-        int fd = open(filename.c_str(), O_RDONLY);
-        // 找个专门的管理员（stream对象）管这个文件
-        std::shared_ptr<cppev::stream> iops =
-            std::make_shared<cppev::stream>(fd);
-        iops->read_all(CHUNK_SIZE);
-        close(fd);
-        hash_[filename] = iops;
-        LOG_INFO << "finish loading file";
-        return &(iops->rbuffer());
-    }
-
-private:
-    std::mutex lock_;
-
-    std::unordered_map<std::string, std::shared_ptr<cppev::stream>> hash_;
-};
-
 cppev::reactor::tcp_event_handler on_read_complete =
     [](const std::shared_ptr<cppev::socktcp> &iopt) -> void
 {
@@ -53,14 +21,43 @@ cppev::reactor::tcp_event_handler on_read_complete =
     filename = filename.substr(0, filename.size() - 1);
     LOG_INFO << "client request file : " << filename;
 
-    // 获取文件内容 (缓存机制)
-    const cppev::buffer *bf =
-        reinterpret_cast<filecache *>(cppev::reactor::external_data(iopt))
-            ->lazyload(filename);
+    // 零拷贝发送文件内容给客户端，file 在发送完毕前保持引用
+    auto send = [](const std::shared_ptr<cppev::socktcp> &iopt,
+                   const cppev::file_view &file)
+    {
+        if (file == nullptr)
+        {
+            cppev::reactor::safely_close(iopt);
+            return;
+        }
+        cppev::reactor::async_sendfile(iopt, file->fd(), 0, file->size(),
+                                       file);
+    };
+
+    // 命中缓存时直接发送
+    auto *cache = reinterpret_cast<cppev::file_cache *>(
+        cppev::reactor::external_data(iopt));
+    cppev::file_view file = cache->lookup(filename);
+    if (file)
+    {
+        send(iopt, file);
+        return;
+    }
 
-    // 把文件内容写入写缓冲区，准备发送给客户端
-    iopt->wbuffer().put_string(bf->data(), bf->size());
-    cppev::reactor::async_write(iopt);
+    // 未命中时由加载线程加载，加载完成后切回连接所在的事件循环发送
+    cppev::event_loop *evlp = &(iopt->evlp());
+    cache->get(filename,
+               [=](const cppev::file_view &file)
+               {
+                   evlp->post(
+                       [=]
+                       {
+                           if (!iopt->is_closed())
+                           {
+                               send(iopt, file);
+                           }
+                       });
+               });
     LOG_INFO << "end callback : on_read_complete";
 };
 
@@ -76,7 +73,7 @@ int main()
 {
     cppev::thread_block_signal(SIGINT);
 
-    filecache cache;
+    cppev::file_cache cache;
     cppev::reactor::tcp_server server(3, false, &cache);
     server.set_on_read_complete(on_read_complete);
     server.set_on_write_complete(on_write_complete);
@@ -21,6 +21,39 @@ namespace cppev
 
         // reactor关闭的超时时间，单位毫秒
         CPPEV_PUBLIC extern int reactor_shutdown_timeout; 
+
+        // reactor排空连接时报告进度的间隔，单位毫秒
+        CPPEV_PUBLIC extern int reactor_drain_interval;
+
+        // reactor 的连接是否使用边缘触发：写事件在连接生命周期内只注册一次，读写都排空至 EAGAIN
+        CPPEV_PUBLIC extern bool reactor_edge_trigger;
+
+        // reactor 一次可读事件最多读取的字节数，超出后该连接让出事件循环，边缘触发时排队到本轮末尾继续读取
+        CPPEV_PUBLIC extern int reactor_read_budget;
+
+        // 域名解析结果的缓存时间，单位毫秒
+        CPPEV_PUBLIC extern int resolver_cache_ttl;
+
+        // happy eyeballs 发起下一个地址连接前的等待时间，单位毫秒
+        CPPEV_PUBLIC extern int connection_attempt_delay;
+
+        // 文件缓存的容量，单位MB
+        CPPEV_PUBLIC extern int file_cache_capacity;
+
+        // 文件缓存命中时重新检查文件是否变更的间隔，单位毫秒
+        CPPEV_PUBLIC extern int file_cache_revalidate;
+
+        // 使用 MSG_ZEROCOPY 发送的最小数据量，单位字节，更小的数据拷贝开销低于页锁定与完成通知
+        CPPEV_PUBLIC extern int zerocopy_threshold;
+
+        // 关闭后仍等待零拷贝完成通知的连接，后台回收的检查间隔，单位毫秒
+        CPPEV_PUBLIC extern int zerocopy_reap_interval;
+
+        // udp reactor 一次系统调用批量接收的数据报数量
+        CPPEV_PUBLIC extern int udp_batch_size;
+
+        // udp reactor 每个 socket 发送队列可容纳的数据报数量，队列满时丢弃
+        CPPEV_PUBLIC extern int udp_send_queue;
     }
 }
 
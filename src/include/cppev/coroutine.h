@@ -0,0 +1,871 @@
+#ifndef _cppev_coroutine_h_6C0224787A17_
+#define _cppev_coroutine_h_6C0224787A17_
+
+// Coroutines need C++20, the header is empty for earlier standards so that
+// it is harmless to include.
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "cppev/event_loop.h"
+#include "cppev/io.h"
+#include "cppev/logger.h"
+
+/*
+    Coroutines on event_loop.
+
+    task<T> is a lazy coroutine started when awaited, or by co_spawn for the
+    outermost one. The first wait on a stream registers its fd to the loop of
+    the stream in edge triggered mode, the fd stays registered and later
+    waits only record the coroutine to resume, so that no syscall nor
+    allocation is made per wait. The coroutine is resumed by the loop thread
+    in the fd callback, so that no thread is switched and nothing but the
+    coroutine frame holds the state of the protocol.
+
+    A stream shall be either driven by coroutines or by callbacks of its own
+    at a time, both register the same fd. Stream shall be attached to loop
+    by set_evlp if not registered to it already. Stream waited on shall be
+    closed by co_close, which removes the fd from the loop and resumes
+    coroutines still waiting on it with an error.
+
+    Frames are allocated from free lists of the thread running the loop,
+    which are reused by later coroutines of the same loop.
+ */
+
+namespace cppev
+{
+
+// Free lists of coroutine frames of current thread by size class, frames
+// larger than the largest class are allocated by global new.
+class CPPEV_PUBLIC coroutine_frame_pool final
+{
+public:
+    static void *allocate(size_t size)
+    {
+        size_t index = size_class(size);
+        if (index < class_num)
+        {
+            auto &list = local().lists[index];
+            if (list.size())
+            {
+                void *p = list.back();
+                list.pop_back();
+                return p;
+            }
+            return ::operator new((index + 1) * granule);
+        }
+        return ::operator new(size);
+    }
+
+    static void deallocate(void *p, size_t size) noexcept
+    {
+        size_t index = size_class(size);
+        if (index < class_num)
+        {
+            auto &list = local().lists[index];
+            if (list.size() < max_cached)
+            {
+                try
+                {
+                    list.push_back(p);
+                    return;
+                }
+                catch (...)
+                {
+                }
+            }
+        }
+        ::operator delete(p);
+    }
+
+private:
+    static const size_t granule = 64;
+
+    static const size_t class_num = 32;
+
+    // Frames kept by each class of each thread.
+    static const size_t max_cached = 1024;
+
+    struct free_lists
+    {
+        ~free_lists()
+        {
+            for (auto &list : lists)
+            {
+                for (void *p : list)
+                {
+                    ::operator delete(p);
+                }
+            }
+        }
+
+        std::array<std::vector<void *>, class_num> lists;
+    };
+
+    static size_t size_class(size_t size) noexcept
+    {
+        return (size + granule - 1) / granule - 1;
+    }
+
+    static free_lists &local()
+    {
+        static thread_local free_lists lists;
+        return lists;
+    }
+};
+
+template <typename T = void>
+class task;
+
+class CPPEV_PUBLIC task_promise_base
+{
+public:
+    static void *operator new(size_t size)
+    {
+        return coroutine_frame_pool::allocate(size);
+    }
+
+    static void operator delete(void *p, size_t size) noexcept
+    {
+        coroutine_frame_pool::deallocate(p, size);
+    }
+
+    std::suspend_always initial_suspend() noexcept
+    {
+        return {};
+    }
+
+    // Resume the awaiting coroutine by symmetric transfer, so that a chain
+    // of tasks completing at once does not grow the stack.
+    struct final_awaiter
+    {
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(
+            std::coroutine_handle<Promise> h) noexcept
+        {
+            std::coroutine_handle<> continuation = h.promise().continuation_;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept
+        {
+        }
+    };
+
+    final_awaiter final_suspend() noexcept
+    {
+        return {};
+    }
+
+    void unhandled_exception() noexcept
+    {
+        exception_ = std::current_exception();
+    }
+
+    void set_continuation(std::coroutine_handle<> continuation) noexcept
+    {
+        continuation_ = continuation;
+    }
+
+protected:
+    std::coroutine_handle<> continuation_;
+
+    std::exception_ptr exception_;
+};
+
+template <typename T>
+class CPPEV_PUBLIC task_promise final : public task_promise_base
+{
+public:
+    task<T> get_return_object() noexcept;
+
+    template <typename U>
+    void return_value(U &&value)
+    {
+        value_.emplace(std::forward<U>(value));
+    }
+
+    T result()
+    {
+        if (exception_)
+        {
+            std::rethrow_exception(exception_);
+        }
+        return std::move(*value_);
+    }
+
+private:
+    std::optional<T> value_;
+};
+
+template <>
+class CPPEV_PUBLIC task_promise<void> final : public task_promise_base
+{
+public:
+    task<void> get_return_object() noexcept;
+
+    void return_void() noexcept
+    {
+    }
+
+    void result()
+    {
+        if (exception_)
+        {
+            std::rethrow_exception(exception_);
+        }
+    }
+};
+
+// Lazy coroutine returning T, move-only. Started when awaited and resumes
+// the awaiting coroutine when done, exception is rethrown to it.
+template <typename T>
+class CPPEV_PUBLIC task final
+{
+public:
+    using promise_type = task_promise<T>;
+
+    using value_type = T;
+
+    task() noexcept = default;
+
+    explicit task(std::coroutine_handle<promise_type> h) noexcept : h_(h)
+    {
+    }
+
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+
+    task(task &&other) noexcept : h_(std::exchange(other.h_, nullptr))
+    {
+    }
+
+    task &operator=(task &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (h_)
+            {
+                h_.destroy();
+            }
+            h_ = std::exchange(other.h_, nullptr);
+        }
+        return *this;
+    }
+
+    ~task()
+    {
+        if (h_)
+        {
+            h_.destroy();
+        }
+    }
+
+    bool valid() const noexcept
+    {
+        return static_cast<bool>(h_);
+    }
+
+    auto operator co_await() && noexcept
+    {
+        struct awaiter
+        {
+            bool await_ready() noexcept
+            {
+                return !h || h.done();
+            }
+
+            std::coroutine_handle<> await_suspend(
+                std::coroutine_handle<> awaiting) noexcept
+            {
+                h.promise().set_continuation(awaiting);
+                return h;
+            }
+
+            T await_resume()
+            {
+                return h.promise().result();
+            }
+
+            std::coroutine_handle<promise_type> h;
+        };
+        return awaiter{h_};
+    }
+
+private:
+    std::coroutine_handle<promise_type> h_;
+};
+
+template <typename T>
+task<T> task_promise<T>::get_return_object() noexcept
+{
+    return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+}
+
+inline task<void> task_promise<void>::get_return_object() noexcept
+{
+    return task<void>(
+        std::coroutine_handle<task_promise<void>>::from_promise(*this));
+}
+
+// Coroutine running eagerly and destroying itself when done, used to start
+// tasks nobody awaits.
+class CPPEV_PUBLIC detached_task final
+{
+public:
+    class promise_type
+    {
+    public:
+        static void *operator new(size_t size)
+        {
+            return coroutine_frame_pool::allocate(size);
+        }
+
+        static void operator delete(void *p, size_t size) noexcept
+        {
+            coroutine_frame_pool::deallocate(p, size);
+        }
+
+        detached_task get_return_object() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_void() noexcept
+        {
+        }
+
+        // Callers catch everything.
+        void unhandled_exception() noexcept
+        {
+            std::terminate();
+        }
+    };
+};
+
+inline detached_task co_detach(task<void> t)
+{
+    try
+    {
+        co_await std::move(t);
+    }
+    catch (const std::exception &e)
+    {
+        LOG_ERROR << "coroutine exits with exception : " << e.what();
+    }
+    catch (...)
+    {
+        LOG_ERROR << "coroutine exits with unknown exception";
+    }
+}
+
+// Start task on loop thread, exception escaping it is logged.
+// @param evlp      Loop.
+// @param t         Task.
+inline void co_spawn(event_loop &evlp, task<void> t)
+{
+    evlp.post([t = std::move(t)]() mutable { co_detach(std::move(t)); });
+}
+
+// Coroutines waiting on one stream. Fd callbacks are registered on the first
+// wait of each event and kept until co_close, used by loop thread only.
+// Streams destroyed or closed other than by co_close are dropped by a sweep
+// once the streams tracked by the thread have doubled since the last one.
+class CPPEV_PUBLIC fd_waiters final
+{
+public:
+    // Suspend coroutine until event of stream is ready, register the fd if
+    // not yet.
+    static void wait(const std::shared_ptr<io> &iop, fd_event ev,
+                     std::coroutine_handle<> h)
+    {
+        auto &waiters = local();
+        sweep(waiters);
+        auto iter = waiters.find(iop.get());
+        // Stale if the stream is destroyed and the address reused, or the
+        // loop of the stream is another one.
+        if (iter == waiters.end() || iter->second->iop_.lock() != iop ||
+            iter->second->evlp_ != &iop->evlp())
+        {
+            auto state = std::make_shared<fd_waiters>();
+            state->iop_ = iop;
+            state->evlp_ = &iop->evlp();
+            iter = waiters.insert_or_assign(iop.get(), state).first;
+        }
+        std::shared_ptr<fd_waiters> state = iter->second;
+        int index = ev == fd_event::fd_readable ? 0 : 1;
+        if (!state->registered_[index])
+        {
+            // Edges arriving while no coroutine waits are dropped, a waiter
+            // always tries io first and waits only after it would block.
+            if (!state->registered_[1 - index])
+            {
+                state->evlp_->fd_set_mode(iop, fd_event_mode::edge_trigger);
+            }
+            state->evlp_->fd_register_and_activate(
+                iop, ev,
+                [state, index](const std::shared_ptr<io> &)
+                {
+                    std::coroutine_handle<> waiting =
+                        std::exchange(state->waiting_[index], nullptr);
+                    if (waiting)
+                    {
+                        waiting.resume();
+                    }
+                });
+            state->registered_[index] = true;
+        }
+        state->waiting_[index] = h;
+    }
+
+    // Remove fd from loop, close stream and resume coroutines waiting on it
+    // after the current one suspends.
+    static void close(const std::shared_ptr<io> &iop)
+    {
+        auto &waiters = local();
+        auto iter = waiters.find(iop.get());
+        if (iter == waiters.end())
+        {
+            iop->close();
+            return;
+        }
+        std::shared_ptr<fd_waiters> state = std::move(iter->second);
+        waiters.erase(iter);
+        event_loop *evlp = state->evlp_;
+        if (&iop->evlp() == evlp)
+        {
+            evlp->fd_clean(iop);
+        }
+        iop->close();
+        for (auto &waiting : state->waiting_)
+        {
+            if (waiting)
+            {
+                evlp->post([h = std::exchange(waiting, nullptr)]
+                           { h.resume(); });
+            }
+        }
+    }
+
+    // Streams tracked by the calling thread.
+    static size_t tracked()
+    {
+        return local().size();
+    }
+
+private:
+    using waiters_map =
+        std::unordered_map<const io *, std::shared_ptr<fd_waiters>>;
+
+    static waiters_map &local()
+    {
+        static thread_local waiters_map waiters;
+        return waiters;
+    }
+
+    // Drop streams destroyed or closed, coroutines still waiting on closed
+    // ones are resumed with error as co_close does.
+    static void sweep(waiters_map &waiters)
+    {
+        static thread_local size_t sweep_at = 64;
+        if (waiters.size() < sweep_at)
+        {
+            return;
+        }
+        for (auto iter = waiters.begin(); iter != waiters.end();)
+        {
+            std::shared_ptr<io> iop = iter->second->iop_.lock();
+            if (iop && !iop->is_closed())
+            {
+                ++iter;
+                continue;
+            }
+            for (auto &waiting : iter->second->waiting_)
+            {
+                if (waiting)
+                {
+                    iter->second->evlp_->post(
+                        [h = std::exchange(waiting, nullptr)] { h.resume(); });
+                }
+            }
+            iter = waiters.erase(iter);
+        }
+        sweep_at = std::max<size_t>(64, 2 * waiters.size());
+    }
+
+    std::weak_ptr<io> iop_;
+
+    event_loop *evlp_ = nullptr;
+
+    // Readable and writable.
+    bool registered_[2] = {false, false};
+
+    std::coroutine_handle<> waiting_[2];
+};
+
+// Awaiter resuming coroutine by loop thread when fd is ready.
+class CPPEV_PUBLIC fd_ready_awaiter final
+{
+public:
+    fd_ready_awaiter(std::shared_ptr<io> iop, fd_event ev) noexcept
+        : iop_(std::move(iop)), ev_(ev)
+    {
+    }
+
+    bool await_ready() const noexcept
+    {
+        return iop_->is_closed();
+    }
+
+    // Exception of registration is rethrown to the coroutine.
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        fd_waiters::wait(iop_, ev_, h);
+    }
+
+    // @return  Whether fd is ready, false if stream is closed.
+    bool await_resume() const noexcept
+    {
+        return !iop_->is_closed();
+    }
+
+private:
+    std::shared_ptr<io> iop_;
+
+    fd_event ev_;
+};
+
+// Wait until fd is ready on its loop.
+inline fd_ready_awaiter async_ready(std::shared_ptr<io> iop, fd_event ev)
+{
+    return fd_ready_awaiter(std::move(iop), ev);
+}
+
+// Close stream waited on by coroutines, shall be called by loop thread.
+// Coroutines waiting on it are resumed with error.
+inline void co_close(const std::shared_ptr<io> &iop)
+{
+    fd_waiters::close(iop);
+}
+
+// Awaiter resuming coroutine by loop thread after delay.
+class CPPEV_PUBLIC sleep_awaiter final
+{
+public:
+    sleep_awaiter(event_loop &evlp, std::chrono::milliseconds delay) noexcept
+        : evlp_(evlp), delay_(delay)
+    {
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        evlp_.post_after(static_cast<int>(delay_.count()),
+                         [h]() { h.resume(); });
+    }
+
+    void await_resume() const noexcept
+    {
+    }
+
+private:
+    event_loop &evlp_;
+
+    std::chrono::milliseconds delay_;
+};
+
+// Resume on loop thread after delay, by timer of loop.
+inline sleep_awaiter async_sleep_for(event_loop &evlp,
+                                     std::chrono::milliseconds delay)
+{
+    return sleep_awaiter(evlp, delay);
+}
+
+// Read available bytes to rbuffer, wait if none.
+// @param iop       Stream.
+// @param len       Bytes read at most.
+// @return          Bytes read, 0 if end of file, -1 if reset, broken or
+//                  closed.
+inline task<int> async_read_some(std::shared_ptr<stream> iop,
+                                 int len = sysconfig::buffer_io_step)
+{
+    while (!iop->is_closed())
+    {
+        int ret = iop->read_chunk(len);
+        if (ret >= 0)
+        {
+            co_return ret;
+        }
+        if (iop->is_reset() || iop->eop())
+        {
+            co_return -1;
+        }
+        co_await async_ready(iop, fd_event::fd_readable);
+    }
+    co_return -1;
+}
+
+// Read until rbuffer holds at least len bytes, bytes are left in rbuffer.
+// @return          Whether len bytes arrived before end of file or error.
+inline task<bool> async_read_exact(std::shared_ptr<stream> iop, int len)
+{
+    while (iop->rbuffer().size() < len)
+    {
+        int ret = co_await async_read_some(
+            iop, std::max(len - iop->rbuffer().size(),
+                          sysconfig::buffer_io_step));
+        if (ret <= 0)
+        {
+            co_return false;
+        }
+    }
+    co_return true;
+}
+
+// Read until rbuffer holds delim, bytes are left in rbuffer.
+// @return          Bytes in rbuffer up to and including delim, -1 if end of
+//                  file or error comes first.
+inline task<int> async_read_until(std::shared_ptr<stream> iop,
+                                  std::string delim)
+{
+    // Bytes searched already, a match may start in the last ones.
+    size_t searched = 0;
+    while (true)
+    {
+        std::string_view data(iop->rbuffer().data(), iop->rbuffer().size());
+        size_t from =
+            searched > delim.size() ? searched - delim.size() + 1 : 0;
+        size_t pos = data.find(delim, from);
+        if (pos != std::string_view::npos)
+        {
+            co_return static_cast<int>(pos + delim.size());
+        }
+        searched = data.size();
+        int ret = co_await async_read_some(iop);
+        if (ret <= 0)
+        {
+            co_return -1;
+        }
+    }
+}
+
+// Write wbuffer until empty, wait while fd is not writable.
+// @return          Whether all is written before reset, broken pipe or
+//                  close.
+inline task<bool> async_write_all(std::shared_ptr<stream> iop)
+{
+    while (!iop->is_closed())
+    {
+        iop->write_all();
+        if (iop->wbuffer().size() == 0)
+        {
+            co_return true;
+        }
+        if (iop->is_reset() || iop->eop())
+        {
+            co_return false;
+        }
+        co_await async_ready(iop, fd_event::fd_writable);
+    }
+    co_return false;
+}
+
+// Completion of tasks started by when_all, shared by their runners.
+class CPPEV_PUBLIC when_all_state final
+{
+public:
+    // One more than tasks, the awaiting coroutine arrives after starting
+    // them all.
+    explicit when_all_state(size_t num) noexcept : remaining_(num + 1)
+    {
+    }
+
+    // Store first exception.
+    void fail(std::exception_ptr e) noexcept
+    {
+        if (!failed_.exchange(true))
+        {
+            exception_ = e;
+        }
+    }
+
+    // @return  Whether the last one arrives, which resumes the awaiter.
+    bool arrive() noexcept
+    {
+        return remaining_.fetch_sub(1) == 1;
+    }
+
+    void set_awaiting(std::coroutine_handle<> h) noexcept
+    {
+        awaiting_ = h;
+    }
+
+    std::coroutine_handle<> awaiting() const noexcept
+    {
+        return awaiting_;
+    }
+
+    void rethrow_if_failed()
+    {
+        if (exception_)
+        {
+            std::rethrow_exception(exception_);
+        }
+    }
+
+private:
+    std::atomic<size_t> remaining_;
+
+    std::atomic<bool> failed_{false};
+
+    std::exception_ptr exception_;
+
+    std::coroutine_handle<> awaiting_;
+};
+
+template <typename T>
+detached_task when_all_run(task<T> t, when_all_state *state,
+                           std::optional<T> *slot)
+{
+    try
+    {
+        slot->emplace(co_await std::move(t));
+    }
+    catch (...)
+    {
+        state->fail(std::current_exception());
+    }
+    // State may be gone once awaiter is resumed.
+    if (state->arrive())
+    {
+        state->awaiting().resume();
+    }
+}
+
+inline detached_task when_all_run(task<void> t, when_all_state *state)
+{
+    try
+    {
+        co_await std::move(t);
+    }
+    catch (...)
+    {
+        state->fail(std::current_exception());
+    }
+    if (state->arrive())
+    {
+        state->awaiting().resume();
+    }
+}
+
+// Awaiter starting runners of tasks and suspending until they finish.
+template <typename Start>
+class CPPEV_PUBLIC when_all_awaiter final
+{
+public:
+    when_all_awaiter(when_all_state &state, Start start)
+        : state_(state), start_(std::move(start))
+    {
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        state_.set_awaiting(h);
+        start_();
+        return !state_.arrive();
+    }
+
+    void await_resume()
+    {
+        state_.rethrow_if_failed();
+    }
+
+private:
+    when_all_state &state_;
+
+    Start start_;
+};
+
+// Run tasks concurrently and wait for them all.
+// @return  Values in order, the first exception is rethrown after all
+//          tasks finish.
+template <typename T>
+task<std::vector<T>> when_all(std::vector<task<T>> tasks)
+{
+    std::vector<std::optional<T>> slots(tasks.size());
+    when_all_state state(tasks.size());
+    co_await when_all_awaiter(
+        state,
+        [&]
+        {
+            for (size_t i = 0; i < tasks.size(); ++i)
+            {
+                when_all_run(std::move(tasks[i]), &state, &slots[i]);
+            }
+        });
+    std::vector<T> values;
+    values.reserve(slots.size());
+    for (auto &slot : slots)
+    {
+        values.push_back(std::move(*slot));
+    }
+    co_return values;
+}
+
+// Same as above for tasks without value.
+inline task<void> when_all(std::vector<task<void>> tasks)
+{
+    when_all_state state(tasks.size());
+    co_await when_all_awaiter(state,
+                              [&]
+                              {
+                                  for (auto &t : tasks)
+                                  {
+                                      when_all_run(std::move(t), &state);
+                                  }
+                              });
+}
+
+}  // namespace cppev
+
+#endif  // __cpp_impl_coroutine
+
+#endif  // coroutine.h
@@ -4,15 +4,25 @@
 
 #include "cppev/buffer.h"
 #include "cppev/common.h"
+#include "cppev/coroutine.h"
 #include "cppev/event_loop.h"
+#include "cppev/file_cache.h"
+#include "cppev/future.h"
 #include "cppev/io.h"
 #include "cppev/ipc.h"
 #include "cppev/lock.h"
+#include "cppev/lockfree_queue.h"
 #include "cppev/logger.h"
+#include "cppev/parallel.h"
+#include "cppev/resolver.h"
 #include "cppev/runnable.h"
+#include "cppev/static_reactor.h"
+#include "cppev/stop_token.h"
 #include "cppev/subprocess.h"
 #include "cppev/tcp.h"
+#include "cppev/udp.h"
 #include "cppev/thread_pool.h"
+#include "cppev/unique_function.h"
 #include "cppev/utils.h"
 
 #endif  // cppev_tcp_h_3F5D2C1A9B4E_
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <unistd.h>
 
+#include <chrono>
 #include <condition_variable>
 #include <functional>
 #include <memory>
@@ -14,6 +15,8 @@
 #include "cppev/common.h"
 #include "cppev/io.h"
 #include "cppev/logger.h"
+#include "cppev/stop_token.h"
+#include "cppev/unique_function.h"
 #include "cppev/utils.h"
 
 namespace cppev
@@ -62,6 +65,9 @@ CPPEV_PRIVATE extern const std::unordered_map<fd_event, const char *>
 // 允许用户在事件发生时执行自定义的逻辑（比如读取数据、写入数据等）。
 using fd_event_handler = std::function<void(const std::shared_ptr<io> &)>;
 
+// 投递到事件循环线程执行的任务。
+using loop_task_handler = unique_function<void(void)>;
+
 struct CPPEV_PRIVATE fd_event_hash
 {
     std::size_t operator()(const std::tuple<int, fd_event> &ev) const noexcept;
@@ -115,6 +121,15 @@ public:
                      const fd_event_handler &handler = fd_event_handler(),
                      priority prio = priority::p0);
 
+    // 同上，回调函数由调用方预先创建并在多个 FD 之间共享，注册时不再分配内存。
+    // @param iop       IO 智能指针。
+    // @param ev_type   事件类型 (读/写)。
+    // @param handler   共享的 FD 事件回调函数。
+    // @param prio      事件优先级。
+    void fd_register(const std::shared_ptr<io> &iop, fd_event ev_type,
+                     const std::shared_ptr<fd_event_handler> &handler,
+                     priority prio = priority::p0);
+
     // 激活 FD 事件（调用系统 API 开始监听）。
     // @param iop       IO 智能指针。
     // @param ev_type   事件类型。
@@ -130,6 +145,16 @@ public:
         const fd_event_handler &handler = fd_event_handler(),
         priority prio = priority::p0);
 
+    // 同上，使用共享的 FD 事件回调函数。
+    // @param iop       IO 智能指针。
+    // @param ev_type   事件类型。
+    // @param handler   共享的 FD 事件回调函数。
+    // @param prio      事件优先级。
+    void fd_register_and_activate(
+        const std::shared_ptr<io> &iop, fd_event ev_type,
+        const std::shared_ptr<fd_event_handler> &handler,
+        priority prio = priority::p0);
+
     // 从用户态事件轮询器中移除 FD 事件，但不从系统 IO 多路复用层取消激活。
     // （通常用于逻辑删除，实际内核监听可能还在，需谨慎使用）
     // @param iop       IO 智能指针。
@@ -167,6 +192,22 @@ public:
     // @return          true: 其他线程的循环已成功停止；false: 超时。
     bool stop_loop(int timeout);
 
+    // 绑定停止令牌：令牌被请求停止时唤醒循环，loop_forever 在本轮结束后返回。
+    // 与 stop_loop 不同，请求方不等待循环线程，适合同时停止大量循环。
+    // 应在 loop_forever 之前或在循环线程中调用。
+    // @param token     停止令牌。
+    void set_stop_token(const stop_token &token);
+
+    // 投递任务，由循环线程在本轮事件处理之后执行（线程安全）。
+    // @param task      任务。
+    void post(loop_task_handler &&task);
+
+    // 投递定时任务，由循环线程在延迟到期后执行（线程安全）。
+    // 循环会缩短 wait 的超时时间以按时触发，不需要 sleep。
+    // @param delay     延迟时间（毫秒）。
+    // @param task      任务。
+    void post_after(int delay, loop_task_handler &&task);
+
 private:
     // 辅助函数：将 FD 事件注册到事件轮询器（非线程安全版本 / NTS）。
     // @param iop       IO 智能指针。
@@ -174,7 +215,8 @@ private:
     // @param handler   FD 事件回调函数。
     // @param prio      事件优先级。
     void fd_register_nts(const std::shared_ptr<io> &iop, fd_event ev_type,
-                         const fd_event_handler &handler, priority prio);
+                         const std::shared_ptr<fd_event_handler> &handler,
+                         priority prio);
 
     // 辅助函数：从事件轮询器中移除 FD 事件（非线程安全版本）。
     // @param iop       IO 智能指针。
@@ -205,6 +247,16 @@ private:
     std::vector<std::tuple<int, fd_event>> fd_io_multiplexing_wait_ts(
         int timeout);
 
+    // 辅助函数：计算本轮 wait 的超时时间，考虑最近到期的定时任务（需持锁）。
+    // @param timeout   用户指定的超时时间（毫秒），-1 表示无限等待。
+    int wait_timeout_nts(int timeout);
+
+    // 辅助函数：执行已投递的任务与到期的定时任务（线程安全）。
+    void run_posted_tasks_ts();
+
+    // 辅助函数：写唤醒管道，使 wait 立即返回（需持锁）。
+    void wakeup_nts();
+
     using waiter_type = std::function<bool(std::unique_lock<std::mutex> &)>;
 
     // 辅助函数：停止事件循环（线程安全 / TS）。
@@ -246,8 +298,30 @@ private:
     // 循环是否应该停止的标志位。
     bool stop_;
 
+    using timer_type =
+        std::tuple<std::chrono::steady_clock::time_point, loop_task_handler>;
+
+    // 已投递待执行的任务。
+    std::vector<loop_task_handler> tasks_;
+
+    // 定时任务小顶堆，按到期时间排序。
+    // 任务只能移动，用 std::push_heap / std::pop_heap 维护堆以便移出堆顶。
+    std::vector<timer_type> timers_;
+
+    // 唤醒管道：[0] 读端注册在本循环中，[1] 写端由投递任务的线程写入。
+    std::vector<std::shared_ptr<stream>> wakeup_pipes_;
+
+    // 唤醒管道中是否已有未处理的数据，避免重复写入。
+    bool wakeup_pending_;
+
     // 默认的 FD 事件模式。
     static const fd_event_mode fd_event_mode_default_;
+
+    // 绑定的停止令牌。
+    stop_token stop_token_;
+
+    // 令牌停止时唤醒循环的回调，最后声明以便最先析构，析构时其他成员仍然有效。
+    std::unique_ptr<stop_callback> stop_callback_;
 };
 
 }  // namespace cppev
@@ -0,0 +1,203 @@
+#ifndef _cppev_file_cache_h_6C0224787A17_
+#define _cppev_file_cache_h_6C0224787A17_
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cppev/common.h"
+#include "cppev/thread_pool.h"
+
+namespace cppev
+{
+
+// Read only file mapped into memory, the descriptor is kept open so that
+// file could also be sent by sendfile.
+class CPPEV_PUBLIC mapped_file final
+{
+public:
+    // Open and map file, throw system error if failed.
+    // @param path      File path.
+    explicit mapped_file(const std::string &path);
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+    mapped_file(mapped_file &&) = delete;
+    mapped_file &operator=(mapped_file &&) = delete;
+
+    ~mapped_file();
+
+    // File content, nullptr if file is empty.
+    const char *data() const noexcept;
+
+    // File size in bytes.
+    size_t size() const noexcept;
+
+    // File descriptor opened read only.
+    int fd() const noexcept;
+
+    // File path.
+    const std::string &path() const noexcept;
+
+    // Whether file on disk has been replaced or modified since mapped.
+    bool is_stale() const;
+
+private:
+    std::string path_;
+
+    int fd_;
+
+    const char *data_;
+
+    size_t size_;
+
+    // Identity of mapped file: device, inode and modification time.
+    dev_t dev_;
+
+    ino_t ino_;
+
+    struct timespec mtime_;
+};
+
+// Refcounted view of cached file, it stays valid after eviction until the
+// last holder releases it. It could be passed to async_sendfile as owner.
+using file_view = std::shared_ptr<const mapped_file>;
+
+// Receive loaded file, nullptr when loading failed.
+using file_load_handler = std::function<void(const file_view &file)>;
+
+// Sharded cache of mapped files with CLOCK eviction under a byte budget.
+// Hits only take a shared lock of one shard and mark the entry referenced,
+// so hits do not serialize with each other, but they still wait while the
+// same shard is locked exclusively to insert, evict or drop a stale file,
+// and all of them touch the cache line of the lock. Misses are loaded by
+// loader threads and concurrent misses of one file share a single load.
+class CPPEV_PUBLIC file_cache final
+{
+public:
+    // Construct cache, loader threads start on the first miss.
+    // @param capacity      Byte budget of cached files.
+    // @param shards        Number of shards, each owning capacity / shards.
+    // @param thr_num       Loader threads.
+    // @param revalidate    Interval in millisecond between checks of
+    //                      whether a cached file is stale, zero checks on
+    //                      every hit and negative never checks.
+    explicit file_cache(
+        size_t capacity = static_cast<size_t>(sysconfig::file_cache_capacity)
+                          << 20,
+        int shards = 16, int thr_num = 1,
+        int revalidate = sysconfig::file_cache_revalidate);
+
+    file_cache(const file_cache &) = delete;
+    file_cache &operator=(const file_cache &) = delete;
+    file_cache(file_cache &&) = delete;
+    file_cache &operator=(file_cache &&) = delete;
+
+    ~file_cache();
+
+    // Get cached file without loading, thread safe.
+    // @param path      File path.
+    // @return          Cached file, nullptr if missed or stale.
+    file_view lookup(const std::string &path);
+
+    // Get file asynchronously, thread safe. Handler is executed by calling
+    // thread if file is cached, otherwise by loader thread.
+    // @param path      File path.
+    // @param handler   Handler receiving file.
+    void get(const std::string &path, const file_load_handler &handler);
+
+    // Drop cached file, thread safe.
+    // @param path      File path.
+    void invalidate(const std::string &path);
+
+    // Bytes of cached files.
+    size_t size() const noexcept;
+
+    // Number of cached files.
+    size_t count() const noexcept;
+
+private:
+    struct entry
+    {
+        file_view file;
+
+        // Set by hits, cleared by the clock hand.
+        std::atomic<bool> referenced;
+
+        // Last time file is checked for staleness, in millisecond.
+        std::atomic<int64_t> checked;
+
+        // Position in clock ring.
+        std::list<std::string>::iterator pos;
+    };
+
+    struct shard
+    {
+        // Shared by hits, exclusive for changes of the shard. Chosen over a
+        // copy on write snapshot, which would copy the map on every insert.
+        std::shared_mutex lock;
+
+        std::unordered_map<std::string, std::unique_ptr<entry>> entries;
+
+        // Clock ring of cached paths.
+        std::list<std::string> ring;
+
+        // Clock hand, points to next eviction candidate.
+        std::list<std::string>::iterator hand;
+
+        size_t bytes = 0;
+
+        // Handlers waiting for in-flight load.
+        std::unordered_map<std::string, std::vector<file_load_handler>>
+            pending;
+    };
+
+    // Shard owning path.
+    shard &shard_of(const std::string &path);
+
+    // Load file by loader thread and notify waiters.
+    void load(const std::string &path);
+
+    // Insert loaded file, evicting others if budget is exceeded. Lock of
+    // shard shall be held.
+    void insert_nts(shard &s, const std::string &path, const file_view &file);
+
+    // Remove entry. Lock of shard shall be held.
+    void erase_nts(shard &s, const std::string &path);
+
+    // Current time in millisecond.
+    static int64_t now_ms();
+
+    std::vector<std::unique_ptr<shard>> shards_;
+
+    // Byte budget of each shard.
+    size_t shard_capacity_;
+
+    int revalidate_;
+
+    std::atomic<size_t> bytes_;
+
+    std::atomic<size_t> count_;
+
+    std::mutex lock_;
+
+    // Whether loader threads are started.
+    bool running_;
+
+    // Loader threads.
+    thread_pool_task_queue tp_;
+};
+
+}  // namespace cppev
+
+#endif  // file_cache.h
@@ -0,0 +1,649 @@
+#ifndef _cppev_future_h_6C0224787A17_
+#define _cppev_future_h_6C0224787A17_
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "cppev/common.h"
+#include "cppev/unique_function.h"
+
+/*
+    Futures completed by thread_pool_task_queue::submit or promise. Unlike
+    std::future, continuations are attached with then and run by the thread
+    completing the future, so that pipelines never park a thread waiting
+    for intermediate results. Continuations should be cheap, expensive ones
+    shall be given an executor to run on.
+ */
+
+namespace cppev
+{
+
+// Thrown by future whose task or continuation is cancelled.
+class CPPEV_PUBLIC cancelled_error : public std::runtime_error
+{
+public:
+    cancelled_error() : std::runtime_error("operation cancelled")
+    {
+    }
+};
+
+// Read side of cancellation, copyable and thread safe. Default constructed
+// token is never cancelled.
+class CPPEV_PUBLIC cancellation_token
+{
+    friend class cancellation_source;
+
+public:
+    cancellation_token() = default;
+
+    // Whether cancellation is requested.
+    bool is_cancelled() const noexcept
+    {
+        return flag_ && flag_->load(std::memory_order_acquire);
+    }
+
+    // Throw cancelled_error if cancellation is requested.
+    void throw_if_cancelled() const
+    {
+        if (is_cancelled())
+        {
+            throw cancelled_error();
+        }
+    }
+
+private:
+    explicit cancellation_token(std::shared_ptr<std::atomic<bool>> flag)
+        : flag_(std::move(flag))
+    {
+    }
+
+    std::shared_ptr<std::atomic<bool>> flag_;
+};
+
+// Write side of cancellation, shared by copies.
+class CPPEV_PUBLIC cancellation_source
+{
+public:
+    cancellation_source() : flag_(std::make_shared<std::atomic<bool>>(false))
+    {
+    }
+
+    // Request cancellation, tasks not started yet are skipped and running
+    // ones could check their token.
+    void cancel() noexcept
+    {
+        flag_->store(true, std::memory_order_release);
+    }
+
+    bool is_cancelled() const noexcept
+    {
+        return flag_->load(std::memory_order_acquire);
+    }
+
+    cancellation_token token() const noexcept
+    {
+        return cancellation_token(flag_);
+    }
+
+private:
+    std::shared_ptr<std::atomic<bool>> flag_;
+};
+
+template <typename T>
+class future;
+
+template <typename T>
+class promise;
+
+// Value stored by future<void>.
+struct future_unit
+{
+};
+
+template <typename T>
+class future_state final
+{
+public:
+    using value_type =
+        std::conditional_t<std::is_void<T>::value, future_unit, T>;
+
+    future_state() : ready_(false)
+    {
+    }
+
+    future_state(const future_state &) = delete;
+    future_state &operator=(const future_state &) = delete;
+    future_state(future_state &&) = delete;
+    future_state &operator=(future_state &&) = delete;
+
+    ~future_state() = default;
+
+    // Satisfy with value and run continuations on current thread.
+    // @return  False if already satisfied, value is discarded.
+    bool set_value(value_type value)
+    {
+        return complete([&] { value_.emplace_back(std::move(value)); });
+    }
+
+    // Satisfy with exception and run continuations on current thread.
+    // @return  False if already satisfied.
+    bool set_exception(std::exception_ptr error)
+    {
+        return complete([&] { error_ = std::move(error); });
+    }
+
+    // Run handler on the thread satisfying state, or right away if ready.
+    void subscribe(unique_function<void()> handler)
+    {
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            if (!ready_)
+            {
+                continuations_.push_back(std::move(handler));
+                return;
+            }
+        }
+        handler();
+    }
+
+    bool is_ready()
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        return ready_;
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        cond_.wait(lock, [this] { return ready_; });
+    }
+
+    // Move value out or rethrow exception, shall be called once after ready.
+    value_type take()
+    {
+        if (error_)
+        {
+            std::rethrow_exception(error_);
+        }
+        return std::move(value_.front());
+    }
+
+private:
+    template <typename Store>
+    bool complete(Store store)
+    {
+        std::vector<unique_function<void()>> continuations;
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            if (ready_)
+            {
+                return false;
+            }
+            store();
+            ready_ = true;
+            continuations.swap(continuations_);
+        }
+        cond_.notify_all();
+        for (auto &continuation : continuations)
+        {
+            continuation();
+        }
+        return true;
+    }
+
+    std::mutex lock_;
+
+    std::condition_variable cond_;
+
+    bool ready_;
+
+    // At most one value, vector avoids requiring T default constructible.
+    std::vector<value_type> value_;
+
+    std::exception_ptr error_;
+
+    std::vector<unique_function<void()>> continuations_;
+};
+
+template <typename T>
+struct future_unwrap
+{
+    using type = T;
+};
+
+template <typename T>
+struct future_unwrap<future<T>>
+{
+    using type = T;
+};
+
+// Result of invoking F with value of future<T>.
+template <typename F, typename T>
+struct future_invoke
+{
+    using type = std::invoke_result_t<F, T>;
+};
+
+template <typename F>
+struct future_invoke<F, void>
+{
+    using type = std::invoke_result_t<F>;
+};
+
+// Future type returned by continuation F of future<T>, future<U> returned
+// by F is unwrapped.
+template <typename F, typename T>
+using future_then_t =
+    typename future_unwrap<typename future_invoke<F, T>::type>::type;
+
+// Copy the result of source to target when source is ready.
+template <typename T>
+void future_forward(const std::shared_ptr<future_state<T>> &source,
+                    const std::shared_ptr<future_state<T>> &target)
+{
+    source->subscribe(
+        [source, target]
+        {
+            try
+            {
+                target->set_value(source->take());
+            }
+            catch (...)
+            {
+                target->set_exception(std::current_exception());
+            }
+        });
+}
+
+// Invoke f with args and satisfy state with its result, exception thrown by
+// f is stored. Future returned by f is forwarded.
+template <typename R, typename F, typename... Args>
+void future_fulfil(const std::shared_ptr<future_state<R>> &state, F &f,
+                   Args &&...args)
+{
+    using result_type = std::invoke_result_t<F &, Args...>;
+    try
+    {
+        if constexpr (std::is_void<result_type>::value)
+        {
+            std::invoke(f, std::forward<Args>(args)...);
+            state->set_value(future_unit());
+        }
+        else if constexpr (std::is_same<result_type, future<R>>::value)
+        {
+            future<R> inner = std::invoke(f, std::forward<Args>(args)...);
+            future_forward(inner.state_, state);
+        }
+        else
+        {
+            state->set_value(std::invoke(f, std::forward<Args>(args)...));
+        }
+    }
+    catch (...)
+    {
+        state->set_exception(std::current_exception());
+    }
+}
+
+template <typename T>
+class CPPEV_PUBLIC future final
+{
+    template <typename U>
+    friend class future;
+
+    friend class promise<T>;
+
+    template <typename R, typename F, typename... Args>
+    friend void future_fulfil(const std::shared_ptr<future_state<R>> &, F &,
+                              Args &&...);
+
+    template <typename U>
+    friend future<std::vector<U>> when_all(std::vector<future<U>> futures);
+
+    friend future<void> when_all(std::vector<future<void>> futures);
+
+    template <typename U>
+    friend future<std::pair<size_t, U>> when_any(
+        std::vector<future<U>> futures);
+
+    friend future<size_t> when_any(std::vector<future<void>> futures);
+
+public:
+    using value_type = T;
+
+    // Invalid future.
+    future() = default;
+
+    // Future completed by state, used by executors.
+    explicit future(std::shared_ptr<future_state<T>> state)
+        : state_(std::move(state))
+    {
+    }
+
+    future(const future &) = delete;
+    future &operator=(const future &) = delete;
+    future(future &&) = default;
+    future &operator=(future &&) = default;
+
+    ~future() = default;
+
+    // Whether future refers to a state, false after get or then.
+    bool valid() const noexcept
+    {
+        return state_ != nullptr;
+    }
+
+    // Whether result is available.
+    bool is_ready() const
+    {
+        return state_->is_ready();
+    }
+
+    // Block until result is available.
+    void wait() const
+    {
+        state_->wait();
+    }
+
+    // Block until result is available, then return it or rethrow its
+    // exception. Future becomes invalid.
+    T get()
+    {
+        std::shared_ptr<future_state<T>> state = std::move(state_);
+        state->wait();
+        if constexpr (std::is_void<T>::value)
+        {
+            state->take();
+        }
+        else
+        {
+            return state->take();
+        }
+    }
+
+    // Attach continuation invoked with the value by the thread completing
+    // this future, or right away if it is ready. Exception of this future
+    // skips f and is propagated. Future becomes invalid.
+    // @param f         Continuation, f returning future<U> gives future<U>.
+    // @return          Future of the result of f.
+    template <typename F>
+    future<future_then_t<std::decay_t<F>, T>> then(F &&f)
+    {
+        return then(std::forward<F>(f), cancellation_token());
+    }
+
+    // Same as above, continuation is skipped with cancelled_error once token
+    // is cancelled.
+    template <typename F>
+    future<future_then_t<std::decay_t<F>, T>> then(
+        F &&f, const cancellation_token &token)
+    {
+        return chain(
+            [](unique_function<void()> task) { task(); }, std::forward<F>(f),
+            token);
+    }
+
+    // Same as above, continuation is run by executor.add_task instead of
+    // the completing thread.
+    template <typename Executor, typename F,
+              typename = decltype(std::declval<Executor &>().add_task(
+                  unique_function<void()>()))>
+    future<future_then_t<std::decay_t<F>, T>> then(
+        Executor &executor, F &&f,
+        const cancellation_token &token = cancellation_token())
+    {
+        return chain([&executor](unique_function<void()> task)
+                     { executor.add_task(std::move(task)); },
+                     std::forward<F>(f), token);
+    }
+
+private:
+    template <typename Run, typename F>
+    future<future_then_t<std::decay_t<F>, T>> chain(
+        Run run, F &&f, const cancellation_token &token)
+    {
+        using R = future_then_t<std::decay_t<F>, T>;
+        auto next = std::make_shared<future_state<R>>();
+        std::shared_ptr<future_state<T>> state = std::move(state_);
+        state->subscribe(
+            [run, state, next, token,
+             handler = std::decay_t<F>(std::forward<F>(f))]() mutable
+            {
+                run(
+                    [state, next, token,
+                     handler = std::move(handler)]() mutable
+                    {
+                        if (token.is_cancelled())
+                        {
+                            next->set_exception(
+                                std::make_exception_ptr(cancelled_error()));
+                            return;
+                        }
+                        try
+                        {
+                            if constexpr (std::is_void<T>::value)
+                            {
+                                state->take();
+                                future_fulfil(next, handler);
+                            }
+                            else
+                            {
+                                future_fulfil(next, handler, state->take());
+                            }
+                        }
+                        catch (...)
+                        {
+                            next->set_exception(std::current_exception());
+                        }
+                    });
+            });
+        return future<R>(next);
+    }
+
+    std::shared_ptr<future_state<T>> state_;
+};
+
+// Producer side of future.
+template <typename T>
+class CPPEV_PUBLIC promise final
+{
+public:
+    promise() : state_(std::make_shared<future_state<T>>())
+    {
+    }
+
+    promise(const promise &) = delete;
+    promise &operator=(const promise &) = delete;
+    promise(promise &&) = default;
+    promise &operator=(promise &&) = default;
+
+    // Future not satisfied yet fails with broken_promise.
+    ~promise()
+    {
+        if (state_)
+        {
+            state_->set_exception(std::make_exception_ptr(
+                std::future_error(std::future_errc::broken_promise)));
+        }
+    }
+
+    // Future of the promise, shall be called once.
+    future<T> get_future()
+    {
+        return future<T>(state_);
+    }
+
+    // Satisfy future, continuations run on current thread.
+    template <typename U = T,
+              typename = std::enable_if_t<!std::is_void<U>::value>>
+    void set_value(U value)
+    {
+        state_->set_value(std::move(value));
+    }
+
+    template <typename U = T,
+              typename = std::enable_if_t<std::is_void<U>::value>>
+    void set_value()
+    {
+        state_->set_value(future_unit());
+    }
+
+    void set_exception(std::exception_ptr error)
+    {
+        state_->set_exception(std::move(error));
+    }
+
+private:
+    std::shared_ptr<future_state<T>> state_;
+};
+
+// Future of all the values in order, fails with the first exception.
+template <typename T>
+future<std::vector<T>> when_all(std::vector<future<T>> futures)
+{
+    auto all = std::make_shared<future_state<std::vector<T>>>();
+    if (futures.empty())
+    {
+        all->set_value(std::vector<T>());
+        return future<std::vector<T>>(all);
+    }
+    struct context
+    {
+        std::vector<std::vector<T>> values;
+
+        std::atomic<size_t> remaining;
+    };
+    auto ctx = std::make_shared<context>();
+    ctx->values.resize(futures.size());
+    ctx->remaining = futures.size();
+    for (size_t i = 0; i < futures.size(); ++i)
+    {
+        auto state = std::move(futures[i].state_);
+        state->subscribe(
+            [state, all, ctx, i]
+            {
+                try
+                {
+                    ctx->values[i].push_back(state->take());
+                }
+                catch (...)
+                {
+                    all->set_exception(std::current_exception());
+                }
+                if (--ctx->remaining == 0)
+                {
+                    std::vector<T> values;
+                    values.reserve(ctx->values.size());
+                    for (auto &value : ctx->values)
+                    {
+                        if (value.empty())
+                        {
+                            return;
+                        }
+                        values.push_back(std::move(value.front()));
+                    }
+                    all->set_value(std::move(values));
+                }
+            });
+    }
+    return future<std::vector<T>>(all);
+}
+
+// Future completed when all are done, fails with the first exception.
+inline future<void> when_all(std::vector<future<void>> futures)
+{
+    auto all = std::make_shared<future_state<void>>();
+    auto remaining = std::make_shared<std::atomic<size_t>>(futures.size());
+    if (futures.empty())
+    {
+        all->set_value(future_unit());
+    }
+    for (auto &fut : futures)
+    {
+        auto state = std::move(fut.state_);
+        state->subscribe(
+            [state, all, remaining]
+            {
+                try
+                {
+                    state->take();
+                }
+                catch (...)
+                {
+                    all->set_exception(std::current_exception());
+                }
+                if (--*remaining == 0)
+                {
+                    all->set_value(future_unit());
+                }
+            });
+    }
+    return future<void>(all);
+}
+
+// Future of the index and value of the first completed one, fails if the
+// first completed one fails. Futures shall not be empty.
+template <typename T>
+future<std::pair<size_t, T>> when_any(std::vector<future<T>> futures)
+{
+    auto any = std::make_shared<future_state<std::pair<size_t, T>>>();
+    for (size_t i = 0; i < futures.size(); ++i)
+    {
+        auto state = std::move(futures[i].state_);
+        state->subscribe(
+            [state, any, i]
+            {
+                if (any->is_ready())
+                {
+                    return;
+                }
+                try
+                {
+                    any->set_value(std::make_pair(i, state->take()));
+                }
+                catch (...)
+                {
+                    any->set_exception(std::current_exception());
+                }
+            });
+    }
+    return future<std::pair<size_t, T>>(any);
+}
+
+// Future of the index of the first completed one, fails if the first
+// completed one fails. Futures shall not be empty.
+inline future<size_t> when_any(std::vector<future<void>> futures)
+{
+    auto any = std::make_shared<future_state<size_t>>();
+    for (size_t i = 0; i < futures.size(); ++i)
+    {
+        auto state = std::move(futures[i].state_);
+        state->subscribe(
+            [state, any, i]
+            {
+                try
+                {
+                    state->take();
+                    any->set_value(i);
+                }
+                catch (...)
+                {
+                    any->set_exception(std::current_exception());
+                }
+            });
+    }
+    return future<size_t>(any);
+}
+
+}  // namespace cppev
+
+#endif  // future.h
@@ -6,6 +6,7 @@
 #include <unistd.h>
 
 #include <climits>
+#include <deque>
 #include <exception>
 #include <iostream>
 #include <memory>
@@ -90,6 +91,12 @@ namespace cppev
         // 设置为阻塞模式
         void set_io_block();
 
+        // 转型为socktcp，不是socktcp时返回nullptr
+        // 虚继承下无法static_cast，用虚函数代替dynamic_cast以降低事件分发开销
+        virtual socktcp *to_socktcp() noexcept;
+        // 转型为sockudp，不是sockudp时返回nullptr
+        virtual sockudp *to_sockudp() noexcept;
+
     protected:
         // 文件描述符
         int fd_;
@@ -107,6 +114,15 @@ namespace cppev
         void move(io &&othre) noexcept;    
     };
 
+    // unix 域 socket 对端进程的凭证
+    struct CPPEV_PUBLIC peer_credentials
+    {
+        // 对端进程号，平台不支持时为 -1
+        pid_t pid;
+        uid_t uid;
+        gid_t gid;
+    };
+
     // 虚继承避免菱形继承问题
     class CPPEV_PUBLIC sock : public virtual io
     {
@@ -143,7 +159,9 @@ namespace cppev
         // 允许多个线程抢占同一个端口，提升并发性能。
         void get_reuseaddr() const;
 
-        // 设置是否允许端口重用
+        // 设置端口重用，多个 socket 可以绑定同一端口，由内核在它们之间分发
+        void set_so_reuseport(bool enable = true);
+        // 获取是否允许端口重用
         bool get_so_reuseport() const;
 
         // 设置接受缓冲区大小
@@ -172,6 +190,17 @@ namespace cppev
         void set_so_sndlowat(int size);
         // 获取触发可写事件的低水位标记
         int get_so_sndlowat() const;
+
+        // 以 SCM_RIGHTS 在 unix 域 socket 上发送描述符，描述符随 data 一同到达对端
+        // 流式 socket 上 data 至少1字节；描述符由内核复制，发送后调用者即可关闭
+        // 返回发送的数据字节数，发送缓冲区满时返回 -1
+        int send_fds(const std::vector<int> &fds, const char *data, int len);
+        // 接收最多 len 字节数据到读缓冲区，随数据到达的描述符(已设置 CLOEXEC)追加到 fds
+        // 返回接收的字节数，对端关闭返回0，暂无数据返回 -1
+        int recv_fds(std::vector<int> &fds, int len = sysconfig::buffer_io_step);
+
+        // unix 域 socket 对端进程的凭证，连接建立时由内核记录
+        peer_credentials get_peer_credentials() const;
     
     protected:
         family family_;
@@ -201,6 +230,8 @@ namespace cppev
         socktcp &operator=(socktcp &&other) noexcept;
         ~socktcp();
 
+        socktcp *to_socktcp() noexcept override;
+
         // backlog(排队区) 默认值为系统最大值
         void listen(int backlog = SOMAXCONN);
 
@@ -253,15 +284,288 @@ namespace cppev
         // 这个错误码藏在内核深处，而且读取它有一个副作用：读完一次，内核里的这个错误码就会被清零。所以这相当于是一次性的“拆信封”查看结果。
         int get_so_error() const;
 
+        // 零拷贝发送文件：Linux 下使用 sendfile，源不支持时经由管道 splice，macOS 下使用 sendfile
+        // in_fd 文件描述符，offset 读取偏移(发送后前移)，len 最多发送的字节数
+        // 返回本次送入套接字的字节数，源已读完返回0，套接字不可写、源暂无数据或出错(eop/reset)返回-1
+        int send_file(int in_fd, off_t &offset, int len);
+
+        // 把文件片段加入发送队列，写缓冲区中现有的数据会先于该片段发送
+        // 队列非空时，写缓冲区中新写入的数据排在所有片段之后，文件描述符由调用者持有
+        // owner 在片段发送完毕前保持引用，可用于延长文件描述符的生命周期
+        void queue_file(int in_fd, off_t offset, off_t len,
+                        const std::shared_ptr<const void> &owner = nullptr);
+
+        // 非阻塞地发送队列中的文件片段，返回队列是否已全部发送
+        // 源文件提前结束时抛出异常
+        bool write_files();
+
+        // 最近一次 send_file 是否因源暂无数据而返回 -1，此时套接字并未写满，
+        // 边缘触发下不会再有可写事件，调用者需要自行重试
+        bool file_source_blocked() const noexcept;
+
+        // 发送队列是否为空
+        bool files_empty() const noexcept;
+
+        // 设置 TCP_CORK(macOS 下为 TCP_NOPUSH)：开启期间不发送未满的报文段，关闭时一并发出
+        // 适用于先写头部再写正文的场景
+        void set_tcp_cork(bool enable = true);
+        // 获取 TCP_CORK 状态
+        bool get_tcp_cork() const;
+
+        // 设置监听 socket 的 TCP_FASTOPEN，应在 listen 前调用
+        // qlen 为尚未完成三次握手的 Fast Open 连接队列长度(macOS 下仅区分开关)，0 表示关闭
+        void set_tcp_fastopen(int qlen);
+        // 获取 TCP_FASTOPEN 队列长度
+        int get_tcp_fastopen() const;
+
+        // 设置客户端 socket 的 TCP_FASTOPEN_CONNECT，应在 connect 前调用，仅 Linux 支持
+        // 开启后 connect 立即返回且可写，首次写入的数据随 SYN 发出；没有 cookie 时退化为普通握手
+        // 连接失败在首次写入时才能发现
+        void set_tcp_fastopen_connect(bool enable = true);
+        // 获取 TCP_FASTOPEN_CONNECT 状态
+        bool get_tcp_fastopen_connect() const;
+
+        // 设置监听 socket 的延迟接受：连接在收到数据后才可被 accept，应在 listen 前调用
+        // Linux 下为 TCP_DEFER_ACCEPT，seconds 为等待数据的秒数；BSD 下为 dataready 过滤器，seconds 仅区分开关
+        void set_tcp_defer_accept(int seconds);
+        // 获取延迟接受的秒数，BSD 下开启时返回 1
+        int get_tcp_defer_accept() const;
+
+        // 设置 SO_ZEROCOPY，仅 Linux 支持
+        // 开启后 write_zerocopy 对大块数据使用 MSG_ZEROCOPY 发送
+        void set_so_zerocopy(bool enable = true);
+        // 获取 SO_ZEROCOPY 状态
+        bool get_so_zerocopy() const;
+
+        // 发送写缓冲区中的数据：不少于 zerocopy_threshold 的数据整块移出写缓冲区，以 MSG_ZEROCOPY 发送，
+        // 在内核的完成通知到达前保持内存有效；小块数据与未开启 SO_ZEROCOPY 时同 write_all
+        // 返回本次发送的字节数
+        int write_zerocopy();
+
+        // 读取错误队列中的零拷贝完成通知，释放内核已用完的数据块，返回处理的通知数
+        // 完成通知以 EPOLLERR 形式唤醒事件循环
+        int drain_zerocopy();
+
+        // 是否仍有零拷贝数据未交给内核
+        bool zerocopy_unsent() const noexcept;
+
+        // 是否仍有零拷贝数据块等待内核完成通知
+        bool zerocopy_pending() const noexcept;
+
+        // 关闭前调用：放弃未发送的数据，仍等待完成通知的数据块连同描述符副本移交延迟释放队列，
+        // 通知全部到达后释放并关闭副本，连接随即 shutdown 使对端收到 FIN；析构时自动调用
+        // 已关闭的 socket 无法再读取通知，数据块随 socket 析构释放
+        void defer_zerocopy() noexcept;
+
+        // 描述符随写缓冲区中下一次发送的数据一同发出，仅 unix 域 socket 支持
+        // 调用时写缓冲区不能为空，描述符在 write_fds 发送完成前须保持打开
+        void queue_fds(const std::vector<int> &fds);
+
+        // 发送排队的描述符与写缓冲区头部的数据，返回描述符是否已全部发出
+        bool write_fds();
+
+        // 开启后 read_all_fds 接收随数据到达的描述符，用于 reactor 的读事件
+        void set_fd_passing(bool enable = true) noexcept;
+        // 是否开启描述符接收
+        bool get_fd_passing() const noexcept;
+
+        // 同 read_all，同时收集随数据到达的描述符
+        // 携带描述符的消息不与其他数据合并，读取不足 step 时仍继续读取直至 EAGAIN，保证边缘触发下不遗留数据
+        int read_all_fds(int step = sysconfig::buffer_io_step, int limit = INT_MAX);
+
+        // 取出已接收的描述符，由调用者负责关闭；未取出的描述符随 socket 析构关闭
+        std::vector<int> take_fds();
+
 
     private:
+        // 发送队列中的片段：先发送 head，再发送文件 [offset, offset + len)
+        struct file_segment
+        {
+            std::string head;
+            int fd;
+            off_t offset;
+            off_t len;
+            std::shared_ptr<const void> owner;
+        };
+
         // string: IP int: port
         std::tuple<std::string, int> conn_uri_;
 
+        // 文件发送队列
+        std::deque<file_segment> files_;
+
+        // splice 使用的中转管道，首次需要时创建
+        int splice_pipes_[2];
+
+        // 已读入中转管道但尚未送入套接字的字节数
+        int splice_pending_;
+
+        // 最近一次 send_file 是否因源暂无数据而返回
+        bool source_blocked_;
+
+        // 以 MSG_ZEROCOPY 发送的数据块，内核完成通知到达后释放
+        struct zerocopy_block
+        {
+            buffer data;
+            // 最后一次零拷贝发送的通知序号，has_id 为 false 表示未使用零拷贝发送
+            uint32_t last_id;
+            bool has_id;
+        };
+
+        // 是否开启 SO_ZEROCOPY
+        bool zerocopy_;
+
+        // 零拷贝数据块，只有最后一块可能未发送完
+        std::deque<zerocopy_block> zerocopy_blocks_;
+
+        // 下一次零拷贝发送的通知序号
+        uint32_t zerocopy_next_id_;
+
+        // 已完成的通知序号上界（不含）
+        uint32_t zerocopy_done_id_;
+
+        // 待发送的描述符
+        std::vector<int> out_fds_;
+
+        // 是否接收描述符
+        bool fd_passing_;
+
+        // 已接收未取出的描述符
+        std::vector<int> in_fds_;
+
+        // 发送数据块中剩余的数据
+        void write_zerocopy_block(zerocopy_block &block);
+
+        // 释放已发送且内核已完成的数据块
+        void release_zerocopy_blocks() noexcept;
+
         void move(socktcp &&other, bool move_base) noexcept;
     };
 
 
+    // 预解析的 socket 地址：构造时完成一次文本解析，收发时直接使用其中的 sockaddr
+    // 比较与哈希只涉及二进制地址，字符串仅在调用 ip / to_string 时格式化
+    class CPPEV_PUBLIC endpoint final
+    {
+        friend class sockudp;
+
+    public:
+        // 空地址，协议族为 AF_UNSPEC
+        endpoint() noexcept;
+        // 解析地址，格式错误时抛出异常
+        // ip 为 nullptr 时表示任意地址，协议族为 local 时 ip 为 unix 域路径且忽略 port
+        endpoint(const char *ip, int port, family f);
+        endpoint(const std::string &ip, int port, family f);
+        // 由内核返回的地址构造
+        explicit endpoint(const sockaddr_storage &addr) noexcept;
+
+        // 地址的协议族
+        family sockfamily() const noexcept;
+        // 端口，unix 域地址返回 -1
+        int port() const noexcept;
+        // 格式化的 ip，unix 域地址返回路径
+        std::string ip() const;
+        // 格式化为 ip:port，ipv6 为 [ip]:port
+        std::string to_string() const;
+
+        // 传给系统调用的地址与长度
+        const sockaddr *addr() const noexcept;
+        socklen_t length() const noexcept;
+        const sockaddr_storage &storage() const noexcept;
+
+        // 对二进制地址与端口的哈希
+        size_t hash() const noexcept;
+
+        bool operator==(const endpoint &other) const noexcept;
+        bool operator!=(const endpoint &other) const noexcept;
+
+    private:
+        sockaddr_storage addr_;
+    };
+
+    // 用于 unordered 容器
+    struct CPPEV_PUBLIC endpoint_hash
+    {
+        size_t operator()(const endpoint &ep) const noexcept
+        {
+            return ep.hash();
+        }
+    };
+
+    // 批量收发数据报使用的数据报环：预分配的槽位中保存载荷、对端地址与长度
+    class CPPEV_PUBLIC datagram_ring final
+    {
+        friend class sockudp;
+
+    public:
+        // slots 槽位数量，即一次系统调用最多收发的数据报数量
+        // slot_size 每个槽位的载荷容量，开启 GRO 或使用 GSO 时应能容纳合并后的数据(最大65535)
+        explicit datagram_ring(int slots, int slot_size = sysconfig::udp_buffer_size);
+
+        datagram_ring(const datagram_ring &) = delete;
+        datagram_ring &operator=(const datagram_ring &) = delete;
+        datagram_ring(datagram_ring &&) = default;
+        datagram_ring &operator=(datagram_ring &&) = default;
+
+        // 槽位数量
+        int slots() const noexcept;
+        // 每个槽位的载荷容量
+        int slot_size() const noexcept;
+        // 有效数据报数量
+        int size() const noexcept;
+        // 清空所有数据报，槽位内存保留复用
+        void clear() noexcept;
+
+        // 第 i 个数据报的载荷
+        char *data(int i) noexcept;
+        const char *data(int i) const noexcept;
+        // 第 i 个数据报的长度
+        int length(int i) const noexcept;
+        // 第 i 个数据报的段长度：接收时为 GRO 合并前每个数据报的长度，发送时为 GSO 拆分的长度，0 表示未合并/不拆分
+        int segment_size(int i) const noexcept;
+        // 第 i 个数据报的对端地址
+        const sockaddr_storage &addr(int i) const noexcept;
+        // 第 i 个数据报的对端地址，可直接用于回复或作为哈希表的键
+        const endpoint &peer(int i) const noexcept;
+
+        // 追加待发送的数据报，槽位已满或数据超出槽位容量时返回false
+        // segment_size 大于0时由内核 GSO 按该长度拆分为多个数据报发送
+        bool push(const char *ptr, int len, const endpoint &peer, int segment_size = 0);
+        bool push(const char *ptr, int len, const sockaddr_storage &addr, int segment_size = 0);
+        bool push(const char *ptr, int len, const char *ip, int port, family f, int segment_size = 0);
+
+    private:
+        int slots_;
+
+        int slot_size_;
+
+        int size_;
+
+        // 所有槽位的载荷，连续分配
+        std::vector<char> payload_;
+
+        std::vector<endpoint> addrs_;
+
+        std::vector<int> lengths_;
+
+        std::vector<int> segments_;
+
+        // 逐个 sendto 时每个槽位已发送的字节数，EAGAIN 中断后从此处继续，不重发已发送的段
+        std::vector<int> sent_;
+
+        std::vector<iovec> iovs_;
+
+        // 每个槽位的控制消息缓冲区，用于传递 GSO/GRO 的段长度
+        std::vector<char> controls_;
+
+        // 每个槽位的控制消息缓冲区大小
+        int control_size_;
+
+#ifdef __linux__
+        std::vector<mmsghdr> msgs_;
+#endif
+    };
+
     // 发送时：如果你要发 2KB 的数据，但系统缓冲区只剩 1KB 了，剩下的可能就被丢了，或者需要你应用层去处理分片。
     // 接收时：如果对方发来一个 1KB 的包，但你只准备了 512 字节的缓冲区去接，剩下的 512 字节通常会被操作系统直接扔掉（截断），找都找不回来。
     class CPPEV_PUBLIC sockudp final : public sock
@@ -272,15 +576,42 @@ namespace cppev
         sockudp &operator=(sockudp &&other) noexcept;
         ~sockudp();
 
+        sockudp *to_sockudp() noexcept override;
+
         std::tuple<std::string, int, family> recv() const;
         void send(const char* ip, size_t port);
         void send(const std::string& ip, size_t port);
         void send_unix(const char* path);
         void send_unix(const std::string& path);
+        // 接收数据报到读缓冲区，返回对端地址，不做字符串格式化
+        endpoint recv_from();
+        // 发送写缓冲区中的数据到预解析的地址
+        void send(const endpoint &peer);
         void set_broadcast(bool enable = true);
         bool get_broadcast() const;
+
+        // 批量接收数据报到 ring 的空闲槽位(Linux 下使用 recvmmsg)，返回接收的数量，无数据时返回0
+        int recv_batch(datagram_ring &ring);
+        // 批量发送 ring 中从 start 开始的数据报(Linux 下使用 sendmmsg)，返回发送的数量
+        // 发送缓冲区满时可能少于剩余数量，可在可写事件中从 start + 返回值 处继续发送
+        // 段长度大于0的数据报优先由内核 GSO 拆分，编译期或运行时(EINVAL/EIO)不支持 GSO 时
+        // 退化为按段长度逐个 sendto，对端收到的数据报相同
+        int send_batch(datagram_ring &ring, int start = 0);
+
+        // 设置 UDP_GRO，仅 Linux 支持：内核把同一流的连续数据报合并后一次交付
+        void set_udp_gro(bool enable = true);
+        // 获取 UDP_GRO 状态
+        bool get_udp_gro() const;
+
     private:
         void move(sockudp &&other, bool move_base) noexcept;
+
+        // 按段长度逐个 sendto 发送 ring 中从 start 开始的数据报，返回发送的数量
+        // EAGAIN 中断时记录数据报已发送的段，下次从未发送的段继续
+        int send_each(datagram_ring &ring, int start);
+
+        // 是否使用 UDP GSO，编译期不支持或网卡返回 EIO 后关闭
+        bool gso_;
     };
 } // namespace cppev
 
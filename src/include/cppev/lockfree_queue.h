@@ -0,0 +1,580 @@
+#ifndef _cppev_lockfree_queue_h_6C0224787A17_
+#define _cppev_lockfree_queue_h_6C0224787A17_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "cppev/common.h"
+
+/*
+    Bounded queues without locks. Storage is inside the object and indices
+    are atomics, so that a queue of trivially copyable elements could be
+    constructed in shared_memory by its creator and used by other processes
+    mapping it. Indices owned by different sides are on different cache
+    lines.
+
+    spsc_queue : One producer and one consumer, wait free.
+    mpmc_queue : Any producers and consumers, Vyukov's array queue where
+                 each cell carries a sequence number.
+
+    Wrappers of either queue:
+    blocking_queue   : Producer waits while full and consumer while empty,
+                       parking only after spinning, in process only.
+    event_loop_queue : Consumer is an event loop, producer posts a drain task
+                       through the wakeup of loop when the loop is not
+                       draining already.
+ */
+
+namespace cppev
+{
+
+class event_loop;
+
+// Single producer single consumer bounded queue.
+// @tparam T            Element, shall be trivially copyable for shared memory.
+// @tparam Capacity     Power of two.
+template <typename T, size_t Capacity>
+class CPPEV_PUBLIC spsc_queue final
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "Capacity shall be power of two");
+    static_assert(std::atomic<size_t>::is_always_lock_free,
+                  "Atomic index is not lock free");
+
+public:
+    using value_type = T;
+
+    spsc_queue() noexcept : head_(0), tail_cache_(0), tail_(0), head_cache_(0)
+    {
+    }
+
+    spsc_queue(const spsc_queue &) = delete;
+    spsc_queue &operator=(const spsc_queue &) = delete;
+    spsc_queue(spsc_queue &&) = delete;
+    spsc_queue &operator=(spsc_queue &&) = delete;
+
+    ~spsc_queue()
+    {
+        size_t tail = tail_.load(std::memory_order_acquire);
+        for (size_t i = head_.load(std::memory_order_relaxed); i != tail; ++i)
+        {
+            slot(i)->~T();
+        }
+    }
+
+    static constexpr size_t capacity() noexcept
+    {
+        return Capacity;
+    }
+
+    // Producer only.
+    // @return  False if full.
+    bool try_push(T item)
+    {
+        return try_push(&item, 1) == 1;
+    }
+
+    // Push items in order, moved from, producer only.
+    // @return  Number pushed, less than num if full.
+    size_t try_push(T *items, size_t num)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ + num > Capacity)
+        {
+            head_cache_ = head_.load(std::memory_order_acquire);
+        }
+        size_t n = std::min(num, Capacity - (tail - head_cache_));
+        for (size_t i = 0; i < n; ++i)
+        {
+            new (slot(tail + i)) T(std::move(items[i]));
+        }
+        tail_.store(tail + n, std::memory_order_release);
+        return n;
+    }
+
+    // Consumer only.
+    // @return  False if empty.
+    bool try_pop(T &item)
+    {
+        return try_pop(&item, 1) == 1;
+    }
+
+    // Pop at most num items in order, consumer only.
+    // @return  Number popped.
+    size_t try_pop(T *items, size_t num)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (tail_cache_ - head < num)
+        {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+        }
+        size_t n = std::min(num, tail_cache_ - head);
+        for (size_t i = 0; i < n; ++i)
+        {
+            T *p = slot(head + i);
+            items[i] = std::move(*p);
+            p->~T();
+        }
+        head_.store(head + n, std::memory_order_release);
+        return n;
+    }
+
+    // Exact for the producer or consumer, approximate for others.
+    size_t size() const noexcept
+    {
+        return tail_.load(std::memory_order_acquire) -
+               head_.load(std::memory_order_acquire);
+    }
+
+    bool empty() const noexcept
+    {
+        return size() == 0;
+    }
+
+private:
+    T *slot(size_t i) noexcept
+    {
+        return std::launder(reinterpret_cast<T *>(&slots_[i & (Capacity - 1)]));
+    }
+
+    // Consumer side.
+    alignas(64) std::atomic<size_t> head_;
+
+    size_t tail_cache_;
+
+    // Producer side.
+    alignas(64) std::atomic<size_t> tail_;
+
+    size_t head_cache_;
+
+    alignas(64) std::aligned_storage_t<sizeof(T), alignof(T)> slots_[Capacity];
+};
+
+// Multiple producers multiple consumers bounded queue.
+// @tparam T            Element, shall be trivially copyable for shared memory.
+// @tparam Capacity     Power of two.
+template <typename T, size_t Capacity>
+class CPPEV_PUBLIC mpmc_queue final
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "Capacity shall be power of two");
+    static_assert(std::atomic<size_t>::is_always_lock_free,
+                  "Atomic index is not lock free");
+
+public:
+    using value_type = T;
+
+    mpmc_queue() noexcept : enqueue_pos_(0), dequeue_pos_(0)
+    {
+        for (size_t i = 0; i < Capacity; ++i)
+        {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    mpmc_queue(const mpmc_queue &) = delete;
+    mpmc_queue &operator=(const mpmc_queue &) = delete;
+    mpmc_queue(mpmc_queue &&) = delete;
+    mpmc_queue &operator=(mpmc_queue &&) = delete;
+
+    ~mpmc_queue()
+    {
+        size_t enq = enqueue_pos_.load(std::memory_order_acquire);
+        for (size_t i = dequeue_pos_.load(std::memory_order_relaxed); i != enq;
+             ++i)
+        {
+            cells_[i & (Capacity - 1)].item()->~T();
+        }
+    }
+
+    static constexpr size_t capacity() noexcept
+    {
+        return Capacity;
+    }
+
+    // Thread safe.
+    // @return  False if full.
+    bool try_push(T item)
+    {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        cell *c;
+        while (true)
+        {
+            c = &cells_[pos & (Capacity - 1)];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            intptr_t diff =
+                static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0)
+            {
+                if (enqueue_pos_.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                // Cell still holds the element of previous round.
+                return false;
+            }
+            else
+            {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        new (c->item()) T(std::move(item));
+        c->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Push items in order of this producer, moved from, thread safe.
+    // @return  Number pushed, less than num if full.
+    size_t try_push(T *items, size_t num)
+    {
+        size_t n = 0;
+        while (n < num && try_push(std::move(items[n])))
+        {
+            ++n;
+        }
+        return n;
+    }
+
+    // Thread safe.
+    // @return  False if empty.
+    bool try_pop(T &item)
+    {
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        cell *c;
+        while (true)
+        {
+            c = &cells_[pos & (Capacity - 1)];
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            intptr_t diff =
+                static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0)
+            {
+                if (dequeue_pos_.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                // Cell not written yet.
+                return false;
+            }
+            else
+            {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        T *p = c->item();
+        item = std::move(*p);
+        p->~T();
+        c->sequence.store(pos + Capacity, std::memory_order_release);
+        return true;
+    }
+
+    // Pop at most num items, thread safe.
+    // @return  Number popped.
+    size_t try_pop(T *items, size_t num)
+    {
+        size_t n = 0;
+        while (n < num && try_pop(items[n]))
+        {
+            ++n;
+        }
+        return n;
+    }
+
+    // Approximate.
+    size_t size() const noexcept
+    {
+        size_t enq = enqueue_pos_.load(std::memory_order_acquire);
+        size_t deq = dequeue_pos_.load(std::memory_order_acquire);
+        return enq > deq ? enq - deq : 0;
+    }
+
+    bool empty() const noexcept
+    {
+        return size() == 0;
+    }
+
+private:
+    struct cell
+    {
+        T *item() noexcept
+        {
+            return std::launder(reinterpret_cast<T *>(&storage));
+        }
+
+        std::atomic<size_t> sequence;
+
+        std::aligned_storage_t<sizeof(T), alignof(T)> storage;
+    };
+
+    alignas(64) std::atomic<size_t> enqueue_pos_;
+
+    alignas(64) std::atomic<size_t> dequeue_pos_;
+
+    alignas(64) cell cells_[Capacity];
+};
+
+// Queue whose push waits while full and pop waits while empty. Waiting
+// spins first and then parks on a condition variable, which is notified
+// only if someone is parked. Not for shared memory.
+// @tparam Queue    spsc_queue or mpmc_queue, sides of spsc_queue are still
+//                  single threaded.
+template <typename Queue>
+class CPPEV_PUBLIC blocking_queue final
+{
+public:
+    using value_type = typename Queue::value_type;
+
+    blocking_queue() : push_waiters_(0), pop_waiters_(0)
+    {
+    }
+
+    blocking_queue(const blocking_queue &) = delete;
+    blocking_queue &operator=(const blocking_queue &) = delete;
+    blocking_queue(blocking_queue &&) = delete;
+    blocking_queue &operator=(blocking_queue &&) = delete;
+
+    ~blocking_queue() = default;
+
+    bool try_push(value_type item)
+    {
+        if (queue_.try_push(std::move(item)))
+        {
+            notify(pop_waiters_);
+            return true;
+        }
+        return false;
+    }
+
+    bool try_pop(value_type &item)
+    {
+        if (queue_.try_pop(item))
+        {
+            notify(push_waiters_);
+            return true;
+        }
+        return false;
+    }
+
+    // Push, wait while full.
+    void push(value_type item)
+    {
+        wait(push_waiters_,
+             [&] { return queue_.try_push(&item, 1) == 1; });
+        notify(pop_waiters_);
+    }
+
+    // Push all items in order, moved from, wait while full.
+    void push(value_type *items, size_t num)
+    {
+        size_t done = 0;
+        while (done < num)
+        {
+            wait(push_waiters_,
+                 [&]
+                 {
+                     size_t n = queue_.try_push(items + done, num - done);
+                     done += n;
+                     return n != 0;
+                 });
+            notify(pop_waiters_);
+        }
+    }
+
+    // Pop, wait while empty.
+    value_type pop()
+    {
+        value_type item;
+        wait(pop_waiters_, [&] { return queue_.try_pop(item); });
+        notify(push_waiters_);
+        return item;
+    }
+
+    // Pop at least one and at most num items, wait while empty.
+    // @return  Number popped.
+    size_t pop(value_type *items, size_t num)
+    {
+        size_t n = 0;
+        wait(pop_waiters_,
+             [&]
+             {
+                 n = queue_.try_pop(items, num);
+                 return n != 0;
+             });
+        notify(push_waiters_);
+        return n;
+    }
+
+    size_t size() const noexcept
+    {
+        return queue_.size();
+    }
+
+    bool empty() const noexcept
+    {
+        return queue_.empty();
+    }
+
+private:
+    template <typename Attempt>
+    void wait(std::atomic<int> &waiters, Attempt attempt)
+    {
+        for (int i = 0; i < 64; ++i)
+        {
+            if (attempt())
+            {
+                return;
+            }
+            std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> lock(lock_);
+        ++waiters;
+        // Waiters is incremented before the attempt, and the other side
+        // checks it after its operation, so that one of them sees the other.
+        cond_.wait(lock, attempt);
+        --waiters;
+    }
+
+    void notify(std::atomic<int> &waiters)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load() > 0)
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            cond_.notify_all();
+        }
+    }
+
+    Queue queue_;
+
+    std::atomic<int> push_waiters_;
+
+    std::atomic<int> pop_waiters_;
+
+    std::mutex lock_;
+
+    std::condition_variable cond_;
+};
+
+// Queue consumed by an event loop. Push schedules a drain task on the loop
+// unless one is scheduled already, so that a burst of pushes costs one
+// wakeup. Drain runs on the loop thread and hands items to the handler.
+// Queue shall outlive the loop or tasks posted to it.
+// @tparam Queue    spsc_queue or mpmc_queue.
+// @tparam Loop     Type with post(task), event_loop by default.
+template <typename Queue, typename Loop = event_loop>
+class CPPEV_PUBLIC event_loop_queue final
+{
+public:
+    using value_type = typename Queue::value_type;
+
+    using handler_type = std::function<void(value_type &&item)>;
+
+    // @param evlp      Loop consuming items.
+    // @param handler   Called on loop thread for each item.
+    // @param budget    Items handled by one drain, the rest are drained by
+    //                  the next one so that other events of loop progress.
+    event_loop_queue(Loop &evlp, handler_type handler, size_t budget = 256)
+        : evlp_(evlp),
+          handler_(std::move(handler)),
+          budget_(budget),
+          scheduled_(false)
+    {
+    }
+
+    event_loop_queue(const event_loop_queue &) = delete;
+    event_loop_queue &operator=(const event_loop_queue &) = delete;
+    event_loop_queue(event_loop_queue &&) = delete;
+    event_loop_queue &operator=(event_loop_queue &&) = delete;
+
+    ~event_loop_queue() = default;
+
+    // @return  False if full.
+    bool try_push(value_type item)
+    {
+        if (!queue_.try_push(std::move(item)))
+        {
+            return false;
+        }
+        schedule();
+        return true;
+    }
+
+    // Push items in order, moved from.
+    // @return  Number pushed, less than num if full.
+    size_t try_push(value_type *items, size_t num)
+    {
+        size_t n = queue_.try_push(items, num);
+        if (n)
+        {
+            schedule();
+        }
+        return n;
+    }
+
+    size_t size() const noexcept
+    {
+        return queue_.size();
+    }
+
+private:
+    void schedule()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!scheduled_.load() && !scheduled_.exchange(true))
+        {
+            evlp_.post([this] { drain(); });
+        }
+    }
+
+    void drain()
+    {
+        // Cleared before popping, an item pushed after the last pop sees
+        // the flag cleared and schedules again.
+        scheduled_.store(false);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        value_type item;
+        for (size_t i = 0; i < budget_; ++i)
+        {
+            if (!queue_.try_pop(item))
+            {
+                return;
+            }
+            handler_(std::move(item));
+        }
+        if (!queue_.empty())
+        {
+            schedule();
+        }
+    }
+
+    Loop &evlp_;
+
+    handler_type handler_;
+
+    size_t budget_;
+
+    std::atomic<bool> scheduled_;
+
+    Queue queue_;
+};
+
+}  // namespace cppev
+
+#endif  // lockfree_queue.h
@@ -0,0 +1,391 @@
+#ifndef _cppev_parallel_h_6C0224787A17_
+#define _cppev_parallel_h_6C0224787A17_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "cppev/thread_pool.h"
+
+/*
+    Parallel algorithms on thread_pool_task_queue.
+
+    Ranges are split in halves recursively, the upper half is added as a task
+    and the lower half is split further, until a part is not larger than the
+    grain. Tasks added by workers go to their own deques, so that idle workers
+    steal the largest parts left and load is balanced by stealing instead of
+    by fixed chunks. Grain 0 picks one giving about 8 parts per worker.
+
+    Calling thread runs the first part itself and then runs queued tasks of
+    the pool until all parts are done. Once no task is queued it spins
+    shortly and then sleeps until the parts running on other threads finish.
+    Since waiting only sleeps on parts already running, algorithms may be
+    called inside tasks of the same pool and nested in each other, and even
+    complete if the pool is not running.
+
+    Exception thrown by a part is rethrown to the caller after the other
+    parts finish, parts not started yet are skipped.
+ */
+
+namespace cppev
+{
+
+// Tasks run on pool whose completion is waited by the thread adding them.
+// Group shall outlive its tasks, which wait guarantees.
+class CPPEV_PUBLIC parallel_group final
+{
+public:
+    explicit parallel_group(thread_pool_task_queue &tp) noexcept
+        : tp_(tp), pending_(0), failed_(false)
+    {
+    }
+
+    parallel_group(const parallel_group &) = delete;
+    parallel_group &operator=(const parallel_group &) = delete;
+    parallel_group(parallel_group &&) = delete;
+    parallel_group &operator=(parallel_group &&) = delete;
+
+    ~parallel_group() = default;
+
+    // Add f as task of pool.
+    template <typename F>
+    void run(F &&f)
+    {
+        pending_.fetch_add(1, std::memory_order_relaxed);
+        tp_.add_task(
+            [this, f = std::decay_t<F>(std::forward<F>(f))]() mutable
+            {
+                invoke(f);
+                done();
+            });
+    }
+
+    // Run f on calling thread, exception is kept as that of a task.
+    template <typename F>
+    void invoke(F &f) noexcept
+    {
+        if (failed_.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+        try
+        {
+            f();
+        }
+        catch (...)
+        {
+            if (!failed_.exchange(true))
+            {
+                exception_ = std::current_exception();
+            }
+        }
+    }
+
+    // Run tasks of pool until tasks of group finish, sleep if none is queued
+    // after spinning shortly.
+    // @throw   First exception thrown by tasks.
+    void wait()
+    {
+        int spins = 0;
+        while (pending_.load(std::memory_order_acquire) != 0)
+        {
+            if (tp_.run_pending_task())
+            {
+                spins = 0;
+            }
+            else if (++spins < spin_num)
+            {
+                std::this_thread::yield();
+            }
+            else
+            {
+                std::unique_lock<std::mutex> lock(lock_);
+                cond_.wait(lock, [this] { return pending_.load() == 0; });
+            }
+        }
+        // Last task may still hold the lock, group is destroyed after it
+        // releases.
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+        }
+        if (exception_)
+        {
+            std::exception_ptr e = std::move(exception_);
+            exception_ = nullptr;
+            failed_ = false;
+            std::rethrow_exception(e);
+        }
+    }
+
+    // Whether a task threw, remaining tasks shall stop early.
+    bool failed() const noexcept
+    {
+        return failed_.load(std::memory_order_relaxed);
+    }
+
+    thread_pool_task_queue &pool() noexcept
+    {
+        return tp_;
+    }
+
+private:
+    // Count task finished, the last one wakes waiter under lock. Last access
+    // of group, waiter may destroy it right after.
+    void done() noexcept
+    {
+        int64_t num = pending_.load(std::memory_order_relaxed);
+        while (num > 1 &&
+               !pending_.compare_exchange_weak(num, num - 1,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed))
+        {
+        }
+        if (num == 1)
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            pending_.fetch_sub(1, std::memory_order_release);
+            cond_.notify_one();
+        }
+    }
+
+    // Yields of waiter finding no task before it sleeps.
+    static const int spin_num = 64;
+
+    thread_pool_task_queue &tp_;
+
+    std::atomic<int64_t> pending_;
+
+    std::atomic<bool> failed_;
+
+    std::exception_ptr exception_;
+
+    std::mutex lock_;
+
+    std::condition_variable cond_;
+};
+
+// Grain for num items, grain given or about 8 parts per worker.
+inline size_t parallel_grain(thread_pool_task_queue &tp, size_t num,
+                             size_t grain) noexcept
+{
+    if (grain != 0)
+    {
+        return grain;
+    }
+    size_t parts = 8 * static_cast<size_t>(std::max(tp.size(), 1));
+    return std::max<size_t>(num / parts, 1);
+}
+
+// Split [begin, end) in halves, adding upper ones to group, and call
+// f(first, last) for parts not larger than grain.
+template <typename Index, typename F>
+void parallel_split(parallel_group &group, Index begin, Index end,
+                    size_t grain, F &f)
+{
+    while (static_cast<size_t>(end - begin) > grain)
+    {
+        if (group.failed())
+        {
+            return;
+        }
+        Index mid = begin + (end - begin) / 2;
+        group.run([&group, mid, end, grain, &f]
+                  { parallel_split(group, mid, end, grain, f); });
+        end = mid;
+    }
+    if (begin != end && !group.failed())
+    {
+        f(begin, end);
+    }
+}
+
+// Call f(first, last) on parts of [begin, end) in parallel.
+// @param tp        Pool.
+// @param begin     First index.
+// @param end       Index after the last one.
+// @param grain     Size of part at most, 0 for auto.
+// @param f         Callable of part.
+template <typename Index, typename F>
+void parallel_for_range(thread_pool_task_queue &tp, Index begin, Index end,
+                        size_t grain, F &&f)
+{
+    static_assert(std::is_integral<Index>::value, "Index not integral");
+    if (!(begin < end))
+    {
+        return;
+    }
+    grain = parallel_grain(tp, end - begin, grain);
+    parallel_group group(tp);
+    auto split = [&] { parallel_split(group, begin, end, grain, f); };
+    group.invoke(split);
+    group.wait();
+}
+
+// Call f(i) for each i in [begin, end) in parallel.
+// @param tp        Pool.
+// @param begin     First index.
+// @param end       Index after the last one.
+// @param grain     Indexes of a task at most, 0 for auto.
+// @param f         Callable of index.
+template <typename Index, typename F>
+void parallel_for(thread_pool_task_queue &tp, Index begin, Index end,
+                  size_t grain, F &&f)
+{
+    parallel_for_range(tp, begin, end, grain,
+                       [&f](Index first, Index last)
+                       {
+                           for (Index i = first; i < last; ++i)
+                           {
+                               f(i);
+                           }
+                       });
+}
+
+// Reduce map(i) for each i in [begin, end) in parallel. Parts are reduced
+// from identity each, then results of parts are reduced in index order, so
+// that reduce needs to be associative but not commutative.
+// @param identity  Identity of reduce.
+// @param map       Callable of index returning T.
+// @param reduce    Callable of (T, T) returning T.
+// @return          Result, identity if range is empty.
+template <typename Index, typename T, typename Map, typename Reduce>
+T parallel_reduce(thread_pool_task_queue &tp, Index begin, Index end,
+                  size_t grain, T identity, Map &&map, Reduce &&reduce)
+{
+    static_assert(std::is_integral<Index>::value, "Index not integral");
+    if (!(begin < end))
+    {
+        return identity;
+    }
+    size_t num = end - begin;
+    grain = parallel_grain(tp, num, grain);
+    size_t parts = (num + grain - 1) / grain;
+    std::vector<T> partials(parts, identity);
+    parallel_for_range(tp, size_t(0), parts, 1,
+                       [&](size_t first, size_t last)
+                       {
+                           for (size_t p = first; p < last; ++p)
+                           {
+                               size_t lo = p * grain;
+                               size_t hi = std::min(num, lo + grain);
+                               T acc = partials[p];
+                               for (size_t i = lo; i < hi; ++i)
+                               {
+                                   acc = reduce(std::move(acc),
+                                                map(begin + Index(i)));
+                               }
+                               partials[p] = std::move(acc);
+                           }
+                       });
+    T result = std::move(identity);
+    for (auto &partial : partials)
+    {
+        result = reduce(std::move(result), std::move(partial));
+    }
+    return result;
+}
+
+// Write f(*it) to out for each it in [first, last) in parallel.
+// @param first     Random access iterator.
+// @param out       Random access iterator.
+// @return          Iterator after the last written.
+template <typename InputIt, typename OutputIt, typename F>
+OutputIt parallel_transform(thread_pool_task_queue &tp, InputIt first,
+                            InputIt last, OutputIt out, F &&f,
+                            size_t grain = 0)
+{
+    auto num = last - first;
+    parallel_for_range(tp, decltype(num)(0), num, grain,
+                       [&](decltype(num) lo, decltype(num) hi)
+                       {
+                           for (auto i = lo; i < hi; ++i)
+                           {
+                               out[i] = f(first[i]);
+                           }
+                       });
+    return out + num;
+}
+
+// Quick sort [first, last), parts not larger than grain are sorted by
+// std::sort, upper parts are added to group.
+template <typename RandomIt, typename Compare>
+void parallel_sort_split(parallel_group &group, RandomIt first, RandomIt last,
+                         size_t grain, Compare &comp)
+{
+    while (static_cast<size_t>(last - first) > grain)
+    {
+        if (group.failed())
+        {
+            return;
+        }
+        // Median of three moved to first as pivot.
+        RandomIt mid = first + (last - first) / 2;
+        RandomIt back = last - 1;
+        if (comp(*mid, *first))
+        {
+            std::iter_swap(mid, first);
+        }
+        if (comp(*back, *mid))
+        {
+            std::iter_swap(back, mid);
+            if (comp(*mid, *first))
+            {
+                std::iter_swap(mid, first);
+            }
+        }
+        std::iter_swap(first, mid);
+
+        // Less, equal and greater than pivot, equal ones are done so that
+        // duplicates do not degrade splitting.
+        RandomIt lower = std::partition(
+            first + 1, last, [&](const auto &x) { return comp(x, *first); });
+        RandomIt upper = std::partition(
+            lower, last, [&](const auto &x) { return !comp(*first, x); });
+        std::iter_swap(first, lower - 1);
+
+        group.run([&group, upper, last, grain, &comp]
+                  { parallel_sort_split(group, upper, last, grain, comp); });
+        last = lower - 1;
+    }
+    if (!group.failed())
+    {
+        std::sort(first, last, comp);
+    }
+}
+
+// Sort [first, last) in parallel, not stable.
+// @param first     Random access iterator.
+// @param comp      Strict weak ordering.
+// @param grain     Elements sorted serially at most, 0 for auto.
+template <typename RandomIt, typename Compare = std::less<>>
+void parallel_sort(thread_pool_task_queue &tp, RandomIt first, RandomIt last,
+                   Compare comp = Compare(), size_t grain = 0)
+{
+    size_t num = last - first;
+    if (num < 2)
+    {
+        return;
+    }
+    if (grain == 0)
+    {
+        // Serial sort of small parts beats the cost of tasks.
+        grain = std::max<size_t>(parallel_grain(tp, num, 0), 1024);
+    }
+    parallel_group group(tp);
+    auto split = [&] { parallel_sort_split(group, first, last, grain, comp); };
+    group.invoke(split);
+    group.wait();
+}
+
+}  // namespace cppev
+
+#endif  // parallel.h
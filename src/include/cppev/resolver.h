@@ -0,0 +1,104 @@
+#ifndef _cppev_resolver_h_6C0224787A17_
+#define _cppev_resolver_h_6C0224787A17_
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "cppev/common.h"
+#include "cppev/io.h"
+#include "cppev/thread_pool.h"
+
+namespace cppev
+{
+
+// Resolved address (ip, family).
+using resolved_address = std::tuple<std::string, family>;
+
+// Lookup addresses of hostname synchronously, in preference order. Empty
+// result means resolution failed.
+using lookup_handler =
+    std::function<std::vector<resolved_address>(const std::string &host)>;
+
+// Receive resolved addresses, empty when resolution failed.
+using resolve_handler =
+    std::function<void(const std::vector<resolved_address> &addrs)>;
+
+// Whether ip is a literal address of family, unix socket path always is.
+CPPEV_PUBLIC bool is_ip_literal(const std::string &ip, family f);
+
+// Order addresses for connection attempts: families are interleaved
+// starting with the preferred one, as described in RFC 8305 section 4.
+// @param addrs     Addresses in resolver preference order.
+// @param preferred Family attempted first.
+CPPEV_PUBLIC std::vector<resolved_address> interleave_addresses(
+    const std::vector<resolved_address> &addrs, family preferred);
+
+class CPPEV_PUBLIC resolver final
+{
+public:
+    // Construct resolver, threads start on the first lookup.
+    // @param thr_num   Threads running blocking lookups.
+    // @param ttl       Lifetime of cached addresses in millisecond.
+    explicit resolver(int thr_num = 1,
+                      int ttl = sysconfig::resolver_cache_ttl);
+
+    resolver(const resolver &) = delete;
+    resolver &operator=(const resolver &) = delete;
+    resolver(resolver &&) = delete;
+    resolver &operator=(resolver &&) = delete;
+
+    ~resolver();
+
+    // Replace getaddrinfo with custom lookup, such as a stand-in resolver.
+    // @param lookup    Lookup executed by resolver thread.
+    void set_lookup(const lookup_handler &lookup);
+
+    // Resolve hostname asynchronously, thread safe. Handler is executed by
+    // calling thread if addresses are cached, otherwise by resolver thread.
+    // Concurrent requests of the same hostname share one lookup.
+    // @param host      Hostname.
+    // @param handler   Handler receiving addresses.
+    void resolve(const std::string &host, const resolve_handler &handler);
+
+    // Drop cached addresses of hostname, thread safe.
+    // @param host      Hostname.
+    void invalidate(const std::string &host);
+
+    // Lookup by getaddrinfo, which honors /etc/hosts and resolv.conf.
+    static std::vector<resolved_address> getaddrinfo_lookup(
+        const std::string &host);
+
+private:
+    using time_point = std::chrono::steady_clock::time_point;
+
+    std::mutex lock_;
+
+    // Lookup executed by resolver thread.
+    lookup_handler lookup_;
+
+    // Lifetime of cached addresses in millisecond.
+    int ttl_;
+
+    // Cached addresses with their expiry.
+    std::unordered_map<std::string,
+                       std::tuple<time_point, std::vector<resolved_address>>>
+        cache_;
+
+    // Handlers waiting for in-flight lookup.
+    std::unordered_map<std::string, std::vector<resolve_handler>> pending_;
+
+    // Whether resolver threads are started.
+    bool running_;
+
+    // Resolver threads.
+    thread_pool_task_queue tp_;
+};
+
+}  // namespace cppev
+
+#endif  // resolver.h
@@ -8,7 +8,10 @@
 #include <cstring>
 #include <exception>
 #include <future>
+#include <string>
+#include <vector>
 
+#include "cppev/stop_token.h"
 #include "cppev/utils.h"
 
 /*
@@ -17,8 +20,14 @@
          but now std::jthread is recommended. Or if you prefer subthread
          implemented by subclass.
 
-    Q2 : Is runnable a full encapsulation of pthread ?
-    A2 : Remain components of pthread:
+    Q2 : How to stop a thread ?
+    A2 : Call request_stop and have run_impl return once get_stop_token is
+         stopped, waits on the token return early. cancel is kept for legacy
+         code only, it unwinds without running destructors on some platforms
+         and may leave locks held.
+
+    Q3 : Is runnable a full encapsulation of pthread ?
+    A3 : Remain components of pthread:
         1) Per-Thread Context Routines : better use "thread_local".
         2) Cleanup Routines : just coding in "run_impl".
         3) Thread Routines : These routines are not essential
@@ -28,6 +37,30 @@
 namespace cppev
 {
 
+// Attributes of thread applied when it is created.
+struct CPPEV_PUBLIC thread_options
+{
+    // Logical CPUs to run on, empty for all. Linux only.
+    std::vector<int> cpus;
+
+    // NUMA node to run on and allocate memory from, -1 for none. Thread is
+    // bound to CPUs of node if cpus is empty, so that memory first touched
+    // by thread is node local. Linux only.
+    int numa_node = -1;
+
+    // Stack size in bytes, 0 for default.
+    size_t stack_size = 0;
+
+    // SCHED_OTHER, SCHED_FIFO or SCHED_RR, -1 to inherit from creator.
+    int sched_policy = -1;
+
+    int sched_priority = 0;
+
+    // Name shown by debuggers and top, truncated to 15 characters, empty to
+    // inherit.
+    std::string name;
+};
+
 class CPPEV_PUBLIC runnable
 {
 public:
@@ -43,12 +76,30 @@ public:
     // Derived class should override
     virtual void run_impl() = 0;
 
-    // Cancel thread
+    // Cancel thread by pthread_cancel, unsafe with destructors and locks.
+    // Prefer request_stop.
     virtual bool cancel() noexcept;
 
-    // Create and run thread
+    // Ask thread to stop, run_impl shall return once it observes the token.
+    // Does not wait, use wait_for or join.
+    void request_stop();
+
+    // Token stopped by request_stop or by parent, of the current run.
+    stop_token get_stop_token() const noexcept;
+
+    // Stop thread when parent is stopped, such as by its owner. Applies to
+    // the next run.
+    void set_stop_parent(const stop_token &parent);
+
+    // Create and run thread, could be called again after joined
     void run();
 
+    // Set attributes of thread created by run
+    void set_thread_options(const thread_options &opts);
+
+    // Attributes of thread created by run
+    const thread_options &get_thread_options() const noexcept;
+
     // Wait until thread finish
     void join();
 
@@ -81,13 +132,59 @@ public:
     }
 
 private:
+    // Apply options that are per thread instead of attribute of creation
+    void apply_thread_options() noexcept;
+
     pthread_t thr_;
 
+    thread_options opts_;
+
     std::promise<bool> prom_;
 
     std::future<bool> fut_;
+
+    stop_source stop_;
+
+    stop_token stop_parent_;
 };
 
+// Join threads that stop before a deadline shared by all of them, so that
+// stopping many threads takes timeout at most instead of timeout each.
+// @param thrs      Threads asked to stop already.
+// @param timeout   Time to wait for all of them.
+// @return          Indexes of threads still running, not joined.
+CPPEV_PUBLIC std::vector<int> join_for(const std::vector<runnable *> &thrs,
+                                       std::chrono::milliseconds timeout);
+
+// Same as above, threads still running after timeout are logged by index
+// and name, then joined without limit since they may use their owner.
+// Callers bounded by timeout use join_for and keep the laggards instead.
+// @param role      Kind of threads shown in log.
+// @return          Indexes of threads not stopped in time.
+CPPEV_PUBLIC std::vector<int> join_reporting(
+    const std::vector<runnable *> &thrs, std::chrono::milliseconds timeout,
+    const std::string &role);
+
+// Logical CPUs of NUMA node, empty if unknown.
+CPPEV_PUBLIC std::vector<int> numa_node_cpus(int node);
+
+// NUMA node of logical CPU, -1 if unknown.
+CPPEV_PUBLIC int numa_node_of_cpu(int cpu);
+
+// Logical CPUs allowed by affinity of process grouped by physical core,
+// hyperthreads of a core are in one group and cores without allowed CPUs are
+// left out. Cores are ordered by package then core id. Systems without
+// topology information give one group per logical CPU.
+CPPEV_PUBLIC std::vector<std::vector<int>> physical_cores();
+
+// Options placing num threads one per physical core, wrapping around if
+// there are less cores. Each thread is bound to the hyperthreads of its
+// core and to the NUMA node of the core.
+// @param num       Number of threads.
+// @param name      Name prefix, thread i is named name-i.
+CPPEV_PUBLIC std::vector<thread_options> spread_physical_cores(
+    int num, const std::string &name = "");
+
 }  // namespace cppev
 
 #endif  // runnable.h
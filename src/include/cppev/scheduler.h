@@ -13,6 +13,7 @@
 #include <tuple>
 #include <vector>
 
+#include "cppev/stop_token.h"
 #include "cppev/utils.h"
 
 namespace cppev
@@ -42,13 +43,14 @@ public:
     // @param exit_tasks : tasks that will be executed once only when thread
     // exits
     // @param align : whether start time align to 1s.
+    // @param parent : scheduler stops when parent is stopped.
     timed_scheduler(
         const std::vector<std::tuple<double, priority, timed_task_handler>>
             &timer_tasks,
         const std::vector<init_task_handler> &init_tasks = {},
         const std::vector<exit_task_handler> &exit_tasks = {},
-        const bool align = true)
-        : stop_(false)
+        const bool align = true, const stop_token &parent = stop_token())
+        : stop_(parent)
     {
         std::priority_queue<std::tuple<priority, size_t>,
                             std::vector<std::tuple<priority, size_t>>,
@@ -94,16 +96,18 @@ public:
                 {
                     task();
                 }
+                // Sleeps are woken by stop instead of running out.
+                stop_token token = stop_.token();
                 auto tp_curr = Clock::now();
                 if (align)
                 {
                     tp_curr = ceil_time_point<Clock>(tp_curr);
-                    std::this_thread::sleep_until(tp_curr);
+                    token.wait_until(tp_curr);
                 }
-                while (!stop_)
+                while (!token.stop_requested())
                 {
                     for (auto iter = tasks_.cbegin();
-                         !stop_ && (iter != tasks_.cend());)
+                         !token.stop_requested() && (iter != tasks_.cend());)
                     {
                         auto curr = iter;
                         auto next = ++iter;
@@ -125,7 +129,7 @@ public:
 
                         auto tp_next = tp_curr + std::chrono::nanoseconds(span);
 
-                        std::this_thread::sleep_until(tp_next);
+                        token.wait_until(tp_next);
 
                         tp_curr = std::chrono::time_point_cast<
                             typename decltype(tp_curr)::duration>(tp_next);
@@ -139,8 +143,10 @@ public:
     }
 
     timed_scheduler(const double freq, const timed_task_handler &handler,
-                    const bool align = true)
-        : timed_scheduler({{freq, priority::p0, handler}}, {}, {}, align)
+                    const bool align = true,
+                    const stop_token &parent = stop_token())
+        : timed_scheduler({{freq, priority::p0, handler}}, {}, {}, align,
+                          parent)
     {
     }
 
@@ -151,13 +157,25 @@ public:
 
     ~timed_scheduler()
     {
-        stop_ = true;
+        stop_.request_stop();
         thr_.join();
     }
 
+    // Stop thread without waiting, exit tasks run once it wakes
+    void request_stop()
+    {
+        stop_.request_stop();
+    }
+
+    // Token stopped when scheduler stops
+    stop_token get_stop_token() const noexcept
+    {
+        return stop_.token();
+    }
+
 private:
     // whether thread shall stop
-    bool stop_;
+    stop_source stop_;
 
     // time interval in nanoseconds
     int64_t interval_;
@@ -0,0 +1,652 @@
+#ifndef _cppev_static_reactor_h_6C0224787A17_
+#define _cppev_static_reactor_h_6C0224787A17_
+
+#include <signal.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cppev/common.h"
+#include "cppev/event_loop.h"
+#include "cppev/io.h"
+#include "cppev/logger.h"
+#include "cppev/runnable.h"
+#include "cppev/utils.h"
+
+/*
+    Static reactor is the templated variant of tcp_server / tcp_client, using
+    the same N+M threading. The handler type is a template parameter, so the
+    callbacks are direct calls that may be inlined instead of std::function
+    invocations. The event handlers of the connection state machine are
+    created once per reactor and shared by all connections, sockets are
+    downcast by a virtual call rather than dynamic_cast. Per connection, only
+    the socket itself and the event loop bookkeeping are allocated.
+ */
+
+namespace cppev
+{
+
+namespace reactor
+{
+
+// Handler of static reactor. Derive from it and hide the callbacks of
+// interest, all callbacks are executed by worker thread unless specified.
+struct static_handler
+{
+    // When tcp server accepts new connection.
+    void on_accept(const std::shared_ptr<socktcp> &)
+    {
+    }
+
+    // When tcp client establishes new connection.
+    void on_connect(const std::shared_ptr<socktcp> &)
+    {
+    }
+
+    // When tcp client fails to connect, socket is already closed. Executed
+    // by the thread calling add if connect syscall fails.
+    void on_connect_failed(const std::shared_ptr<socktcp> &)
+    {
+    }
+
+    // When read from tcp connection completes.
+    void on_read_complete(const std::shared_ptr<socktcp> &)
+    {
+    }
+
+    // When write to tcp connection completes.
+    void on_write_complete(const std::shared_ptr<socktcp> &)
+    {
+    }
+
+    // When tcp socket is closed by opposite host.
+    void on_closed(const std::shared_ptr<socktcp> &)
+    {
+    }
+};
+
+// Thread running an event loop for static reactor.
+class CPPEV_PRIVATE static_worker final : public runnable
+{
+public:
+    // @param data  Reactor owning the thread.
+    explicit static_worker(void *data) : evlp_(data, this)
+    {
+    }
+
+    static_worker(const static_worker &) = delete;
+    static_worker &operator=(const static_worker &) = delete;
+    static_worker(static_worker &&) = delete;
+    static_worker &operator=(static_worker &&) = delete;
+
+    ~static_worker() = default;
+
+    // Get event loop.
+    event_loop &evlp() noexcept
+    {
+        return evlp_;
+    }
+
+    void run_impl() override
+    {
+        try
+        {
+            evlp_.set_stop_token(get_stop_token());
+            evlp_.loop_forever();
+        }
+        catch (std::exception &e)
+        {
+            LOG_ERROR << e.what();
+        }
+    }
+
+    // Shutdown event loop and wait for thread.
+    void shutdown()
+    {
+        request_stop();
+        join_reporting(
+            {this},
+            std::chrono::milliseconds(sysconfig::reactor_shutdown_timeout),
+            "static worker");
+    }
+
+private:
+    event_loop evlp_;
+};
+
+template <typename Handler>
+class CPPEV_PUBLIC static_reactor
+{
+public:
+    // @param iohandler_num     IO thread pool size.
+    // @param args              Arguments to construct handler.
+    template <typename... Args>
+    explicit static_reactor(int iohandler_num, Args &&...args)
+        : handler_(std::forward<Args>(args)...),
+          edge_trigger_(sysconfig::reactor_edge_trigger),
+          on_connected_(std::make_shared<fd_event_handler>(
+              &static_reactor::on_connected)),
+          on_readable_(std::make_shared<fd_event_handler>(
+              &static_reactor::on_readable)),
+          on_writable_(std::make_shared<fd_event_handler>(
+              &static_reactor::on_writable))
+    {
+        for (int i = 0; i < iohandler_num; ++i)
+        {
+            workers_.push_back(std::make_unique<static_worker>(this));
+        }
+    }
+
+    static_reactor(const static_reactor &) = delete;
+    static_reactor &operator=(const static_reactor &) = delete;
+    static_reactor(static_reactor &&) = delete;
+    static_reactor &operator=(static_reactor &&) = delete;
+
+    ~static_reactor() = default;
+
+    // Handler of the reactor.
+    Handler &handler() noexcept
+    {
+        return handler_;
+    }
+
+    // Handler of the reactor owning the socket.
+    static Handler &handler_of(const std::shared_ptr<socktcp> &iopt)
+    {
+        return self(iopt)->handler_;
+    }
+
+    // Async write data in write buffer.
+    static void async_write(const std::shared_ptr<socktcp> &iopt)
+    {
+        bool ok = write_pending(iopt);
+        if (write_done(iopt))
+        {
+            self(iopt)->handler_.on_write_complete(iopt);
+        }
+        else if (!ok || iopt->eop() || iopt->is_reset())
+        {
+            if (!iopt->is_closed())
+            {
+                close_conn(iopt);
+            }
+        }
+        else if (!self(iopt)->edge_trigger_)
+        {
+            iopt->evlp().fd_activate(iopt, fd_event::fd_writable);
+        }
+        else if (iopt->file_source_blocked())
+        {
+            retry_blocked_source(iopt);
+        }
+    }
+
+    // Async send file range with zero copy, see reactor::async_sendfile.
+    static void async_sendfile(
+        const std::shared_ptr<socktcp> &iopt, int fd, off_t offset, off_t len,
+        const std::shared_ptr<const void> &owner = nullptr)
+    {
+        if (iopt->files_empty() && iopt->wbuffer().size())
+        {
+            exception_guard([&iopt] { iopt->write_all(); });
+        }
+        iopt->queue_file(fd, offset, len, owner);
+        async_write(iopt);
+    }
+
+    // Async send descriptors with data in write buffer, see
+    // reactor::async_send_fds.
+    static void async_send_fds(const std::shared_ptr<socktcp> &iopt,
+                               const std::vector<int> &fds)
+    {
+        iopt->queue_fds(fds);
+        async_write(iopt);
+    }
+
+    // Safely close tcp socket.
+    static void safely_close(const std::shared_ptr<socktcp> &iopt)
+    {
+        if (iopt->is_closed())
+        {
+            return;
+        }
+        iopt->evlp().fd_clean(iopt);
+        iopt->defer_zerocopy();
+        iopt->close();
+    }
+
+protected:
+    static static_reactor *self(const std::shared_ptr<io> &iop)
+    {
+        return reinterpret_cast<static_reactor *>(iop->evlp().data());
+    }
+
+    // Downcast without dynamic_cast, the result shares ownership with iop.
+    static std::shared_ptr<socktcp> to_socktcp(const std::shared_ptr<io> &iop)
+    {
+        return std::shared_ptr<socktcp>(iop, iop->to_socktcp());
+    }
+
+    // Assign socket to worker with minimum loads. Connecting socket is
+    // established when it becomes writable, while accepted socket is already
+    // established, so its handlers are installed right away and on_accept
+    // runs as a task of the worker.
+    // @param accepted  Whether socket is accepted or connecting.
+    void assign(const std::shared_ptr<socktcp> &iopt, bool accepted)
+    {
+        event_loop *minloads_evlp = &workers_[0]->evlp();
+        for (auto &worker : workers_)
+        {
+            // This is not thread safe but it's okay
+            if (worker->evlp().ev_loads() < minloads_evlp->ev_loads())
+            {
+                minloads_evlp = &worker->evlp();
+            }
+        }
+        if (accepted)
+        {
+            minloads_evlp->fd_register(iopt, fd_event::fd_writable,
+                                       on_writable_);
+            minloads_evlp->fd_register(iopt, fd_event::fd_readable,
+                                       on_readable_);
+            minloads_evlp->post([iopt] { on_accepted(iopt); });
+        }
+        else
+        {
+            minloads_evlp->fd_register_and_activate(
+                iopt, fd_event::fd_writable, on_connected_);
+        }
+    }
+
+    void run_workers()
+    {
+        ignore_signal(SIGPIPE);
+        for (auto &worker : workers_)
+        {
+            worker->run();
+        }
+    }
+
+    // Workers stop in parallel, within one shutdown timeout.
+    void shutdown_workers()
+    {
+        std::vector<runnable *> thrs;
+        for (auto &worker : workers_)
+        {
+            worker->request_stop();
+            thrs.push_back(worker.get());
+        }
+        join_reporting(
+            thrs,
+            std::chrono::milliseconds(sysconfig::reactor_shutdown_timeout),
+            "static worker");
+    }
+
+private:
+    // Set event mode of connection before its events are activated.
+    static void prepare_conn(const std::shared_ptr<socktcp> &iopt)
+    {
+        if (self(iopt)->edge_trigger_)
+        {
+            iopt->evlp().fd_set_mode(iopt, fd_event_mode::edge_trigger);
+        }
+    }
+
+    // Activate events of connection after on_accept or on_connect. Edge
+    // triggered writable is activated once for the lifetime of connection.
+    static void activate_conn(const std::shared_ptr<socktcp> &iopt)
+    {
+        if (iopt->is_closed())
+        {
+            return;
+        }
+        iopt->evlp().fd_activate(iopt, fd_event::fd_readable);
+        if (self(iopt)->edge_trigger_)
+        {
+            iopt->evlp().fd_activate(iopt, fd_event::fd_writable);
+        }
+    }
+
+    // Accepted socket with handlers registered, executed by worker thread.
+    static void on_accepted(const std::shared_ptr<socktcp> &iopt)
+    {
+        // Readable is activated after on_accept so that no data is read
+        // before it.
+        prepare_conn(iopt);
+        self(iopt)->handler_.on_accept(iopt);
+        activate_conn(iopt);
+    }
+
+    // Connecting socket is writable for the first time, check and init the
+    // connection.
+    static void on_connected(const std::shared_ptr<io> &iop)
+    {
+        std::shared_ptr<socktcp> iopt = to_socktcp(iop);
+        static_reactor *sr = self(iop);
+        iop->evlp().fd_remove_and_deactivate(iop, fd_event::fd_writable);
+        if (!iopt->check_connect())
+        {
+            iop->evlp().fd_clean(iop);
+            iopt->close();
+            sr->handler_.on_connect_failed(iopt);
+            return;
+        }
+
+        // The sequence CANNOT be changed, since on_connect may call
+        // async_write
+        prepare_conn(iopt);
+        iop->evlp().fd_register(iop, fd_event::fd_writable, sr->on_writable_);
+        iop->evlp().fd_register(iop, fd_event::fd_readable, sr->on_readable_);
+        sr->handler_.on_connect(iopt);
+        activate_conn(iopt);
+    }
+
+    static void on_readable(const std::shared_ptr<io> &iop)
+    {
+        std::shared_ptr<socktcp> iopt = to_socktcp(iop);
+        if (iopt->zerocopy_pending() &&
+            !exception_guard([&iopt] { iopt->drain_zerocopy(); }))
+        {
+            LOG_ERROR_FMT("Drain zero copy completions error for fd %d",
+                          iopt->fd());
+        }
+        // Hot connection reads at most the budget so that others of the
+        // worker are not starved.
+        int budget = sysconfig::reactor_read_budget;
+        int total = 0;
+        if (!exception_guard(
+                [&iopt, &total, budget]
+                {
+                    int step = sysconfig::buffer_io_step;
+                    total = iopt->get_fd_passing()
+                                ? iopt->read_all_fds(step, budget)
+                                : iopt->read_all(step, budget);
+                }))
+        {
+            LOG_ERROR_FMT("Syscall read error for fd %d", iopt->fd());
+        }
+        self(iop)->handler_.on_read_complete(iopt);
+        if (iopt->is_closed())
+        {
+            return;
+        }
+        if (0 == iopt->rbuffer().size())
+        {
+            iopt->rbuffer().clear();
+        }
+        else if ((iopt->rbuffer().capacity() >> 1) < iopt->rbuffer().waste())
+        {
+            iopt->rbuffer().tiny();
+        }
+        if (iopt->eof() || iopt->is_reset())
+        {
+            close_conn(iopt);
+        }
+        else if (self(iop)->edge_trigger_ && total >= budget)
+        {
+            // No more edge comes for the data left, continue after the other
+            // events of this loop.
+            iop->evlp().post(
+                [iop]
+                {
+                    if (!iop->is_closed())
+                    {
+                        on_readable(iop);
+                    }
+                });
+        }
+    }
+
+    static void on_writable(const std::shared_ptr<io> &iop)
+    {
+        std::shared_ptr<socktcp> iopt = to_socktcp(iop);
+        bool edge_trigger = self(iop)->edge_trigger_;
+        // Edge triggered writable also fires when nothing is pending, such
+        // as on activation.
+        if (edge_trigger && write_done(iopt))
+        {
+            return;
+        }
+        bool ok = write_pending(iopt);
+        if (write_done(iopt))
+        {
+            iopt->wbuffer().clear();
+            if (!edge_trigger)
+            {
+                iop->evlp().fd_deactivate(iop, fd_event::fd_writable);
+            }
+            self(iop)->handler_.on_write_complete(iopt);
+        }
+        else if ((iopt->wbuffer().capacity() >> 1) < iopt->wbuffer().waste())
+        {
+            iopt->wbuffer().tiny();
+        }
+        if ((!ok || iopt->eop() || iopt->is_reset()) && (!iopt->is_closed()))
+        {
+            close_conn(iopt);
+        }
+        else if (edge_trigger && !write_done(iopt) &&
+                 iopt->file_source_blocked() && !iopt->is_closed())
+        {
+            retry_blocked_source(iopt);
+        }
+    }
+
+    // Edge triggered socket left writable by a file source without data gets
+    // no more edge, retry after the other events of this loop.
+    static void retry_blocked_source(const std::shared_ptr<socktcp> &iopt)
+    {
+        std::shared_ptr<io> iop = iopt;
+        iop->evlp().post(
+            [iop]
+            {
+                if (!iop->is_closed())
+                {
+                    on_writable(iop);
+                }
+            });
+    }
+
+    // Write queued descriptors, file segments and then write buffer, return
+    // false if write failed unrecoverably.
+    static bool write_pending(const std::shared_ptr<socktcp> &iopt)
+    {
+        if (!exception_guard(
+                [&iopt]
+                {
+                    if (iopt->write_fds() && iopt->write_files())
+                    {
+                        iopt->write_zerocopy();
+                    }
+                }))
+        {
+            LOG_ERROR_FMT("Syscall write error for fd %d", iopt->fd());
+            return false;
+        }
+        return true;
+    }
+
+    // Whether file segments, zero copy blocks and write buffer are sent.
+    static bool write_done(const std::shared_ptr<socktcp> &iopt)
+    {
+        return iopt->files_empty() && !iopt->zerocopy_unsent() &&
+               0 == iopt->wbuffer().size();
+    }
+
+    // Notify on_closed, remove connection from event loop and close it.
+    static void close_conn(const std::shared_ptr<socktcp> &iopt)
+    {
+        self(iopt)->handler_.on_closed(iopt);
+        iopt->evlp().fd_clean(iopt);
+        iopt->defer_zerocopy();
+        iopt->close();
+    }
+
+    // Handler defined by user.
+    Handler handler_;
+
+    // Whether connections are edge triggered, taken from
+    // sysconfig::reactor_edge_trigger on construction.
+    bool edge_trigger_;
+
+    // Event handlers shared by all connections.
+    std::shared_ptr<fd_event_handler> on_connected_;
+
+    std::shared_ptr<fd_event_handler> on_readable_;
+
+    std::shared_ptr<fd_event_handler> on_writable_;
+
+    // Worker threads.
+    std::vector<std::unique_ptr<static_worker>> workers_;
+};
+
+template <typename Handler>
+class CPPEV_PUBLIC static_tcp_server final : public static_reactor<Handler>
+{
+    using base_type = static_reactor<Handler>;
+
+public:
+    // @param iohandler_num     IO thread pool size.
+    // @param args              Arguments to construct handler.
+    template <typename... Args>
+    explicit static_tcp_server(int iohandler_num, Args &&...args)
+        : base_type(iohandler_num, std::forward<Args>(args)...),
+          acpt_(static_cast<base_type *>(this))
+    {
+    }
+
+    // Listen in ip and port.
+    // Should be called before run().
+    // @param port      Port to listen.
+    // @param f         TCP socket family, can be IPv4 or IPv6.
+    // @param ip        IP to listen, nullptr means all addresses.
+    void listen(int port, family f, const char *ip = nullptr)
+    {
+        std::shared_ptr<socktcp> sock = io_factory::get_socktcp(f);
+        sock->bind(ip, port);
+        sock->listen();
+        socks_.push_back(sock);
+        LOG_INFO_FMT("Listening socket %d working in %s %d", sock->fd(),
+                     ip ? ip : "localhost", port);
+    }
+
+    // Listen in unix socket path.
+    // Should be called before run().
+    // @param path      Unix socket path.
+    // @param remove    Whether remove path before binding.
+    void listen_unix(const std::string &path, bool remove = false)
+    {
+        std::shared_ptr<socktcp> sock = io_factory::get_socktcp(family::local);
+        sock->bind_unix(path, remove);
+        sock->listen();
+        socks_.push_back(sock);
+        LOG_INFO_FMT("Listening socket %d working in %s", sock->fd(),
+                     path.c_str());
+    }
+
+    // Start server asynchronously.
+    void run()
+    {
+        this->run_workers();
+        for (auto &sock : socks_)
+        {
+            acpt_.evlp().fd_register_and_activate(
+                sock, fd_event::fd_readable,
+                &static_tcp_server::on_listening_readable);
+        }
+        acpt_.run();
+    }
+
+    // Shutdown server synchronously, return when all server threads exit.
+    void shutdown()
+    {
+        acpt_.shutdown();
+        this->shutdown_workers();
+    }
+
+private:
+    static void on_listening_readable(const std::shared_ptr<io> &iop)
+    {
+        auto sr = static_cast<static_tcp_server *>(base_type::self(iop));
+        std::vector<std::shared_ptr<socktcp>> conns =
+            base_type::to_socktcp(iop)->accept();
+        for (auto &conn : conns)
+        {
+            sr->assign(conn, true);
+        }
+    }
+
+    // Accept thread.
+    static_worker acpt_;
+
+    // Listening sockets.
+    std::vector<std::shared_ptr<socktcp>> socks_;
+};
+
+template <typename Handler>
+class CPPEV_PUBLIC static_tcp_client final : public static_reactor<Handler>
+{
+public:
+    // @param iohandler_num     IO thread pool size.
+    // @param args              Arguments to construct handler.
+    template <typename... Args>
+    explicit static_tcp_client(int iohandler_num, Args &&...args)
+        : static_reactor<Handler>(iohandler_num, std::forward<Args>(args)...)
+    {
+    }
+
+    // Connect to target uri, the connect syscall is issued by calling thread.
+    // Thread safe, can be called before or after run().
+    // @param ip        Opposite host IP.
+    // @param port      Opposite port.
+    // @param f         TCP socket family, can be IPv4 or IPv6.
+    // @param t         Counts of the uri to add.
+    void add(const std::string &ip, int port, family f, int t = 1)
+    {
+        for (int i = 0; i < t; ++i)
+        {
+            std::shared_ptr<socktcp> sock = io_factory::get_socktcp(f);
+            bool succeed = f == family::local ? sock->connect_unix(ip)
+                                              : sock->connect(ip, port);
+            if (succeed)
+            {
+                this->assign(sock, false);
+            }
+            else
+            {
+                LOG_WARNING_FMT("Connect %s %d failed with syscall errno %d",
+                                ip.c_str(), port, errno);
+                sock->close();
+                this->handler().on_connect_failed(sock);
+            }
+        }
+    }
+
+    // Connect to unix socket path.
+    // @param path      TCP Unix socket path to connect.
+    // @param t         Counts of the uri to add.
+    void add_unix(const std::string &path, int t = 1)
+    {
+        add(path, -1, family::local, t);
+    }
+
+    // Start client asynchronously.
+    void run()
+    {
+        this->run_workers();
+    }
+
+    // Shutdown client synchronously, return when all client threads exit.
+    void shutdown()
+    {
+        this->shutdown_workers();
+    }
+};
+
+}  // namespace reactor
+
+}  // namespace cppev
+
+#endif  // static_reactor.h
@@ -0,0 +1,244 @@
+#ifndef _cppev_stop_token_h_6C0224787A17_
+#define _cppev_stop_token_h_6C0224787A17_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "cppev/unique_function.h"
+#include "cppev/utils.h"
+
+/*
+    Cooperative stop, in the manner of std::stop_token of C++20.
+
+    A stop_source requests stop, its stop_tokens observe it and stop_callbacks
+    registered on the tokens run once stop is requested. Source constructed
+    from a parent token is stopped when the parent is, so that stopping an
+    owner stops everything it created. Waits on a token return early once
+    stop is requested.
+ */
+
+namespace cppev
+{
+
+using stop_callback_handler = unique_function<void(void)>;
+
+// State shared by a source and its tokens and callbacks.
+class CPPEV_PUBLIC stop_state final
+{
+public:
+    stop_state() noexcept;
+
+    stop_state(const stop_state &) = delete;
+    stop_state &operator=(const stop_state &) = delete;
+    stop_state(stop_state &&) = delete;
+    stop_state &operator=(stop_state &&) = delete;
+
+    // Unlink from parent.
+    ~stop_state();
+
+    // Stop state when parent stops.
+    static void link(const std::shared_ptr<stop_state> &child,
+                     const std::shared_ptr<stop_state> &parent);
+
+    // Run callbacks by calling thread, the first request only.
+    // @return  Whether this is the first request.
+    bool request_stop();
+
+    bool stop_requested() const noexcept
+    {
+        return requested_.load(std::memory_order_acquire);
+    }
+
+    // Add callback, run at once if stop is requested already.
+    // @return  Id of callback, 0 if run at once.
+    uint64_t add(stop_callback_handler &&handler);
+
+    // Remove callback, wait if it is running by another thread.
+    void remove(uint64_t id) noexcept;
+
+    // Wait until stop is requested or deadline.
+    // @return  Whether stop is requested.
+    template <typename Clock, typename Duration>
+    bool wait_until(const std::chrono::time_point<Clock, Duration> &deadline)
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        return cond_.wait_until(lock, deadline,
+                                [this] { return stop_requested(); });
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        cond_.wait(lock, [this] { return stop_requested(); });
+    }
+
+private:
+    std::atomic<bool> requested_;
+
+    std::mutex lock_;
+
+    std::condition_variable cond_;
+
+    std::vector<std::pair<uint64_t, stop_callback_handler>> callbacks_;
+
+    uint64_t next_id_;
+
+    // Callback running by request_stop, 0 for none.
+    uint64_t running_;
+
+    std::thread::id running_thread_;
+
+    // Parent and id of the callback stopping this state.
+    std::shared_ptr<stop_state> parent_;
+
+    uint64_t parent_id_;
+};
+
+// Read side of stop, copyable and thread safe. Default constructed token is
+// never stopped.
+class CPPEV_PUBLIC stop_token final
+{
+    friend class stop_source;
+
+    friend class stop_callback;
+
+public:
+    stop_token() noexcept = default;
+
+    // Whether stop is requested.
+    bool stop_requested() const noexcept
+    {
+        return state_ && state_->stop_requested();
+    }
+
+    // Whether stop could ever be requested.
+    bool stop_possible() const noexcept
+    {
+        return state_ != nullptr;
+    }
+
+    // Sleep until stop is requested or deadline.
+    // @return  Whether stop is requested.
+    template <typename Clock, typename Duration>
+    bool wait_until(
+        const std::chrono::time_point<Clock, Duration> &deadline) const
+    {
+        if (!state_)
+        {
+            std::this_thread::sleep_until(deadline);
+            return false;
+        }
+        return state_->wait_until(deadline);
+    }
+
+    // Sleep until stop is requested or timeout.
+    // @return  Whether stop is requested.
+    template <typename Rep, typename Period>
+    bool wait_for(const std::chrono::duration<Rep, Period> &timeout) const
+    {
+        return wait_until(std::chrono::steady_clock::now() + timeout);
+    }
+
+    // Wait until stop is requested, forever for default token.
+    void wait() const
+    {
+        if (!state_)
+        {
+            throw_logic_error("waiting for stop of default token");
+        }
+        state_->wait();
+    }
+
+private:
+    explicit stop_token(std::shared_ptr<stop_state> state) noexcept
+        : state_(std::move(state))
+    {
+    }
+
+    std::shared_ptr<stop_state> state_;
+};
+
+// Write side of stop, shared by copies.
+class CPPEV_PUBLIC stop_source final
+{
+public:
+    stop_source() : state_(std::make_shared<stop_state>())
+    {
+    }
+
+    // Source stopped when parent is stopped, requesting stop of source does
+    // not stop parent.
+    explicit stop_source(const stop_token &parent)
+        : state_(std::make_shared<stop_state>())
+    {
+        if (parent.state_)
+        {
+            stop_state::link(state_, parent.state_);
+        }
+    }
+
+    // Request stop, callbacks registered are run by calling thread.
+    // @return  Whether this is the first request.
+    bool request_stop()
+    {
+        return state_->request_stop();
+    }
+
+    bool stop_requested() const noexcept
+    {
+        return state_->stop_requested();
+    }
+
+    stop_token token() const noexcept
+    {
+        return stop_token(state_);
+    }
+
+private:
+    std::shared_ptr<stop_state> state_;
+};
+
+// Callback run once stop is requested, unregistered by destructor. Runs at
+// once by constructing thread if stop is requested already. Destructor waits
+// if the callback is running by another thread.
+class CPPEV_PUBLIC stop_callback final
+{
+public:
+    stop_callback(const stop_token &token, stop_callback_handler handler)
+        : state_(token.state_), id_(0)
+    {
+        if (state_)
+        {
+            id_ = state_->add(std::move(handler));
+        }
+    }
+
+    stop_callback(const stop_callback &) = delete;
+    stop_callback &operator=(const stop_callback &) = delete;
+    stop_callback(stop_callback &&) = delete;
+    stop_callback &operator=(stop_callback &&) = delete;
+
+    ~stop_callback()
+    {
+        if (state_ && id_)
+        {
+            state_->remove(id_);
+        }
+    }
+
+private:
+    std::shared_ptr<stop_state> state_;
+
+    uint64_t id_;
+};
+
+}  // namespace cppev
+
+#endif  // stop_token.h
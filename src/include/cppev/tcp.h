@@ -3,17 +3,22 @@
 
 #include <signal.h>
 
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <functional>
 #include <iostream>
 #include <memory>
 #include <queue>
 #include <random>
 #include <type_traits>
+#include <unordered_set>
 #include <vector>
 
 #include "cppev/common.h"
 #include "cppev/event_loop.h"
 #include "cppev/io.h"
+#include "cppev/resolver.h"
 #include "cppev/runnable.h"
 #include "cppev/thread_pool.h"
 
@@ -50,17 +55,123 @@ using tcp_event_handler = std::function<void(const std::shared_ptr<socktcp> &)>;
 // Async write data in write buffer.
 CPPEV_PUBLIC void async_write(const std::shared_ptr<socktcp> &iopt);
 
+// Async send file range with zero copy (sendfile, or splice via pipe when
+// source doesn't support sendfile). Data already in write buffer is sent
+// before the file, and on_write_complete is triggered when all of them are
+// sent. Same as async_write, it shall not be called again before
+// on_write_complete; to frame a file with trailing data, use
+// socktcp::queue_file, fill write buffer and then call async_write once.
+// @param iopt      Connection.
+// @param fd        File descriptor owned by caller, it shall be kept open
+//                  until on_write_complete or on_closed.
+// @param offset    Start offset in file.
+// @param len       Length in bytes.
+// @param owner     Kept alive until the file is sent, such as file_view.
+CPPEV_PUBLIC void async_sendfile(
+    const std::shared_ptr<socktcp> &iopt, int fd, off_t offset, off_t len,
+    const std::shared_ptr<const void> &owner = nullptr);
+
+// Async send descriptors over unix domain connection together with data in
+// write buffer, which shall not be empty. The peer receives them by
+// enabling socktcp::set_fd_passing, typically in on_accept / on_connect,
+// and calling socktcp::take_fds in on_read_complete.
+// @param iopt      Connection.
+// @param fds       Descriptors owned by caller, they shall be kept open
+//                  until on_write_complete or on_closed.
+CPPEV_PUBLIC void async_send_fds(const std::shared_ptr<socktcp> &iopt,
+                                 const std::vector<int> &fds);
+
 // Safely close tcp socket.
 CPPEV_PUBLIC void safely_close(const std::shared_ptr<socktcp> &iopt);
 
 // Get external data of reactor server and client.
 CPPEV_PUBLIC void *external_data(const std::shared_ptr<socktcp> &iopt);
 
+// Whether the reactor owning the socket is draining, handlers may use it to
+// close idle keep-alive connections early.
+CPPEV_PUBLIC bool is_draining(const std::shared_ptr<socktcp> &iopt);
+
 struct CPPEV_PRIVATE host_hash
 {
     size_t operator()(const std::tuple<std::string, int, family> &h) const;
 };
 
+// Callback when connecting to target uri (ip, port, family) is given up.
+using connect_failed_handler =
+    std::function<void(const std::tuple<std::string, int, family> &)>;
+
+// Retry policy of connecting to a target uri.
+struct CPPEV_PUBLIC retry_policy
+{
+    // Retries after the first failed attempt, 0 means never retry.
+    int max_retries = 0;
+
+    // Backoff before the first retry, in millisecond.
+    int base_backoff = 100;
+
+    // Upper bound of backoff, in millisecond.
+    int max_backoff = 10000;
+
+    // Backoff grows by multiplier for each retry.
+    double multiplier = 2.0;
+
+    // Backoff is randomized in [backoff * (1 - jitter), backoff] so that
+    // clients do not reconnect in lockstep.
+    double jitter = 0.5;
+
+    // Consecutive failures that open the circuit, 0 means never open.
+    int breaker_threshold = 0;
+
+    // Time the circuit stays open before one trial connect is let through,
+    // in millisecond. Attempts rejected by the circuit count as retries and
+    // are scheduled again once it may let them through.
+    int breaker_cooldown = 5000;
+};
+
+// Circuit breaker state of a target uri.
+enum class CPPEV_PUBLIC breaker_state
+{
+    // Connect attempts are allowed.
+    closed,
+    // Connect attempts are rejected until cooldown elapses.
+    open,
+    // One trial connect is in flight, others are rejected.
+    half_open,
+};
+
+// Connect accounting of a target uri.
+struct CPPEV_PUBLIC connect_stats
+{
+    // Connections established.
+    int64_t successes = 0;
+
+    // Attempts failed in connect syscall or SO_ERROR check.
+    int64_t failures = 0;
+
+    // Attempts rejected by open circuit.
+    int64_t rejects = 0;
+
+    // Failed attempts since the last success.
+    int consecutive_failures = 0;
+
+    // Latency from connect syscall to connection established of the last
+    // success, in microsecond.
+    int64_t last_latency = 0;
+
+    // Max latency, in microsecond.
+    int64_t max_latency = 0;
+
+    // Sum of latency of all successes, in microsecond.
+    int64_t total_latency = 0;
+
+    // Circuit breaker state.
+    breaker_state state = breaker_state::closed;
+};
+
+class connection_pool;
+
+class connect_tracker;
+
 // Data used for event loop initialization.
 struct CPPEV_PRIVATE data_storage final
 {
@@ -107,6 +218,39 @@ public:
 
     const void *external_data() const noexcept;
 
+    // Connections established and not yet closed by the reactor.
+    std::atomic<int> connections;
+
+    // Whether server stops accepting and waits for connections to finish.
+    std::atomic<bool> draining;
+
+    // Whether connections are edge triggered, taken from
+    // sysconfig::reactor_edge_trigger on construction.
+    bool edge_trigger;
+
+    // Connection pool of tcp client, nullptr for tcp server.
+    connection_pool *pool;
+
+    // Retry and failure accounting of tcp client, nullptr for tcp server.
+    connect_tracker *tracker;
+
+    // Resolver of hostname targets, nullptr for tcp server.
+    resolver *dns;
+
+    // When tcp client gives up connecting to target, executed by connect
+    // thread.
+    connect_failed_handler on_connect_failed;
+
+    // TCP Fast Open queue length of listening sockets, 0 means disabled.
+    int fastopen_qlen;
+
+    // Seconds listening sockets defer accept until data arrives, 0 means
+    // disabled.
+    int defer_accept;
+
+    // Whether tcp client carries its first write in SYN by TCP Fast Open.
+    bool fastopen_connect;
+
 private:
     // Event loops of thread pool, used for task assign.
     std::vector<event_loop *> evls;
@@ -135,13 +279,23 @@ public:
     // Connected socket that has been registered to thread pool is writable.
     static void on_writable(const std::shared_ptr<io> &iop);
 
-    // Connecting socket is writable, registered by listening / connecting
-    // thread and will be executed by one thread of the pool to do the
-    // check and init jobs.
+    // Connecting socket is writable, registered by connecting thread and
+    // will be executed by one thread of the pool to do the check and init
+    // jobs.
     static void on_conn_establish(const std::shared_ptr<io> &iop,
                                   init_checker checker,
                                   tcp_event_handler handler);
 
+    // Accepted socket whose handlers are registered by listening thread,
+    // posted to the thread of the pool owning it to trigger on_accept and
+    // activate readable. Accepted socket is already established and skips
+    // the writable check of on_conn_establish.
+    static void on_conn_accepted(const std::shared_ptr<socktcp> &iopt);
+
+    // Notify on_closed, remove connection from event loop and close it,
+    // nothing is done if on_closed has closed it by safely_close.
+    static void close_conn(const std::shared_ptr<socktcp> &iopt);
+
     // Get event loop.
     event_loop &evlp();
 
@@ -151,7 +305,7 @@ public:
     // Run with exception handling.
     void run_impl() override;
 
-    // Shutdown io eventloop.
+    // Ask io eventloop to stop, without waiting for thread.
     void shutdown();
 
 private:
@@ -190,7 +344,14 @@ public:
     // Should be called before subthread runs.
     void listen_unix(const std::string &path, bool remove);
 
-    // Shutdown io eventloop.
+    // Use listening socket inherited from another process.
+    // Should be called before subthread runs.
+    void inherit(const std::shared_ptr<socktcp> &sock);
+
+    // Listening sockets.
+    const std::vector<std::shared_ptr<socktcp>> &sockets() const noexcept;
+
+    // Ask io eventloop to stop, without waiting for thread.
     // Thread safe.
     void shutdown();
 
@@ -202,6 +363,77 @@ private:
     std::vector<std::shared_ptr<socktcp>> socks_;
 };
 
+class CPPEV_PRIVATE connect_tracker final
+{
+public:
+    using host_type = std::tuple<std::string, int, family>;
+
+    connect_tracker();
+
+    connect_tracker(const connect_tracker &) = delete;
+    connect_tracker &operator=(const connect_tracker &) = delete;
+    connect_tracker(connect_tracker &&) = delete;
+    connect_tracker &operator=(connect_tracker &&) = delete;
+
+    ~connect_tracker();
+
+    // Set retry policy of host.
+    void set_policy(const host_type &h, const retry_policy &policy);
+
+    // Set retry policy of hosts without their own policy.
+    void set_default_policy(const retry_policy &policy);
+
+    // Whether circuit breaker lets a connect attempt to host through.
+    // @param attempt   Retries already made before this attempt.
+    // @return          0 if let through, otherwise delay in millisecond
+    //                  before the next attempt, -1 if connecting shall be
+    //                  given up.
+    int acquire(const host_type &h, int attempt);
+
+    // Record an established connection.
+    // @param latency   Connect latency in microsecond.
+    void on_success(const host_type &h, int64_t latency);
+
+    // Record a failed attempt.
+    // @param attempt   Retries already made before this attempt.
+    // @return          Backoff in millisecond before the next attempt, -1 if
+    //                  connecting shall be given up.
+    int on_failure(const host_type &h, int attempt);
+
+    // Copy of accounting of all hosts ever attempted.
+    std::unordered_map<host_type, connect_stats, host_hash> snapshot();
+
+private:
+    struct host_state
+    {
+        connect_stats stats;
+
+        // When circuit was opened.
+        std::chrono::steady_clock::time_point opened;
+
+        // Whether the half-open trial connect is in flight.
+        bool probing = false;
+    };
+
+    const retry_policy &policy_nts(const host_type &h) const;
+
+    // Delay before the retry after attempt, -1 if retries are exhausted.
+    // Retry of open circuit is delayed until its trial may be let through.
+    int retry_delay_nts(const host_state &hs, const retry_policy &policy,
+                        int attempt);
+
+    std::mutex lock_;
+
+    retry_policy default_policy_;
+
+    std::unordered_map<host_type, retry_policy, host_hash> policies_;
+
+    std::unordered_map<host_type, host_state, host_hash> states_;
+
+    // Random engine for backoff jitter.
+    std::default_random_engine rde_;
+};
+
 class CPPEV_PRIVATE connector final : public runnable
 {
 public:
@@ -229,11 +461,53 @@ public:
     // Thread safe.
     void add(const std::string &ip, int port, family f, int t);
 
-    // Shutdown io eventloop.
+    // Ask io eventloop to stop, without waiting for thread.
     // Thread safe.
     void shutdown();
 
 private:
+    using host_type = std::tuple<std::string, int, family>;
+
+    // Connection attempts racing among resolved addresses of one connection
+    // task, the first established connection wins.
+    struct race_state
+    {
+        host_type h;
+
+        // Retries already made for this connection task.
+        int attempt;
+
+        // When connection task started, for latency accounting.
+        std::chrono::steady_clock::time_point start;
+
+        // Addresses in attempt order.
+        std::vector<resolved_address> addrs;
+
+        // Index of next address to attempt, used by connect thread only.
+        size_t next;
+
+        // Attempts in flight, used by connect thread only.
+        int inflight;
+
+        // Whether one connection has been established.
+        std::atomic<bool> won;
+    };
+
+    // Connect to host once, hostname is resolved before racing addresses.
+    // Executed by connect thread.
+    // @param attempt   Retries already made for this connection task.
+    void connect(const host_type &h, int attempt);
+
+    // Start connection attempt to the next address of race, executed by
+    // connect thread.
+    void race_next(const std::shared_ptr<race_state> &race);
+
+    // Schedule retry after backoff or give up, executed by connect thread.
+    void on_connect_failed(const host_type &h, int attempt);
+
+    // Notify user and connection pool that connection task failed.
+    void give_up(const host_type &h);
+
     // Event loop.
     event_loop evlp_;
 
@@ -249,10 +523,109 @@ private:
     // Hosts waiting for connecting.
     std::unordered_map<std::tuple<std::string, int, family>, int, host_hash>
         hosts_;
+};
 
-    // Hosts failed in the connect syscall or SO_ERROR check.
-    std::unordered_map<std::tuple<std::string, int, family>, int, host_hash>
-        failures_;
+class CPPEV_PRIVATE connection_pool final
+{
+public:
+    using host_type = std::tuple<std::string, int, family>;
+
+    // Request t new connections to host, executed without holding lock.
+    using connect_request = std::function<void(const host_type &h, int t)>;
+
+    explicit connection_pool(const connect_request &request);
+
+    connection_pool(const connection_pool &) = delete;
+    connection_pool &operator=(const connection_pool &) = delete;
+    connection_pool(connection_pool &&) = delete;
+    connection_pool &operator=(connection_pool &&) = delete;
+
+    ~connection_pool();
+
+    // Create or resize pool of host, connect until min size is reached.
+    void set_limits(const host_type &h, int min_size, int max_size);
+
+    // Handler is triggered by worker thread owning the connection once an
+    // idle one passes health check or a connection is established or
+    // returned, or with nullptr by connect thread when connecting fails.
+    void checkout(const host_type &h, const tcp_event_handler &handler);
+
+    // Return connection to its pool, health checked by worker thread owning
+    // the connection.
+    void checkin(const std::shared_ptr<socktcp> &iopt);
+
+    // Evict broken idle connections by worker threads owning them and
+    // refill pools to min size.
+    void check_idle();
+
+    // Connection established by connector, adopted only if requested by
+    // pool and within its max size.
+    // @return  Whether connection belongs to a pool.
+    bool on_connect(const std::shared_ptr<socktcp> &iopt);
+
+    // Connecting to host failed.
+    void on_connect_failed(const host_type &h);
+
+    // Connection is closed by reactor or user, pool is refilled to min
+    // size and waiters count.
+    void on_closed(const std::shared_ptr<socktcp> &iopt);
+
+private:
+    struct host_pool
+    {
+        // Idle connections to keep.
+        int min_size = 0;
+
+        // Established and connecting connections limit.
+        int max_size = 0;
+
+        // Connections requested but not established.
+        int pending = 0;
+
+        // Connections checked in but not yet returned by worker thread.
+        int returning = 0;
+
+        // Established connections, idle or checked out.
+        std::unordered_set<const socktcp *> members;
+
+        // Idle connections, most recently returned at back.
+        std::deque<std::shared_ptr<socktcp>> idle;
+
+        // Checkout handlers waiting for connection.
+        std::queue<tcp_event_handler> waiters;
+    };
+
+    // Request connections up to min size and waiters count, need lock.
+    int refill_nts(host_pool &hp);
+
+    // Remove connection from pool, need lock.
+    // @return  Connections to request, same as refill_nts.
+    int evict_nts(host_pool &hp, const std::shared_ptr<socktcp> &iopt);
+
+    // Close evicted connection and request replacements, executed by worker
+    // thread owning the connection.
+    void evict(const host_type &h, const std::shared_ptr<socktcp> &iopt,
+               int num);
+
+    // Hand idle connection to checkout handler if healthy, otherwise evict it
+    // and checkout again, executed by worker thread owning the connection.
+    void deliver(const host_type &h, const std::shared_ptr<socktcp> &iopt,
+                 const tcp_event_handler &handler);
+
+    // Return connection to pool, executed by worker thread owning it.
+    void on_checkin(const std::shared_ptr<socktcp> &iopt);
+
+    // Evict idle connection if broken, executed by worker thread owning it.
+    void check_idle(const std::shared_ptr<socktcp> &iopt);
+
+    // Guard pools.
+    std::mutex lock_;
+
+    // Target uri --> pool.
+    std::unordered_map<host_type, host_pool, host_hash> pools_;
+
+    // Connect request to tcp client.
+    connect_request request_;
 };
 
 class CPPEV_INTERNAL tcp_common
@@ -283,6 +656,11 @@ public:
     // @param handler   Handler for the event.
     void set_on_closed(const tcp_event_handler &handler);
 
+    // Set attributes of iohandler threads, shall be called before run.
+    // @param opts      Options of iohandler i are opts[i % opts.size()],
+    //                  spread_physical_cores gives one per physical core.
+    void set_thread_options(const std::vector<thread_options> &opts);
+
 protected:
     template <typename R1>
     void run(std::vector<std::unique_ptr<R1>> &rpv)
@@ -298,23 +676,40 @@ protected:
     template <typename R1>
     void shutdown(std::vector<std::unique_ptr<R1>> &rpv)
     {
+        shutdown_front(rpv);
+        shutdown_workers();
+    }
+
+    // Shutdown acceptors or connectors. All are asked to stop first, then
+    // joined within one shutdown timeout.
+    template <typename R1>
+    void shutdown_front(std::vector<std::unique_ptr<R1>> &rpv)
+    {
+        std::vector<runnable *> thrs;
         for (auto &rp : rpv)
         {
             rp->shutdown();
+            thrs.push_back(rp.get());
         }
-        for (auto &rp : rpv)
-        {
-            rp->join();
-        }
+        join_reporting(
+            thrs,
+            std::chrono::milliseconds(sysconfig::reactor_shutdown_timeout),
+            "tcp front");
+    }
 
+    // Shutdown worker threads, same as above.
+    void shutdown_workers()
+    {
+        std::vector<runnable *> thrs;
         for (auto &thr : tp_)
         {
             thr.shutdown();
+            thrs.push_back(&thr);
         }
-        for (auto &thr : tp_)
-        {
-            thr.join();
-        }
+        join_reporting(
+            thrs,
+            std::chrono::milliseconds(sysconfig::reactor_shutdown_timeout),
+            "iohandler");
     }
 
     // Thread pool shared data.
@@ -324,6 +719,15 @@ protected:
     thread_pool<iohandler, data_storage *> tp_;
 };
 
+// Triggered periodically while draining.
+// @param remaining : connections not finished yet
+using drain_progress_handler = std::function<void(int remaining)>;
+
+// Check process connected for hand over.
+// @param cred : credentials of peer process
+// @return     : whether listening sockets may be handed over to it
+using peer_verifier = std::function<bool(const peer_credentials &cred)>;
+
 class CPPEV_PUBLIC tcp_server final : public tcp_common
 {
 public:
@@ -355,16 +759,65 @@ public:
     // @param remove    Whether remove the socket file when it already exists.
     void listen_unix(const std::string &path, bool remove = false);
 
+    // Enable TCP Fast Open of listening sockets, data in SYN of clients
+    // having cookies is accepted without waiting for the handshake.
+    // Can be called only before listen().
+    // @param qlen      Pending Fast Open connections, 0 means disabled.
+    void set_fastopen(int qlen);
+
+    // Defer accepting connections until their first data arrives, so that
+    // workers are not woken by idle connections (TCP_DEFER_ACCEPT on Linux,
+    // dataready accept filter on BSD).
+    // Can be called only before listen().
+    // @param seconds   Time waiting for data, after which the connection is
+    //                  accepted anyway on Linux, 0 means disabled.
+    void set_defer_accept(int seconds);
+
     // Start server asynchronously.
     void run();
 
     // Shutdown server synchronously, return when all server threads exit.
     void shutdown();
 
+    // Stop accepting, wait for in-flight connections to be closed, then
+    // shutdown server synchronously. Connections remaining after the
+    // deadline are dropped with worker threads.
+    // @param timeout   Drain deadline in milliseconds.
+    // @param handler   Progress handler, triggered every
+    //                  sysconfig::reactor_drain_interval milliseconds.
+    // @return          Whether all connections finished before deadline.
+    bool drain(int timeout, const drain_progress_handler &handler =
+                                drain_progress_handler());
+
+    // Hand listening sockets over to a new process by SCM_RIGHTS, the new
+    // process shall call takeover with the same path. Server keeps
+    // accepting until drain or shutdown is called. Path is accessible only
+    // by owner, peers rejected by verifier are closed and waiting goes on.
+    // Can be called only after run().
+    // @param path      Unix socket path used for hand over.
+    // @param timeout   Time waiting for new process in milliseconds.
+    // @param verifier  Check of peer, default accepts peer of the same
+    //                  effective uid only.
+    // @return          Whether listening sockets are handed over.
+    bool handover(const std::string &path, int timeout = -1,
+                  const peer_verifier &verifier = nullptr);
+
+    // Take over listening sockets from an old process by SCM_RIGHTS.
+    // Can be called only before run().
+    // @param path      Unix socket path used for hand over.
+    // @return          Count of listening sockets taken over.
+    int takeover(const std::string &path);
+
 private:
+    // Create acceptor for the next listening socket.
+    acceptor *next_acceptor();
+
     // Whether use single acceptor for multiple listening socket.
     bool single_acceptor_;
 
+    // Whether acceptors have been shutdown.
+    bool acpts_stopped_;
+
     // Listening threads.
     std::vector<std::unique_ptr<acceptor>> acpts_;
 };
@@ -386,11 +839,59 @@ public:
     // @param handler   Handler for the event.
     void set_on_connect(const tcp_event_handler &handler);
 
-    // Add target uri to connect.
+    // Set handler which will be triggered by connect thread when tcp client
+    // gives up connecting to target uri after retries are exhausted,
+    // attempts rejected by the open circuit of target count as retries.
+    // @param handler   Handler for the event.
+    void set_on_connect_failed(const connect_failed_handler &handler);
+
+    // Set retry policy of targets without their own policy.
+    // Can be called before or after run().
+    // @param policy    Retry policy.
+    void set_retry_policy(const retry_policy &policy);
+
+    // Set retry policy of target uri.
     // Can be called before or after run().
     // @param ip        Opposite host IP.
     // @param port      Opposite port.
     // @param f         TCP socket family, can be IPv4 or IPv6.
+    // @param policy    Retry policy.
+    void set_retry_policy(const std::string &ip, int port, family f,
+                          const retry_policy &policy);
+
+    // Set retry policy of unix socket path.
+    // @param path      TCP Unix socket path to connect.
+    // @param policy    Retry policy.
+    void set_retry_policy_unix(const std::string &path,
+                               const retry_policy &policy);
+
+    // Snapshot of connect accounting of all targets, thread safe. Unix socket
+    // targets are keyed with port -1.
+    std::unordered_map<std::tuple<std::string, int, family>, connect_stats,
+                       host_hash>
+    stats();
+
+    // Replace getaddrinfo used to resolve hostname targets.
+    // @param lookup    Lookup executed by resolver thread.
+    void set_lookup(const lookup_handler &lookup);
+
+    // Enable TCP Fast Open of connections (Linux only), on_connect is
+    // triggered before the handshake completes and the first write is sent
+    // within SYN. Connect failure then surfaces as error of the first write
+    // instead of on_connect_failed, and the first address of a hostname
+    // always wins the happy eyeballs race.
+    // Can be called only before run().
+    // @param enable    Whether enable Fast Open.
+    void set_fastopen(bool enable = true);
+
+    // Add target uri to connect.
+    // Can be called before or after run().
+    // @param ip        Opposite host IP or hostname. Hostname is resolved
+    //                  asynchronously and its IPv6 and IPv4 addresses race
+    //                  with happy eyeballs.
+    // @param port      Opposite port.
+    // @param f         TCP socket family, can be IPv4 or IPv6. Family
+    //                  attempted first for hostname.
     // @param t         Counts of the uri to add.
     void add(const std::string &ip, int port, family f, int t = 1);
 
@@ -400,6 +901,47 @@ public:
     // @param t         Counts of the uri to add.
     void add_unix(const std::string &path, int t = 1);
 
+    // Keep a pool of reusable connections to target uri, connections of the
+    // target are delivered to checkout handlers instead of on_connect.
+    // Can be called before or after run(). Target shall be a literal IP.
+    // @param ip        Opposite host IP.
+    // @param port      Opposite port.
+    // @param f         TCP socket family, can be IPv4 or IPv6.
+    // @param min_size  Connections kept open.
+    // @param max_size  Connections limit.
+    void set_pool(const std::string &ip, int port, family f, int min_size,
+                  int max_size);
+
+    // Keep a pool of reusable connections to unix socket path.
+    // @param path      TCP Unix socket path to connect.
+    // @param min_size  Connections kept open.
+    // @param max_size  Connections limit.
+    void set_pool_unix(const std::string &path, int min_size, int max_size);
+
+    // Checkout a connection from pool, thread safe. Handler is triggered by
+    // worker thread owning the connection, or with nullptr by connect thread
+    // if connect fails.
+    // @param ip        Opposite host IP.
+    // @param port      Opposite port.
+    // @param f         TCP socket family, can be IPv4 or IPv6.
+    // @param handler   Handler receiving the connection.
+    void checkout(const std::string &ip, int port, family f,
+                  const tcp_event_handler &handler);
+
+    // Checkout a connection to unix socket path from pool, thread safe.
+    // @param path      TCP Unix socket path to connect.
+    // @param handler   Handler receiving the connection.
+    void checkout_unix(const std::string &path,
+                       const tcp_event_handler &handler);
+
+    // Return connection to pool for reuse, thread safe.
+    // @param iopt      Connection got by checkout.
+    void checkin(const std::shared_ptr<socktcp> &iopt);
+
+    // Health check idle connections, evict broken ones and reconnect up to
+    // min size, thread safe.
+    void check_idle();
+
     // Start client asynchronously.
     void run();
 
@@ -409,6 +951,15 @@ public:
 private:
     // Connecting threads.
     std::vector<std::unique_ptr<connector>> conts_;
+
+    // Reusable connections.
+    connection_pool pool_;
+
+    // Retry and failure accounting of targets.
+    connect_tracker tracker_;
+
+    // Resolver of hostname targets.
+    resolver dns_;
 };
 
 }  // namespace reactor
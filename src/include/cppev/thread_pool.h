@@ -1,15 +1,22 @@
 #ifndef _cppev_thread_pool_h_6C0224787A17_
 #define _cppev_thread_pool_h_6C0224787A17_
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <type_traits>
 #include <vector>
 
+#include "cppev/future.h"
 #include "cppev/runnable.h"
+#include "cppev/stop_token.h"
+#include "cppev/unique_function.h"
 #include "cppev/utils.h"
 
 namespace cppev
@@ -31,6 +38,7 @@ public:
         {
             thrs_.push_back(
                 std::make_unique<Runnable>(std::forward<Args>(args)...));
+            thrs_.back()->set_stop_parent(stop_source_.token());
         }
     }
 
@@ -84,6 +92,7 @@ public:
     // Run all threads.
     void run()
     {
+        reset_stop();
         for (auto &thr : thrs_)
         {
             thr->run();
@@ -99,7 +108,32 @@ public:
         }
     }
 
-    // Cancel all threads.
+    // Ask all threads to stop, without waiting.
+    void request_stop()
+    {
+        stop_source_.request_stop();
+    }
+
+    // Token stopped by request_stop, parent of tokens of all threads.
+    stop_token get_stop_token() const noexcept
+    {
+        return stop_source_.token();
+    }
+
+    // Join threads that stop in time, all sharing one deadline.
+    // @param timeout   Time to wait for all threads.
+    // @return          Indexes of threads still running, not joined.
+    std::vector<int> join_for(std::chrono::milliseconds timeout)
+    {
+        std::vector<runnable *> thrs;
+        for (auto &thr : thrs_)
+        {
+            thrs.push_back(thr.get());
+        }
+        return cppev::join_for(thrs, timeout);
+    }
+
+    // Cancel all threads, prefer request_stop.
     virtual void cancel()
     {
         for (auto &thr : thrs_)
@@ -120,6 +154,32 @@ public:
         return *(thrs_[i].get());
     }
 
+    // Set attributes of all threads, applied when they run.
+    // @param opts      Options, non-empty name is suffixed with -index.
+    void set_thread_options(const thread_options &opts)
+    {
+        for (size_t i = 0; i < thrs_.size(); ++i)
+        {
+            thread_options opt = opts;
+            if (!opt.name.empty())
+            {
+                opt.name += "-" + std::to_string(i);
+            }
+            thrs_[i]->set_thread_options(opt);
+        }
+    }
+
+    // Set attributes of each thread, applied when they run.
+    // @param opts      Options of thread i are opts[i % opts.size()], such
+    //                  as given by spread_physical_cores.
+    void set_thread_options(const std::vector<thread_options> &opts)
+    {
+        for (size_t i = 0; i < thrs_.size() && opts.size(); ++i)
+        {
+            thrs_[i]->set_thread_options(opts[i % opts.size()]);
+        }
+    }
+
     // Thread pool size.
     int size() const noexcept
     {
@@ -127,23 +187,258 @@ public:
     }
 
 protected:
+    // Renew stop source stopped by a previous run.
+    void reset_stop()
+    {
+        if (!stop_source_.stop_requested())
+        {
+            return;
+        }
+        stop_source_ = stop_source();
+        for (auto &thr : thrs_)
+        {
+            thr->set_stop_parent(stop_source_.token());
+        }
+    }
+
     container_type thrs_;
+
+    stop_source stop_source_;
+};
+
+// Chase-Lev work stealing deque of pointers. The owner thread pushes and
+// pops at the bottom while other threads steal from the top, only the last
+// element is contended. Arrays replaced by growth are kept until destruction
+// since thieves may still be reading them. Elements are not owned.
+template <typename T>
+class CPPEV_PRIVATE work_stealing_deque final
+{
+public:
+    explicit work_stealing_deque(int64_t capacity = 256)
+        : top_(0), bottom_(0)
+    {
+        arrays_.push_back(std::make_unique<ring>(capacity));
+        array_.store(arrays_.back().get(), std::memory_order_relaxed);
+    }
+
+    work_stealing_deque(const work_stealing_deque &) = delete;
+    work_stealing_deque &operator=(const work_stealing_deque &) = delete;
+    work_stealing_deque(work_stealing_deque &&) = delete;
+    work_stealing_deque &operator=(work_stealing_deque &&) = delete;
+
+    ~work_stealing_deque() = default;
+
+    // Push to the bottom, owner only.
+    void push(T *item)
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        ring *a = array_.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1)
+        {
+            arrays_.push_back(std::make_unique<ring>(a->capacity * 2));
+            ring *grown = arrays_.back().get();
+            for (int64_t i = t; i < b; ++i)
+            {
+                grown->put(i, a->get(i));
+            }
+            a = grown;
+            array_.store(a, std::memory_order_release);
+        }
+        a->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // Pop from the bottom, owner only.
+    // @return  nullptr if empty.
+    T *pop()
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        ring *a = array_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        if (t > b)
+        {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T *item = a->get(b);
+        if (t == b)
+        {
+            // Last element, race with thieves.
+            if (!top_.compare_exchange_strong(t, t + 1,
+                                              std::memory_order_seq_cst,
+                                              std::memory_order_relaxed))
+            {
+                item = nullptr;
+            }
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // Steal from the top, thread safe.
+    // @return  nullptr if empty or another thread won the element.
+    T *steal()
+    {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b)
+        {
+            return nullptr;
+        }
+        T *item = array_.load(std::memory_order_acquire)->get(t);
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                          std::memory_order_relaxed))
+        {
+            return nullptr;
+        }
+        return item;
+    }
+
+    // Whether deque looks empty, thread safe.
+    bool empty() const noexcept
+    {
+        return bottom_.load(std::memory_order_relaxed) <=
+               top_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct ring
+    {
+        explicit ring(int64_t capacity)
+            : capacity(capacity),
+              slots(std::make_unique<std::atomic<T *>[]>(capacity))
+        {
+        }
+
+        T *get(int64_t i) const noexcept
+        {
+            return slots[i & (capacity - 1)].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t i, T *item) noexcept
+        {
+            slots[i & (capacity - 1)].store(item, std::memory_order_relaxed);
+        }
+
+        // Power of two.
+        int64_t capacity;
+
+        std::unique_ptr<std::atomic<T *>[]> slots;
+    };
+
+    // Thieves and owner contend on top, keep it apart from bottom.
+    alignas(64) std::atomic<int64_t> top_;
+
+    alignas(64) std::atomic<int64_t> bottom_;
+
+    std::atomic<ring *> array_;
+
+    // All the arrays ever used, accessed by owner only.
+    std::vector<std::unique_ptr<ring>> arrays_;
 };
 
 class thread_pool_task_queue;
 
+using thread_pool_task_handler = unique_function<void(void)>;
+
+// What to do with a task taken after its deadline.
+enum class CPPEV_PUBLIC deadline_policy
+{
+    drop,  // Destroy without running.
+    flag,  // Run, thread_pool_task_queue::deadline_missed returns true.
+};
+
+// Metrics of a priority lane of thread_pool_task_queue.
+struct CPPEV_PUBLIC thread_pool_lane_stats
+{
+    // Tasks queued in lane.
+    int64_t depth = 0;
+
+    // Tasks taken from lane, including expired ones.
+    int64_t dequeued = 0;
+
+    // Tasks taken after their deadline.
+    int64_t expired = 0;
+
+    // Sum and maximum of time between queued and taken.
+    std::chrono::nanoseconds total_wait = std::chrono::nanoseconds(0);
+
+    std::chrono::nanoseconds max_wait = std::chrono::nanoseconds(0);
+};
+
 class CPPEV_PRIVATE thread_pool_task_queue_runnable final : public runnable
 {
+    friend class thread_pool_task_queue;
+
 public:
+    // Thread state guarded by grow lock of pool.
+    enum class thread_state
+    {
+        idle,     // Never run or joined.
+        running,  // Running or about to run.
+        exited,   // Retired and not joined yet.
+        joining,  // Being joined by stop.
+    };
+
     thread_pool_task_queue_runnable(thread_pool_task_queue *tptq) noexcept;
 
+    ~thread_pool_task_queue_runnable();
+
     void run_impl() override;
 
 private:
+    // Find task in local deque, then priority lanes, then deques of other
+    // workers starting from a random one.
+    // @param task      Moved to if found.
+    // @param missed    Whether deadline of task is missed.
+    bool next_task(thread_pool_task_handler &task, bool &missed);
+
+    // Slot for a task pushed to the local deque, owner only.
+    thread_pool_task_handler *acquire_slot();
+
+    // Keep empty slot for reuse, owner only.
+    void release_slot(thread_pool_task_handler *slot);
+
     thread_pool_task_queue *tptq_;
+
+    // Slots of tasks added by this worker.
+    work_stealing_deque<thread_pool_task_handler> deque_;
+
+    thread_state state_;
+
+    // Empty slots taken from deques, reused so that spawning tasks does not
+    // allocate once warmed up.
+    std::vector<thread_pool_task_handler *> spare_;
+
+    // State of victim selection.
+    uint32_t seed_;
+
+    // When local deque last turned non-empty in steady clock nanoseconds,
+    // owner only. Older tasks of deque waited at most this long.
+    int64_t local_since_;
 };
 
-using thread_pool_task_handler = std::function<void(void)>;
+// Work stealing executor. Each worker owns a Chase-Lev deque where tasks
+// added by the worker itself are pushed, tasks added by other threads or
+// with a priority go to the priority lanes. Idle workers steal from each
+// other and park when nothing is found, adding a task wakes at most one
+// parked worker.
+//
+// Lanes are p0 to p6 of priority, taken by smooth weighted round robin so
+// that lower lanes still progress. Tasks added without priority by other
+// threads go to p0.
+//
+// Elastic pool starts min workers. A worker is spawned when a task waited
+// longer than the spawn threshold while no worker was parked, a worker
+// parked longer than the idle timeout retires. Wait is measured when tasks
+// are taken from lanes, and when tasks are added to lanes or to a local
+// deque that stayed non-empty. Workers inside blocking
+// sections are compensated with up to max extra workers.
 
 class CPPEV_PUBLIC thread_pool_task_queue final
     : private thread_pool<thread_pool_task_queue_runnable,
@@ -155,35 +450,231 @@ class CPPEV_PUBLIC thread_pool_task_queue final
         thread_pool<thread_pool_task_queue_runnable, thread_pool_task_queue *>;
 
 public:
+    // Fixed pool.
+    // @param thr_num       Number of workers.
     thread_pool_task_queue(int thr_num);
 
+    // Elastic pool.
+    // @param min_thr_num   Workers kept, at least 1.
+    // @param max_thr_num   Workers not blocking at most, at least min.
+    // @param spawn_wait    Queue wait spawning a worker.
+    // @param idle_timeout  Park time retiring a worker.
+    thread_pool_task_queue(
+        int min_thr_num, int max_thr_num,
+        std::chrono::milliseconds spawn_wait = std::chrono::milliseconds(5),
+        std::chrono::milliseconds idle_timeout = std::chrono::seconds(10));
+
     thread_pool_task_queue(const thread_pool_task_queue &) = delete;
     thread_pool_task_queue &operator=(const thread_pool_task_queue &) = delete;
     thread_pool_task_queue(thread_pool_task_queue &&) = delete;
     thread_pool_task_queue &operator=(thread_pool_task_queue &&) = delete;
 
+    // Stop workers still running, as stop does.
     ~thread_pool_task_queue();
 
-    using thread_pool_base_type::run;
+    // Run workers, min ones for elastic pool.
+    void run();
 
-    using thread_pool_base_type::size;
+    // Number of workers running.
+    int size() const noexcept;
 
-    void add_task(const thread_pool_task_handler &h) noexcept;
+    // Options apply to workers spawned later by elastic pool as well.
+    using thread_pool_base_type::set_thread_options;
+
+    // Stop token shared by workers, long tasks observing it return early
+    // once request_stop is called. Queued tasks still run until stop.
+    using thread_pool_base_type::get_stop_token;
+    using thread_pool_base_type::request_stop;
 
     void add_task(thread_pool_task_handler &&h) noexcept;
 
-    void add_task(const std::vector<thread_pool_task_handler> &vh) noexcept;
+    // Add tasks in batch, moved from.
+    // @param tasks     First task.
+    // @param num       Number of tasks.
+    void add_task(thread_pool_task_handler *tasks, size_t num) noexcept;
+
+    void add_task(std::vector<thread_pool_task_handler> &&vh) noexcept;
+
+    // Add task to priority lane, even if called by a worker.
+    // @param h         Task.
+    // @param prio      Lane, highest and lowest are clamped to p0 and p6.
+    void add_task(thread_pool_task_handler &&h, priority prio) noexcept;
+
+    // Same as above, task taken after deadline is handled by policy.
+    void add_task(thread_pool_task_handler &&h, priority prio,
+                  std::chrono::steady_clock::time_point deadline,
+                  deadline_policy policy = deadline_policy::drop) noexcept;
+
+    // Add tasks to priority lane in batch, moved from.
+    void add_task(thread_pool_task_handler *tasks, size_t num,
+                  priority prio) noexcept;
+
+    // Set weight of lane, lanes default to 64 for p0 halving down to 1 for
+    // p6.
+    // @param prio      Lane.
+    // @param weight    Share of lane relative to others, at least 1.
+    void set_lane_weight(priority prio, int weight) noexcept;
+
+    // Metrics of lane.
+    thread_pool_lane_stats lane_stats(priority prio) const noexcept;
+
+    // Whether the running task was taken after its deadline, called in task.
+    static bool deadline_missed() noexcept;
+
+    // Hint that the running task is going to block, so that elastic pool
+    // spawns a worker for queued tasks. No-op if not called in task.
+    static void enter_blocking() noexcept;
+
+    // Hint that the running task finished blocking.
+    static void leave_blocking() noexcept;
+
+    // Run one queued task on the calling thread, so that a thread waiting
+    // for tasks helps instead of blocking a worker. A worker takes from its
+    // own deque first, other threads take from lanes then steal.
+    // @return  Whether a task is run.
+    bool run_pending_task();
+
+    // Run f on a worker.
+    // @param f         Callable without arguments.
+    // @return          Future of the result of f, continuations attached by
+    //                  then are run by the worker completing it.
+    template <typename F>
+    future<std::invoke_result_t<std::decay_t<F>>> submit(F &&f)
+    {
+        return submit(std::forward<F>(f), cancellation_token());
+    }
+
+    // Same as above, f is skipped with cancelled_error if token is cancelled
+    // before a worker takes it.
+    template <typename F>
+    future<std::invoke_result_t<std::decay_t<F>>> submit(
+        F &&f, const cancellation_token &token)
+    {
+        using R = std::invoke_result_t<std::decay_t<F>>;
+        auto state = std::make_shared<future_state<R>>();
+        add_task(
+            [state, token, f = std::decay_t<F>(std::forward<F>(f))]() mutable
+            {
+                if (token.is_cancelled())
+                {
+                    state->set_exception(
+                        std::make_exception_ptr(cancelled_error()));
+                    return;
+                }
+                future_fulfil(state, f);
+            });
+        return future<R>(state);
+    }
 
+    // Run the remaining tasks and stop workers, return when they exit.
     void stop() noexcept;
 
 private:
-    std::queue<thread_pool_task_handler> queue_;
+    using time_point = std::chrono::steady_clock::time_point;
 
-    std::mutex lock_;
+    struct lane_task
+    {
+        thread_pool_task_handler task;
+
+        time_point queued;
+
+        // time_point::max() if none.
+        time_point deadline;
+
+        deadline_policy policy;
+    };
+
+    struct lane
+    {
+        std::deque<lane_task> tasks;
+
+        int weight;
+
+        // Credit of smooth weighted round robin.
+        int64_t credit;
+
+        thread_pool_lane_stats stats;
+    };
+
+    static const int lane_num = 7;
+
+    static int lane_index(priority prio) noexcept;
+
+    // Move tasks to deque of current worker, or p0 lane if called by other
+    // threads, then wake parked workers.
+    void push(thread_pool_task_handler *tasks, size_t num);
+
+    // Move tasks to lane, then wake parked workers.
+    void push_lane(thread_pool_task_handler *tasks, size_t num, int index,
+                   time_point deadline, deadline_policy policy);
+
+    // Take task from lanes by weight, expired tasks to drop are moved to
+    // dropped.
+    // @param wait  Queue wait of the task taken.
+    // @return      Whether task is taken.
+    bool pop_lane(thread_pool_task_handler &task, bool &missed,
+                  std::chrono::nanoseconds &wait,
+                  std::vector<thread_pool_task_handler> &dropped);
+
+    // Spawn a worker if task waited too long while no worker is parked,
+    // at most once per spawn threshold, or if all workers are blocked.
+    void grow_if_starving(std::chrono::nanoseconds wait);
+
+    // Spawn a worker in an idle slot if below limit.
+    // @return  Whether spawned.
+    bool grow();
+
+    // Retire worker if above min and nothing is pending.
+    // @return  Whether worker shall exit.
+    bool retire(thread_pool_task_queue_runnable *worker);
+
+    // Wake at most num parked workers.
+    void wake(int64_t num);
+
+    // Take task from lanes or deques of workers, for other threads.
+    bool take_task(thread_pool_task_handler &task, bool &missed);
+
+    // Priority lanes, from p0 to p6.
+    std::array<lane, lane_num> lanes_;
+
+    // Tasks in lanes, checked before locking them.
+    std::atomic<int64_t> injected_;
+
+    mutable std::mutex lock_;
+
+    // Tasks queued and not yet taken by a worker.
+    std::atomic<int64_t> pending_;
+
+    // Workers parked or about to park.
+    std::atomic<int> sleepers_;
+
+    std::mutex park_lock_;
 
     std::condition_variable cond_;
 
-    bool stop_;
+    std::atomic<bool> stop_;
+
+    const bool elastic_;
+
+    const int min_thr_num_;
+
+    const int max_thr_num_;
+
+    const std::chrono::milliseconds spawn_wait_;
+
+    const std::chrono::milliseconds idle_timeout_;
+
+    // Workers running.
+    std::atomic<int> workers_;
+
+    // Workers inside blocking sections.
+    std::atomic<int> blocking_;
+
+    // Time of last spawn in steady clock nanoseconds.
+    std::atomic<int64_t> last_spawn_;
+
+    // Guards thread state of workers.
+    std::mutex grow_lock_;
 };
 
 }  // namespace cppev
@@ -0,0 +1,264 @@
+#ifndef _cppev_udp_h_6C0224787A17_
+#define _cppev_udp_h_6C0224787A17_
+
+#include <signal.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "cppev/common.h"
+#include "cppev/event_loop.h"
+#include "cppev/io.h"
+#include "cppev/runnable.h"
+#include "cppev/thread_pool.h"
+
+/*
+    Each worker thread owns an event loop and one SO_REUSEPORT socket of
+    every listening port, so the kernel spreads datagrams across workers
+    and no socket is shared between threads. Datagrams are received in
+    batches, and replies are queued in the send queue of the socket which
+    is flushed after each batch and on writable.
+ */
+
+namespace cppev
+{
+
+namespace reactor
+{
+
+// Callback of received datagram, payload is only valid during the callback.
+using udp_datagram_handler =
+    std::function<void(const std::shared_ptr<sockudp> &sock,
+                       std::string_view payload, const endpoint &peer)>;
+
+// Queue datagram to peer, shall be called by the worker thread owning the
+// socket, such as in on_datagram.
+// @param sock      Socket owned by udp_server or udp_client.
+// @param ptr       Payload.
+// @param len       Payload length.
+// @param peer      Destination address.
+// @return          False if send queue is full and datagram is dropped.
+CPPEV_PUBLIC bool async_send(const std::shared_ptr<sockudp> &sock,
+                             const char *ptr, int len, const endpoint &peer);
+
+// Get external data of udp server and client.
+CPPEV_PUBLIC void *external_data(const std::shared_ptr<sockudp> &sock);
+
+struct CPPEV_PRIVATE udp_storage final
+{
+    explicit udp_storage(void *external_data_ptr);
+
+    udp_storage(const udp_storage &) = delete;
+    udp_storage &operator=(const udp_storage &) = delete;
+    udp_storage(udp_storage &&) = delete;
+    udp_storage &operator=(udp_storage &&) = delete;
+
+    ~udp_storage();
+
+    // Executed by worker thread.
+    udp_datagram_handler on_datagram;
+
+    // Datagrams dropped since send queue is full or sending failed.
+    std::atomic<uint64_t> dropped;
+
+    void *external_data_ptr;
+};
+
+class CPPEV_PRIVATE udp_worker final : public runnable
+{
+public:
+    explicit udp_worker(udp_storage *data);
+
+    udp_worker(const udp_worker &) = delete;
+    udp_worker &operator=(const udp_worker &) = delete;
+    udp_worker(udp_worker &&) = delete;
+    udp_worker &operator=(udp_worker &&) = delete;
+
+    ~udp_worker();
+
+    // Socket is readable, receive datagrams in batches and dispatch them.
+    static void on_readable(const std::shared_ptr<io> &iop);
+
+    // Socket is writable, flush send queue.
+    static void on_writable(const std::shared_ptr<io> &iop);
+
+    // Add listening socket, should be called before subthread runs.
+    void add(const std::shared_ptr<sockudp> &sock);
+
+    // Queue datagram, should be called by worker thread. Send queues
+    // touched while dispatching a batch are flushed after the batch.
+    bool send(const std::shared_ptr<sockudp> &sock, const char *ptr, int len,
+              const endpoint &peer);
+
+    // Queue datagram from any thread, sent by ephemeral socket of the family
+    // of peer.
+    void post_send(std::string data, const endpoint &peer);
+
+    // Get event loop.
+    event_loop &evlp();
+
+    // Register sockets and start loop.
+    void run_without_exception_handling();
+
+    // Run with exception handling.
+    void run_impl() override;
+
+    // Ask event loop to stop, without waiting for thread.
+    void shutdown();
+
+private:
+    // Send queue of a socket.
+    struct outbox
+    {
+        explicit outbox(const std::shared_ptr<sockudp> &sock);
+
+        std::shared_ptr<sockudp> sock;
+
+        datagram_ring ring;
+
+        // First datagram not sent yet.
+        int start;
+
+        // Whether writable event is activated.
+        bool waiting;
+
+        // Whether queued in dirty list.
+        bool dirty;
+    };
+
+    struct posted_datagram
+    {
+        std::string data;
+
+        endpoint peer;
+    };
+
+    // Register socket to event loop.
+    void attach(const std::shared_ptr<sockudp> &sock);
+
+    // Socket of family created on demand, used by client.
+    const std::shared_ptr<sockudp> &ephemeral(family f);
+
+    // Send datagrams posted by other threads.
+    void drain_posted();
+
+    // Send queued datagrams until kernel buffer is full.
+    void flush(outbox &box);
+
+    // Flush send queues touched by the batch.
+    void flush_dirty();
+
+    event_loop evlp_;
+
+    // Receive ring shared by all the sockets of worker.
+    datagram_ring in_;
+
+    std::vector<std::shared_ptr<sockudp>> socks_;
+
+    // Ephemeral sockets of ipv4 and ipv6.
+    std::shared_ptr<sockudp> ephemeral_[2];
+
+    // Send queues indexed by fd.
+    std::unordered_map<int, std::unique_ptr<outbox>> outboxes_;
+
+    // Whether a batch is being dispatched.
+    bool dispatching_;
+
+    std::vector<outbox *> dirty_;
+
+    std::mutex lock_;
+
+    // Datagrams posted by other threads.
+    std::vector<posted_datagram> posted_;
+};
+
+class CPPEV_PUBLIC udp_common
+{
+public:
+    udp_common(int thr_num, void *external_data);
+
+    udp_common(const udp_common &) = delete;
+    udp_common &operator=(const udp_common &) = delete;
+    udp_common(udp_common &&) = delete;
+    udp_common &operator=(udp_common &&) = delete;
+
+    virtual ~udp_common();
+
+    // Set handler which will be triggered when datagram is received.
+    // @param handler   Handler for the event.
+    void set_on_datagram(const udp_datagram_handler &handler);
+
+    // Start worker threads.
+    void run();
+
+    // Stop worker threads.
+    void shutdown();
+
+    // Datagrams dropped since send queue is full or sending failed.
+    uint64_t dropped() const noexcept;
+
+protected:
+    // Thread pool shared data.
+    udp_storage data_;
+
+    // Worker threads.
+    thread_pool<udp_worker, udp_storage *> tp_;
+};
+
+class CPPEV_PUBLIC udp_server final : public udp_common
+{
+public:
+    // Construct udp server.
+    // @param thr_num           Worker threads, each owns one socket of every
+    //                          listening port.
+    // @param external_data     External data of server.
+    explicit udp_server(int thr_num, void *external_data = nullptr);
+
+    ~udp_server();
+
+    // Listen on port, should be called before run.
+    // @param port              Port.
+    // @param f                 Family, ipv4 or ipv6.
+    // @param ip                Address bound, nullptr means any address.
+    // @param peer_affinity     Deliver datagrams of one peer address to the
+    //                          same worker regardless of source port, by
+    //                          attaching reuseport BPF program (Linux only).
+    void listen(int port, family f, const char *ip = nullptr,
+                bool peer_affinity = false);
+};
+
+class CPPEV_PUBLIC udp_client final : public udp_common
+{
+public:
+    // Construct udp client, each worker sends from its own ephemeral socket
+    // and receives replies on it.
+    // @param thr_num           Worker threads.
+    // @param external_data     External data of client.
+    explicit udp_client(int thr_num, void *external_data = nullptr);
+
+    ~udp_client();
+
+    // Send datagram, thread safe. Datagrams to one destination are always
+    // sent by the same worker so that their order is kept.
+    // @param ptr       Payload.
+    // @param len       Payload length.
+    // @param peer      Destination, ipv4 or ipv6.
+    void send(const char *ptr, int len, const endpoint &peer);
+
+    // Same as above, destination is parsed on every call.
+    void send(const char *ptr, int len, const char *ip, int port, family f);
+};
+
+}  // namespace reactor
+
+}  // namespace cppev
+
+#endif  // udp.h
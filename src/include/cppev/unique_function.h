@@ -0,0 +1,249 @@
+#ifndef _cppev_unique_function_h_6C0224787A17_
+#define _cppev_unique_function_h_6C0224787A17_
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "cppev/common.h"
+
+namespace cppev
+{
+
+template <typename Signature, size_t Capacity = 64>
+class unique_function;
+
+// Move-only replacement of std::function. Callables up to Capacity bytes
+// that are nothrow move constructible are stored inline, larger ones are
+// allocated on heap. Being move-only, callables capturing unique_ptr or
+// future are accepted and never copied.
+template <typename R, typename... Args, size_t Capacity>
+class CPPEV_PUBLIC unique_function<R(Args...), Capacity> final
+{
+    static_assert(Capacity >= sizeof(void *), "Capacity too small");
+
+    template <typename F>
+    using is_callable = std::conjunction<
+        std::negation<std::is_same<std::decay_t<F>, unique_function>>,
+        std::is_invocable_r<R, std::decay_t<F> &, Args...>>;
+
+public:
+    unique_function() noexcept : vtable_(nullptr)
+    {
+    }
+
+    unique_function(std::nullptr_t) noexcept : vtable_(nullptr)
+    {
+    }
+
+    // Empty if f is a null function pointer or an empty std::function.
+    template <typename F, typename = std::enable_if_t<is_callable<F>::value>>
+    unique_function(F &&f) : vtable_(nullptr)
+    {
+        using T = std::decay_t<F>;
+        if (is_null(f))
+        {
+            return;
+        }
+        if constexpr (is_inline<T>())
+        {
+            new (&storage_) T(std::forward<F>(f));
+            vtable_ = &inline_vtable<T>;
+        }
+        else
+        {
+            *reinterpret_cast<T **>(&storage_) = new T(std::forward<F>(f));
+            vtable_ = &heap_vtable<T>;
+        }
+    }
+
+    unique_function(const unique_function &) = delete;
+    unique_function &operator=(const unique_function &) = delete;
+
+    unique_function(unique_function &&other) noexcept : vtable_(other.vtable_)
+    {
+        if (vtable_)
+        {
+            vtable_->move(&other.storage_, &storage_);
+            other.vtable_ = nullptr;
+        }
+    }
+
+    unique_function &operator=(unique_function &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            if (other.vtable_)
+            {
+                other.vtable_->move(&other.storage_, &storage_);
+                vtable_ = other.vtable_;
+                other.vtable_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    unique_function &operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    template <typename F, typename = std::enable_if_t<is_callable<F>::value>>
+    unique_function &operator=(F &&f)
+    {
+        return *this = unique_function(std::forward<F>(f));
+    }
+
+    ~unique_function()
+    {
+        reset();
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return vtable_ != nullptr;
+    }
+
+    // Throw std::bad_function_call if empty.
+    R operator()(Args... args)
+    {
+        if (vtable_ == nullptr)
+        {
+            throw std::bad_function_call();
+        }
+        return vtable_->invoke(&storage_, std::forward<Args>(args)...);
+    }
+
+private:
+    struct vtable
+    {
+        R (*invoke)(void *storage, Args &&...args);
+
+        // Move callable from src to uninitialized dst, src is left empty.
+        void (*move)(void *src, void *dst) noexcept;
+
+        void (*destroy)(void *storage) noexcept;
+    };
+
+    template <typename T>
+    static constexpr bool is_inline()
+    {
+        return sizeof(T) <= Capacity &&
+               alignof(T) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible<T>::value;
+    }
+
+    template <typename T>
+    static bool is_null(const T &f) noexcept
+    {
+        if constexpr (std::is_pointer<T>::value ||
+                      std::is_member_pointer<T>::value)
+        {
+            return f == nullptr;
+        }
+        else if constexpr (std::is_constructible<bool, const T &>::value &&
+                           !std::is_class<T>::value)
+        {
+            return !f;
+        }
+        else
+        {
+            return is_empty_function(&f);
+        }
+    }
+
+    template <typename Sig>
+    static bool is_empty_function(const std::function<Sig> *f) noexcept
+    {
+        return !*f;
+    }
+
+    static bool is_empty_function(const void *) noexcept
+    {
+        return false;
+    }
+
+    template <typename T>
+    static R invoke_inline(void *storage, Args &&...args)
+    {
+        // Result is discarded for void signature, as std::function does.
+        if constexpr (std::is_void_v<R>)
+        {
+            std::invoke(*static_cast<T *>(storage),
+                        std::forward<Args>(args)...);
+        }
+        else
+        {
+            return std::invoke(*static_cast<T *>(storage),
+                               std::forward<Args>(args)...);
+        }
+    }
+
+    template <typename T>
+    static void move_inline(void *src, void *dst) noexcept
+    {
+        new (dst) T(std::move(*static_cast<T *>(src)));
+        static_cast<T *>(src)->~T();
+    }
+
+    template <typename T>
+    static void destroy_inline(void *storage) noexcept
+    {
+        static_cast<T *>(storage)->~T();
+    }
+
+    template <typename T>
+    static R invoke_heap(void *storage, Args &&...args)
+    {
+        if constexpr (std::is_void_v<R>)
+        {
+            std::invoke(**static_cast<T **>(storage),
+                        std::forward<Args>(args)...);
+        }
+        else
+        {
+            return std::invoke(**static_cast<T **>(storage),
+                               std::forward<Args>(args)...);
+        }
+    }
+
+    static void move_heap(void *src, void *dst) noexcept
+    {
+        *static_cast<void **>(dst) = *static_cast<void **>(src);
+    }
+
+    template <typename T>
+    static void destroy_heap(void *storage) noexcept
+    {
+        delete *static_cast<T **>(storage);
+    }
+
+    template <typename T>
+    static constexpr vtable inline_vtable = {
+        &invoke_inline<T>, &move_inline<T>, &destroy_inline<T>};
+
+    template <typename T>
+    static constexpr vtable heap_vtable = {&invoke_heap<T>, &move_heap,
+                                           &destroy_heap<T>};
+
+    void reset() noexcept
+    {
+        if (vtable_)
+        {
+            vtable_->destroy(&storage_);
+            vtable_ = nullptr;
+        }
+    }
+
+    const vtable *vtable_;
+
+    alignas(std::max_align_t) unsigned char storage_[Capacity];
+};
+
+}  // namespace cppev
+
+#endif  // unique_function.h
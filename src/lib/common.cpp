@@ -15,5 +15,38 @@ namespace cppev
 
         // reactor关闭的超时时间，单位毫秒
         int reactor_shutdown_timeout = 5000;
+
+        // reactor排空连接时报告进度的间隔，单位毫秒
+        int reactor_drain_interval = 100;
+
+        // reactor 的连接是否使用边缘触发：写事件在连接生命周期内只注册一次，读写都排空至 EAGAIN
+        bool reactor_edge_trigger = true;
+
+        // reactor 一次可读事件最多读取的字节数，超出后该连接让出事件循环，边缘触发时排队到本轮末尾继续读取
+        int reactor_read_budget = 262144;
+
+        // 域名解析结果的缓存时间，单位毫秒
+        int resolver_cache_ttl = 30000;
+
+        // happy eyeballs 发起下一个地址连接前的等待时间，单位毫秒
+        int connection_attempt_delay = 250;
+
+        // 文件缓存的容量，单位MB
+        int file_cache_capacity = 256;
+
+        // 文件缓存命中时重新检查文件是否变更的间隔，单位毫秒
+        int file_cache_revalidate = 1000;
+
+        // 使用 MSG_ZEROCOPY 发送的最小数据量，单位字节，更小的数据拷贝开销低于页锁定与完成通知
+        int zerocopy_threshold = 16384;
+
+        // 关闭后仍等待零拷贝完成通知的连接，后台回收的检查间隔，单位毫秒
+        int zerocopy_reap_interval = 10;
+
+        // udp reactor 一次系统调用批量接收的数据报数量
+        int udp_batch_size = 32;
+
+        // udp reactor 每个 socket 发送队列可容纳的数据报数量，队列满时丢弃
+        int udp_send_queue = 256;
     } // namespace sysconfig
 } // namespace cppev
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "cppev/event_loop.h"
 
+#include <algorithm>
+
 namespace cppev
 {
 // 位运算符重载实现
@@ -49,12 +51,30 @@ const fd_event_mode event_loop::fd_event_mode_default_ =
     fd_event_mode::level_trigger;
 
 event_loop::event_loop(void *data, void *owner)
-    : data_(data), owner_(owner), stop_(false)
+    : data_(data), owner_(owner), stop_(false), wakeup_pending_(false)
 {
     // 它调用了操作系统的 API（比如 epoll_create）。
     //它向操作系统申请了一个 “监控之眼”（Epoll 句柄）。
     //有了这个句柄，这个“项目经理”才有能力同时监控成千上万个连接。
     fd_io_multiplexing_create_nts();
+
+    // 唤醒管道的读端常驻在循环中，其他线程投递任务时写入一个字节，
+    // 使阻塞在 wait 上的循环线程立即返回并执行任务。
+    wakeup_pipes_ = io_factory::get_pipes();
+    fd_event_handler handler = [](const std::shared_ptr<io> &iop)
+    {
+        auto iopr = std::dynamic_pointer_cast<stream>(iop);
+        iopr->read_all();
+        iopr->rbuffer().clear();
+        event_loop &evlp = iop->evlp();
+        std::unique_lock<std::mutex> lock(evlp.lock_);
+        evlp.wakeup_pending_ = false;
+    };
+    auto iopr = std::dynamic_pointer_cast<io>(wakeup_pipes_[0]);
+    fd_register_nts(iopr, fd_event::fd_readable,
+                    std::make_shared<fd_event_handler>(handler),
+                    priority::lowest);
+    fd_io_multiplexing_add_nts(iopr, fd_event::fd_readable);
 }
 
 event_loop::~event_loop() noexcept
@@ -84,7 +104,8 @@ const void *event_loop::owner() const noexcept
 
 int event_loop::ev_loads() const noexcept
 {
-    return fd_event_datas_.size();
+    // 不计入唤醒管道。
+    return fd_event_datas_.size() - 1;
 }
 
 // 设置文件描述符的事件模式（TS）。
@@ -99,8 +120,17 @@ void event_loop::fd_set_mode(const std::shared_ptr<io> &iop,
 void event_loop::fd_register(const std::shared_ptr<io> &iop, fd_event ev_type,
                              const fd_event_handler &handler, priority prio)
 {
+    auto shared_handler = std::make_shared<fd_event_handler>(handler);
     std::unique_lock<std::mutex> lock(lock_);
     // nts防止死锁
+    fd_register_nts(iop, ev_type, shared_handler, prio);
+}
+
+void event_loop::fd_register(const std::shared_ptr<io> &iop, fd_event ev_type,
+                             const std::shared_ptr<fd_event_handler> &handler,
+                             priority prio)
+{
+    std::unique_lock<std::mutex> lock(lock_);
     fd_register_nts(iop, ev_type, handler, prio);
 }
 
@@ -115,6 +145,14 @@ void event_loop::fd_register_and_activate(const std::shared_ptr<io> &iop,
                                           fd_event ev_type,
                                           const fd_event_handler &handler,
                                           priority prio)
+{
+    fd_register_and_activate(iop, ev_type,
+                             std::make_shared<fd_event_handler>(handler), prio);
+}
+
+void event_loop::fd_register_and_activate(
+    const std::shared_ptr<io> &iop, fd_event ev_type,
+    const std::shared_ptr<fd_event_handler> &handler, priority prio)
 {
     std::unique_lock<std::mutex> lock(lock_);
     fd_register_nts(iop, ev_type, handler, prio);
@@ -162,6 +200,10 @@ void event_loop::fd_clean(const std::shared_ptr<io> &iop)
 
 void event_loop::loop_once(int timeout)
 {
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        timeout = wait_timeout_nts(timeout);
+    }
     auto fd_events = fd_io_multiplexing_wait_ts(timeout);
     for (const auto &fd_ev_tp : fd_events)
     {
@@ -208,8 +250,93 @@ void event_loop::loop_once(int timeout)
     {
         auto ev = fd_callbacks.top();
         fd_callbacks.pop();
+        // 同一轮中先执行的回调可能已关闭该 fd（边缘触发下读写事件常同时就绪），跳过其余事件。
+        if (std::get<1>(ev)->is_closed())
+        {
+            continue;
+        }
         (*std::get<2>(ev))(std::get<1>(ev));
     }
+
+    run_posted_tasks_ts();
+}
+
+void event_loop::post(loop_task_handler &&task)
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    tasks_.push_back(std::move(task));
+    wakeup_nts();
+}
+
+void event_loop::post_after(int delay, loop_task_handler &&task)
+{
+    auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(delay);
+    std::unique_lock<std::mutex> lock(lock_);
+    // 只有新任务成为最早到期的任务时，才需要唤醒循环重新计算超时时间。
+    bool earliest =
+        timers_.empty() || deadline < std::get<0>(timers_.front());
+    timers_.emplace_back(deadline, std::move(task));
+    std::push_heap(timers_.begin(), timers_.end(),
+                   tuple_greater<timer_type, 0>());
+    if (earliest)
+    {
+        wakeup_nts();
+    }
+}
+
+int event_loop::wait_timeout_nts(int timeout)
+{
+    if (tasks_.size())
+    {
+        return 0;
+    }
+    if (timers_.empty())
+    {
+        return timeout;
+    }
+    auto remain = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      std::get<0>(timers_.front()) -
+                      std::chrono::steady_clock::now())
+                      .count();
+    // 向上取整，避免定时任务尚未到期就提前醒来空转。
+    int delay = remain <= 0 ? 0 : static_cast<int>(remain) + 1;
+    return (timeout < 0 || delay < timeout) ? delay : timeout;
+}
+
+void event_loop::run_posted_tasks_ts()
+{
+    std::vector<loop_task_handler> tasks;
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        tasks.swap(tasks_);
+        auto now = std::chrono::steady_clock::now();
+        while (timers_.size() && std::get<0>(timers_.front()) <= now)
+        {
+            std::pop_heap(timers_.begin(), timers_.end(),
+                          tuple_greater<timer_type, 0>());
+            tasks.push_back(std::move(std::get<1>(timers_.back())));
+            timers_.pop_back();
+        }
+    }
+    // 在锁外执行任务，任务中可以再次投递任务或注册 FD 事件。
+    for (auto &task : tasks)
+    {
+        task();
+    }
+}
+
+void event_loop::wakeup_nts()
+{
+    if (wakeup_pending_)
+    {
+        return;
+    }
+    wakeup_pending_ = true;
+    wakeup_pipes_[1]->wbuffer().put_string("w", 1);
+    wakeup_pipes_[1]->write_all();
+    // 管道写满时数据留在缓冲区中，管道中已有数据，循环同样会被唤醒。
+    wakeup_pipes_[1]->wbuffer().clear();
 }
 
 bool event_loop::stop_loop_ts_wl(waiter_type waiter)
@@ -261,22 +388,45 @@ bool event_loop::stop_loop(int timeout)
 
 void event_loop::loop_forever(int timeout)
 {
-    stop_ = false;
-    while (!stop_)
+    stop_token token;
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        stop_ = false;
+        token = stop_token_;
+    }
+    // 令牌可能在进入循环前已经停止，此时回调设置的 stop_ 已被上面覆盖。
+    while (!stop_ && !token.stop_requested())
     {
         loop_once(timeout);
     }
 }
 
-void event_loop::fd_register_nts(const std::shared_ptr<io> &iop,
-                                 fd_event ev_type,
-                                 const fd_event_handler &handler, priority prio)
+void event_loop::set_stop_token(const stop_token &token)
+{
+    // 先注销旧回调，其析构会等待正在其他线程中执行的回调结束。
+    stop_callback_.reset();
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        stop_token_ = token;
+    }
+    stop_callback_ = std::make_unique<stop_callback>(
+        token,
+        [this]
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            stop_ = true;
+            cond_.notify_all();
+            wakeup_nts();
+        });
+}
+
+void event_loop::fd_register_nts(
+    const std::shared_ptr<io> &iop, fd_event ev_type,
+    const std::shared_ptr<fd_event_handler> &handler, priority prio)
 {
     iop->set_evlp(this);
     auto fd_ev_tp = std::make_tuple(iop->fd(), ev_type);
-    fd_event_datas_.emplace(
-        fd_ev_tp, std::make_tuple(prio, iop,
-                                  std::make_shared<fd_event_handler>(handler)));
+    fd_event_datas_.emplace(fd_ev_tp, std::make_tuple(prio, iop, handler));
     if (!fd_event_modes_.count(iop->fd()))
     {
         fd_event_modes_[iop->fd()] = fd_event_mode_default_;
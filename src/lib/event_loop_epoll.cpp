@@ -155,6 +155,17 @@ std::vector<std::tuple<int, fd_event>> event_loop::fd_io_multiplexing_wait_ts(
         int fd = evs[i].data.fd;
         bool succeed = false;
         fd_event ev = fd_event_map_sys_to_wrapper(evs[i].events);
+        // Error without readiness, such as zero copy completion queued in
+        // error queue, is reported to activated events so that handlers
+        // could consume it instead of being woken up forever.
+        if (!static_cast<bool>(ev) && (evs[i].events & (EPOLLERR | EPOLLHUP)))
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            if (fd_event_masks_.count(fd))
+            {
+                ev = fd_event_masks_[fd];
+            }
+        }
         for (auto event : {fd_event::fd_readable, fd_event::fd_writable})
         {
             if (static_cast<bool>(ev & event))
@@ -0,0 +1,313 @@
+#include "cppev/file_cache.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "cppev/logger.h"
+#include "cppev/utils.h"
+
+namespace cppev
+{
+
+static struct timespec mtime_of(const struct stat &st)
+{
+#ifdef __APPLE__
+    return st.st_mtimespec;
+#else
+    return st.st_mtim;
+#endif
+}
+
+mapped_file::mapped_file(const std::string &path)
+    : path_(path), fd_(-1), data_(nullptr), size_(0)
+{
+    fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ == -1)
+    {
+        throw_system_error("open error for ", path);
+    }
+    struct stat st;
+    if (fstat(fd_, &st) == -1)
+    {
+        close(fd_);
+        throw_system_error("fstat error for ", path);
+    }
+    if (!S_ISREG(st.st_mode))
+    {
+        close(fd_);
+        throw_runtime_error("not regular file : ", path);
+    }
+    size_ = st.st_size;
+    dev_ = st.st_dev;
+    ino_ = st.st_ino;
+    mtime_ = mtime_of(st);
+    // Mapping of empty file is rejected by mmap.
+    if (size_ != 0)
+    {
+        void *ptr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+        if (ptr == MAP_FAILED)
+        {
+            close(fd_);
+            throw_system_error("mmap error for ", path);
+        }
+        data_ = static_cast<const char *>(ptr);
+    }
+}
+
+mapped_file::~mapped_file()
+{
+    if (data_ != nullptr)
+    {
+        munmap(const_cast<char *>(data_), size_);
+    }
+    close(fd_);
+}
+
+const char *mapped_file::data() const noexcept
+{
+    return data_;
+}
+
+size_t mapped_file::size() const noexcept
+{
+    return size_;
+}
+
+int mapped_file::fd() const noexcept
+{
+    return fd_;
+}
+
+const std::string &mapped_file::path() const noexcept
+{
+    return path_;
+}
+
+bool mapped_file::is_stale() const
+{
+    struct stat st;
+    if (stat(path_.c_str(), &st) == -1)
+    {
+        return true;
+    }
+    struct timespec mtime = mtime_of(st);
+    return st.st_dev != dev_ || st.st_ino != ino_ ||
+           static_cast<size_t>(st.st_size) != size_ ||
+           mtime.tv_sec != mtime_.tv_sec || mtime.tv_nsec != mtime_.tv_nsec;
+}
+
+file_cache::file_cache(size_t capacity, int shards, int thr_num,
+                       int revalidate)
+    : shard_capacity_(capacity / std::max(shards, 1)),
+      revalidate_(revalidate),
+      bytes_(0),
+      count_(0),
+      running_(false),
+      tp_(thr_num)
+{
+    for (int i = 0; i < std::max(shards, 1); ++i)
+    {
+        shards_.push_back(std::make_unique<shard>());
+        shards_.back()->hand = shards_.back()->ring.end();
+    }
+}
+
+file_cache::~file_cache()
+{
+    if (running_)
+    {
+        tp_.stop();
+    }
+}
+
+file_view file_cache::lookup(const std::string &path)
+{
+    shard &s = shard_of(path);
+    file_view file;
+    {
+        std::shared_lock<std::shared_mutex> lock(s.lock);
+        auto iter = s.entries.find(path);
+        if (iter == s.entries.end())
+        {
+            return nullptr;
+        }
+        entry *e = iter->second.get();
+        e->referenced.store(true, std::memory_order_relaxed);
+        file = e->file;
+        if (revalidate_ < 0)
+        {
+            return file;
+        }
+        int64_t now = now_ms();
+        int64_t checked = e->checked.load(std::memory_order_relaxed);
+        // Only one of the concurrent readers performs the check.
+        if (now - checked < revalidate_ ||
+            !e->checked.compare_exchange_strong(checked, now))
+        {
+            return file;
+        }
+    }
+    if (!file->is_stale())
+    {
+        return file;
+    }
+    std::unique_lock<std::shared_mutex> lock(s.lock);
+    auto iter = s.entries.find(path);
+    if (iter != s.entries.end() && iter->second->file == file)
+    {
+        erase_nts(s, path);
+    }
+    return nullptr;
+}
+
+void file_cache::get(const std::string &path, const file_load_handler &handler)
+{
+    file_view file = lookup(path);
+    if (file)
+    {
+        handler(file);
+        return;
+    }
+    shard &s = shard_of(path);
+    {
+        std::unique_lock<std::shared_mutex> lock(s.lock);
+        // Loaded by others after lookup.
+        auto iter = s.entries.find(path);
+        if (iter != s.entries.end())
+        {
+            file = iter->second->file;
+            lock.unlock();
+            handler(file);
+            return;
+        }
+        auto &waiters = s.pending[path];
+        waiters.push_back(handler);
+        if (waiters.size() > 1)
+        {
+            return;
+        }
+    }
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        if (!running_)
+        {
+            tp_.run();
+            running_ = true;
+        }
+    }
+    tp_.add_task([this, path] { load(path); });
+}
+
+void file_cache::invalidate(const std::string &path)
+{
+    shard &s = shard_of(path);
+    std::unique_lock<std::shared_mutex> lock(s.lock);
+    erase_nts(s, path);
+}
+
+size_t file_cache::size() const noexcept
+{
+    return bytes_.load();
+}
+
+size_t file_cache::count() const noexcept
+{
+    return count_.load();
+}
+
+file_cache::shard &file_cache::shard_of(const std::string &path)
+{
+    return *shards_[std::hash<std::string>()(path) % shards_.size()];
+}
+
+void file_cache::load(const std::string &path)
+{
+    file_view file;
+    if (!exception_guard([&] { file = std::make_shared<mapped_file>(path); }))
+    {
+        LOG_WARNING_FMT("Load file %s failed", path.c_str());
+    }
+    shard &s = shard_of(path);
+    std::vector<file_load_handler> waiters;
+    {
+        std::unique_lock<std::shared_mutex> lock(s.lock);
+        // Failures are not cached so that next request retries.
+        if (file)
+        {
+            insert_nts(s, path, file);
+        }
+        s.pending[path].swap(waiters);
+        s.pending.erase(path);
+    }
+    for (const auto &waiter : waiters)
+    {
+        waiter(file);
+    }
+}
+
+void file_cache::insert_nts(shard &s, const std::string &path,
+                            const file_view &file)
+{
+    erase_nts(s, path);
+    // Too large file is handed to waiters without being cached.
+    if (file->size() > shard_capacity_)
+    {
+        return;
+    }
+    while (s.bytes + file->size() > shard_capacity_)
+    {
+        if (s.hand == s.ring.end())
+        {
+            s.hand = s.ring.begin();
+        }
+        entry *e = s.entries[*s.hand].get();
+        if (e->referenced.exchange(false))
+        {
+            ++s.hand;
+            continue;
+        }
+        std::string victim = *s.hand;
+        erase_nts(s, victim);
+    }
+    auto e = std::make_unique<entry>();
+    e->file = file;
+    e->referenced = false;
+    e->checked = now_ms();
+    // Inserted right behind the hand, so it is visited last.
+    e->pos = s.ring.insert(s.hand, path);
+    s.bytes += file->size();
+    bytes_ += file->size();
+    ++count_;
+    s.entries.emplace(path, std::move(e));
+}
+
+void file_cache::erase_nts(shard &s, const std::string &path)
+{
+    auto iter = s.entries.find(path);
+    if (iter == s.entries.end())
+    {
+        return;
+    }
+    entry *e = iter->second.get();
+    if (s.hand == e->pos)
+    {
+        ++s.hand;
+    }
+    s.ring.erase(e->pos);
+    s.bytes -= e->file->size();
+    bytes_ -= e->file->size();
+    --count_;
+    s.entries.erase(iter);
+}
+
+int64_t file_cache::now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+}  // namespace cppev
@@ -3,16 +3,30 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <sys/sendfile.h>
+#elif defined(__APPLE__)
+#include <sys/uio.h>
+#endif
+
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <climits>
 #include <cstdio>
 #include <cstring>
 #include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <tuple>
 #include <vector>
 
@@ -139,6 +153,16 @@ namespace cppev
         block_ = true;
     }
 
+    socktcp *io::to_socktcp() noexcept
+    {
+        return nullptr;
+    }
+
+    sockudp *io::to_sockudp() noexcept
+    {
+        return nullptr;
+    }
+
     void io::move(io &&other) noexcept
     {
         this->fd_ = other.fd_;
@@ -260,7 +284,8 @@ namespace cppev
                 {
                     continue;
                 }
-                else if (errno == EAGAIN || errno == EWOULDBLOCK)
+                // TCP_FASTOPEN_CONNECT 的 socket 没有 cookie 时首次写入返回 EINPROGRESS，数据留待可写后发送
+                else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS)
                 {
                 }
                 else if (errno == EPIPE)
@@ -290,14 +315,15 @@ namespace cppev
     }
 
     // ET模式下，非阻塞IO读取全部数据
-    int stream::read_all(int step)
+    // 读取至 EAGAIN、对端关闭或读取量达到 limit
+    int stream::read_all(int step, int limit)
     {
         if (this->block_)
         {
             throw_logic_error("block io shall never call read_all");
         }
         int total = 0;
-        while (true)
+        while (total < limit)
         {
             int curr = read_chunk(step);
 
@@ -574,6 +600,26 @@ namespace cppev
         return static_cast<bool>(opt);
     }
 
+    void sock::set_so_reuseport(bool enable)
+    {
+        int opt = enable ? 1 : 0;
+        if (setsockopt(fd_, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+        {
+            throw_system_error("setsockopt SO_REUSEPORT error");
+        }
+    }
+
+    bool sock::get_so_reuseport() const
+    {
+        int opt = 0;
+        socklen_t len = sizeof(opt);
+        if (getsockopt(fd_, SOL_SOCKET, SO_REUSEPORT, &opt, &len) < 0)
+        {
+            throw_system_error("getsockopt SO_REUSEPORT error");
+        }
+        return static_cast<bool>(opt);
+    }
+
     // 实际设置的值是传入值的两倍
     void sock::set_so_rcvbuf(int size)
     {
@@ -651,6 +697,138 @@ namespace cppev
         return size;
     }
 
+    int sock::send_fds(const std::vector<int> &fds, const char *data, int len)
+    {
+        iovec iov;
+        iov.iov_base = const_cast<char *>(data);
+        iov.iov_len = len;
+
+        std::vector<char> ctrl(CMSG_SPACE(sizeof(int) * fds.size()), 0);
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        if (fds.size())
+        {
+            msg.msg_control = ctrl.data();
+            msg.msg_controllen = ctrl.size();
+            cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+            cm->cmsg_level = SOL_SOCKET;
+            cm->cmsg_type = SCM_RIGHTS;
+            cm->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+            memcpy(CMSG_DATA(cm), fds.data(), sizeof(int) * fds.size());
+        }
+
+        ssize_t ret;
+        while ((ret = sendmsg(fd_, &msg, 0)) == -1 && errno == EINTR)
+        {
+        }
+        if (ret == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return -1;
+            }
+            throw_system_error("sendmsg error");
+        }
+        return ret;
+    }
+
+    int sock::recv_fds(std::vector<int> &fds, int len)
+    {
+        // Linux 单条消息最多携带 SCM_MAX_FD(253) 个描述符
+        static constexpr int max_fds = 253;
+        union
+        {
+            cmsghdr align;
+            char buf[CMSG_SPACE(sizeof(int) * max_fds)];
+        } ctrl;
+
+        rbuffer().resize(rbuffer().get_offset() + len);
+        iovec iov;
+        iov.iov_base = &(rbuffer()[rbuffer().size()]);
+        iov.iov_len = len;
+
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctrl.buf;
+        msg.msg_controllen = sizeof(ctrl.buf);
+
+        int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+        flags |= MSG_CMSG_CLOEXEC;
+#endif
+        ssize_t ret;
+        while ((ret = recvmsg(fd_, &msg, flags)) == -1 && errno == EINTR)
+        {
+        }
+        if (ret == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return -1;
+            }
+            throw_system_error("recvmsg error");
+        }
+        rbuffer().get_offset_ref() += ret;
+
+        for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+            {
+                continue;
+            }
+            int num = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (int i = 0; i < num; ++i)
+            {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cm) + sizeof(int) * i, sizeof(int));
+#ifndef MSG_CMSG_CLOEXEC
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+                fds.push_back(fd);
+            }
+        }
+        // 超出的描述符已被内核丢弃
+        if (msg.msg_flags & MSG_CTRUNC)
+        {
+            throw_runtime_error("recvmsg control message truncated");
+        }
+        return ret;
+    }
+
+    peer_credentials sock::get_peer_credentials() const
+    {
+        peer_credentials cred;
+#ifdef __linux__
+        ucred uc;
+        socklen_t len = sizeof(uc);
+        if (getsockopt(fd_, SOL_SOCKET, SO_PEERCRED, &uc, &len) == -1)
+        {
+            throw_system_error("getsockopt error for SO_PEERCRED");
+        }
+        cred.pid = uc.pid;
+        cred.uid = uc.uid;
+        cred.gid = uc.gid;
+#else
+        if (getpeereid(fd_, &cred.uid, &cred.gid) == -1)
+        {
+            throw_system_error("getpeereid error");
+        }
+        cred.pid = -1;
+#ifdef LOCAL_PEERPID
+        socklen_t len = sizeof(cred.pid);
+        if (getsockopt(fd_, SOL_LOCAL, LOCAL_PEERPID, &cred.pid, &len) == -1)
+        {
+            cred.pid = -1;
+        }
+#endif
+#endif
+        return cred;
+    }
+
     void sock::move(sock &&other, bool move_base) noexcept
     {
         if (move_base)
@@ -661,13 +839,44 @@ namespace cppev
         this->unix_path_ = other.unix_path_;
     }
 
-    socktcp::socktcp(int sockfd, family f) : io(sockfd), sock(-1, f), stream(-1) {}
-    socktcp::~socktcp() = default;
+    socktcp::socktcp(int sockfd, family f)
+        : io(sockfd), sock(-1, f), stream(-1), splice_pipes_{-1, -1}, splice_pending_(0),
+          source_blocked_(false), zerocopy_(false), zerocopy_next_id_(0), zerocopy_done_id_(0), fd_passing_(false)
+    {
+    }
+
+    socktcp::~socktcp()
+    {
+        defer_zerocopy();
+        for (int fd : splice_pipes_)
+        {
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+        }
+        for (int fd : in_fds_)
+        {
+            ::close(fd);
+        }
+    }
+
+    socktcp *socktcp::to_socktcp() noexcept
+    {
+        return this;
+    }
 
     socktcp::socktcp(socktcp &&other) noexcept
         : io(std::forward<socktcp>(other)),
           sock(std::forward<socktcp>(other)),
-          stream(std::forward<socktcp>(other))
+          stream(std::forward<socktcp>(other)),
+          splice_pipes_{-1, -1},
+          splice_pending_(0),
+          source_blocked_(false),
+          zerocopy_(false),
+          zerocopy_next_id_(0),
+          zerocopy_done_id_(0),
+          fd_passing_(false)
     {
         if (&other == this)
         {
@@ -920,88 +1129,1364 @@ namespace cppev
             stream::move(std::forward<socktcp>(other), false);
         }
         this->conn_uri_ = other.conn_uri_;
+        this->files_ = std::move(other.files_);
+        // 中转管道随连接转移，旧管道交由对方析构关闭
+        std::swap(this->splice_pipes_, other.splice_pipes_);
+        std::swap(this->splice_pending_, other.splice_pending_);
+        this->source_blocked_ = other.source_blocked_;
+        this->zerocopy_ = other.zerocopy_;
+        this->zerocopy_blocks_ = std::move(other.zerocopy_blocks_);
+        this->zerocopy_next_id_ = other.zerocopy_next_id_;
+        this->zerocopy_done_id_ = other.zerocopy_done_id_;
+        this->out_fds_ = std::move(other.out_fds_);
+        this->fd_passing_ = other.fd_passing_;
+        // 未取出的描述符随连接转移，旧描述符交由对方析构关闭
+        std::swap(this->in_fds_, other.in_fds_);
+    }
+
+    int socktcp::send_file(int in_fd, off_t &offset, int len)
+    {
+        source_blocked_ = false;
+        if (len <= 0)
+        {
+            return 0;
+        }
+#ifdef __linux__
+        // 每次按源的类型选择：普通文件用 sendfile，管道、套接字等用 splice。
+        // 中转管道中还有上次残留的数据时，必须先经 splice 送出以保证顺序。
+        struct stat st;
+        if (splice_pending_ == 0 && fstat(in_fd, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            while (true)
+            {
+                ssize_t ret = ::sendfile(fd_, in_fd, &offset, len);
+                if (ret >= 0)
+                {
+                    return ret;
+                }
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                // 文件系统不支持 sendfile，改用 splice
+                if (errno == EINVAL || errno == ESPIPE || errno == ENOSYS)
+                {
+                    break;
+                }
+                if (errno == EPIPE)
+                {
+                    eop_ = true;
+                }
+                else if (errno == ECONNRESET)
+                {
+                    reset_ = true;
+                }
+                else if (errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    throw_system_error("sendfile error");
+                }
+                return -1;
+            }
+        }
+        if (splice_pipes_[0] < 0 && pipe2(splice_pipes_, O_NONBLOCK | O_CLOEXEC) == -1)
+        {
+            throw_system_error("pipe2 error");
+        }
+
+        // 不可定位的源只能从当前位置读取
+        off_t *offp = lseek(in_fd, 0, SEEK_CUR) == -1 ? nullptr : &offset;
+        int total = 0;
+        while (total < len)
+        {
+            // 先把上次残留在管道中的数据送出
+            if (splice_pending_ == 0)
+            {
+                ssize_t ret = splice(in_fd, offp, splice_pipes_[1], nullptr, len - total,
+                                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (ret == 0)
+                {
+                    break;
+                }
+                if (ret == -1)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    // 源暂无数据，套接字未写满，由调用者稍后重试
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    {
+                        source_blocked_ = total == 0;
+                        return total > 0 ? total : -1;
+                    }
+                    throw_system_error("splice error");
+                }
+                if (offp == nullptr)
+                {
+                    offset += ret;
+                }
+                splice_pending_ = ret;
+            }
+            ssize_t ret = splice(splice_pipes_[0], nullptr, fd_, nullptr, splice_pending_,
+                                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (ret == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno == EPIPE)
+                {
+                    eop_ = true;
+                }
+                else if (errno == ECONNRESET)
+                {
+                    reset_ = true;
+                }
+                else if (errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    throw_system_error("splice error");
+                }
+                return total > 0 && !eop_ && !reset_ ? total : -1;
+            }
+            splice_pending_ -= ret;
+            total += ret;
+        }
+        return total;
+#elif defined(__APPLE__)
+        while (true)
+        {
+            off_t sent = len;
+            int ret = ::sendfile(in_fd, fd_, offset, &sent, nullptr, 0);
+            offset += sent;
+            if (ret == 0 || sent > 0)
+            {
+                return sent;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EPIPE)
+            {
+                eop_ = true;
+            }
+            else if (errno == ECONNRESET)
+            {
+                reset_ = true;
+            }
+            else if (errno != EAGAIN)
+            {
+                throw_system_error("sendfile error");
+            }
+            return -1;
+        }
+#endif
     }
 
-    sockudp::sockudp(int sockfd, family f) : io(sockfd), sock(-1, f) {}
-    sockudp::~sockudp() = default;
+    void socktcp::queue_file(int in_fd, off_t offset, off_t len,
+                             const std::shared_ptr<const void> &owner)
+    {
+        // 写缓冲区中的剩余数据属于该片段之前，转入片段头部
+        files_.push_back({wbuffer().get_string(), in_fd, offset, len, owner});
+    }
 
-    sockudp::sockudp(sockudp &&other) noexcept
-    : io(std::forward<sockudp>(other)), sock(std::forward<sockudp>(other))
+    bool socktcp::write_files()
     {
-        if (&other == this)
+        while (!files_.empty())
         {
-            return;
+            file_segment &seg = files_.front();
+            while (!seg.head.empty())
+            {
+                int flags = 0;
+#ifdef __linux__
+                // 头部与随后的文件内容合并为完整报文段发送
+                if (seg.len > 0)
+                {
+                    flags |= MSG_MORE;
+                }
+#endif
+                ssize_t ret = ::send(fd_, seg.head.data(), seg.head.size(), flags);
+                if (ret == -1)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    if (errno == EPIPE)
+                    {
+                        eop_ = true;
+                    }
+                    else if (errno == ECONNRESET)
+                    {
+                        reset_ = true;
+                    }
+                    else if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    {
+                        throw_system_error("write error");
+                    }
+                    return false;
+                }
+                seg.head.erase(0, ret);
+            }
+            while (seg.len > 0)
+            {
+                int len = static_cast<int>(std::min<off_t>(seg.len, INT_MAX));
+                int ret = send_file(seg.fd, seg.offset, len);
+                if (ret == -1)
+                {
+                    return false;
+                }
+                if (ret == 0)
+                {
+                    throw_runtime_error("file ends before segment is sent");
+                }
+                seg.len -= ret;
+            }
+            files_.pop_front();
         }
-        move(std::forward<sockudp>(other), false);
+        return true;
     }
 
-    sockudp &sockudp::operator=(sockudp &&other) noexcept
+    bool socktcp::files_empty() const noexcept
     {
-        if (&other == this)
+        return files_.empty();
+    }
+
+    bool socktcp::file_source_blocked() const noexcept
+    {
+        return source_blocked_;
+    }
+
+    void socktcp::set_tcp_cork(bool enable)
+    {
+        int opt = static_cast<int>(enable);
+#ifdef __linux__
+        if (setsockopt(fd_, IPPROTO_TCP, TCP_CORK, &opt, sizeof(opt)) == -1)
+#else
+        if (setsockopt(fd_, IPPROTO_TCP, TCP_NOPUSH, &opt, sizeof(opt)) == -1)
+#endif
         {
-            return *this;
+            throw_system_error("setsockopt error for TCP_CORK");
         }
-        move(std::forward<sockudp>(other), true);
-        return *this;
     }
 
-    void sockudp::send(const std::string &ip, int port)
+    bool socktcp::get_tcp_cork() const
     {
-        send(ip.c_str(), port);
+        int opt;
+        socklen_t len = sizeof(opt);
+#ifdef __linux__
+        if (getsockopt(fd_, IPPROTO_TCP, TCP_CORK, &opt, &len) == -1)
+#else
+        if (getsockopt(fd_, IPPROTO_TCP, TCP_NOPUSH, &opt, &len) == -1)
+#endif
+        {
+            throw_system_error("getsockopt error for TCP_CORK");
+        }
+        return static_cast<bool>(opt);
     }
 
-    void sockudp::send_unix(const std::string &path)
+    void socktcp::set_tcp_fastopen(int qlen)
     {
-        send_unix(path.c_str());
+#ifdef TCP_FASTOPEN
+#ifndef __linux__
+        qlen = static_cast<int>(qlen > 0);
+#endif
+        if (setsockopt(fd_, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen)) == -1)
+        {
+            throw_system_error("setsockopt error for TCP_FASTOPEN");
+        }
+#else
+        if (qlen > 0)
+        {
+            throw_logic_error("TCP_FASTOPEN is not supported");
+        }
+#endif
     }
 
-    std::tuple<std::string, int, family> sockudp::recv()
+    int socktcp::get_tcp_fastopen() const
     {
-        sockaddr_storage addr;
-        socklen_t len = faddr_len_.at(family_);
-        void *ptr = &(rbuffer()[rbuffer().size()]);
-        int ret = recvfrom(fd_, ptr, rbuffer().capacity() - rbuffer().get_offset(),
-                        0, (sockaddr *)&addr, &len);
-        if ((ret == -1) && (errno != EAGAIN))
+#ifdef TCP_FASTOPEN
+        int qlen;
+        socklen_t len = sizeof(qlen);
+        if (getsockopt(fd_, IPPROTO_TCP, TCP_FASTOPEN, &qlen, &len) == -1)
         {
-            throw_system_error("recvfrom error");
+            throw_system_error("getsockopt error for TCP_FASTOPEN");
         }
-        rbuffer().get_offset_ref() += ret;
-        if (family_ == family::local)
+        return qlen;
+#else
+        return 0;
+#endif
+    }
+
+    void socktcp::set_tcp_fastopen_connect(bool enable)
+    {
+#ifdef TCP_FASTOPEN_CONNECT
+        int opt = static_cast<int>(enable);
+        if (setsockopt(fd_, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &opt, sizeof(opt)) == -1)
         {
-            return std::make_tuple(unix_path_, -1, family::local);
+            throw_system_error("setsockopt error for TCP_FASTOPEN_CONNECT");
         }
-        return get_inet_uri(addr);
+#else
+        if (enable)
+        {
+            throw_logic_error("TCP_FASTOPEN_CONNECT is not supported");
+        }
+#endif
     }
 
-    void sockudp::send(const char *ip, int port)
+    bool socktcp::get_tcp_fastopen_connect() const
     {
-        sockaddr_storage addr;
-        addr.ss_family = fmap_.at(family_);
-        set_inet_uri(addr, ip, port);
-        void *ptr = &(wbuffer()[0]);
-        int ret = sendto(fd_, ptr, wbuffer().size(), 0, (sockaddr *)&addr,
-                        faddr_len_.at(family_));
-        if ((ret == -1) && (errno != EAGAIN))
+#ifdef TCP_FASTOPEN_CONNECT
+        int opt;
+        socklen_t len = sizeof(opt);
+        if (getsockopt(fd_, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &opt, &len) == -1)
         {
-            throw_system_error("sendto error");
+            throw_system_error("getsockopt error for TCP_FASTOPEN_CONNECT");
         }
-        wbuffer().get_start_ref() += ret;
+        return static_cast<bool>(opt);
+#else
+        return false;
+#endif
     }
 
-    void sockudp::send_unix(const char *path)
+    void socktcp::set_tcp_defer_accept(int seconds)
     {
-        sockaddr_storage addr;
-        addr.ss_family = fmap_.at(family_);
-        set_unix_uri(addr, path);
-        void *ptr = &(wbuffer()[0]);
-        int ret = sendto(fd_, ptr, wbuffer().size(), 0, (sockaddr *)&addr,
-                        SUN_LEN((sockaddr_un *)&addr));
-        if ((ret == -1) && (errno != EAGAIN))
+#if defined(TCP_DEFER_ACCEPT)
+        if (setsockopt(fd_, IPPROTO_TCP, TCP_DEFER_ACCEPT, &seconds, sizeof(seconds)) == -1)
         {
-            throw_system_error("sendto error");
+            throw_system_error("setsockopt error for TCP_DEFER_ACCEPT");
         }
-        wbuffer().get_start_ref() += ret;
+#elif defined(SO_ACCEPTFILTER)
+        if (seconds > 0)
+        {
+            accept_filter_arg arg;
+            memset(&arg, 0, sizeof(arg));
+            strcpy(arg.af_name, "dataready");
+            if (setsockopt(fd_, SOL_SOCKET, SO_ACCEPTFILTER, &arg, sizeof(arg)) == -1)
+            {
+                throw_system_error("setsockopt error for SO_ACCEPTFILTER");
+            }
+        }
+        else if (setsockopt(fd_, SOL_SOCKET, SO_ACCEPTFILTER, nullptr, 0) == -1)
+        {
+            throw_system_error("setsockopt error for SO_ACCEPTFILTER");
+        }
+#else
+        if (seconds > 0)
+        {
+            throw_logic_error("deferred accept is not supported");
+        }
+#endif
+    }
+
+    int socktcp::get_tcp_defer_accept() const
+    {
+#if defined(TCP_DEFER_ACCEPT)
+        int seconds;
+        socklen_t len = sizeof(seconds);
+        if (getsockopt(fd_, IPPROTO_TCP, TCP_DEFER_ACCEPT, &seconds, &len) == -1)
+        {
+            throw_system_error("getsockopt error for TCP_DEFER_ACCEPT");
+        }
+        return seconds;
+#elif defined(SO_ACCEPTFILTER)
+        accept_filter_arg arg;
+        socklen_t len = sizeof(arg);
+        if (getsockopt(fd_, SOL_SOCKET, SO_ACCEPTFILTER, &arg, &len) == -1)
+        {
+            // 未设置过滤器时返回 EINVAL
+            if (errno == EINVAL)
+            {
+                return 0;
+            }
+            throw_system_error("getsockopt error for SO_ACCEPTFILTER");
+        }
+        return 1;
+#else
+        return 0;
+#endif
+    }
+
+    void socktcp::set_so_zerocopy(bool enable)
+    {
+#ifdef SO_ZEROCOPY
+        int opt = static_cast<int>(enable);
+        if (setsockopt(fd_, SOL_SOCKET, SO_ZEROCOPY, &opt, sizeof(opt)) == -1)
+        {
+            throw_system_error("setsockopt error for SO_ZEROCOPY");
+        }
+        zerocopy_ = enable;
+#else
+        if (enable)
+        {
+            throw_logic_error("SO_ZEROCOPY is not supported");
+        }
+#endif
+    }
+
+    bool socktcp::get_so_zerocopy() const
+    {
+        return zerocopy_;
+    }
+
+    int socktcp::write_zerocopy()
+    {
+        int total = 0;
+        // 先发送上次未发送完的数据块，保证数据顺序
+        if (zerocopy_unsent())
+        {
+            int before = zerocopy_blocks_.back().data.size();
+            write_zerocopy_block(zerocopy_blocks_.back());
+            total += before - zerocopy_blocks_.back().data.size();
+            release_zerocopy_blocks();
+            if (zerocopy_unsent())
+            {
+                return total;
+            }
+        }
+        if (!zerocopy_ || wbuffer().size() < sysconfig::zerocopy_threshold)
+        {
+            return total + write_all();
+        }
+        // 整块移出写缓冲区，发送完成前内存不会被复用
+        zerocopy_blocks_.push_back({std::move(wbuffer()), 0, false});
+        wbuffer() = buffer();
+        int before = zerocopy_blocks_.back().data.size();
+        write_zerocopy_block(zerocopy_blocks_.back());
+        total += before - zerocopy_blocks_.back().data.size();
+        release_zerocopy_blocks();
+        return total;
+    }
+
+    void socktcp::write_zerocopy_block(zerocopy_block &block)
+    {
+        while (block.data.size() > 0)
+        {
+            int flags = 0;
+#ifdef MSG_ZEROCOPY
+            flags |= MSG_ZEROCOPY;
+#endif
+            ssize_t ret = ::send(fd_, &(block.data[0]), block.data.size(), flags);
+            // 锁定页数超出 optmem 限制，本次退化为拷贝发送
+            if (ret == -1 && errno == ENOBUFS)
+            {
+                ret = ::send(fd_, &(block.data[0]), block.data.size(), 0);
+                flags = 0;
+            }
+            if (ret == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno == EPIPE)
+                {
+                    eop_ = true;
+                }
+                else if (errno == ECONNRESET)
+                {
+                    reset_ = true;
+                }
+                else if (errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    throw_system_error("send error");
+                }
+                break;
+            }
+            // 每次成功的零拷贝发送对应一个通知序号
+            if (flags != 0)
+            {
+                block.last_id = zerocopy_next_id_++;
+                block.has_id = true;
+            }
+            block.data.get_start_ref() += ret;
+        }
+    }
+
+    int socktcp::drain_zerocopy()
+    {
+        int count = 0;
+#ifdef __linux__
+        while (true)
+        {
+            char control[128];
+            msghdr msg = {};
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (recvmsg(fd_, &msg, MSG_ERRQUEUE) == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    break;
+                }
+                throw_system_error("recvmsg error for MSG_ERRQUEUE");
+            }
+            for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr;
+                 cm = CMSG_NXTHDR(&msg, cm))
+            {
+                if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                      (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+                {
+                    continue;
+                }
+                auto *serr = reinterpret_cast<sock_extended_err *>(CMSG_DATA(cm));
+                if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                {
+                    continue;
+                }
+                // [ee_info, ee_data] 区间内的发送已完成，TCP 的通知按序到达
+                uint32_t hi = serr->ee_data;
+                if (static_cast<int32_t>(hi + 1 - zerocopy_done_id_) > 0)
+                {
+                    zerocopy_done_id_ = hi + 1;
+                }
+                ++count;
+            }
+        }
+#endif
+        release_zerocopy_blocks();
+        return count;
+    }
+
+    void socktcp::release_zerocopy_blocks() noexcept
+    {
+        while (!zerocopy_blocks_.empty())
+        {
+            zerocopy_block &block = zerocopy_blocks_.front();
+            if (block.data.size() > 0 ||
+                (block.has_id &&
+                 static_cast<int32_t>(block.last_id - zerocopy_done_id_) >= 0))
+            {
+                break;
+            }
+            zerocopy_blocks_.pop_front();
+        }
+    }
+
+    bool socktcp::zerocopy_unsent() const noexcept
+    {
+        return !zerocopy_blocks_.empty() && zerocopy_blocks_.back().data.size() > 0;
+    }
+
+    bool socktcp::zerocopy_pending() const noexcept
+    {
+        return !zerocopy_blocks_.empty();
+    }
+
+    // 关闭时仍等待零拷贝完成通知的连接，以描述符副本继续读取通知，数据块在通知到达前不释放
+    // 已完成的连接由后台线程每隔 zerocopy_reap_interval 回收，队列为空时线程退出，下次移交时重新启动
+    class zerocopy_deferred_list
+    {
+    public:
+        // 移交连接，同时回收已完成的连接
+        void push(std::unique_ptr<socktcp> &&sock)
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            reap_nts();
+            socks_.push_back(std::move(sock));
+            if (!reaping_)
+            {
+                // 线程创建失败时留待下一次移交回收
+                reaping_ = exception_guard(
+                    [this] { std::thread([this] { reap_forever(); }).detach(); });
+            }
+        }
+
+    private:
+        void reap_forever()
+        {
+            while (true)
+            {
+                std::this_thread::sleep_for(
+                    std::chrono::milliseconds(sysconfig::zerocopy_reap_interval));
+                std::unique_lock<std::mutex> lock(lock_);
+                reap_nts();
+                if (socks_.empty())
+                {
+                    reaping_ = false;
+                    return;
+                }
+            }
+        }
+
+        // 读取通知并关闭已完成的连接，需持有锁
+        void reap_nts()
+        {
+            for (auto iter = socks_.begin(); iter != socks_.end();)
+            {
+                bool failed = !exception_guard([&sock = *iter] { sock->drain_zerocopy(); });
+                if (failed || !(*iter)->zerocopy_pending())
+                {
+                    // 读取通知出错时不再等待
+                    (*iter)->close();
+                    iter = socks_.erase(iter);
+                }
+                else
+                {
+                    ++iter;
+                }
+            }
+        }
+
+        std::mutex lock_;
+
+        std::vector<std::unique_ptr<socktcp>> socks_;
+
+        // 是否有后台线程在回收
+        bool reaping_ = false;
+    };
+
+    // 不析构，进程退出前析构的 socket 仍可移交
+    static zerocopy_deferred_list &zerocopy_deferred()
+    {
+        static zerocopy_deferred_list *list = new zerocopy_deferred_list();
+        return *list;
+    }
+
+    void socktcp::defer_zerocopy() noexcept
+    {
+        if (is_closed() || !zerocopy_pending())
+        {
+            return;
+        }
+        // 未交给内核的数据不再发送，未以零拷贝发出过的数据块可直接释放
+        zerocopy_block &last = zerocopy_blocks_.back();
+        if (last.data.size() > 0)
+        {
+            if (last.has_id)
+            {
+                last.data.get_start_ref() += last.data.size();
+            }
+            else
+            {
+                zerocopy_blocks_.pop_back();
+            }
+        }
+        if (!exception_guard([this] { drain_zerocopy(); }) || !zerocopy_pending())
+        {
+            return;
+        }
+        int fd = ::dup(fd_);
+        if (fd < 0)
+        {
+            return;
+        }
+        // 副本使连接在关闭原描述符后仍然存在，主动结束连接
+        ::shutdown(fd, SHUT_RDWR);
+        std::unique_ptr<socktcp> deferred;
+        try
+        {
+            deferred = std::make_unique<socktcp>(fd, sockfamily());
+        }
+        catch (...)
+        {
+            ::close(fd);
+            return;
+        }
+        deferred->zerocopy_ = true;
+        deferred->zerocopy_blocks_ = std::move(zerocopy_blocks_);
+        deferred->zerocopy_next_id_ = zerocopy_next_id_;
+        deferred->zerocopy_done_id_ = zerocopy_done_id_;
+        zerocopy_blocks_.clear();
+        try
+        {
+            zerocopy_deferred().push(std::move(deferred));
+        }
+        catch (...)
+        {
+            // 关闭后析构不再移交
+            deferred->close();
+        }
+    }
+
+    void socktcp::queue_fds(const std::vector<int> &fds)
+    {
+        // 文件片段与零拷贝数据块排在写缓冲区之前，描述符无法随写缓冲区的数据按序到达
+        if (0 == wbuffer().size() || !files_.empty() || zerocopy_unsent())
+        {
+            throw_logic_error("descriptors shall be sent with data in write buffer");
+        }
+        out_fds_.insert(out_fds_.end(), fds.begin(), fds.end());
+    }
+
+    bool socktcp::write_fds()
+    {
+        if (out_fds_.empty())
+        {
+            return true;
+        }
+        int ret = send_fds(out_fds_, &(wbuffer()[0]), wbuffer().size());
+        if (ret == -1)
+        {
+            return false;
+        }
+        wbuffer().get_start_ref() += ret;
+        if (0 == wbuffer().size())
+        {
+            wbuffer().clear();
+        }
+        out_fds_.clear();
+        return true;
+    }
+
+    void socktcp::set_fd_passing(bool enable) noexcept
+    {
+        fd_passing_ = enable;
+    }
+
+    bool socktcp::get_fd_passing() const noexcept
+    {
+        return fd_passing_;
+    }
+
+    int socktcp::read_all_fds(int step, int limit)
+    {
+        if (this->block_)
+        {
+            throw_logic_error("block io shall never call read_all_fds");
+        }
+        int total = 0;
+        while (total < limit)
+        {
+            int curr = recv_fds(in_fds_, step);
+            if (curr == 0)
+            {
+                eof_ = true;
+                break;
+            }
+            if (curr <= -1)
+            {
+                break;
+            }
+            // 携带描述符的消息不与其他数据合并，读取不足 step 时可能仍有数据，继续读取
+            total += curr;
+        }
+        return total;
+    }
+
+    std::vector<int> socktcp::take_fds()
+    {
+        std::vector<int> fds;
+        fds.swap(in_fds_);
+        return fds;
+    }
+
+    sockudp::sockudp(int sockfd, family f) : io(sockfd), sock(-1, f), gso_(true) {}
+    sockudp::~sockudp() = default;
+
+    sockudp *sockudp::to_sockudp() noexcept
+    {
+        return this;
+    }
+
+    sockudp::sockudp(sockudp &&other) noexcept
+    : io(std::forward<sockudp>(other)), sock(std::forward<sockudp>(other)), gso_(true)
+    {
+        if (&other == this)
+        {
+            return;
+        }
+        move(std::forward<sockudp>(other), false);
+    }
+
+    sockudp &sockudp::operator=(sockudp &&other) noexcept
+    {
+        if (&other == this)
+        {
+            return *this;
+        }
+        move(std::forward<sockudp>(other), true);
+        return *this;
+    }
+
+    void sockudp::send(const std::string &ip, int port)
+    {
+        send(ip.c_str(), port);
+    }
+
+    void sockudp::send_unix(const std::string &path)
+    {
+        send_unix(path.c_str());
+    }
+
+    std::tuple<std::string, int, family> sockudp::recv()
+    {
+        sockaddr_storage addr;
+        socklen_t len = faddr_len_.at(family_);
+        void *ptr = &(rbuffer()[rbuffer().size()]);
+        int ret = recvfrom(fd_, ptr, rbuffer().capacity() - rbuffer().get_offset(),
+                        0, (sockaddr *)&addr, &len);
+        if ((ret == -1) && (errno != EAGAIN))
+        {
+            throw_system_error("recvfrom error");
+        }
+        rbuffer().get_offset_ref() += ret;
+        if (family_ == family::local)
+        {
+            return std::make_tuple(unix_path_, -1, family::local);
+        }
+        return get_inet_uri(addr);
+    }
+
+    void sockudp::send(const char *ip, int port)
+    {
+        send(endpoint(ip, port, family_));
+    }
+
+    void sockudp::send(const endpoint &peer)
+    {
+        void *ptr = &(wbuffer()[0]);
+        int ret = sendto(fd_, ptr, wbuffer().size(), 0, peer.addr(), peer.length());
+        if ((ret == -1) && (errno != EAGAIN))
+        {
+            throw_system_error("sendto error");
+        }
+        wbuffer().get_start_ref() += ret;
+    }
+
+    endpoint sockudp::recv_from()
+    {
+        endpoint peer;
+        socklen_t len = sizeof(peer.addr_);
+        void *ptr = &(rbuffer()[rbuffer().size()]);
+        int ret = recvfrom(fd_, ptr, rbuffer().capacity() - rbuffer().get_offset(),
+                           0, (sockaddr *)&peer.addr_, &len);
+        if (ret == -1)
+        {
+            if (errno != EAGAIN)
+            {
+                throw_system_error("recvfrom error");
+            }
+            return peer;
+        }
+        rbuffer().get_offset_ref() += ret;
+        return peer;
+    }
+
+    void sockudp::send_unix(const char *path)
+    {
+        sockaddr_storage addr;
+        addr.ss_family = fmap_.at(family_);
+        set_unix_uri(addr, path);
+        void *ptr = &(wbuffer()[0]);
+        int ret = sendto(fd_, ptr, wbuffer().size(), 0, (sockaddr *)&addr,
+                        SUN_LEN((sockaddr_un *)&addr));
+        if ((ret == -1) && (errno != EAGAIN))
+        {
+            throw_system_error("sendto error");
+        }
+        wbuffer().get_start_ref() += ret;
+    }
+
+    endpoint::endpoint() noexcept
+    {
+        memset(&addr_, 0, sizeof(addr_));
+        addr_.ss_family = AF_UNSPEC;
+    }
+
+    endpoint::endpoint(const char *ip, int port, family f)
+    {
+        memset(&addr_, 0, sizeof(addr_));
+        addr_.ss_family = fmap_.at(f);
+        if (f == family::local)
+        {
+            set_unix_uri(addr_, ip);
+        }
+        else
+        {
+            set_inet_uri(addr_, ip, port);
+        }
+    }
+
+    endpoint::endpoint(const std::string &ip, int port, family f)
+        : endpoint(ip.c_str(), port, f)
+    {
+    }
+
+    endpoint::endpoint(const sockaddr_storage &addr) noexcept : addr_(addr)
+    {
+    }
+
+    family endpoint::sockfamily() const noexcept
+    {
+        switch (addr_.ss_family)
+        {
+            case AF_INET:
+                return family::ipv4;
+            case AF_INET6:
+                return family::ipv6;
+            default:
+                return family::local;
+        }
+    }
+
+    int endpoint::port() const noexcept
+    {
+        switch (addr_.ss_family)
+        {
+            case AF_INET:
+                return ntohs(reinterpret_cast<const sockaddr_in *>(&addr_)->sin_port);
+            case AF_INET6:
+                return ntohs(reinterpret_cast<const sockaddr_in6 *>(&addr_)->sin6_port);
+            default:
+                return -1;
+        }
+    }
+
+    std::string endpoint::ip() const
+    {
+        char buf[INET6_ADDRSTRLEN];
+        switch (addr_.ss_family)
+        {
+            case AF_INET:
+                inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in *>(&addr_)->sin_addr,
+                          buf, sizeof(buf));
+                return buf;
+            case AF_INET6:
+                inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6 *>(&addr_)->sin6_addr,
+                          buf, sizeof(buf));
+                return buf;
+            case AF_UNIX:
+                return reinterpret_cast<const sockaddr_un *>(&addr_)->sun_path;
+            default:
+                return "";
+        }
+    }
+
+    std::string endpoint::to_string() const
+    {
+        switch (addr_.ss_family)
+        {
+            case AF_INET:
+                return ip() + ":" + std::to_string(port());
+            case AF_INET6:
+                return "[" + ip() + "]:" + std::to_string(port());
+            default:
+                return ip();
+        }
+    }
+
+    const sockaddr *endpoint::addr() const noexcept
+    {
+        return reinterpret_cast<const sockaddr *>(&addr_);
+    }
+
+    socklen_t endpoint::length() const noexcept
+    {
+        switch (addr_.ss_family)
+        {
+            case AF_INET:
+                return sizeof(sockaddr_in);
+            case AF_INET6:
+                return sizeof(sockaddr_in6);
+            case AF_UNIX:
+                return sizeof(sockaddr_un);
+            default:
+                return 0;
+        }
+    }
+
+    const sockaddr_storage &endpoint::storage() const noexcept
+    {
+        return addr_;
+    }
+
+    // 只比较有效部分，sockaddr_storage 的填充字节不参与比较和哈希
+    static std::pair<const void *, size_t> addr_bytes_of(const sockaddr_storage &addr)
+    {
+        switch (addr.ss_family)
+        {
+            case AF_INET:
+            {
+                const sockaddr_in *ap = reinterpret_cast<const sockaddr_in *>(&addr);
+                return {&ap->sin_addr, sizeof(ap->sin_addr)};
+            }
+            case AF_INET6:
+            {
+                const sockaddr_in6 *ap = reinterpret_cast<const sockaddr_in6 *>(&addr);
+                return {&ap->sin6_addr, sizeof(ap->sin6_addr)};
+            }
+            case AF_UNIX:
+            {
+                const sockaddr_un *ap = reinterpret_cast<const sockaddr_un *>(&addr);
+                return {ap->sun_path, strnlen(ap->sun_path, sizeof(ap->sun_path))};
+            }
+            default:
+                return {nullptr, 0};
+        }
+    }
+
+    // IPv6 链路本地地址在不同网卡上是不同的端点，比较与哈希都要包含 scope id
+    static uint32_t scope_id_of(const sockaddr_storage &addr)
+    {
+        if (addr.ss_family != AF_INET6)
+        {
+            return 0;
+        }
+        return reinterpret_cast<const sockaddr_in6 *>(&addr)->sin6_scope_id;
+    }
+
+    size_t endpoint::hash() const noexcept
+    {
+        // FNV-1a
+        auto bytes = addr_bytes_of(addr_);
+        const unsigned char *ptr = static_cast<const unsigned char *>(bytes.first);
+        size_t ret = 14695981039346656037ULL;
+        for (size_t i = 0; i < bytes.second; ++i)
+        {
+            ret = (ret ^ ptr[i]) * 1099511628211ULL;
+        }
+        ret = (ret ^ static_cast<size_t>(port() & 0xffff)) * 1099511628211ULL;
+        ret = (ret ^ scope_id_of(addr_)) * 1099511628211ULL;
+        return ret ^ addr_.ss_family;
+    }
+
+    bool endpoint::operator==(const endpoint &other) const noexcept
+    {
+        if (addr_.ss_family != other.addr_.ss_family || port() != other.port() ||
+            scope_id_of(addr_) != scope_id_of(other.addr_))
+        {
+            return false;
+        }
+        auto lhs = addr_bytes_of(addr_);
+        auto rhs = addr_bytes_of(other.addr_);
+        return lhs.second == rhs.second && memcmp(lhs.first, rhs.first, lhs.second) == 0;
+    }
+
+    bool endpoint::operator!=(const endpoint &other) const noexcept
+    {
+        return !(*this == other);
+    }
+
+    datagram_ring::datagram_ring(int slots, int slot_size)
+        : slots_(slots),
+          slot_size_(slot_size),
+          size_(0),
+          payload_(static_cast<size_t>(slots) * slot_size),
+          addrs_(slots),
+          lengths_(slots),
+          segments_(slots),
+          sent_(slots),
+          iovs_(slots),
+          control_size_(CMSG_SPACE(sizeof(int)))
+#ifdef __linux__
+          ,
+          msgs_(slots)
+#endif
+    {
+        if (slots < 1 || slot_size < 1)
+        {
+            throw_logic_error("datagram_ring slots and slot size should be positive");
+        }
+        controls_.resize(static_cast<size_t>(slots) * control_size_);
+    }
+
+    int datagram_ring::slots() const noexcept
+    {
+        return slots_;
+    }
+
+    int datagram_ring::slot_size() const noexcept
+    {
+        return slot_size_;
+    }
+
+    int datagram_ring::size() const noexcept
+    {
+        return size_;
+    }
+
+    void datagram_ring::clear() noexcept
+    {
+        size_ = 0;
+    }
+
+    char *datagram_ring::data(int i) noexcept
+    {
+        return &payload_[static_cast<size_t>(i) * slot_size_];
+    }
+
+    const char *datagram_ring::data(int i) const noexcept
+    {
+        return &payload_[static_cast<size_t>(i) * slot_size_];
+    }
+
+    int datagram_ring::length(int i) const noexcept
+    {
+        return lengths_[i];
+    }
+
+    int datagram_ring::segment_size(int i) const noexcept
+    {
+        return segments_[i];
+    }
+
+    const sockaddr_storage &datagram_ring::addr(int i) const noexcept
+    {
+        return addrs_[i].storage();
+    }
+
+    const endpoint &datagram_ring::peer(int i) const noexcept
+    {
+        return addrs_[i];
+    }
+
+    bool datagram_ring::push(const char *ptr, int len, const endpoint &peer, int segment_size)
+    {
+        if (size_ == slots_ || len < 0 || len > slot_size_)
+        {
+            return false;
+        }
+        memcpy(data(size_), ptr, len);
+        addrs_[size_] = peer;
+        lengths_[size_] = len;
+        segments_[size_] = segment_size;
+        sent_[size_] = 0;
+        ++size_;
+        return true;
+    }
+
+    bool datagram_ring::push(const char *ptr, int len, const sockaddr_storage &addr,
+                             int segment_size)
+    {
+        return push(ptr, len, endpoint(addr), segment_size);
+    }
+
+    bool datagram_ring::push(const char *ptr, int len, const char *ip, int port, family f,
+                             int segment_size)
+    {
+        return push(ptr, len, endpoint(ip, port, f), segment_size);
+    }
+
+    int sockudp::recv_batch(datagram_ring &ring)
+    {
+        int n = ring.slots_ - ring.size_;
+        if (n <= 0)
+        {
+            return 0;
+        }
+#ifdef __linux__
+        for (int i = ring.size_; i < ring.slots_; ++i)
+        {
+            ring.iovs_[i].iov_base = ring.data(i);
+            ring.iovs_[i].iov_len = ring.slot_size_;
+            msghdr &hdr = ring.msgs_[i].msg_hdr;
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.msg_name = &ring.addrs_[i].addr_;
+            hdr.msg_namelen = sizeof(sockaddr_storage);
+            hdr.msg_iov = &ring.iovs_[i];
+            hdr.msg_iovlen = 1;
+            hdr.msg_control = &ring.controls_[static_cast<size_t>(i) * ring.control_size_];
+            hdr.msg_controllen = ring.control_size_;
+        }
+        int ret;
+        // 阻塞模式下只等待第一个数据报
+        while ((ret = recvmmsg(fd_, &ring.msgs_[ring.size_], n, MSG_WAITFORONE, nullptr)) == -1 &&
+               errno == EINTR)
+        {
+        }
+        if (ret == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return 0;
+            }
+            throw_system_error("recvmmsg error");
+        }
+        for (int i = ring.size_; i < ring.size_ + ret; ++i)
+        {
+            msghdr &hdr = ring.msgs_[i].msg_hdr;
+            ring.lengths_[i] = ring.msgs_[i].msg_len;
+            ring.segments_[i] = 0;
+            ring.sent_[i] = 0;
+#ifdef UDP_GRO
+            for (cmsghdr *cm = CMSG_FIRSTHDR(&hdr); cm != nullptr; cm = CMSG_NXTHDR(&hdr, cm))
+            {
+                if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO)
+                {
+                    int segment;
+                    memcpy(&segment, CMSG_DATA(cm), sizeof(segment));
+                    ring.segments_[i] = segment;
+                }
+            }
+#endif
+        }
+        ring.size_ += ret;
+        return ret;
+#else
+        int count = 0;
+        while (count < n)
+        {
+            int i = ring.size_;
+            socklen_t len = sizeof(sockaddr_storage);
+            // 阻塞模式下只等待第一个数据报
+            int ret = recvfrom(fd_, ring.data(i), ring.slot_size_, count ? MSG_DONTWAIT : 0,
+                               (sockaddr *)&ring.addrs_[i].addr_, &len);
+            if (ret == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    break;
+                }
+                throw_system_error("recvfrom error");
+            }
+            ring.lengths_[i] = ret;
+            ring.segments_[i] = 0;
+            ring.sent_[i] = 0;
+            ++ring.size_;
+            ++count;
+        }
+        return count;
+#endif
+    }
+
+    int sockudp::send_batch(datagram_ring &ring, int start)
+    {
+        int n = ring.size_ - start;
+        if (n <= 0)
+        {
+            return 0;
+        }
+#ifdef __linux__
+        bool split = false;
+        for (int i = start; i < ring.size_; ++i)
+        {
+            split = split || (ring.segments_[i] > 0 && ring.lengths_[i] > ring.segments_[i]);
+        }
+#ifndef UDP_SEGMENT
+        gso_ = false;
+#endif
+        // 不支持 GSO 时需要拆分的批次逐个发送，部分段已发送的数据报也需逐个续发
+        if ((split && !gso_) || ring.sent_[start] > 0)
+        {
+            return send_each(ring, start);
+        }
+        for (int i = start; i < ring.size_; ++i)
+        {
+            ring.iovs_[i].iov_base = ring.data(i);
+            ring.iovs_[i].iov_len = ring.lengths_[i];
+            msghdr &hdr = ring.msgs_[i].msg_hdr;
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.msg_name = &ring.addrs_[i].addr_;
+            hdr.msg_namelen = ring.addrs_[i].length();
+            hdr.msg_iov = &ring.iovs_[i];
+            hdr.msg_iovlen = 1;
+#ifdef UDP_SEGMENT
+            // 由内核 GSO 拆分为多个数据报
+            if (ring.segments_[i] > 0 && ring.lengths_[i] > ring.segments_[i])
+            {
+                hdr.msg_control = &ring.controls_[static_cast<size_t>(i) * ring.control_size_];
+                hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+                cmsghdr *cm = CMSG_FIRSTHDR(&hdr);
+                cm->cmsg_level = SOL_UDP;
+                cm->cmsg_type = UDP_SEGMENT;
+                cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t segment = ring.segments_[i];
+                memcpy(CMSG_DATA(cm), &segment, sizeof(segment));
+            }
+#endif
+        }
+        int ret;
+        while ((ret = sendmmsg(fd_, &ring.msgs_[start], n, 0)) == -1 && errno == EINTR)
+        {
+        }
+        if (ret == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return 0;
+            }
+            // 旧内核或段数超过上限时为 EINVAL，仅本批逐个发送；
+            // 网卡无校验和卸载时为 EIO，此后都逐个发送
+            if (split && (errno == EINVAL || errno == EIO))
+            {
+                gso_ = errno != EIO;
+                return send_each(ring, start);
+            }
+            throw_system_error("sendmmsg error");
+        }
+        return ret;
+#else
+        return send_each(ring, start);
+#endif
+    }
+
+    int sockudp::send_each(datagram_ring &ring, int start)
+    {
+        int count = 0;
+        for (int i = start; i < ring.size_; ++i)
+        {
+            // 不支持 GSO，按段长度逐个发送
+            int step = ring.segments_[i] > 0 ? ring.segments_[i] : ring.lengths_[i];
+            for (int offset = ring.sent_[i]; offset < ring.lengths_[i] || offset == 0;
+                 offset += step)
+            {
+                int len = std::min(step, ring.lengths_[i] - offset);
+                int ret;
+                while ((ret = sendto(fd_, ring.data(i) + offset, len, 0,
+                                     ring.addrs_[i].addr(),
+                                     ring.addrs_[i].length())) == -1 &&
+                       errno == EINTR)
+                {
+                }
+                if (ret == -1)
+                {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    {
+                        return count;
+                    }
+                    throw_system_error("sendto error");
+                }
+                ring.sent_[i] = offset + len;
+                if (ring.lengths_[i] == 0)
+                {
+                    break;
+                }
+            }
+            ring.sent_[i] = 0;
+            ++count;
+        }
+        return count;
+    }
+
+    void sockudp::set_udp_gro(bool enable)
+    {
+#ifdef UDP_GRO
+        int opt = static_cast<int>(enable);
+        if (setsockopt(fd_, SOL_UDP, UDP_GRO, &opt, sizeof(opt)) == -1)
+        {
+            throw_system_error("setsockopt error for UDP_GRO");
+        }
+#else
+        if (enable)
+        {
+            throw_logic_error("UDP_GRO is not supported");
+        }
+#endif
+    }
+
+    bool sockudp::get_udp_gro() const
+    {
+#ifdef UDP_GRO
+        int opt;
+        socklen_t len = sizeof(opt);
+        if (getsockopt(fd_, SOL_UDP, UDP_GRO, &opt, &len) == -1)
+        {
+            throw_system_error("getsockopt error for UDP_GRO");
+        }
+        return static_cast<bool>(opt);
+#else
+        return false;
+#endif
     }
 
     void sockudp::move(sockudp &&other, bool move_base) noexcept
@@ -1010,6 +2495,7 @@ namespace cppev
         {
             sock::move(std::forward<sockudp>(other), true);
         }
+        this->gso_ = other.gso_;
     }
 
     namespace io_factory
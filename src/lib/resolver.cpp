@@ -0,0 +1,194 @@
+#include "cppev/resolver.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <deque>
+
+#include "cppev/logger.h"
+
+namespace cppev
+{
+
+bool is_ip_literal(const std::string &ip, family f)
+{
+    unsigned char buf[sizeof(in6_addr)];
+    switch (f)
+    {
+    case family::ipv4:
+        return inet_pton(AF_INET, ip.c_str(), buf) == 1;
+    case family::ipv6:
+        return inet_pton(AF_INET6, ip.c_str(), buf) == 1;
+    default:
+        return true;
+    }
+}
+
+std::vector<resolved_address> interleave_addresses(
+    const std::vector<resolved_address> &addrs, family preferred)
+{
+    std::deque<resolved_address> first;
+    std::deque<resolved_address> second;
+    for (const auto &addr : addrs)
+    {
+        (std::get<1>(addr) == preferred ? first : second).push_back(addr);
+    }
+    std::vector<resolved_address> ret;
+    while (first.size() || second.size())
+    {
+        for (auto *q : {&first, &second})
+        {
+            if (q->size())
+            {
+                ret.push_back(q->front());
+                q->pop_front();
+            }
+        }
+    }
+    return ret;
+}
+
+resolver::resolver(int thr_num, int ttl)
+    : lookup_(resolver::getaddrinfo_lookup),
+      ttl_(ttl),
+      running_(false),
+      tp_(thr_num)
+{
+}
+
+resolver::~resolver()
+{
+    if (running_)
+    {
+        tp_.stop();
+    }
+}
+
+void resolver::set_lookup(const lookup_handler &lookup)
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    lookup_ = lookup;
+}
+
+void resolver::resolve(const std::string &host, const resolve_handler &handler)
+{
+    lookup_handler lookup;
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        auto iter = cache_.find(host);
+        if (iter != cache_.end())
+        {
+            if (std::chrono::steady_clock::now() < std::get<0>(iter->second))
+            {
+                auto addrs = std::get<1>(iter->second);
+                lock.unlock();
+                handler(addrs);
+                return;
+            }
+            cache_.erase(iter);
+        }
+        auto &waiters = pending_[host];
+        waiters.push_back(handler);
+        if (waiters.size() > 1)
+        {
+            return;
+        }
+        if (!running_)
+        {
+            tp_.run();
+            running_ = true;
+        }
+        lookup = lookup_;
+    }
+
+    tp_.add_task(
+        [this, host, lookup]
+        {
+            std::vector<resolved_address> addrs;
+            if (!exception_guard([&] { addrs = lookup(host); }))
+            {
+                LOG_ERROR_FMT("Lookup %s throws exception", host.c_str());
+            }
+            if (addrs.empty())
+            {
+                LOG_WARNING_FMT("Resolve %s failed", host.c_str());
+            }
+            std::vector<resolve_handler> waiters;
+            {
+                std::unique_lock<std::mutex> lock(lock_);
+                // Failures are not cached so that next request retries.
+                if (addrs.size())
+                {
+                    cache_[host] = std::make_tuple(
+                        std::chrono::steady_clock::now() +
+                            std::chrono::milliseconds(ttl_),
+                        addrs);
+                }
+                pending_[host].swap(waiters);
+                pending_.erase(host);
+            }
+            for (const auto &waiter : waiters)
+            {
+                waiter(addrs);
+            }
+        });
+}
+
+void resolver::invalidate(const std::string &host)
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    cache_.erase(host);
+}
+
+std::vector<resolved_address> resolver::getaddrinfo_lookup(
+    const std::string &host)
+{
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo *res = nullptr;
+    int rtn = getaddrinfo(host.c_str(), nullptr, &hints, &res);
+    if (rtn != 0)
+    {
+        LOG_WARNING_FMT("getaddrinfo %s error : %s", host.c_str(),
+                        gai_strerror(rtn));
+        return {};
+    }
+
+    std::vector<resolved_address> addrs;
+    char buf[INET6_ADDRSTRLEN];
+    for (addrinfo *ai = res; ai != nullptr; ai = ai->ai_next)
+    {
+        const char *ip = nullptr;
+        family f = family::ipv4;
+        if (ai->ai_family == AF_INET)
+        {
+            auto ap = reinterpret_cast<sockaddr_in *>(ai->ai_addr);
+            ip = inet_ntop(AF_INET, &ap->sin_addr, buf, sizeof(buf));
+            f = family::ipv4;
+        }
+        else if (ai->ai_family == AF_INET6)
+        {
+            auto ap6 = reinterpret_cast<sockaddr_in6 *>(ai->ai_addr);
+            ip = inet_ntop(AF_INET6, &ap6->sin6_addr, buf, sizeof(buf));
+            f = family::ipv6;
+        }
+        if (ip == nullptr)
+        {
+            continue;
+        }
+        auto addr = std::make_tuple(std::string(ip), f);
+        if (std::find(addrs.begin(), addrs.end(), addr) == addrs.end())
+        {
+            addrs.push_back(addr);
+        }
+    }
+    freeaddrinfo(res);
+    return addrs;
+}
+
+}  // namespace cppev
@@ -1,5 +1,21 @@
 #include "cppev/runnable.h"
 
+#include <sched.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <utility>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "cppev/logger.h"
+
 namespace cppev
 {
 
@@ -14,6 +30,61 @@ bool runnable::cancel() noexcept
     return 0 == pthread_cancel(thr_);
 }
 
+void runnable::request_stop()
+{
+    stop_.request_stop();
+}
+
+stop_token runnable::get_stop_token() const noexcept
+{
+    return stop_.token();
+}
+
+void runnable::set_stop_parent(const stop_token &parent)
+{
+    stop_parent_ = parent;
+    stop_ = stop_source(stop_parent_);
+}
+
+#ifdef __linux__
+// Bind memory policy of calling thread to node, MPOL_PREFERRED falls back to
+// other nodes when node is out of memory.
+static void prefer_numa_node(int node) noexcept
+{
+#ifdef SYS_set_mempolicy
+    const int mpol_preferred = 1;
+    unsigned long mask[16] = {0};
+    const unsigned long bits = 8 * sizeof(unsigned long);
+    if (node < 0 || node >= static_cast<int>(sizeof(mask) * 8))
+    {
+        return;
+    }
+    mask[node / bits] |= 1UL << (node % bits);
+    syscall(SYS_set_mempolicy, mpol_preferred, mask, sizeof(mask) * 8 + 1);
+#endif
+}
+#endif
+
+void runnable::apply_thread_options() noexcept
+{
+    // Failures are ignored, they only affect placement and diagnostics.
+    if (!opts_.name.empty())
+    {
+        std::string name = opts_.name.substr(0, 15);
+#if defined(__linux__)
+        pthread_setname_np(pthread_self(), name.c_str());
+#elif defined(__APPLE__)
+        pthread_setname_np(name.c_str());
+#endif
+    }
+#ifdef __linux__
+    if (opts_.numa_node >= 0)
+    {
+        prefer_numa_node(opts_.numa_node);
+    }
+#endif
+}
+
 void runnable::run()
 {
     auto thr_func = [](void *arg) -> void *
@@ -27,11 +98,86 @@ void runnable::run()
         {
             throw_logic_error("pthread_setcanceltype error");
         }
+        pseudo_this->apply_thread_options();
         pseudo_this->run_impl();
         pseudo_this->prom_.set_value(true);
         return nullptr;
     };
-    int ret = pthread_create(&thr_, nullptr, thr_func, this);
+    if (fut_.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+    {
+        prom_ = std::promise<bool>();
+        fut_ = prom_.get_future();
+    }
+    // Stop of previous run does not carry over, unless parent is stopped.
+    if (stop_.stop_requested())
+    {
+        stop_ = stop_source(stop_parent_);
+    }
+
+    pthread_attr_t attr;
+    int ret = pthread_attr_init(&attr);
+    if (ret != 0)
+    {
+        throw_system_error("pthread_attr_init error", ret);
+    }
+    std::unique_ptr<pthread_attr_t, int (*)(pthread_attr_t *)> guard(
+        &attr, pthread_attr_destroy);
+    if (opts_.stack_size != 0)
+    {
+        ret = pthread_attr_setstacksize(&attr, opts_.stack_size);
+        if (ret != 0)
+        {
+            throw_system_error("pthread_attr_setstacksize error", ret);
+        }
+    }
+    if (opts_.sched_policy != -1)
+    {
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = opts_.sched_priority;
+        ret = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        if (ret == 0)
+        {
+            ret = pthread_attr_setschedpolicy(&attr, opts_.sched_policy);
+        }
+        if (ret == 0)
+        {
+            ret = pthread_attr_setschedparam(&attr, &param);
+        }
+        if (ret != 0)
+        {
+            throw_system_error("pthread_attr_setsched error", ret);
+        }
+    }
+    std::vector<int> cpus = opts_.cpus;
+    if (cpus.empty() && opts_.numa_node >= 0)
+    {
+        cpus = numa_node_cpus(opts_.numa_node);
+    }
+    if (cpus.size())
+    {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus)
+        {
+            if (cpu < 0 || cpu >= CPU_SETSIZE)
+            {
+                throw_logic_error("invalid cpu ", cpu);
+            }
+            CPU_SET(cpu, &set);
+        }
+        ret = pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        if (ret != 0)
+        {
+            throw_system_error("pthread_attr_setaffinity_np error", ret);
+        }
+#else
+        throw_logic_error("cpu affinity is only supported in linux");
+#endif
+    }
+
+    ret = pthread_create(&thr_, &attr, thr_func, this);
     if (ret != 0)
     {
         throw_system_error("pthread_create error", ret);
@@ -56,9 +202,181 @@ void runnable::detach()
     }
 }
 
+std::vector<int> join_for(const std::vector<runnable *> &thrs,
+                          std::chrono::milliseconds timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    std::vector<int> running;
+    for (size_t i = 0; i < thrs.size(); ++i)
+    {
+        auto left = std::max(deadline - std::chrono::steady_clock::now(),
+                             std::chrono::steady_clock::duration::zero());
+        if (thrs[i]->wait_for(left))
+        {
+            thrs[i]->join();
+        }
+        else
+        {
+            running.push_back(i);
+        }
+    }
+    return running;
+}
+
+std::vector<int> join_reporting(const std::vector<runnable *> &thrs,
+                                std::chrono::milliseconds timeout,
+                                const std::string &role)
+{
+    std::vector<int> running = join_for(thrs, timeout);
+    for (int i : running)
+    {
+        const std::string &name = thrs[i]->get_thread_options().name;
+        LOG_WARNING_FMT("%s %d (%s) not stopped in %d ms", role.c_str(), i,
+                        name.empty() ? "unnamed" : name.c_str(),
+                        static_cast<int>(timeout.count()));
+    }
+    for (int i : running)
+    {
+        thrs[i]->join();
+    }
+    return running;
+}
+
 void runnable::send_signal(int sig) noexcept
 {
     pthread_kill(thr_, sig);
 }
 
+void runnable::set_thread_options(const thread_options &opts)
+{
+    opts_ = opts;
+}
+
+const thread_options &runnable::get_thread_options() const noexcept
+{
+    return opts_;
+}
+
+// Parse list like "0-3,8,10-11" used by sysfs.
+static std::vector<int> read_cpu_list(const std::string &path)
+{
+    std::vector<int> ids;
+    std::ifstream in(path);
+    std::string list;
+    if (!(in >> list))
+    {
+        return ids;
+    }
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ','))
+    {
+        size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos
+                       ? first
+                       : std::stoi(range.substr(dash + 1));
+        for (int i = first; i <= last; ++i)
+        {
+            ids.push_back(i);
+        }
+    }
+    return ids;
+}
+
+static int read_int(const std::string &path, int fallback)
+{
+    std::ifstream in(path);
+    int value;
+    if (!(in >> value))
+    {
+        return fallback;
+    }
+    return value;
+}
+
+std::vector<int> numa_node_cpus(int node)
+{
+    return read_cpu_list("/sys/devices/system/node/node" +
+                         std::to_string(node) + "/cpulist");
+}
+
+int numa_node_of_cpu(int cpu)
+{
+    for (int node : read_cpu_list("/sys/devices/system/node/online"))
+    {
+        std::vector<int> cpus = numa_node_cpus(node);
+        if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end())
+        {
+            return node;
+        }
+    }
+    return -1;
+}
+
+std::vector<std::vector<int>> physical_cores()
+{
+    std::vector<int> cpus = read_cpu_list("/sys/devices/system/cpu/online");
+    if (cpus.empty())
+    {
+        long num = sysconf(_SC_NPROCESSORS_ONLN);
+        for (long i = 0; i < num; ++i)
+        {
+            cpus.push_back(i);
+        }
+    }
+#ifdef __linux__
+    // CPUs outside affinity of process, such as in containers or under
+    // taskset, can not be bound to.
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    {
+        cpus.erase(std::remove_if(cpus.begin(), cpus.end(),
+                                  [&allowed](int cpu)
+                                  {
+                                      return cpu < 0 || cpu >= CPU_SETSIZE ||
+                                             !CPU_ISSET(cpu, &allowed);
+                                  }),
+                   cpus.end());
+    }
+#endif
+    std::map<std::pair<int, int>, std::vector<int>> cores;
+    for (int cpu : cpus)
+    {
+        std::string topo =
+            "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+        int package = read_int(topo + "physical_package_id", 0);
+        // Unknown core is a core of its own.
+        int core = read_int(topo + "core_id", -1 - cpu);
+        cores[{package, core}].push_back(cpu);
+    }
+    std::vector<std::vector<int>> groups;
+    for (auto &core : cores)
+    {
+        groups.push_back(std::move(core.second));
+    }
+    return groups;
+}
+
+std::vector<thread_options> spread_physical_cores(int num,
+                                                  const std::string &name)
+{
+    std::vector<std::vector<int>> cores = physical_cores();
+    std::vector<thread_options> opts(num);
+    for (int i = 0; i < num && cores.size(); ++i)
+    {
+#ifdef __linux__
+        const std::vector<int> &core = cores[i % cores.size()];
+        opts[i].cpus = core;
+        opts[i].numa_node = numa_node_of_cpu(core.front());
+#endif
+        if (!name.empty())
+        {
+            opts[i].name = name + "-" + std::to_string(i);
+        }
+    }
+    return opts;
+}
+
 }  // namespace cppev
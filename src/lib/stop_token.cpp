@@ -0,0 +1,100 @@
+#include "cppev/stop_token.h"
+
+#include <algorithm>
+
+namespace cppev
+{
+
+stop_state::stop_state() noexcept
+    : requested_(false), next_id_(0), running_(0), parent_id_(0)
+{
+}
+
+stop_state::~stop_state()
+{
+    if (parent_ && parent_id_)
+    {
+        parent_->remove(parent_id_);
+    }
+}
+
+void stop_state::link(const std::shared_ptr<stop_state> &child,
+                      const std::shared_ptr<stop_state> &parent)
+{
+    // Weak reference, so that parent does not keep children alive.
+    std::weak_ptr<stop_state> weak = child;
+    child->parent_ = parent;
+    child->parent_id_ = parent->add(
+        [weak]
+        {
+            if (auto state = weak.lock())
+            {
+                state->request_stop();
+            }
+        });
+}
+
+bool stop_state::request_stop()
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    if (requested_.load(std::memory_order_relaxed))
+    {
+        return false;
+    }
+    requested_.store(true, std::memory_order_release);
+    cond_.notify_all();
+    running_thread_ = std::this_thread::get_id();
+    // Callbacks run out of lock in order of registration, each may remove
+    // others or itself.
+    while (!callbacks_.empty())
+    {
+        {
+            auto callback = std::move(callbacks_.front());
+            callbacks_.erase(callbacks_.begin());
+            running_ = callback.first;
+            lock.unlock();
+            callback.second();
+        }
+        lock.lock();
+        running_ = 0;
+        cond_.notify_all();
+    }
+    return true;
+}
+
+uint64_t stop_state::add(stop_callback_handler &&handler)
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    if (requested_.load(std::memory_order_relaxed))
+    {
+        lock.unlock();
+        handler();
+        return 0;
+    }
+    uint64_t id = ++next_id_;
+    callbacks_.emplace_back(id, std::move(handler));
+    return id;
+}
+
+void stop_state::remove(uint64_t id) noexcept
+{
+    stop_callback_handler handler;
+    std::unique_lock<std::mutex> lock(lock_);
+    auto iter = std::find_if(callbacks_.begin(), callbacks_.end(),
+                             [id](const auto &callback)
+                             { return callback.first == id; });
+    if (iter != callbacks_.end())
+    {
+        // Destroyed out of lock.
+        handler = std::move(iter->second);
+        callbacks_.erase(iter);
+        return;
+    }
+    // Callback removing itself does not wait.
+    if (running_thread_ != std::this_thread::get_id())
+    {
+        cond_.wait(lock, [this, id] { return running_ != id; });
+    }
+}
+
+}  // namespace cppev
@@ -1,5 +1,14 @@
 #include "cppev/tcp.h"
 
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
 #include "cppev/logger.h"
 
 namespace cppev
@@ -14,6 +23,16 @@ data_storage::data_storage(void *external_data_ptr)
       on_read_complete(idle_handler),
       on_write_complete(idle_handler),
       on_closed(idle_handler),
+      connections(0),
+      draining(false),
+      edge_trigger(sysconfig::reactor_edge_trigger),
+      pool(nullptr),
+      tracker(nullptr),
+      dns(nullptr),
+      on_connect_failed([](const std::tuple<std::string, int, family> &) {}),
+      fastopen_qlen(0),
+      defer_accept(0),
+      fastopen_connect(false),
       external_data_ptr(external_data_ptr)
 {
 }
@@ -54,42 +73,116 @@ const void *data_storage::external_data() const noexcept
     return external_data_ptr;
 }
 
-void async_write(const std::shared_ptr<socktcp> &iopt)
+// Write queued descriptors with the head of write buffer, then file segments
+// and then write buffer, whose data are always behind the segments. Return
+// false if write failed unrecoverably.
+static bool write_pending(const std::shared_ptr<socktcp> &iopt)
 {
-    data_storage *dp = reinterpret_cast<data_storage *>(iopt->evlp().data());
-    if (!exception_guard([&iops = iopt] { iops->write_all(); }))
+    if (!exception_guard(
+            [&iops = iopt]
+            {
+                if (iops->write_fds() && iops->write_files())
+                {
+                    iops->write_zerocopy();
+                }
+            }))
     {
         LOG_ERROR_FMT("Syscall write error for fd %d", iopt->fd());
+        return false;
     }
-    if (0 == iopt->wbuffer().size())
+    return true;
+}
+
+// Whether file segments, zero copy blocks and write buffer are sent.
+static bool write_done(const std::shared_ptr<socktcp> &iopt)
+{
+    return iopt->files_empty() && !iopt->zerocopy_unsent() &&
+           0 == iopt->wbuffer().size();
+}
+
+// Edge triggered socket left writable by a file source without data gets no
+// more edge, retry after the other events of this loop.
+static void retry_blocked_source(const std::shared_ptr<socktcp> &iopt)
+{
+    std::shared_ptr<io> iop = std::static_pointer_cast<io>(iopt);
+    iopt->evlp().post(
+        [iop]
+        {
+            if (!iop->is_closed())
+            {
+                iohandler::on_writable(iop);
+            }
+        });
+}
+
+void async_write(const std::shared_ptr<socktcp> &iopt)
+{
+    data_storage *dp = reinterpret_cast<data_storage *>(iopt->evlp().data());
+    bool ok = write_pending(iopt);
+    if (write_done(iopt))
     {
         dp->on_write_complete(iopt);
     }
     else
     {
-        if (iopt->eop() || iopt->is_reset())
+        if (!ok || iopt->eop() || iopt->is_reset())
         {
             if (!iopt->is_closed())
             {
-                dp->on_closed(iopt);
-                std::shared_ptr<io> iop = std::static_pointer_cast<io>(iopt);
-                iopt->evlp().fd_clean(iop);
-                iopt->close();
+                iohandler::close_conn(iopt);
             }
         }
-        else
+        else if (!dp->edge_trigger)
         {
             std::shared_ptr<io> iop = std::static_pointer_cast<io>(iopt);
             iopt->evlp().fd_activate(iop, fd_event::fd_writable);
         }
+        else if (iopt->file_source_blocked())
+        {
+            retry_blocked_source(iopt);
+        }
+        // Edge triggered writable is always activated, the rest is sent on
+        // the next edge since kernel buffer is full.
+    }
+}
+
+void async_sendfile(const std::shared_ptr<socktcp> &iopt, int fd,
+                    off_t offset, off_t len,
+                    const std::shared_ptr<const void> &owner)
+{
+    // Flush write buffer first so that usually nothing has to be copied
+    // into the segment.
+    if (iopt->files_empty() && iopt->wbuffer().size())
+    {
+        exception_guard([&iops = iopt] { iops->write_all(); });
     }
+    iopt->queue_file(fd, offset, len, owner);
+    async_write(iopt);
+}
+
+void async_send_fds(const std::shared_ptr<socktcp> &iopt,
+                    const std::vector<int> &fds)
+{
+    iopt->queue_fds(fds);
+    async_write(iopt);
 }
 
 void safely_close(const std::shared_ptr<socktcp> &iopt)
 {
+    if (iopt->is_closed())
+    {
+        return;
+    }
+    data_storage *dp = reinterpret_cast<data_storage *>(iopt->evlp().data());
+    if (dp->pool)
+    {
+        dp->pool->on_closed(iopt);
+    }
+    dp->connections--;
     std::shared_ptr<io> iop = std::static_pointer_cast<io>(iopt);
     // epoll/kqueue will remove fd when it's closed
     iopt->evlp().fd_clean(iop);
+    iopt->defer_zerocopy();
     iopt->close();
 }
 
@@ -99,6 +192,11 @@ void *external_data(const std::shared_ptr<socktcp> &iopt)
         ->external_data();
 }
 
+bool is_draining(const std::shared_ptr<socktcp> &iopt)
+{
+    return (reinterpret_cast<data_storage *>(iopt->evlp().data()))->draining;
+}
+
 size_t host_hash::operator()(
     const std::tuple<std::string, int, family> &h) const
 {
@@ -127,6 +225,34 @@ static void with_exception_handling(const std::string &thr_name,
     LOG_INFO_FMT("Thread %s ending", thr_name.c_str());
 }
 
+// Set event mode of connection before its events are activated.
+static void prepare_conn(const std::shared_ptr<socktcp> &iopt)
+{
+    data_storage *dp = reinterpret_cast<data_storage *>(iopt->evlp().data());
+    if (dp->edge_trigger)
+    {
+        iopt->evlp().fd_set_mode(std::static_pointer_cast<io>(iopt),
+                                 fd_event_mode::edge_trigger);
+    }
+}
+
+// Activate events of connection after on_accept or on_connect. Edge
+// triggered writable is activated once for the lifetime of connection.
+static void activate_conn(const std::shared_ptr<socktcp> &iopt)
+{
+    if (iopt->is_closed())
+    {
+        return;
+    }
+    data_storage *dp = reinterpret_cast<data_storage *>(iopt->evlp().data());
+    std::shared_ptr<io> iop = std::static_pointer_cast<io>(iopt);
+    iopt->evlp().fd_activate(iop, fd_event::fd_readable);
+    if (dp->edge_trigger)
+    {
+        iopt->evlp().fd_activate(iop, fd_event::fd_writable);
+    }
+}
+
 iohandler::iohandler(data_storage *data)
     : evlp_(reinterpret_cast<void *>(data), reinterpret_cast<void *>(this))
 {
@@ -136,13 +262,31 @@ iohandler::~iohandler() = default;
 
 void iohandler::on_readable(const std::shared_ptr<io> &iop)
 {
-    std::shared_ptr<socktcp> iopt = std::dynamic_pointer_cast<socktcp>(iop);
+    std::shared_ptr<socktcp> iopt(iop, iop->to_socktcp());
     if (iopt == nullptr)
     {
-        throw_logic_error("dynamic_pointer_cast error");
+        throw_logic_error("to_socktcp error");
     }
     data_storage *dp = reinterpret_cast<data_storage *>(iop->evlp().data());
-    if (!exception_guard([&iops = iopt] { iops->read_all(); }))
+    // Zero copy completions wake up readable event by EPOLLERR.
+    if (iopt->zerocopy_pending() &&
+        !exception_guard([&iops = iopt] { iops->drain_zerocopy(); }))
+    {
+        LOG_ERROR_FMT("Drain zero copy completions error for fd %d",
+                      iopt->fd());
+    }
+    // Hot connection reads at most the budget so that others of the worker
+    // are not starved.
+    int budget = sysconfig::reactor_read_budget;
+    int total = 0;
+    if (!exception_guard(
+            [&iops = iopt, &total, budget]
+            {
+                int step = sysconfig::buffer_io_step;
+                total = iops->get_fd_passing()
+                            ? iops->read_all_fds(step, budget)
+                            : iops->read_all(step, budget);
+            }))
     {
         LOG_ERROR_FMT("Syscall read error for fd %d", iopt->fd());
     }
@@ -157,39 +301,59 @@ void iohandler::on_readable(const std::shared_ptr<io> &iop)
     }
     if ((iopt->eof() || iopt->is_reset()) && (!iopt->is_closed()))
     {
-        dp->on_closed(iopt);
-        iopt->evlp().fd_clean(iop);
-        iopt->close();
+        close_conn(iopt);
+    }
+    else if (dp->edge_trigger && total >= budget && !iopt->is_closed())
+    {
+        // No more edge comes for the data left, continue after the other
+        // events of this loop.
+        iopt->evlp().post(
+            [iop]
+            {
+                if (!iop->is_closed())
+                {
+                    iohandler::on_readable(iop);
+                }
+            });
     }
 }
 
 void iohandler::on_writable(const std::shared_ptr<io> &iop)
 {
-    std::shared_ptr<socktcp> iopt = std::dynamic_pointer_cast<socktcp>(iop);
+    std::shared_ptr<socktcp> iopt(iop, iop->to_socktcp());
     if (iopt == nullptr)
     {
-        throw_logic_error("dynamic_pointer_cast error");
+        throw_logic_error("to_socktcp error");
     }
     data_storage *dp = reinterpret_cast<data_storage *>(iop->evlp().data());
-    if (!exception_guard([&iops = iopt] { iops->write_all(); }))
+    // Edge triggered writable also fires when nothing is pending, such as
+    // on activation.
+    if (dp->edge_trigger && write_done(iopt))
     {
-        LOG_ERROR_FMT("Syscall write error for fd %d", iopt->fd());
+        return;
     }
-    if (0 == iopt->wbuffer().size())
+    bool ok = write_pending(iopt);
+    if (write_done(iopt))
     {
         iopt->wbuffer().clear();
-        iopt->evlp().fd_deactivate(iop, fd_event::fd_writable);
+        if (!dp->edge_trigger)
+        {
+            iopt->evlp().fd_deactivate(iop, fd_event::fd_writable);
+        }
         dp->on_write_complete(iopt);
     }
     else if ((iopt->wbuffer().capacity() >> 1) < iopt->wbuffer().waste())
     {
         iopt->wbuffer().tiny();
     }
-    if ((iopt->eop() || iopt->is_reset()) && (!iopt->is_closed()))
+    if ((!ok || iopt->eop() || iopt->is_reset()) && (!iopt->is_closed()))
     {
-        dp->on_closed(iopt);
-        iopt->evlp().fd_clean(iop);
-        iopt->close();
+        close_conn(iopt);
+    }
+    else if (dp->edge_trigger && !write_done(iopt) &&
+             iopt->file_source_blocked() && !iopt->is_closed())
+    {
+        retry_blocked_source(iopt);
     }
 }
 
@@ -197,10 +361,10 @@ void iohandler::on_conn_establish(const std::shared_ptr<io> &iop,
                                   init_checker checker,
                                   tcp_event_handler handler)
 {
-    std::shared_ptr<socktcp> iopt = std::dynamic_pointer_cast<socktcp>(iop);
+    std::shared_ptr<socktcp> iopt(iop, iop->to_socktcp());
     if (iopt == nullptr)
     {
-        throw_logic_error("dynamic_pointer_cast error");
+        throw_logic_error("to_socktcp error");
     }
     iopt->evlp().fd_remove_and_deactivate(iop, fd_event::fd_writable);
 
@@ -208,16 +372,48 @@ void iohandler::on_conn_establish(const std::shared_ptr<io> &iop,
     {
         return;
     }
+    reinterpret_cast<data_storage *>(iop->evlp().data())->connections++;
 
-    // The sequence CANNOT be changed, since on_accept may call async_write
+    // The sequence CANNOT be changed, since on_connect may call async_write
+    prepare_conn(iopt);
     iopt->evlp().fd_register(iop, fd_event::fd_writable,
                              iohandler::on_writable);
+    iopt->evlp().fd_register(iop, fd_event::fd_readable,
+                             iohandler::on_readable);
     handler(iopt);
-    iopt->evlp().fd_register_and_activate(iop, fd_event::fd_readable,
-                                          iohandler::on_readable);
+    activate_conn(iopt);
     LOG_INFO_FMT("Connected socket %d initialized", iop->fd());
 }
 
+void iohandler::on_conn_accepted(const std::shared_ptr<socktcp> &iopt)
+{
+    data_storage *dp = reinterpret_cast<data_storage *>(iopt->evlp().data());
+
+    // Readable is activated after on_accept so that no data is read before
+    // it, while on_accept may call async_write since writable is registered.
+    prepare_conn(iopt);
+    dp->on_accept(iopt);
+    activate_conn(iopt);
+    LOG_INFO_FMT("Accepted socket %d initialized", iopt->fd());
+}
+
+void iohandler::close_conn(const std::shared_ptr<socktcp> &iopt)
+{
+    if (iopt->is_closed())
+    {
+        return;
+    }
+    data_storage *dp = reinterpret_cast<data_storage *>(iopt->evlp().data());
+    // Leave the pool first so that on_closed cannot check it out again.
+    if (dp->pool)
+    {
+        dp->pool->on_closed(iopt);
+    }
+    dp->on_closed(iopt);
+    // Bookkeeping is done once even if on_closed called safely_close.
+    safely_close(iopt);
+}
+
 event_loop &iohandler::evlp()
 {
     return evlp_;
@@ -225,6 +421,7 @@ event_loop &iohandler::evlp()
 
 void iohandler::run_without_exception_handling()
 {
+    evlp_.set_stop_token(get_stop_token());
     evlp_.loop_forever();
 }
 
@@ -237,10 +434,7 @@ void iohandler::run_impl()
 
 void iohandler::shutdown()
 {
-    if (!evlp_.stop_loop(sysconfig::reactor_shutdown_timeout))
-    {
-        LOG_WARNING_FMT("iohandler shutdown wait timeout");
-    }
+    request_stop();
 }
 
 acceptor::acceptor(data_storage *data)
@@ -252,8 +446,17 @@ acceptor::~acceptor() = default;
 
 void acceptor::listen(int port, family f, const char *ip)
 {
+    data_storage *dp = reinterpret_cast<data_storage *>(evlp_.data());
     std::shared_ptr<socktcp> sock = io_factory::get_socktcp(f);
     sock->bind(ip, port);
+    if (dp->fastopen_qlen > 0)
+    {
+        sock->set_tcp_fastopen(dp->fastopen_qlen);
+    }
+    if (dp->defer_accept > 0)
+    {
+        sock->set_tcp_defer_accept(dp->defer_accept);
+    }
     sock->listen();
     socks_.push_back(sock);
     LOG_INFO_FMT("Listening socket %d working in %s %d", sock->fd(),
@@ -269,28 +472,42 @@ void acceptor::listen_unix(const std::string &path, bool remove)
     LOG_INFO_FMT("Listening socket %d working in %s", sock->fd(), path.c_str());
 }
 
+void acceptor::inherit(const std::shared_ptr<socktcp> &sock)
+{
+    socks_.push_back(sock);
+    LOG_INFO_FMT("Listening socket %d inherited", sock->fd());
+}
+
+const std::vector<std::shared_ptr<socktcp>> &acceptor::sockets() const noexcept
+{
+    return socks_;
+}
+
 void acceptor::on_acpt_readable(const std::shared_ptr<io> &iop)
 {
-    std::shared_ptr<socktcp> iopt = std::dynamic_pointer_cast<socktcp>(iop);
+    std::shared_ptr<socktcp> iopt(iop, iop->to_socktcp());
     if (iopt == nullptr)
     {
-        throw_logic_error("dynamic_pointer_cast error");
+        throw_logic_error("to_socktcp error");
     }
     data_storage *dp = reinterpret_cast<data_storage *>(iopt->evlp().data());
 
-    static iohandler::init_checker checker = [](const std::shared_ptr<io> &)
-    { return true; };
-
     std::vector<std::shared_ptr<socktcp>> conns = iopt->accept();
 
     for (auto &conn : conns)
     {
         LOG_INFO_FMT("Listening socket %d accepted new socket %d", iopt->fd(),
                      conn->fd());
-        dp->minloads_get_evlp()->fd_register_and_activate(
-            std::static_pointer_cast<io>(conn), fd_event::fd_writable,
-            std::bind(iohandler::on_conn_establish, std::placeholders::_1,
-                      checker, dp->on_accept));
+        // Handlers are registered here so that the loads include the
+        // connection when choosing worker for the next one, no event is
+        // activated until on_accept is done by the worker.
+        event_loop *evlp = dp->minloads_get_evlp();
+        std::shared_ptr<io> iop = std::static_pointer_cast<io>(conn);
+        evlp->fd_register(iop, fd_event::fd_writable, iohandler::on_writable);
+        evlp->fd_register(iop, fd_event::fd_readable, iohandler::on_readable);
+        // Counted before posted so that drain waits for queued ones.
+        dp->connections++;
+        evlp->post([conn] { iohandler::on_conn_accepted(conn); });
     }
 }
 
@@ -302,6 +519,7 @@ void acceptor::run_without_exception_handling()
                                        fd_event::fd_readable,
                                        acceptor::on_acpt_readable);
     }
+    evlp_.set_stop_token(get_stop_token());
     evlp_.loop_forever();
 }
 
@@ -313,10 +531,142 @@ void acceptor::run_impl()
 
 void acceptor::shutdown()
 {
-    if (!evlp_.stop_loop(sysconfig::reactor_shutdown_timeout))
+    request_stop();
+}
+
+connect_tracker::connect_tracker() : rde_(std::random_device()())
+{
+}
+
+connect_tracker::~connect_tracker() = default;
+
+void connect_tracker::set_policy(const host_type &h,
+                                 const retry_policy &policy)
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    policies_[h] = policy;
+}
+
+void connect_tracker::set_default_policy(const retry_policy &policy)
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    default_policy_ = policy;
+}
+
+const retry_policy &connect_tracker::policy_nts(const host_type &h) const
+{
+    auto iter = policies_.find(h);
+    return iter == policies_.end() ? default_policy_ : iter->second;
+}
+
+int connect_tracker::retry_delay_nts(const host_state &hs,
+                                     const retry_policy &policy, int attempt)
+{
+    if (attempt >= policy.max_retries)
+    {
+        return -1;
+    }
+    double backoff = policy.base_backoff;
+    for (int i = 0; i < attempt && backoff < policy.max_backoff; ++i)
+    {
+        backoff *= policy.multiplier;
+    }
+    backoff = std::min(backoff, static_cast<double>(policy.max_backoff));
+    double jitter = std::min(std::max(policy.jitter, 0.0), 1.0);
+    std::uniform_real_distribution<double> dist(backoff * (1 - jitter),
+                                                backoff);
+    int delay = static_cast<int>(dist(rde_));
+    if (hs.stats.state == breaker_state::open)
+    {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            hs.opened + std::chrono::milliseconds(policy.breaker_cooldown) -
+            std::chrono::steady_clock::now());
+        delay = std::max(delay, static_cast<int>(remaining.count()) + 1);
+    }
+    return delay;
+}
+
+int connect_tracker::acquire(const host_type &h, int attempt)
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    host_state &hs = states_[h];
+    const retry_policy &policy = policy_nts(h);
+    switch (hs.stats.state)
+    {
+    case breaker_state::closed:
+        return 0;
+    case breaker_state::open:
+        if (std::chrono::steady_clock::now() - hs.opened >=
+            std::chrono::milliseconds(policy.breaker_cooldown))
+        {
+            hs.stats.state = breaker_state::half_open;
+            hs.probing = true;
+            return 0;
+        }
+        break;
+    case breaker_state::half_open:
+        if (!hs.probing)
+        {
+            hs.probing = true;
+            return 0;
+        }
+        break;
+    }
+    ++hs.stats.rejects;
+    return retry_delay_nts(hs, policy, attempt);
+}
+
+void connect_tracker::on_success(const host_type &h, int64_t latency)
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    host_state &hs = states_[h];
+    ++hs.stats.successes;
+    hs.stats.consecutive_failures = 0;
+    hs.stats.last_latency = latency;
+    hs.stats.max_latency = std::max(hs.stats.max_latency, latency);
+    hs.stats.total_latency += latency;
+    hs.stats.state = breaker_state::closed;
+    hs.probing = false;
+}
+
+int connect_tracker::on_failure(const host_type &h, int attempt)
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    host_state &hs = states_[h];
+    const retry_policy &policy = policy_nts(h);
+    ++hs.stats.failures;
+    ++hs.stats.consecutive_failures;
+
+    // Failed trial reopens the circuit, otherwise open it once failures in a
+    // row reach the threshold.
+    if (hs.stats.state == breaker_state::half_open ||
+        (hs.stats.state == breaker_state::closed &&
+         policy.breaker_threshold > 0 &&
+         hs.stats.consecutive_failures >= policy.breaker_threshold))
+    {
+        hs.stats.state = breaker_state::open;
+        hs.opened = std::chrono::steady_clock::now();
+        hs.probing = false;
+        LOG_WARNING_FMT("Circuit of %s %d opened after %d failures",
+                        std::get<0>(h).c_str(), std::get<1>(h),
+                        hs.stats.consecutive_failures);
+    }
+
+    // Retry of open circuit waits for the trial instead of retrying into
+    // it.
+    return retry_delay_nts(hs, policy, attempt);
+}
+
+std::unordered_map<connect_tracker::host_type, connect_stats, host_hash>
+connect_tracker::snapshot()
+{
+    std::unordered_map<host_type, connect_stats, host_hash> ret;
+    std::unique_lock<std::mutex> lock(lock_);
+    for (const auto &state : states_)
     {
-        LOG_WARNING_FMT("acceptor shutdown wait timeout");
+        ret.emplace(state.first, state.second.stats);
     }
+    return ret;
 }
 
 connector::connector(data_storage *data)
@@ -356,40 +706,9 @@ void connector::on_pipe_readable(const std::shared_ptr<io> &iop)
     {
         throw_logic_error("dynamic_cast error");
     }
-    data_storage *dp = reinterpret_cast<data_storage *>(iops->evlp().data());
-
     connector *pseudo_this =
         reinterpret_cast<connector *>(iops->evlp().owner());
 
-    iohandler::init_checker checker =
-        [pseudo_this](const std::shared_ptr<io> &iop) -> bool
-    {
-        std::shared_ptr<socktcp> iopt = std::dynamic_pointer_cast<socktcp>(iop);
-        bool ret = iopt->check_connect();
-        if (!ret)
-        {
-            std::tuple<std::string, int, family> h = iopt->target_uri();
-
-            {
-                std::unique_lock<std::mutex> _(pseudo_this->lock_);
-                pseudo_this->failures_[h] += 1;
-            }
-            iopt->evlp().fd_clean(iop);
-            iopt->close();
-            if (family::local == std::get<2>(h))
-            {
-                LOG_WARNING_FMT("Connect %s failed when checking writable",
-                                std::get<0>(h).c_str());
-            }
-            else
-            {
-                LOG_WARNING_FMT("Connect %s %d failed when checking writable",
-                                std::get<0>(h).c_str(), std::get<1>(h));
-            }
-        }
-        return ret;
-    };
-
     if (!exception_guard([&iops] { iops->read_all(1); }))
     {
         LOG_ERROR_FMT("Syscall read error for fd %d", iops->fd());
@@ -406,49 +725,235 @@ void connector::on_pipe_readable(const std::shared_ptr<io> &iop)
     {
         for (int i = 0; i < iter->second; ++i)
         {
-            std::shared_ptr<socktcp> sock =
-                io_factory::get_socktcp(std::get<2>(iter->first));
-            bool succeed;
-            if (std::get<2>(iter->first) == family::local)
-            {
-                succeed = sock->connect_unix(std::get<0>(iter->first));
-            }
-            else
-            {
-                succeed = sock->connect(std::get<0>(iter->first),
-                                        std::get<1>(iter->first));
-            }
-            if (succeed)
+            pseudo_this->connect(iter->first, 0);
+        }
+    }
+}
+
+void connector::connect(const host_type &h, int attempt)
+{
+    data_storage *dp = reinterpret_cast<data_storage *>(evlp_.data());
+
+    int delay = dp->tracker ? dp->tracker->acquire(h, attempt) : 0;
+    if (delay < 0)
+    {
+        LOG_WARNING_FMT("Connect %s %d rejected by open circuit",
+                        std::get<0>(h).c_str(), std::get<1>(h));
+        give_up(h);
+        return;
+    }
+    if (delay > 0)
+    {
+        // Loop sends the trial once the circuit lets it through.
+        LOG_INFO_FMT("Connect %s %d rejected by open circuit, retry %d "
+                     "scheduled after %d ms",
+                     std::get<0>(h).c_str(), std::get<1>(h), attempt + 1,
+                     delay);
+        evlp_.post_after(delay,
+                         [this, h, attempt] { this->connect(h, attempt + 1); });
+        return;
+    }
+
+    auto race = std::make_shared<race_state>();
+    race->h = h;
+    race->attempt = attempt;
+    race->start = std::chrono::steady_clock::now();
+    race->next = 0;
+    race->inflight = 0;
+    race->won = false;
+
+    const std::string &host = std::get<0>(h);
+    family f = std::get<2>(h);
+    if (dp->dns == nullptr || is_ip_literal(host, f))
+    {
+        race->addrs.emplace_back(host, f);
+        race_next(race);
+        return;
+    }
+
+    // Resolver thread hands addresses back to connect thread.
+    dp->dns->resolve(
+        host,
+        [this, race, f](const std::vector<resolved_address> &addrs)
+        {
+            race->addrs = interleave_addresses(addrs, f);
+            evlp_.post([this, race] { this->race_next(race); });
+        });
+}
+
+void connector::race_next(const std::shared_ptr<race_state> &race)
+{
+    data_storage *dp = reinterpret_cast<data_storage *>(evlp_.data());
+    const host_type &h = race->h;
+
+    iohandler::init_checker checker =
+        [this, race](const std::shared_ptr<io> &iop) -> bool
+    {
+        std::shared_ptr<socktcp> iopt(iop, iop->to_socktcp());
+        data_storage *dp =
+            reinterpret_cast<data_storage *>(iopt->evlp().data());
+        const host_type &h = race->h;
+        bool ret = iopt->check_connect();
+        if (ret && race->won.exchange(true))
+        {
+            // Lost the race, another address connected first.
+            iopt->evlp().fd_clean(iop);
+            iopt->close();
+            return false;
+        }
+        if (ret)
+        {
+            if (dp->tracker)
             {
-                dp->minloads_get_evlp()->fd_register_and_activate(
-                    std::static_pointer_cast<io>(sock), fd_event::fd_writable,
-                    std::bind(iohandler::on_conn_establish,
-                              std::placeholders::_1, checker, dp->on_connect));
+                dp->tracker->on_success(
+                    h, std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::steady_clock::now() - race->start)
+                           .count());
             }
-            else
+            return true;
+        }
+
+        auto target = iopt->target_uri();
+        iopt->evlp().fd_clean(iop);
+        iopt->close();
+        if (family::local == std::get<2>(h))
+        {
+            LOG_WARNING_FMT("Connect %s failed when checking writable",
+                            std::get<0>(target).c_str());
+        }
+        else
+        {
+            LOG_WARNING_FMT("Connect %s %d failed when checking writable",
+                            std::get<0>(target).c_str(), std::get<1>(h));
+        }
+        // Next address or retry is scheduled by connect thread.
+        evlp_.post(
+            [this, race]
             {
+                --race->inflight;
+                if (race->won)
                 {
-                    std::unique_lock<std::mutex> _(pseudo_this->lock_);
-                    pseudo_this->failures_[iter->first] += 1;
+                    return;
                 }
-                std::error_code err_code(errno, std::system_category());
-                if (std::get<2>(iter->first) == family::local)
+                if (race->next < race->addrs.size())
                 {
-                    LOG_WARNING_FMT(
-                        "Connect %s failed with syscall errno %d : %s",
-                        std::get<0>(iter->first).c_str(), err_code.value(),
-                        err_code.message().c_str());
+                    this->race_next(race);
                 }
-                else
+                else if (race->inflight == 0)
                 {
-                    LOG_WARNING_FMT(
-                        "Connect %s %d failed with syscall errno %d : %s",
-                        std::get<0>(iter->first).c_str(),
-                        std::get<1>(iter->first), err_code.value(),
-                        err_code.message().c_str());
+                    this->on_connect_failed(race->h, race->attempt);
                 }
+            });
+        return false;
+    };
+
+    tcp_event_handler on_connect = dp->on_connect;
+    if (dp->pool)
+    {
+        on_connect = [dp](const std::shared_ptr<socktcp> &iopt)
+        {
+            if (!dp->pool->on_connect(iopt))
+            {
+                dp->on_connect(iopt);
+            }
+        };
+    }
+
+    while (race->next < race->addrs.size())
+    {
+        const std::string &ip = std::get<0>(race->addrs[race->next]);
+        family f = std::get<1>(race->addrs[race->next]);
+        ++race->next;
+
+        std::shared_ptr<socktcp> sock = io_factory::get_socktcp(f);
+        bool succeed;
+        if (f == family::local)
+        {
+            succeed = sock->connect_unix(ip);
+        }
+        else
+        {
+            // Kernel without Fast Open support connects as usual.
+            if (dp->fastopen_connect &&
+                !exception_guard([&sock] { sock->set_tcp_fastopen_connect(); }))
+            {
+                LOG_WARNING_FMT("Fast Open unavailable for socket %d",
+                                sock->fd());
+            }
+            succeed = sock->connect(ip, std::get<1>(h));
+        }
+        if (succeed)
+        {
+            ++race->inflight;
+            dp->minloads_get_evlp()->fd_register_and_activate(
+                std::static_pointer_cast<io>(sock), fd_event::fd_writable,
+                std::bind(iohandler::on_conn_establish, std::placeholders::_1,
+                          checker, on_connect));
+            // Start the next address if this one is still pending after the
+            // connection attempt delay (RFC 8305 section 5).
+            if (race->next < race->addrs.size())
+            {
+                size_t next = race->next;
+                evlp_.post_after(sysconfig::connection_attempt_delay,
+                                 [this, race, next]
+                                 {
+                                     if (!race->won && race->next == next)
+                                     {
+                                         this->race_next(race);
+                                     }
+                                 });
             }
+            return;
+        }
+
+        std::error_code err_code(errno, std::system_category());
+        if (f == family::local)
+        {
+            LOG_WARNING_FMT("Connect %s failed with syscall errno %d : %s",
+                            ip.c_str(), err_code.value(),
+                            err_code.message().c_str());
+        }
+        else
+        {
+            LOG_WARNING_FMT("Connect %s %d failed with syscall errno %d : %s",
+                            ip.c_str(), std::get<1>(h), err_code.value(),
+                            err_code.message().c_str());
+        }
+    }
+
+    if (race->inflight == 0)
+    {
+        if (race->addrs.empty())
+        {
+            LOG_WARNING_FMT("Connect %s %d failed without resolved address",
+                            std::get<0>(h).c_str(), std::get<1>(h));
         }
+        on_connect_failed(h, race->attempt);
+    }
+}
+
+void connector::on_connect_failed(const host_type &h, int attempt)
+{
+    data_storage *dp = reinterpret_cast<data_storage *>(evlp_.data());
+    int backoff = dp->tracker ? dp->tracker->on_failure(h, attempt) : -1;
+    if (backoff < 0)
+    {
+        give_up(h);
+        return;
+    }
+    LOG_INFO_FMT("Connect %s %d retry %d scheduled after %d ms",
+                 std::get<0>(h).c_str(), std::get<1>(h), attempt + 1, backoff);
+    evlp_.post_after(backoff,
+                     [this, h, attempt] { this->connect(h, attempt + 1); });
+}
+
+void connector::give_up(const host_type &h)
+{
+    data_storage *dp = reinterpret_cast<data_storage *>(evlp_.data());
+    dp->on_connect_failed(h);
+    if (dp->pool)
+    {
+        dp->pool->on_connect_failed(h);
     }
 }
 
@@ -457,6 +962,7 @@ void connector::run_without_exception_handling()
     evlp_.fd_register_and_activate(std::static_pointer_cast<io>(rdp_),
                                    fd_event::fd_readable,
                                    connector::on_pipe_readable);
+    evlp_.set_stop_token(get_stop_token());
     evlp_.loop_forever();
 }
 
@@ -469,20 +975,343 @@ void connector::run_impl()
 
 void connector::shutdown()
 {
-    if (!evlp_.stop_loop(sysconfig::reactor_shutdown_timeout))
-    {
-        LOG_WARNING_FMT("connector shutdown wait timeout");
-    }
+    request_stop();
 }
 
-tcp_common::tcp_common(int iohandler_num, void *external_data)
-    : data_(external_data), tp_(iohandler_num, &data_)
+// Whether connection can be reused.
+static bool is_healthy(const std::shared_ptr<socktcp> &iopt)
 {
-    for (auto &thr : tp_)
+    if (iopt->is_closed() || iopt->eof() || iopt->eop() || iopt->is_reset())
     {
-        data_.evls.push_back(&(thr.evlp()));
+        return false;
     }
-}
+    bool ret = false;
+    if (!exception_guard([&] { ret = iopt->check_connect(); }))
+    {
+        return false;
+    }
+    return ret;
+}
+
+connection_pool::connection_pool(const connect_request &request)
+    : request_(request)
+{
+}
+
+connection_pool::~connection_pool() = default;
+
+int connection_pool::refill_nts(host_pool &hp)
+{
+    int members = hp.members.size();
+    int waiters = hp.waiters.size();
+    int want = std::max(hp.min_size - members - hp.pending,
+                        waiters - hp.pending - hp.returning);
+    int room = hp.max_size - members - hp.pending;
+    int num = std::max(0, std::min(want, room));
+    hp.pending += num;
+    return num;
+}
+
+void connection_pool::set_limits(const host_type &h, int min_size,
+                                 int max_size)
+{
+    if (min_size < 0 || max_size < 1 || min_size > max_size)
+    {
+        throw_logic_error("invalid connection pool size ", min_size, " ",
+                          max_size);
+    }
+    int num;
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        host_pool &hp = pools_[h];
+        hp.min_size = min_size;
+        hp.max_size = max_size;
+        num = refill_nts(hp);
+    }
+    if (num)
+    {
+        request_(h, num);
+    }
+}
+
+int connection_pool::evict_nts(host_pool &hp,
+                               const std::shared_ptr<socktcp> &iopt)
+{
+    hp.members.erase(iopt.get());
+    auto iter = std::find(hp.idle.begin(), hp.idle.end(), iopt);
+    if (iter != hp.idle.end())
+    {
+        hp.idle.erase(iter);
+    }
+    return refill_nts(hp);
+}
+
+void connection_pool::evict(const host_type &h,
+                            const std::shared_ptr<socktcp> &iopt, int num)
+{
+    LOG_INFO_FMT("Evict broken pooled connection %d", iopt->fd());
+    safely_close(iopt);
+    if (num)
+    {
+        request_(h, num);
+    }
+}
+
+void connection_pool::checkout(const host_type &h,
+                               const tcp_event_handler &handler)
+{
+    std::shared_ptr<socktcp> conn;
+    int num = 0;
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        auto iter = pools_.find(h);
+        if (iter == pools_.end())
+        {
+            throw_logic_error("connection pool of ", std::get<0>(h), " ",
+                              std::get<1>(h), " not set");
+        }
+        host_pool &hp = iter->second;
+        if (hp.idle.size())
+        {
+            conn = hp.idle.back();
+            hp.idle.pop_back();
+        }
+        else
+        {
+            hp.waiters.push(handler);
+            num = refill_nts(hp);
+        }
+    }
+    if (num)
+    {
+        request_(h, num);
+    }
+    if (conn)
+    {
+        // Checked and delivered by worker thread owning the connection.
+        conn->evlp().post([this, h, conn, handler]
+                          { deliver(h, conn, handler); });
+    }
+}
+
+void connection_pool::deliver(const host_type &h,
+                              const std::shared_ptr<socktcp> &iopt,
+                              const tcp_event_handler &handler)
+{
+    if (is_healthy(iopt))
+    {
+        handler(iopt);
+        return;
+    }
+    int num;
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        num = evict_nts(pools_[h], iopt);
+    }
+    evict(h, iopt, num);
+    checkout(h, handler);
+}
+
+void connection_pool::checkin(const std::shared_ptr<socktcp> &iopt)
+{
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        auto iter = pools_.find(iopt->target_uri());
+        if (iter == pools_.end() || !iter->second.members.count(iopt.get()))
+        {
+            LOG_WARNING_FMT("Connection %d returned to pool is not pooled",
+                            iopt->fd());
+            return;
+        }
+        // Waiters meanwhile are served by it instead of new connections.
+        ++iter->second.returning;
+    }
+    iopt->evlp().post([this, iopt] { on_checkin(iopt); });
+}
+
+void connection_pool::on_checkin(const std::shared_ptr<socktcp> &iopt)
+{
+    tcp_event_handler handler;
+    bool broken = false;
+    int num = 0;
+    host_type h = iopt->target_uri();
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        host_pool &hp = pools_[h];
+        --hp.returning;
+        // Closed meanwhile, on_closed has removed it.
+        if (!hp.members.count(iopt.get()))
+        {
+            num = refill_nts(hp);
+        }
+        else if (!is_healthy(iopt))
+        {
+            broken = true;
+            num = evict_nts(hp, iopt);
+        }
+        else if (hp.waiters.size())
+        {
+            handler = hp.waiters.front();
+            hp.waiters.pop();
+        }
+        else
+        {
+            hp.idle.push_back(iopt);
+        }
+    }
+    if (broken)
+    {
+        evict(h, iopt, num);
+    }
+    else if (num)
+    {
+        request_(h, num);
+    }
+    if (handler)
+    {
+        handler(iopt);
+    }
+}
+
+void connection_pool::check_idle()
+{
+    std::vector<std::shared_ptr<socktcp>> idle;
+    std::vector<std::tuple<host_type, int>> requests;
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        for (auto &pool : pools_)
+        {
+            host_pool &hp = pool.second;
+            idle.insert(idle.end(), hp.idle.begin(), hp.idle.end());
+            int num = refill_nts(hp);
+            if (num)
+            {
+                requests.emplace_back(pool.first, num);
+            }
+        }
+    }
+    for (auto &iopt : idle)
+    {
+        iopt->evlp().post([this, iopt] { check_idle(iopt); });
+    }
+    for (auto &req : requests)
+    {
+        request_(std::get<0>(req), std::get<1>(req));
+    }
+}
+
+void connection_pool::check_idle(const std::shared_ptr<socktcp> &iopt)
+{
+    host_type h = iopt->target_uri();
+    int num;
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        auto iter = pools_.find(h);
+        if (iter == pools_.end())
+        {
+            return;
+        }
+        host_pool &hp = iter->second;
+        // Checked out since, the new owner is responsible for it.
+        if (std::find(hp.idle.begin(), hp.idle.end(), iopt) == hp.idle.end() ||
+            is_healthy(iopt))
+        {
+            return;
+        }
+        num = evict_nts(hp, iopt);
+    }
+    evict(h, iopt, num);
+}
+
+bool connection_pool::on_connect(const std::shared_ptr<socktcp> &iopt)
+{
+    tcp_event_handler handler;
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        auto iter = pools_.find(iopt->target_uri());
+        if (iter == pools_.end())
+        {
+            return false;
+        }
+        host_pool &hp = iter->second;
+        // Connections added by user to the same target are not pooled.
+        if (hp.pending <= 0 ||
+            static_cast<int>(hp.members.size()) >= hp.max_size)
+        {
+            return false;
+        }
+        --hp.pending;
+        hp.members.insert(iopt.get());
+        if (hp.waiters.size())
+        {
+            handler = hp.waiters.front();
+            hp.waiters.pop();
+        }
+        else
+        {
+            hp.idle.push_back(iopt);
+        }
+    }
+    if (handler)
+    {
+        handler(iopt);
+    }
+    return true;
+}
+
+void connection_pool::on_connect_failed(const host_type &h)
+{
+    tcp_event_handler handler;
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        auto iter = pools_.find(h);
+        if (iter == pools_.end())
+        {
+            return;
+        }
+        host_pool &hp = iter->second;
+        hp.pending = std::max(0, hp.pending - 1);
+        // Waiters that no pending connection can serve are failed.
+        if (static_cast<int>(hp.waiters.size()) > hp.pending)
+        {
+            handler = hp.waiters.front();
+            hp.waiters.pop();
+        }
+    }
+    if (handler)
+    {
+        handler(nullptr);
+    }
+}
+
+void connection_pool::on_closed(const std::shared_ptr<socktcp> &iopt)
+{
+    host_type h = iopt->target_uri();
+    int num;
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        auto iter = pools_.find(h);
+        // Evicted ones are removed and refilled already.
+        if (iter == pools_.end() || !iter->second.members.count(iopt.get()))
+        {
+            return;
+        }
+        num = evict_nts(iter->second, iopt);
+    }
+    if (num)
+    {
+        request_(h, num);
+    }
+}
+
+tcp_common::tcp_common(int iohandler_num, void *external_data)
+    : data_(external_data), tp_(iohandler_num, &data_)
+{
+    for (auto &thr : tp_)
+    {
+        data_.evls.push_back(&(thr.evlp()));
+    }
+}
 
 tcp_common::~tcp_common() = default;
 
@@ -501,10 +1330,16 @@ void tcp_common::set_on_closed(const tcp_event_handler &handler)
     data_.on_closed = handler;
 }
 
+void tcp_common::set_thread_options(const std::vector<thread_options> &opts)
+{
+    tp_.set_thread_options(opts);
+}
+
 tcp_server::tcp_server(int iohandler_num, bool single_acceptor,
                        void *external_data)
     : tcp_common(iohandler_num, external_data),
-      single_acceptor_(single_acceptor)
+      single_acceptor_(single_acceptor),
+      acpts_stopped_(false)
 {
 }
 
@@ -515,22 +1350,33 @@ void tcp_server::set_on_accept(const tcp_event_handler &handler)
     data_.on_accept = handler;
 }
 
-void tcp_server::listen(int port, family f, const char *ip)
+acceptor *tcp_server::next_acceptor()
 {
     if ((!single_acceptor_) || acpts_.empty())
     {
         acpts_.push_back(std::make_unique<acceptor>(&data_));
     }
-    acpts_.back()->listen(port, f, ip);
+    return acpts_.back().get();
+}
+
+void tcp_server::listen(int port, family f, const char *ip)
+{
+    next_acceptor()->listen(port, f, ip);
 }
 
 void tcp_server::listen_unix(const std::string &path, bool remove)
 {
-    if ((!single_acceptor_) || acpts_.empty())
-    {
-        acpts_.push_back(std::make_unique<acceptor>(&data_));
-    }
-    acpts_.back()->listen_unix(path, remove);
+    next_acceptor()->listen_unix(path, remove);
+}
+
+void tcp_server::set_fastopen(int qlen)
+{
+    data_.fastopen_qlen = qlen;
+}
+
+void tcp_server::set_defer_accept(int seconds)
+{
+    data_.defer_accept = seconds;
 }
 
 void tcp_server::run()
@@ -540,17 +1386,224 @@ void tcp_server::run()
 
 void tcp_server::shutdown()
 {
-    tcp_common::shutdown(acpts_);
+    if (!acpts_stopped_)
+    {
+        tcp_common::shutdown_front(acpts_);
+        acpts_stopped_ = true;
+    }
+    tcp_common::shutdown_workers();
+}
+
+bool tcp_server::drain(int timeout, const drain_progress_handler &handler)
+{
+    data_.draining = true;
+    if (!acpts_stopped_)
+    {
+        tcp_common::shutdown_front(acpts_);
+        acpts_stopped_ = true;
+    }
+    // Stop completing handshakes for this process, the listening sockets
+    // handed over to a new process stay open there.
+    for (auto &acpt : acpts_)
+    {
+        for (auto &sock : acpt->sockets())
+        {
+            sock->close();
+        }
+    }
+
+    auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    int remaining;
+    while (true)
+    {
+        remaining = data_.connections;
+        if (handler)
+        {
+            handler(remaining);
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (remaining <= 0 || now >= deadline)
+        {
+            break;
+        }
+        std::this_thread::sleep_for(
+            std::min<std::chrono::steady_clock::duration>(
+                std::chrono::milliseconds(sysconfig::reactor_drain_interval),
+                deadline - now));
+    }
+    if (remaining > 0)
+    {
+        LOG_WARNING_FMT("tcp server drain timeout with %d connections left",
+                        remaining);
+    }
+    LOG_INFO_FMT("tcp server drained, shutting down workers");
+    tcp_common::shutdown_workers();
+    return remaining <= 0;
+}
+
+// Send listening sockets with SCM_RIGHTS, families are sent as payload.
+static bool send_listening_socks(
+    const std::shared_ptr<socktcp> &conn,
+    const std::vector<std::shared_ptr<socktcp>> &socks)
+{
+    std::vector<char> families;
+    std::vector<int> fds;
+    for (const auto &sock : socks)
+    {
+        families.push_back(static_cast<char>(sock->sockfamily()));
+        fds.push_back(sock->fd());
+    }
+    return exception_guard(
+        [&] { conn->send_fds(fds, families.data(), families.size()); });
+}
+
+// Receive listening sockets sent by send_listening_socks.
+static std::vector<std::shared_ptr<socktcp>> recv_listening_socks(
+    const std::shared_ptr<socktcp> &conn)
+{
+    std::vector<int> fds;
+    conn->recv_fds(fds);
+    std::string families = conn->rbuffer().get_string();
+    std::vector<std::shared_ptr<socktcp>> socks;
+    for (size_t i = 0; i < fds.size(); ++i)
+    {
+        if (i >= families.size())
+        {
+            ::close(fds[i]);
+            continue;
+        }
+        socks.push_back(std::make_shared<socktcp>(
+            fds[i], static_cast<family>(families[i])));
+    }
+    return socks;
+}
+
+bool tcp_server::handover(const std::string &path, int timeout,
+                          const peer_verifier &verifier)
+{
+    std::vector<std::shared_ptr<socktcp>> socks;
+    for (auto &acpt : acpts_)
+    {
+        const auto &acpt_socks = acpt->sockets();
+        socks.insert(socks.end(), acpt_socks.begin(), acpt_socks.end());
+    }
+    if (socks.empty())
+    {
+        throw_logic_error("no listening socket to hand over");
+    }
+
+    std::shared_ptr<socktcp> hsock = io_factory::get_socktcp(family::local);
+    hsock->bind_unix(path, true);
+    // Restricted before listening, so no other user connects meanwhile.
+    if (::chmod(path.c_str(), S_IRUSR | S_IWUSR) < 0)
+    {
+        int err = errno;
+        ::unlink(path.c_str());
+        throw_system_error_with_specific_errno("chmod error : ", path, err);
+    }
+    hsock->listen(1);
+    LOG_INFO_FMT("Waiting for new process to take over in %s", path.c_str());
+
+    auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    bool succeed = false;
+    while (true)
+    {
+        int wait = timeout;
+        if (timeout >= 0)
+        {
+            wait = std::max<int>(
+                0, std::chrono::duration_cast<std::chrono::milliseconds>(
+                       deadline - std::chrono::steady_clock::now())
+                       .count());
+        }
+        pollfd pfd;
+        pfd.fd = hsock->fd();
+        pfd.events = POLLIN;
+        int ret;
+        while ((ret = poll(&pfd, 1, wait)) < 0 && errno == EINTR)
+        {
+        }
+        if (ret <= 0)
+        {
+            break;
+        }
+        std::vector<std::shared_ptr<socktcp>> conns = hsock->accept(1);
+        if (conns.empty())
+        {
+            continue;
+        }
+        peer_credentials cred = conns[0]->get_peer_credentials();
+        bool trusted = verifier ? verifier(cred) : cred.uid == ::geteuid();
+        if (!trusted)
+        {
+            LOG_WARNING_FMT("Hand over rejected peer pid %d uid %d",
+                            static_cast<int>(cred.pid),
+                            static_cast<int>(cred.uid));
+            continue;
+        }
+        conns[0]->set_io_block();
+        succeed = send_listening_socks(conns[0], socks);
+        break;
+    }
+    ::unlink(path.c_str());
+
+    if (succeed)
+    {
+        LOG_INFO_FMT("Handed over %d listening sockets",
+                     static_cast<int>(socks.size()));
+    }
+    else
+    {
+        LOG_WARNING_FMT("Hand over listening sockets in %s failed",
+                        path.c_str());
+    }
+    return succeed;
+}
+
+int tcp_server::takeover(const std::string &path)
+{
+    std::shared_ptr<socktcp> hsock = io_factory::get_socktcp(family::local);
+    hsock->set_io_block();
+    if (!hsock->connect_unix(path))
+    {
+        throw_system_error("connect error : ", path);
+    }
+    std::vector<std::shared_ptr<socktcp>> socks =
+        recv_listening_socks(hsock);
+    for (auto &sock : socks)
+    {
+        next_acceptor()->inherit(sock);
+    }
+    LOG_INFO_FMT("Took over %d listening sockets",
+                 static_cast<int>(socks.size()));
+    return socks.size();
 }
 
 tcp_client::tcp_client(int iohandler_num, int connector_num,
                        void *external_data)
-    : tcp_common(iohandler_num, external_data)
+    : tcp_common(iohandler_num, external_data),
+      pool_(
+          [this](const connection_pool::host_type &h, int t)
+          {
+              if (std::get<2>(h) == family::local)
+              {
+                  add_unix(std::get<0>(h), t);
+              }
+              else
+              {
+                  add(std::get<0>(h), std::get<1>(h), std::get<2>(h), t);
+              }
+          })
 {
     for (int i = 0; i < connector_num; ++i)
     {
         conts_.push_back(std::make_unique<connector>(&data_));
     }
+    data_.pool = &pool_;
+    data_.tracker = &tracker_;
+    data_.dns = &dns_;
 }
 
 tcp_client::~tcp_client() = default;
@@ -560,6 +1613,51 @@ void tcp_client::set_on_connect(const tcp_event_handler &handler)
     data_.on_connect = handler;
 }
 
+void tcp_client::set_on_connect_failed(const connect_failed_handler &handler)
+{
+    data_.on_connect_failed = handler;
+}
+
+void tcp_client::set_retry_policy(const retry_policy &policy)
+{
+    tracker_.set_default_policy(policy);
+}
+
+void tcp_client::set_retry_policy(const std::string &ip, int port, family f,
+                                  const retry_policy &policy)
+{
+    tracker_.set_policy(std::make_tuple(ip, port, f), policy);
+}
+
+void tcp_client::set_retry_policy_unix(const std::string &path,
+                                       const retry_policy &policy)
+{
+    tracker_.set_policy(std::make_tuple(path, -1, family::local), policy);
+}
+
+std::unordered_map<std::tuple<std::string, int, family>, connect_stats,
+                   host_hash>
+tcp_client::stats()
+{
+    return tracker_.snapshot();
+}
+
+void tcp_client::set_lookup(const lookup_handler &lookup)
+{
+    dns_.set_lookup(lookup);
+}
+
+void tcp_client::set_fastopen(bool enable)
+{
+#ifndef __linux__
+    if (enable)
+    {
+        throw_logic_error("tcp client fast open is only supported in linux");
+    }
+#endif
+    data_.fastopen_connect = enable;
+}
+
 void tcp_client::add(const std::string &ip, int port, family f, int t)
 {
     int div = t / conts_.size();
@@ -579,7 +1677,49 @@ void tcp_client::add(const std::string &ip, int port, family f, int t)
 
 void tcp_client::add_unix(const std::string &path, int t)
 {
-    add(path, 0, family::local, t);
+    // Keyed with port -1 the same as target uri of connected unix socket.
+    add(path, -1, family::local, t);
+}
+
+void tcp_client::set_pool(const std::string &ip, int port, family f,
+                          int min_size, int max_size)
+{
+    // Pooled connections are matched by target uri of the socket.
+    if (!is_ip_literal(ip, f))
+    {
+        throw_logic_error("connection pool requires literal ip");
+    }
+    pool_.set_limits(std::make_tuple(ip, port, f), min_size, max_size);
+}
+
+void tcp_client::set_pool_unix(const std::string &path, int min_size,
+                               int max_size)
+{
+    // Connected unix socket reports port -1 in target uri.
+    pool_.set_limits(std::make_tuple(path, -1, family::local), min_size,
+                     max_size);
+}
+
+void tcp_client::checkout(const std::string &ip, int port, family f,
+                          const tcp_event_handler &handler)
+{
+    pool_.checkout(std::make_tuple(ip, port, f), handler);
+}
+
+void tcp_client::checkout_unix(const std::string &path,
+                               const tcp_event_handler &handler)
+{
+    pool_.checkout(std::make_tuple(path, -1, family::local), handler);
+}
+
+void tcp_client::checkin(const std::shared_ptr<socktcp> &iopt)
+{
+    pool_.checkin(iopt);
+}
+
+void tcp_client::check_idle()
+{
+    pool_.check_idle();
 }
 
 void tcp_client::run()
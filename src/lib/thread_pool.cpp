@@ -1,86 +1,663 @@
 #include "cppev/thread_pool.h"
 
+#include <algorithm>
+
 namespace cppev
 {
 
+// Worker running on current thread, nullptr for other threads.
+static thread_local thread_pool_task_queue_runnable *current_worker = nullptr;
+
+// Whether deadline of the task running on current thread is missed.
+static thread_local bool current_missed = false;
+
+// Empty slots kept by each worker.
+static const size_t max_spare_slots = 1024;
+
+using thread_state = thread_pool_task_queue_runnable::thread_state;
+
 thread_pool_task_queue_runnable::thread_pool_task_queue_runnable(
     thread_pool_task_queue *tptq) noexcept
-    : tptq_(tptq)
+    : tptq_(tptq),
+      state_(thread_state::idle),
+      seed_(static_cast<uint32_t>(reinterpret_cast<uintptr_t>(this) >> 4) | 1),
+      local_since_(0)
+{
+}
+
+thread_pool_task_queue_runnable::~thread_pool_task_queue_runnable()
 {
+    // Tasks left when worker never ran.
+    while (auto slot = deque_.pop())
+    {
+        delete slot;
+    }
+    for (auto slot : spare_)
+    {
+        delete slot;
+    }
 }
 
 void thread_pool_task_queue_runnable::run_impl()
 {
-    thread_pool_task_handler handler;
+    current_worker = this;
+    thread_pool_task_handler task;
+    bool missed = false;
     while (true)
     {
+        if (next_task(task, missed))
         {
-            std::unique_lock<std::mutex> lock(tptq_->lock_);
-            if (tptq_->queue_.empty())
-            {
-                if (tptq_->stop_)
-                {
-                    break;
-                }
-                tptq_->cond_.wait(
-                    lock, [this]() -> bool
-                    { return tptq_->queue_.size() || tptq_->stop_; });
-            }
-            if (tptq_->queue_.empty() && tptq_->stop_)
+            // Wake another worker for the rest, so that sleepers are woken
+            // one by one as long as tasks remain.
+            if (tptq_->pending_.fetch_sub(1) > 1)
             {
-                break;
+                tptq_->wake(1);
             }
-            handler = std::move(tptq_->queue_.front());
-            tptq_->queue_.pop();
+            current_missed = missed;
+            task();
+            task = nullptr;
+            current_missed = false;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(tptq_->park_lock_);
+        ++tptq_->sleepers_;
+        auto ready = [this]() -> bool
+        { return tptq_->pending_.load() > 0 || tptq_->stop_.load(); };
+        bool woken = true;
+        if (tptq_->elastic_)
+        {
+            woken = tptq_->cond_.wait_for(lock, tptq_->idle_timeout_, ready);
+        }
+        else
+        {
+            tptq_->cond_.wait(lock, ready);
+        }
+        --tptq_->sleepers_;
+        if (tptq_->pending_.load() <= 0 && tptq_->stop_.load())
+        {
+            break;
+        }
+        lock.unlock();
+        if (!woken && tptq_->retire(this))
+        {
+            break;
         }
-        tptq_->cond_.notify_all();
-        handler();
+    }
+    current_worker = nullptr;
+}
+
+bool thread_pool_task_queue_runnable::next_task(thread_pool_task_handler &task,
+                                                bool &missed)
+{
+    missed = false;
+    thread_pool_task_handler *slot = deque_.pop();
+    if (slot)
+    {
+        task = std::move(*slot);
+        release_slot(slot);
+        return true;
+    }
+
+    if (tptq_->injected_.load() > 0)
+    {
+        // Destroyed out of lock, since task may hold anything.
+        std::vector<thread_pool_task_handler> dropped;
+        std::chrono::nanoseconds wait(0);
+        if (tptq_->pop_lane(task, missed, wait, dropped))
+        {
+            tptq_->grow_if_starving(wait);
+            return true;
+        }
+    }
+
+    // Xorshift, victims of different workers are spread.
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 17;
+    seed_ ^= seed_ << 5;
+    // Idle slots of elastic pool have empty deques.
+    int num = tptq_->thrs_.size();
+    int start = seed_ % num;
+    for (int i = 0; i < num; ++i)
+    {
+        thread_pool_task_queue_runnable &victim = (*tptq_)[(start + i) % num];
+        if (&victim == this)
+        {
+            continue;
+        }
+        slot = victim.deque_.steal();
+        if (slot)
+        {
+            task = std::move(*slot);
+            release_slot(slot);
+            return true;
+        }
+    }
+    return false;
+}
+
+thread_pool_task_handler *thread_pool_task_queue_runnable::acquire_slot()
+{
+    if (spare_.empty())
+    {
+        return new thread_pool_task_handler();
+    }
+    thread_pool_task_handler *slot = spare_.back();
+    spare_.pop_back();
+    return slot;
+}
+
+void thread_pool_task_queue_runnable::release_slot(
+    thread_pool_task_handler *slot)
+{
+    // Stolen slots are kept by the thief, bounded so that a thief of a
+    // spawning worker does not hoard them.
+    if (spare_.size() < max_spare_slots)
+    {
+        spare_.push_back(slot);
+    }
+    else
+    {
+        delete slot;
     }
 }
 
 thread_pool_task_queue::thread_pool_task_queue(int thr_num)
     : thread_pool<thread_pool_task_queue_runnable, thread_pool_task_queue *>(
           thr_num, this),
-      stop_(false)
+      injected_(0),
+      pending_(0),
+      sleepers_(0),
+      stop_(false),
+      elastic_(false),
+      min_thr_num_(thr_num),
+      max_thr_num_(thr_num),
+      spawn_wait_(0),
+      idle_timeout_(0),
+      workers_(thr_num),
+      blocking_(0),
+      last_spawn_(0)
 {
+    for (int i = 0; i < lane_num; ++i)
+    {
+        lanes_[i].weight = 64 >> i;
+        lanes_[i].credit = 0;
+    }
 }
 
-thread_pool_task_queue::~thread_pool_task_queue() = default;
+// Slots of elastic pool, blocked workers are compensated beyond max.
+static int elastic_slots(int min_thr_num, int max_thr_num)
+{
+    if (min_thr_num < 1 || max_thr_num < min_thr_num)
+    {
+        throw_logic_error("invalid thread number ", min_thr_num, " ",
+                          max_thr_num);
+    }
+    return 2 * max_thr_num;
+}
 
-void thread_pool_task_queue::add_task(
-    const thread_pool_task_handler &h) noexcept
+thread_pool_task_queue::thread_pool_task_queue(
+    int min_thr_num, int max_thr_num, std::chrono::milliseconds spawn_wait,
+    std::chrono::milliseconds idle_timeout)
+    : thread_pool<thread_pool_task_queue_runnable, thread_pool_task_queue *>(
+          elastic_slots(min_thr_num, max_thr_num), this),
+      injected_(0),
+      pending_(0),
+      sleepers_(0),
+      stop_(false),
+      elastic_(true),
+      min_thr_num_(min_thr_num),
+      max_thr_num_(max_thr_num),
+      spawn_wait_(spawn_wait),
+      idle_timeout_(idle_timeout),
+      workers_(min_thr_num),
+      blocking_(0),
+      last_spawn_(0)
 {
-    std::unique_lock<std::mutex> lock(lock_);
-    queue_.push(h);
-    cond_.notify_one();
+    for (int i = 0; i < lane_num; ++i)
+    {
+        lanes_[i].weight = 64 >> i;
+        lanes_[i].credit = 0;
+    }
+}
+
+thread_pool_task_queue::~thread_pool_task_queue()
+{
+    // Workers still running wait on members destroyed below.
+    stop();
 }
 
 void thread_pool_task_queue::add_task(thread_pool_task_handler &&h) noexcept
 {
-    std::unique_lock<std::mutex> lock(lock_);
-    queue_.push(std::forward<thread_pool_task_handler>(h));
-    cond_.notify_one();
+    push(&h, 1);
+}
+
+void thread_pool_task_queue::add_task(thread_pool_task_handler *tasks,
+                                      size_t num) noexcept
+{
+    push(tasks, num);
 }
 
 void thread_pool_task_queue::add_task(
-    const std::vector<thread_pool_task_handler> &vh) noexcept
+    std::vector<thread_pool_task_handler> &&vh) noexcept
+{
+    push(vh.data(), vh.size());
+}
+
+void thread_pool_task_queue::add_task(thread_pool_task_handler &&h,
+                                      priority prio) noexcept
+{
+    push_lane(&h, 1, lane_index(prio), time_point::max(),
+              deadline_policy::drop);
+}
+
+void thread_pool_task_queue::add_task(thread_pool_task_handler &&h,
+                                      priority prio, time_point deadline,
+                                      deadline_policy policy) noexcept
+{
+    push_lane(&h, 1, lane_index(prio), deadline, policy);
+}
+
+void thread_pool_task_queue::add_task(thread_pool_task_handler *tasks,
+                                      size_t num, priority prio) noexcept
+{
+    push_lane(tasks, num, lane_index(prio), time_point::max(),
+              deadline_policy::drop);
+}
+
+void thread_pool_task_queue::set_lane_weight(priority prio,
+                                             int weight) noexcept
 {
     std::unique_lock<std::mutex> lock(lock_);
-    for (const auto &h : vh)
+    lanes_[lane_index(prio)].weight = std::max(weight, 1);
+}
+
+thread_pool_lane_stats thread_pool_task_queue::lane_stats(
+    priority prio) const noexcept
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    const lane &ln = lanes_[lane_index(prio)];
+    thread_pool_lane_stats stats = ln.stats;
+    stats.depth = ln.tasks.size();
+    return stats;
+}
+
+bool thread_pool_task_queue::deadline_missed() noexcept
+{
+    return current_missed;
+}
+
+void thread_pool_task_queue::run()
+{
+    std::unique_lock<std::mutex> lock(grow_lock_);
+    reset_stop();
+    for (int i = 0; i < min_thr_num_; ++i)
     {
-        queue_.push(h);
+        thrs_[i]->state_ = thread_state::running;
+        thrs_[i]->run();
     }
-    cond_.notify_all();
+}
+
+int thread_pool_task_queue::size() const noexcept
+{
+    return workers_.load();
 }
 
 void thread_pool_task_queue::stop() noexcept
 {
     {
-        std::unique_lock<std::mutex> lock(lock_);
+        std::unique_lock<std::mutex> lock(park_lock_);
         stop_ = true;
         cond_.notify_all();
     }
-    join();
+    // Draining workers may still grow to compensate blocking ones, so join
+    // out of lock until no worker is left.
+    while (true)
+    {
+        std::vector<thread_pool_task_queue_runnable *> thrs;
+        {
+            std::unique_lock<std::mutex> lock(grow_lock_);
+            for (auto &thr : thrs_)
+            {
+                if (thr->state_ == thread_state::running)
+                {
+                    thr->state_ = thread_state::joining;
+                    thrs.push_back(thr.get());
+                }
+                else if (thr->state_ == thread_state::exited)
+                {
+                    // Retired worker is exiting, slot stays usable.
+                    thr->join();
+                    thr->state_ = thread_state::idle;
+                }
+            }
+        }
+        if (thrs.empty())
+        {
+            break;
+        }
+        for (auto thr : thrs)
+        {
+            thr->join();
+        }
+        std::unique_lock<std::mutex> lock(grow_lock_);
+        for (auto thr : thrs)
+        {
+            thr->state_ = thread_state::idle;
+        }
+    }
+}
+
+void thread_pool_task_queue::enter_blocking() noexcept
+{
+    if (current_worker == nullptr)
+    {
+        return;
+    }
+    thread_pool_task_queue *tptq = current_worker->tptq_;
+    ++tptq->blocking_;
+    if (tptq->elastic_ && tptq->pending_.load() > 0 &&
+        tptq->sleepers_.load() == 0)
+    {
+        tptq->grow();
+    }
+}
+
+void thread_pool_task_queue::leave_blocking() noexcept
+{
+    if (current_worker == nullptr)
+    {
+        return;
+    }
+    --current_worker->tptq_->blocking_;
+}
+
+bool thread_pool_task_queue::run_pending_task()
+{
+    thread_pool_task_handler task;
+    bool missed = false;
+    if (current_worker != nullptr && current_worker->tptq_ == this)
+    {
+        if (!current_worker->next_task(task, missed))
+        {
+            return false;
+        }
+    }
+    else if (!take_task(task, missed))
+    {
+        return false;
+    }
+    if (pending_.fetch_sub(1) > 1)
+    {
+        wake(1);
+    }
+    // Helping worker is inside a task of its own.
+    bool outer_missed = current_missed;
+    current_missed = missed;
+    task();
+    current_missed = outer_missed;
+    return true;
+}
+
+bool thread_pool_task_queue::take_task(thread_pool_task_handler &task,
+                                       bool &missed)
+{
+    missed = false;
+    if (injected_.load() > 0)
+    {
+        std::vector<thread_pool_task_handler> dropped;
+        std::chrono::nanoseconds wait(0);
+        if (pop_lane(task, missed, wait, dropped))
+        {
+            return true;
+        }
+    }
+    for (auto &thr : thrs_)
+    {
+        thread_pool_task_handler *slot = thr->deque_.steal();
+        if (slot)
+        {
+            task = std::move(*slot);
+            delete slot;
+            return true;
+        }
+    }
+    return false;
+}
+
+void thread_pool_task_queue::grow_if_starving(std::chrono::nanoseconds wait)
+{
+    if (!elastic_ || sleepers_.load() > 0)
+    {
+        return;
+    }
+    // All workers blocked, no one is going to take the task.
+    if (workers_.load() <= blocking_.load())
+    {
+        grow();
+        return;
+    }
+    if (wait < spawn_wait_)
+    {
+        return;
+    }
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now().time_since_epoch())
+                      .count();
+    int64_t last = last_spawn_.load();
+    if (now - last < std::chrono::nanoseconds(spawn_wait_).count() ||
+        !last_spawn_.compare_exchange_strong(last, now))
+    {
+        return;
+    }
+    grow();
+}
+
+bool thread_pool_task_queue::grow()
+{
+    std::unique_lock<std::mutex> lock(grow_lock_);
+    if (workers_.load() - blocking_.load() >= max_thr_num_)
+    {
+        return false;
+    }
+    for (auto &thr : thrs_)
+    {
+        if (thr->state_ == thread_state::running ||
+            thr->state_ == thread_state::joining)
+        {
+            continue;
+        }
+        if (thr->state_ == thread_state::exited)
+        {
+            thr->join();
+        }
+        thr->state_ = thread_state::running;
+        ++workers_;
+        if (!exception_guard([&] { thr->run(); }))
+        {
+            thr->state_ = thread_state::idle;
+            --workers_;
+            return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool thread_pool_task_queue::retire(thread_pool_task_queue_runnable *worker)
+{
+    std::unique_lock<std::mutex> lock(grow_lock_);
+    if (stop_.load() || pending_.load() > 0 ||
+        workers_.load() <= min_thr_num_)
+    {
+        return false;
+    }
+    --workers_;
+    worker->state_ = thread_state::exited;
+    return true;
+}
+
+void thread_pool_task_queue::push(thread_pool_task_handler *tasks,
+                                  size_t num)
+{
+    if (current_worker == nullptr || current_worker->tptq_ != this)
+    {
+        push_lane(tasks, num, 0, time_point::max(), deadline_policy::drop);
+        return;
+    }
+    if (num == 0)
+    {
+        return;
+    }
+    // Tasks of local deque are taken by the owner after the running task
+    // or by thieves, neither notices the wait if all workers are busy.
+    std::chrono::nanoseconds oldest(0);
+    if (elastic_)
+    {
+        std::chrono::nanoseconds now =
+            std::chrono::steady_clock::now().time_since_epoch();
+        if (current_worker->deque_.empty())
+        {
+            current_worker->local_since_ = now.count();
+        }
+        else
+        {
+            oldest = now - std::chrono::nanoseconds(
+                               current_worker->local_since_);
+        }
+    }
+    // Counted before queued, so that a worker seeing no pending task never
+    // misses one.
+    pending_ += num;
+    for (size_t i = 0; i < num; ++i)
+    {
+        thread_pool_task_handler *slot = current_worker->acquire_slot();
+        *slot = std::move(tasks[i]);
+        current_worker->deque_.push(slot);
+    }
+    wake(num);
+    grow_if_starving(oldest);
+}
+
+void thread_pool_task_queue::push_lane(thread_pool_task_handler *tasks,
+                                       size_t num, int index,
+                                       time_point deadline,
+                                       deadline_policy policy)
+{
+    if (num == 0)
+    {
+        return;
+    }
+    pending_ += num;
+    std::chrono::nanoseconds oldest(0);
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        lane &ln = lanes_[index];
+        time_point now = std::chrono::steady_clock::now();
+        if (ln.tasks.size())
+        {
+            oldest = now - ln.tasks.front().queued;
+        }
+        for (size_t i = 0; i < num; ++i)
+        {
+            ln.tasks.push_back({std::move(tasks[i]), now, deadline, policy});
+        }
+        injected_ += num;
+    }
+    wake(num);
+    // Workers may all be blocked, nobody takes tasks to notice the wait.
+    grow_if_starving(oldest);
+}
+
+bool thread_pool_task_queue::pop_lane(
+    thread_pool_task_handler &task, bool &missed,
+    std::chrono::nanoseconds &wait,
+    std::vector<thread_pool_task_handler> &dropped)
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    time_point now = std::chrono::steady_clock::now();
+    while (true)
+    {
+        // Smooth weighted round robin: each non-empty lane earns its weight,
+        // the richest one is taken and pays the total.
+        lane *taken = nullptr;
+        int64_t total = 0;
+        for (auto &ln : lanes_)
+        {
+            if (ln.tasks.empty())
+            {
+                continue;
+            }
+            ln.credit += ln.weight;
+            total += ln.weight;
+            if (taken == nullptr || ln.credit > taken->credit)
+            {
+                taken = &ln;
+            }
+        }
+        if (taken == nullptr)
+        {
+            return false;
+        }
+        taken->credit -= total;
+
+        lane_task &front = taken->tasks.front();
+        wait = now - front.queued;
+        bool expired = now > front.deadline;
+        thread_pool_lane_stats &stats = taken->stats;
+        ++stats.dequeued;
+        stats.total_wait += wait;
+        stats.max_wait = std::max(stats.max_wait, wait);
+        if (expired)
+        {
+            ++stats.expired;
+        }
+        --injected_;
+        bool drop = expired && front.policy == deadline_policy::drop;
+        if (drop)
+        {
+            dropped.push_back(std::move(front.task));
+            --pending_;
+        }
+        else
+        {
+            task = std::move(front.task);
+            missed = expired;
+        }
+        taken->tasks.pop_front();
+        if (taken->tasks.empty())
+        {
+            // Idle lane shall not keep credit earned or owed.
+            taken->credit = 0;
+        }
+        if (!drop)
+        {
+            return true;
+        }
+    }
+}
+
+int thread_pool_task_queue::lane_index(priority prio) noexcept
+{
+    int p = std::min(std::max(static_cast<int>(prio),
+                              static_cast<int>(priority::p6)),
+                     static_cast<int>(priority::p0));
+    return static_cast<int>(priority::p0) - p;
+}
+
+void thread_pool_task_queue::wake(int64_t num)
+{
+    // Pairs with the increment of sleepers before parked worker checks
+    // pending tasks.
+    if (sleepers_.load() == 0)
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(park_lock_);
+    for (int64_t i = std::min<int64_t>(num, sleepers_.load()); i > 0; --i)
+    {
+        cond_.notify_one();
+    }
 }
 
 }  // namespace cppev
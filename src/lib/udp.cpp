@@ -0,0 +1,406 @@
+#include "cppev/udp.h"
+
+#include <sys/socket.h>
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
+
+#include <algorithm>
+
+#include "cppev/logger.h"
+#include "cppev/utils.h"
+
+namespace cppev
+{
+
+namespace reactor
+{
+
+// Batches received in one readable event, the rest are left to next loop
+// so that other sockets of the worker are not starved.
+static const int max_recv_batches = 8;
+
+static udp_worker *worker_of(const std::shared_ptr<sockudp> &sock)
+{
+    return reinterpret_cast<udp_worker *>(sock->evlp().owner());
+}
+
+bool async_send(const std::shared_ptr<sockudp> &sock, const char *ptr, int len,
+                const endpoint &peer)
+{
+    return worker_of(sock)->send(sock, ptr, len, peer);
+}
+
+void *external_data(const std::shared_ptr<sockudp> &sock)
+{
+    return reinterpret_cast<udp_storage *>(sock->evlp().data())
+        ->external_data_ptr;
+}
+
+static void with_exception_handling(const std::string &thr_name,
+                                    std::function<void()> handler)
+{
+    LOG_INFO_FMT("Thread %s starting", thr_name.c_str());
+    try
+    {
+        handler();
+    }
+    catch (std::exception &e)
+    {
+        LOG_ERROR << e.what();
+    }
+    LOG_INFO_FMT("Thread %s ending", thr_name.c_str());
+}
+
+// Select socket of reuseport group by source address of datagram, the
+// sockets of group are indexed in the order of binding.
+static void attach_peer_affinity(const std::shared_ptr<sockudp> &sock,
+                                 family f, int workers)
+{
+#ifdef __linux__
+    // Source address of ipv4 header, or its last word of ipv6 header.
+    uint32_t offset = SKF_NET_OFF + (f == family::ipv4 ? 12 : 20);
+    sock_filter code[] = {
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, offset},
+        {BPF_ALU | BPF_MOD | BPF_K, 0, 0, static_cast<uint32_t>(workers)},
+        {BPF_RET | BPF_A, 0, 0, 0},
+    };
+    sock_fprog prog;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    if (setsockopt(sock->fd(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+                   sizeof(prog)) < 0)
+    {
+        throw_system_error("setsockopt error for SO_ATTACH_REUSEPORT_CBPF");
+    }
+#else
+    throw_logic_error("peer affinity is only supported in linux");
+#endif
+}
+
+udp_storage::udp_storage(void *external_data_ptr)
+    : on_datagram([](const std::shared_ptr<sockudp> &, std::string_view,
+                     const endpoint &) {}),
+      dropped(0),
+      external_data_ptr(external_data_ptr)
+{
+}
+
+udp_storage::~udp_storage() = default;
+
+udp_worker::outbox::outbox(const std::shared_ptr<sockudp> &sock)
+    : sock(sock),
+      ring(sysconfig::udp_send_queue),
+      start(0),
+      waiting(false),
+      dirty(false)
+{
+}
+
+udp_worker::udp_worker(udp_storage *data)
+    : evlp_(reinterpret_cast<void *>(data), reinterpret_cast<void *>(this)),
+      in_(sysconfig::udp_batch_size),
+      dispatching_(false)
+{
+}
+
+udp_worker::~udp_worker() = default;
+
+void udp_worker::on_readable(const std::shared_ptr<io> &iop)
+{
+    std::shared_ptr<sockudp> sock(iop, iop->to_sockudp());
+    if (sock == nullptr)
+    {
+        throw_logic_error("to_sockudp error");
+    }
+    udp_worker *worker = worker_of(sock);
+    udp_storage *dp = reinterpret_cast<udp_storage *>(sock->evlp().data());
+    datagram_ring &in = worker->in_;
+    worker->dispatching_ = true;
+    for (int batch = 0; batch < max_recv_batches; ++batch)
+    {
+        in.clear();
+        int num = 0;
+        if (!exception_guard([&] { num = sock->recv_batch(in); }))
+        {
+            LOG_ERROR_FMT("Syscall recvmmsg error for fd %d", sock->fd());
+            break;
+        }
+        for (int i = 0; i < num; ++i)
+        {
+            // Datagrams coalesced by GRO are split back.
+            int len = in.length(i);
+            int step = in.segment_size(i) > 0 ? in.segment_size(i)
+                                              : std::max(len, 1);
+            for (int offset = 0; offset < std::max(len, 1); offset += step)
+            {
+                dp->on_datagram(
+                    sock,
+                    std::string_view(in.data(i) + offset,
+                                     std::min(step, len - offset)),
+                    in.peer(i));
+            }
+        }
+        if (num < in.slots())
+        {
+            break;
+        }
+    }
+    worker->dispatching_ = false;
+    worker->flush_dirty();
+}
+
+void udp_worker::on_writable(const std::shared_ptr<io> &iop)
+{
+    std::shared_ptr<sockudp> sock(iop, iop->to_sockudp());
+    if (sock == nullptr)
+    {
+        throw_logic_error("to_sockudp error");
+    }
+    udp_worker *worker = worker_of(sock);
+    worker->flush(*worker->outboxes_.at(sock->fd()));
+}
+
+void udp_worker::add(const std::shared_ptr<sockudp> &sock)
+{
+    socks_.push_back(sock);
+}
+
+bool udp_worker::send(const std::shared_ptr<sockudp> &sock, const char *ptr,
+                      int len, const endpoint &peer)
+{
+    outbox &box = *outboxes_.at(sock->fd());
+    if (!box.ring.push(ptr, len, peer))
+    {
+        // Make room by sending queued datagrams right away.
+        flush(box);
+        if (!box.ring.push(ptr, len, peer))
+        {
+            ++reinterpret_cast<udp_storage *>(evlp_.data())->dropped;
+            return false;
+        }
+    }
+    if (!dispatching_)
+    {
+        flush(box);
+    }
+    else if (!box.dirty)
+    {
+        box.dirty = true;
+        dirty_.push_back(&box);
+    }
+    return true;
+}
+
+void udp_worker::post_send(std::string data, const endpoint &peer)
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    posted_.push_back(posted_datagram{std::move(data), peer});
+    // Datagrams posted before the task runs are sent by it in batch.
+    if (posted_.size() == 1)
+    {
+        evlp_.post([this] { drain_posted(); });
+    }
+}
+
+event_loop &udp_worker::evlp()
+{
+    return evlp_;
+}
+
+void udp_worker::run_without_exception_handling()
+{
+    for (auto &sock : socks_)
+    {
+        attach(sock);
+    }
+    evlp_.set_stop_token(get_stop_token());
+    evlp_.loop_forever();
+}
+
+void udp_worker::run_impl()
+{
+    with_exception_handling(
+        "udp_worker",
+        std::bind(&udp_worker::run_without_exception_handling, this));
+}
+
+void udp_worker::shutdown()
+{
+    request_stop();
+}
+
+void udp_worker::attach(const std::shared_ptr<sockudp> &sock)
+{
+    outboxes_.emplace(sock->fd(), std::make_unique<outbox>(sock));
+    evlp_.fd_register(std::static_pointer_cast<io>(sock), fd_event::fd_writable,
+                      udp_worker::on_writable);
+    evlp_.fd_register_and_activate(std::static_pointer_cast<io>(sock),
+                                   fd_event::fd_readable,
+                                   udp_worker::on_readable);
+    LOG_INFO_FMT("Udp socket %d working", sock->fd());
+}
+
+const std::shared_ptr<sockudp> &udp_worker::ephemeral(family f)
+{
+    std::shared_ptr<sockudp> &sock = ephemeral_[f == family::ipv4 ? 0 : 1];
+    if (sock == nullptr)
+    {
+        sock = io_factory::get_sockudp(f);
+        attach(sock);
+    }
+    return sock;
+}
+
+void udp_worker::drain_posted()
+{
+    std::vector<posted_datagram> posted;
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        posted.swap(posted_);
+    }
+    dispatching_ = true;
+    for (const auto &dgram : posted)
+    {
+        send(ephemeral(dgram.peer.sockfamily()), dgram.data.data(),
+             static_cast<int>(dgram.data.size()), dgram.peer);
+    }
+    dispatching_ = false;
+    flush_dirty();
+}
+
+void udp_worker::flush(outbox &box)
+{
+    while (box.start < box.ring.size())
+    {
+        int num = 0;
+        if (!exception_guard([&] { num = box.sock->send_batch(box.ring,
+                                                             box.start); }))
+        {
+            // Datagram failing to send is dropped so that the rest of the
+            // queue is not blocked.
+            LOG_ERROR_FMT("Syscall sendmmsg error for fd %d", box.sock->fd());
+            ++reinterpret_cast<udp_storage *>(evlp_.data())->dropped;
+            num = 1;
+        }
+        else if (num == 0)
+        {
+            break;
+        }
+        box.start += num;
+    }
+    if (box.start == box.ring.size())
+    {
+        box.ring.clear();
+        box.start = 0;
+        if (box.waiting)
+        {
+            evlp_.fd_deactivate(std::static_pointer_cast<io>(box.sock),
+                                fd_event::fd_writable);
+            box.waiting = false;
+        }
+    }
+    else if (!box.waiting)
+    {
+        evlp_.fd_activate(std::static_pointer_cast<io>(box.sock),
+                          fd_event::fd_writable);
+        box.waiting = true;
+    }
+}
+
+void udp_worker::flush_dirty()
+{
+    for (outbox *box : dirty_)
+    {
+        box->dirty = false;
+        flush(*box);
+    }
+    dirty_.clear();
+}
+
+udp_common::udp_common(int thr_num, void *external_data)
+    : data_(external_data), tp_(thr_num, &data_)
+{
+}
+
+udp_common::~udp_common() = default;
+
+void udp_common::set_on_datagram(const udp_datagram_handler &handler)
+{
+    data_.on_datagram = handler;
+}
+
+void udp_common::run()
+{
+    tp_.run();
+}
+
+void udp_common::shutdown()
+{
+    // All workers stop in parallel, within one shutdown timeout.
+    std::vector<runnable *> thrs;
+    for (auto &thr : tp_)
+    {
+        thr.shutdown();
+        thrs.push_back(&thr);
+    }
+    join_reporting(
+        thrs, std::chrono::milliseconds(sysconfig::reactor_shutdown_timeout),
+        "udp_worker");
+}
+
+uint64_t udp_common::dropped() const noexcept
+{
+    return data_.dropped.load();
+}
+
+udp_server::udp_server(int thr_num, void *external_data)
+    : udp_common(thr_num, external_data)
+{
+}
+
+udp_server::~udp_server() = default;
+
+void udp_server::listen(int port, family f, const char *ip,
+                        bool peer_affinity)
+{
+    for (int i = 0; i < tp_.size(); ++i)
+    {
+        std::shared_ptr<sockudp> sock = io_factory::get_sockudp(f);
+        sock->set_so_reuseport();
+        sock->bind(ip, port);
+        if (i == 0 && peer_affinity)
+        {
+            attach_peer_affinity(sock, f, tp_.size());
+        }
+        tp_[i].add(sock);
+        LOG_INFO_FMT("Udp socket %d bound to %s %d", sock->fd(),
+                     ip ? ip : "localhost", port);
+    }
+}
+
+udp_client::udp_client(int thr_num, void *external_data)
+    : udp_common(thr_num, external_data)
+{
+}
+
+udp_client::~udp_client() = default;
+
+void udp_client::send(const char *ptr, int len, const endpoint &peer)
+{
+    if (peer.sockfamily() == family::local)
+    {
+        throw_logic_error("udp client only supports ipv4 and ipv6");
+    }
+    tp_[peer.hash() % tp_.size()].post_send(std::string(ptr, len), peer);
+}
+
+void udp_client::send(const char *ptr, int len, const char *ip, int port,
+                      family f)
+{
+    send(ptr, len, endpoint(ip, port, f));
+}
+
+}  // namespace reactor
+
+}  // namespace cppev
@@ -0,0 +1,255 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cppev/coroutine.h"
+
+namespace cppev
+{
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+// Run loop on another thread until test body sets done.
+class TestCoroutine : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        done_ = false;
+        thr_ = std::thread([this] { evlp_.loop_forever(); });
+    }
+
+    void TearDown() override
+    {
+        auto start = std::chrono::steady_clock::now();
+        while (!done_.load() && std::chrono::steady_clock::now() - start <
+                                    std::chrono::seconds(5))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        evlp_.stop_loop();
+        thr_.join();
+        ASSERT_TRUE(done_.load());
+    }
+
+    event_loop evlp_;
+
+    std::thread thr_;
+
+    std::atomic<bool> done_;
+
+    std::thread::id loop_id_;
+};
+
+static task<int> add_later(event_loop &evlp, int a, int b)
+{
+    co_await async_sleep_for(evlp, std::chrono::milliseconds(10));
+    co_return a + b;
+}
+
+static task<int> fail_later(event_loop &evlp)
+{
+    co_await async_sleep_for(evlp, std::chrono::milliseconds(1));
+    throw std::runtime_error("fail");
+}
+
+TEST_F(TestCoroutine, test_task)
+{
+    evlp_.post([this] { loop_id_ = std::this_thread::get_id(); });
+    auto body = [](event_loop &evlp, std::atomic<bool> &done,
+                   std::thread::id *loop_id) -> task<void>
+    {
+        auto start = std::chrono::steady_clock::now();
+        int sum = co_await add_later(evlp, 1, 2);
+        EXPECT_EQ(sum, 3);
+        EXPECT_GE(std::chrono::steady_clock::now() - start,
+                  std::chrono::milliseconds(10));
+        EXPECT_EQ(std::this_thread::get_id(), *loop_id);
+
+        bool thrown = false;
+        try
+        {
+            co_await fail_later(evlp);
+        }
+        catch (const std::runtime_error &)
+        {
+            thrown = true;
+        }
+        EXPECT_TRUE(thrown);
+
+        // Timers run concurrently, all done in about the longest one.
+        start = std::chrono::steady_clock::now();
+        std::vector<task<int>> tasks;
+        for (int i = 0; i < 10; ++i)
+        {
+            tasks.push_back(add_later(evlp, i, i));
+        }
+        std::vector<int> sums = co_await when_all(std::move(tasks));
+        EXPECT_LT(std::chrono::steady_clock::now() - start,
+                  std::chrono::milliseconds(100));
+        EXPECT_EQ(sums.size(), 10);
+        for (size_t i = 0; i < sums.size(); ++i)
+        {
+            EXPECT_EQ(sums[i], 2 * i);
+        }
+        done = true;
+    };
+    co_spawn(evlp_, body(evlp_, done_, &loop_id_));
+}
+
+static task<void> pipe_writer(std::shared_ptr<stream> wr, std::string data)
+{
+    // Larger than pipe buffer, writer waits for reader.
+    wr->wbuffer().put_string(data);
+    bool ok = co_await async_write_all(wr);
+    EXPECT_TRUE(ok);
+    wr->wbuffer().put_string("line one\nline two\n");
+    co_await async_write_all(wr);
+    co_close(wr);
+}
+
+static task<void> pipe_reader(std::shared_ptr<stream> rd, std::string data)
+{
+    bool ok = co_await async_read_exact(rd, data.size());
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(rd->rbuffer().get_string(data.size()), data);
+
+    int len = co_await async_read_until(rd, "\n");
+    EXPECT_EQ(rd->rbuffer().get_string(len), "line one\n");
+    len = co_await async_read_until(rd, "\n");
+    EXPECT_EQ(rd->rbuffer().get_string(len), "line two\n");
+
+    // Writer closed.
+    len = co_await async_read_until(rd, "\n");
+    EXPECT_EQ(len, -1);
+    co_close(rd);
+}
+
+TEST_F(TestCoroutine, test_stream)
+{
+    auto pipes = io_factory::get_pipes();
+    pipes[0]->set_evlp(&evlp_);
+    pipes[1]->set_evlp(&evlp_);
+    std::string data(1 << 20, 'c');
+    for (size_t i = 0; i < data.size(); i += 7)
+    {
+        data[i] = 'a' + i % 26;
+    }
+
+    auto body = [](std::atomic<bool> &done,
+                   std::vector<std::shared_ptr<stream>> p,
+                   std::string data) -> task<void>
+    {
+        std::vector<task<void>> tasks;
+        tasks.push_back(pipe_reader(p[0], data));
+        tasks.push_back(pipe_writer(p[1], data));
+        co_await when_all(std::move(tasks));
+        done = true;
+    };
+    co_spawn(evlp_, body(done_, pipes, data));
+}
+
+static task<int> waiting_reader(std::shared_ptr<stream> rd)
+{
+    int len = co_await async_read_some(rd, 4);
+    EXPECT_EQ(len, 4);
+    rd->rbuffer().clear();
+    // Suspended until closed.
+    len = co_await async_read_some(rd, 4);
+    co_return len;
+}
+
+static task<int> closer(event_loop &evlp,
+                        std::vector<std::shared_ptr<stream>> p, int loads)
+{
+    co_await async_sleep_for(evlp, std::chrono::milliseconds(10));
+    EXPECT_EQ(evlp.ev_loads(), loads + 1);
+    p[1]->wbuffer().put_string("ping");
+    co_await async_write_all(p[1]);
+    // Fd stays registered between waits.
+    co_await async_sleep_for(evlp, std::chrono::milliseconds(10));
+    EXPECT_EQ(evlp.ev_loads(), loads + 1);
+    co_close(p[0]);
+    EXPECT_EQ(evlp.ev_loads(), loads);
+    co_return 0;
+}
+
+TEST_F(TestCoroutine, test_close_waiting)
+{
+    auto pipes = io_factory::get_pipes();
+    pipes[0]->set_evlp(&evlp_);
+    pipes[1]->set_evlp(&evlp_);
+
+    auto body = [](event_loop &evlp, std::atomic<bool> &done,
+                   std::vector<std::shared_ptr<stream>> p) -> task<void>
+    {
+        int loads = evlp.ev_loads();
+        std::vector<task<int>> tasks;
+        tasks.push_back(waiting_reader(p[0]));
+        tasks.push_back(closer(evlp, p, loads));
+        std::vector<int> lens = co_await when_all(std::move(tasks));
+        EXPECT_EQ(lens[0], -1);
+        // Closed stream is not waited on.
+        int len = co_await async_read_some(p[0], 4);
+        EXPECT_EQ(len, -1);
+        co_close(p[1]);
+        done = true;
+    };
+    co_spawn(evlp_, body(evlp_, done_, pipes));
+}
+
+TEST_F(TestCoroutine, test_closed_untracked)
+{
+    auto body = [](event_loop &evlp, std::atomic<bool> &done) -> task<void>
+    {
+        // Streams closed without co_close are dropped from the waiters.
+        for (int i = 0; i < 200; ++i)
+        {
+            auto pipes = io_factory::get_pipes();
+            pipes[0]->set_evlp(&evlp);
+            pipes[1]->wbuffer().put_string("x");
+            pipes[1]->write_all();
+            bool ready =
+                co_await async_ready(pipes[0], fd_event::fd_readable);
+            EXPECT_TRUE(ready);
+            evlp.fd_clean(pipes[0]);
+            pipes[0]->close();
+            pipes[1]->close();
+        }
+        EXPECT_LE(fd_waiters::tracked(), 64);
+        done = true;
+    };
+    co_spawn(evlp_, body(evlp_, done_));
+}
+
+TEST(TestCoroutineFramePool, test_reuse)
+{
+    void *p = coroutine_frame_pool::allocate(100);
+    coroutine_frame_pool::deallocate(p, 100);
+    // Same size class.
+    void *q = coroutine_frame_pool::allocate(120);
+    ASSERT_EQ(p, q);
+    coroutine_frame_pool::deallocate(q, 120);
+}
+
+#else
+
+TEST(TestCoroutine, test_unsupported)
+{
+    GTEST_SKIP() << "coroutines need C++20";
+}
+
+#endif
+
+}  // namespace cppev
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -1,7 +1,11 @@
 #include <fcntl.h>
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include <unordered_set>
+#include <vector>
 
 #include "cppev/event_loop.h"
 #include "cppev/io.h"
@@ -249,6 +253,62 @@ TEST_P(TestEventLoop, test_tcp_connect_with_evlp_second)
     sub_thr.join();
 }
 
+TEST(TestEventLoopTask, test_post_and_post_after)
+{
+    event_loop evlp;
+    ASSERT_EQ(evlp.ev_loads(), 0);
+
+    std::vector<int> order;
+    std::atomic<int> count(0);
+    std::chrono::steady_clock::time_point fired;
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread thr([&] { evlp.loop_forever(); });
+
+    // Timers are fired in deadline order, posted tasks at once.
+    evlp.post_after(200,
+                    [&]
+                    {
+                        order.push_back(3);
+                        fired = std::chrono::steady_clock::now();
+                        ++count;
+                    });
+    evlp.post_after(100,
+                    [&]
+                    {
+                        order.push_back(2);
+                        ++count;
+                    });
+    evlp.post(
+        [&]
+        {
+            order.push_back(1);
+            ++count;
+            // Posting from the loop thread is also supported.
+            evlp.post_after(0,
+                            [&]
+                            {
+                                order.push_back(10);
+                                ++count;
+                            });
+        });
+
+    // No upper bound on time, loaded machines delay timers.
+    while (count.load() < 4 && std::chrono::steady_clock::now() - start <
+                                   std::chrono::seconds(10))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    evlp.stop_loop();
+    thr.join();
+
+    ASSERT_EQ(order, std::vector<int>({1, 10, 2, 3}));
+    auto elapsed =
+        std::chrono::duration_cast<std::chrono::milliseconds>(fired - start)
+            .count();
+    ASSERT_GE(elapsed, 200);
+}
+
 INSTANTIATE_TEST_SUITE_P(CppevTest, TestEventLoop,
                          testing::Values(fd_event_mode::level_trigger,
                                          fd_event_mode::edge_trigger,
@@ -0,0 +1,164 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include "cppev/file_cache.h"
+
+namespace cppev
+{
+
+class TestFileCache : public testing::Test
+{
+protected:
+    void TearDown() override
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            unlink(path(i).c_str());
+        }
+    }
+
+    std::string path(int i)
+    {
+        return "./cppev_test_file_cache_" + std::to_string(i);
+    }
+
+    void write_file(const std::string &p, const std::string &content)
+    {
+        int fd = open(p.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
+        ASSERT_EQ(write(fd, content.data(), content.size()),
+                  static_cast<ssize_t>(content.size()));
+        close(fd);
+    }
+
+    // Wait until load handler is triggered and return file.
+    file_view get_and_wait(file_cache &cache, const std::string &p)
+    {
+        std::mutex lock;
+        std::condition_variable cond;
+        bool done = false;
+        file_view ret;
+        cache.get(p,
+                  [&](const file_view &file)
+                  {
+                      std::unique_lock<std::mutex> _(lock);
+                      ret = file;
+                      done = true;
+                      cond.notify_all();
+                  });
+        std::unique_lock<std::mutex> _(lock);
+        cond.wait(_, [&] { return done; });
+        return ret;
+    }
+};
+
+TEST_F(TestFileCache, test_mapped_file)
+{
+    write_file(path(0), "cppev");
+    mapped_file file(path(0));
+    ASSERT_EQ(file.size(), 5);
+    ASSERT_EQ(std::string(file.data(), file.size()), "cppev");
+    ASSERT_FALSE(file.is_stale());
+
+    write_file(path(1), "");
+    mapped_file empty(path(1));
+    ASSERT_EQ(empty.size(), 0);
+    ASSERT_EQ(empty.data(), nullptr);
+
+    ASSERT_THROW(mapped_file(path(2)), std::system_error);
+}
+
+TEST_F(TestFileCache, test_hit_and_stale)
+{
+    write_file(path(0), "cppev");
+    file_cache cache(1024, 1, 1, 0);
+    ASSERT_EQ(cache.lookup(path(0)), nullptr);
+
+    file_view file = get_and_wait(cache, path(0));
+    ASSERT_NE(file, nullptr);
+    ASSERT_EQ(cache.lookup(path(0)), file);
+    ASSERT_EQ(cache.count(), 1);
+    ASSERT_EQ(cache.size(), 5);
+
+    // Replaced file is reloaded, old view stays valid.
+    write_file(path(0), "cppev library");
+    ASSERT_EQ(cache.lookup(path(0)), nullptr);
+    ASSERT_EQ(cache.count(), 0);
+    file_view reloaded = get_and_wait(cache, path(0));
+    ASSERT_EQ(reloaded->size(), 13);
+    ASSERT_EQ(std::string(file->data(), file->size()), "cppev");
+
+    cache.invalidate(path(0));
+    ASSERT_EQ(cache.lookup(path(0)), nullptr);
+
+    // Failure is not cached
+    ASSERT_EQ(get_and_wait(cache, path(3)), nullptr);
+    ASSERT_EQ(cache.count(), 0);
+}
+
+TEST_F(TestFileCache, test_clock_eviction)
+{
+    std::string content(100, 'c');
+    for (int i = 0; i < 4; ++i)
+    {
+        write_file(path(i), content);
+    }
+    file_cache cache(300, 1, 1, -1);
+    for (int i = 0; i < 3; ++i)
+    {
+        ASSERT_NE(get_and_wait(cache, path(i)), nullptr);
+    }
+    ASSERT_EQ(cache.size(), 300);
+
+    // Referenced file survives one sweep of the hand.
+    ASSERT_NE(cache.lookup(path(0)), nullptr);
+    file_view file = get_and_wait(cache, path(3));
+    ASSERT_EQ(cache.count(), 3);
+    ASSERT_NE(cache.lookup(path(0)), nullptr);
+    ASSERT_EQ(cache.lookup(path(1)), nullptr);
+
+    // File larger than budget is loaded but not cached.
+    write_file(path(1), std::string(400, 'c'));
+    ASSERT_EQ(get_and_wait(cache, path(1))->size(), 400);
+    ASSERT_EQ(cache.lookup(path(1)), nullptr);
+    ASSERT_EQ(cache.size(), 300);
+}
+
+TEST_F(TestFileCache, test_concurrent_misses_share_load)
+{
+    write_file(path(0), "cppev");
+    file_cache cache(1024, 4, 2);
+    int count = 10;
+    std::atomic<int> received(0);
+    std::vector<const mapped_file *> files(count);
+    for (int i = 0; i < count; ++i)
+    {
+        cache.get(path(0),
+                  [&, i](const file_view &file)
+                  {
+                      files[i] = file.get();
+                      ++received;
+                  });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_EQ(received.load(), count);
+    for (int i = 0; i < count; ++i)
+    {
+        ASSERT_EQ(files[i], files[0]);
+    }
+}
+
+}  // namespace cppev
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,224 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cppev/future.h"
+#include "cppev/thread_pool.h"
+
+namespace cppev
+{
+
+TEST(TestFuture, test_submit_get)
+{
+    thread_pool_task_queue tp(4);
+    tp.run();
+
+    std::vector<future<int>> futs;
+    for (int i = 0; i < 100; ++i)
+    {
+        futs.push_back(tp.submit([i]() { return i * i; }));
+    }
+    for (int i = 0; i < 100; ++i)
+    {
+        ASSERT_EQ(futs[i].get(), i * i);
+        ASSERT_FALSE(futs[i].valid());
+    }
+
+    std::atomic<int> count(0);
+    future<void> fut = tp.submit([&count]() { ++count; });
+    fut.get();
+    ASSERT_EQ(count.load(), 1);
+
+    tp.stop();
+}
+
+TEST(TestFuture, test_then)
+{
+    thread_pool_task_queue tp(4);
+    tp.run();
+
+    // Task is held until continuations are attached, otherwise the first
+    // one could run inline on this thread.
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::thread::id worker;
+    future<std::string> fut =
+        tp.submit(
+              [opened]()
+              {
+                  opened.wait();
+                  return 6;
+              })
+            .then(
+                [&worker](int x)
+                {
+                    worker = std::this_thread::get_id();
+                    return x * 7;
+                })
+            .then([](int x) { return std::to_string(x); });
+    gate.set_value();
+    ASSERT_EQ(fut.get(), "42");
+    ASSERT_NE(worker, std::this_thread::get_id());
+
+    // Continuation returning future is unwrapped.
+    future<int> nested =
+        tp.submit([]() { return 1; })
+            .then([&tp](int x) { return tp.submit([x]() { return x + 1; }); })
+            .then([](int x) { return x * 10; });
+    ASSERT_EQ(nested.get(), 20);
+
+    // Continuation on ready future runs right away.
+    promise<int> p;
+    future<int> ready = p.get_future();
+    p.set_value(3);
+    int value = 0;
+    ready.then([&value](int x) { value = x; }).get();
+    ASSERT_EQ(value, 3);
+
+    // Continuation posted to executor.
+    future<std::thread::id> posted = tp.submit([]() {}).then(
+        tp, []() { return std::this_thread::get_id(); });
+    ASSERT_NE(posted.get(), std::this_thread::get_id());
+
+    tp.stop();
+}
+
+TEST(TestFuture, test_exception)
+{
+    thread_pool_task_queue tp(2);
+    tp.run();
+
+    std::atomic<bool> called(false);
+    future<int> fut = tp.submit([]() -> int { throw std::runtime_error("x"); })
+                          .then(
+                              [&called](int x)
+                              {
+                                  called = true;
+                                  return x;
+                              });
+    ASSERT_THROW(fut.get(), std::runtime_error);
+    ASSERT_FALSE(called.load());
+
+    future<int> broken;
+    {
+        promise<int> p;
+        broken = p.get_future();
+    }
+    ASSERT_THROW(broken.get(), std::future_error);
+
+    tp.stop();
+}
+
+TEST(TestFuture, test_when_all)
+{
+    thread_pool_task_queue tp(4);
+    tp.run();
+
+    std::vector<future<int>> futs;
+    for (int i = 0; i < 50; ++i)
+    {
+        futs.push_back(tp.submit([i]() { return i; }));
+    }
+    std::vector<int> values = when_all(std::move(futs)).get();
+    ASSERT_EQ(values.size(), 50);
+    for (int i = 0; i < 50; ++i)
+    {
+        ASSERT_EQ(values[i], i);
+    }
+
+    std::atomic<int> count(0);
+    std::vector<future<void>> voids;
+    for (int i = 0; i < 50; ++i)
+    {
+        voids.push_back(tp.submit([&count]() { ++count; }));
+    }
+    when_all(std::move(voids)).get();
+    ASSERT_EQ(count.load(), 50);
+
+    std::vector<future<int>> failing;
+    failing.push_back(tp.submit([]() { return 1; }));
+    failing.push_back(
+        tp.submit([]() -> int { throw std::logic_error("failed"); }));
+    ASSERT_THROW(when_all(std::move(failing)).get(), std::logic_error);
+
+    ASSERT_TRUE(when_all(std::vector<future<int>>()).get().empty());
+
+    tp.stop();
+}
+
+TEST(TestFuture, test_when_any)
+{
+    promise<int> p0;
+    promise<int> p1;
+    std::vector<future<int>> futs;
+    futs.push_back(p0.get_future());
+    futs.push_back(p1.get_future());
+    future<std::pair<size_t, int>> any = when_any(std::move(futs));
+    ASSERT_FALSE(any.is_ready());
+    p1.set_value(11);
+    ASSERT_TRUE(any.is_ready());
+    p0.set_value(10);
+    std::pair<size_t, int> first = any.get();
+    ASSERT_EQ(first.first, 1);
+    ASSERT_EQ(first.second, 11);
+
+    promise<void> v0;
+    promise<void> v1;
+    std::vector<future<void>> voids;
+    voids.push_back(v0.get_future());
+    voids.push_back(v1.get_future());
+    future<size_t> index = when_any(std::move(voids));
+    v0.set_value();
+    v1.set_value();
+    ASSERT_EQ(index.get(), 0);
+}
+
+TEST(TestFuture, test_cancellation)
+{
+    thread_pool_task_queue tp(1);
+    tp.run();
+
+    cancellation_source source;
+    std::atomic<bool> release(false);
+    future<void> blocker = tp.submit(
+        [&release]()
+        {
+            while (!release.load())
+            {
+                std::this_thread::yield();
+            }
+        });
+
+    // Worker is busy, so the task is cancelled before it is taken.
+    std::atomic<bool> called(false);
+    future<void> skipped =
+        tp.submit([&called]() { called = true; }, source.token());
+    source.cancel();
+    release = true;
+    ASSERT_THROW(skipped.get(), cancelled_error);
+    ASSERT_FALSE(called.load());
+    blocker.get();
+
+    cancellation_source chain;
+    promise<int> p;
+    future<int> fut =
+        p.get_future().then([](int x) { return x + 1; }, chain.token());
+    chain.cancel();
+    p.set_value(1);
+    ASSERT_THROW(fut.get(), cancelled_error);
+
+    tp.stop();
+}
+
+}  // namespace cppev
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
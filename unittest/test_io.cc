@@ -1,6 +1,10 @@
+#include <arpa/inet.h>
 #include <fcntl.h>
 #include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
 
+#include <cstring>
 #include <unordered_set>
 
 #include "cppev/event_loop.h"
@@ -126,6 +130,396 @@ TEST_P(TestIOSocket, test_udp_socket)
     EXPECT_EQ(sock->get_so_rcvlowat(), std::get<2>(p));
 }
 
+TEST(TestIO, test_socktcp_send_file)
+{
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
+    ASSERT_EQ(write(fd, str, strlen(str)), static_cast<ssize_t>(strlen(str)));
+    close(fd);
+    fd = open(file, O_RDONLY);
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    socktcp sender(fds[0], family::local);
+    stream receiver(fds[1]);
+
+    // sendfile
+    off_t offset = 6;
+    EXPECT_EQ(sender.send_file(fd, offset, 5), 5);
+    EXPECT_EQ(offset, 11);
+    EXPECT_EQ(sender.send_file(fd, offset, 100),
+              static_cast<int>(strlen(str)) - 11);
+    EXPECT_EQ(sender.send_file(fd, offset, 100), 0);
+    receiver.read_all();
+    EXPECT_EQ(receiver.rbuffer().get_string(), std::string(str + 6));
+
+    // Write buffer is sent before the segment queued after it
+    sender.wbuffer().put_string("head:");
+    sender.queue_file(fd, 0, 5);
+    sender.wbuffer().put_string(":tail");
+    EXPECT_FALSE(sender.files_empty());
+    EXPECT_TRUE(sender.write_files());
+    EXPECT_TRUE(sender.files_empty());
+    sender.write_all();
+    receiver.read_all();
+    EXPECT_EQ(receiver.rbuffer().get_string(), "head:Cppev:tail");
+
+    // splice, source is pipe
+    auto pipes = io_factory::get_pipes();
+    pipes[1]->wbuffer().put_string(str);
+    pipes[1]->write_all();
+    offset = 0;
+    EXPECT_EQ(sender.send_file(pipes[0]->fd(), offset, strlen(str)),
+              static_cast<int>(strlen(str)));
+    receiver.read_all();
+    EXPECT_EQ(receiver.rbuffer().get_string(), str);
+
+    // Regular file after pipe source, chosen per call
+    offset = 0;
+    EXPECT_EQ(sender.send_file(fd, offset, 5), 5);
+    EXPECT_EQ(offset, 5);
+    receiver.read_all();
+    EXPECT_EQ(receiver.rbuffer().get_string(), std::string(str, 5));
+
+    close(fd);
+}
+
+#ifdef __linux__
+TEST(TestIO, test_socktcp_zerocopy)
+{
+    // Loopback tcp connection, sender is nonblocking.
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(lfd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)), 0);
+    ASSERT_EQ(listen(lfd, 1), 0);
+    socklen_t len = sizeof(addr);
+    getsockname(lfd, reinterpret_cast<sockaddr *>(&addr), &len);
+    int cfd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_EQ(connect(cfd, reinterpret_cast<sockaddr *>(&addr), len), 0);
+    socktcp sender(accept(lfd, nullptr, nullptr), family::ipv4);
+    stream receiver(cfd);
+    close(lfd);
+    sender.set_io_nonblock();
+
+    sender.set_tcp_cork(true);
+    EXPECT_TRUE(sender.get_tcp_cork());
+    sender.set_tcp_cork(false);
+    EXPECT_FALSE(sender.get_tcp_cork());
+
+    sender.set_so_zerocopy();
+    EXPECT_TRUE(sender.get_so_zerocopy());
+
+    std::string data(4 * sysconfig::zerocopy_threshold, 'c');
+    sender.wbuffer().put_string(data);
+    std::string received;
+    while (sender.zerocopy_unsent() || sender.wbuffer().size())
+    {
+        sender.write_zerocopy();
+        receiver.read_all();
+        received += receiver.rbuffer().get_string();
+    }
+    EXPECT_EQ(sender.wbuffer().size(), 0);
+    while (static_cast<int>(received.size()) < static_cast<int>(data.size()))
+    {
+        receiver.read_all();
+        received += receiver.rbuffer().get_string();
+    }
+    EXPECT_EQ(received, data);
+
+    // Block is released once kernel completes the send.
+    for (int i = 0; i < 100 && sender.zerocopy_pending(); ++i)
+    {
+        sender.drain_zerocopy();
+        usleep(1000);
+    }
+    EXPECT_FALSE(sender.zerocopy_pending());
+}
+
+TEST(TestIO, test_socktcp_zerocopy_defer)
+{
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(lfd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)), 0);
+    ASSERT_EQ(listen(lfd, 1), 0);
+    socklen_t len = sizeof(addr);
+    getsockname(lfd, reinterpret_cast<sockaddr *>(&addr), &len);
+    int cfd = socket(AF_INET, SOCK_STREAM, 0);
+    // Small window of receiver keeps zero copy data queued in sender, so
+    // its completion does not arrive before close.
+    int rcvbuf = 4096;
+    setsockopt(cfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    ASSERT_EQ(connect(cfd, reinterpret_cast<sockaddr *>(&addr), len), 0);
+    stream receiver(cfd);
+    std::string filler(1 << 16, 'f');
+    std::string data(sysconfig::zerocopy_threshold, 'c');
+    for (size_t i = 0; i < data.size(); i += 7)
+    {
+        data[i] = 'a' + i % 26;
+    }
+    // Lowest free descriptor, taken by the copy kept for completions.
+    int copied;
+    {
+        socktcp sender(accept(lfd, nullptr, nullptr), family::ipv4);
+        sender.set_io_nonblock();
+        sender.set_so_sndbuf(1 << 20);
+        sender.set_so_zerocopy();
+        sender.wbuffer().put_string(filler);
+        sender.write_all();
+        ASSERT_EQ(sender.wbuffer().size(), 0);
+        sender.wbuffer().put_string(data);
+        sender.write_zerocopy();
+        ASSERT_FALSE(sender.zerocopy_unsent());
+        sender.drain_zerocopy();
+        EXPECT_TRUE(sender.zerocopy_pending());
+        // Closed before completion, block outlives the socket.
+        copied = dup(0);
+        close(copied);
+        sender.defer_zerocopy();
+        EXPECT_FALSE(sender.zerocopy_pending());
+    }
+    close(lfd);
+
+    // Data arrives intact and the connection ends.
+    std::string received;
+    while (!receiver.eof())
+    {
+        receiver.read_all();
+        received += receiver.rbuffer().get_string();
+    }
+    EXPECT_EQ(received, filler + data);
+
+    // Copy is closed in background once completion arrives.
+    for (int i = 0; i < 200 && fcntl(copied, F_GETFD) != -1; ++i)
+    {
+        usleep(10000);
+    }
+    EXPECT_EQ(fcntl(copied, F_GETFD), -1);
+}
+#endif
+
+#ifdef __linux__
+TEST(TestIO, test_socktcp_fastopen)
+{
+    int port = 8901;
+    auto listener = io_factory::get_socktcp(family::ipv4);
+    listener->set_so_reuseaddr();
+    listener->set_tcp_fastopen(16);
+    EXPECT_EQ(listener->get_tcp_fastopen(), 16);
+    listener->set_tcp_defer_accept(1);
+    EXPECT_GT(listener->get_tcp_defer_accept(), 0);
+    listener->bind("127.0.0.1", port);
+    listener->listen();
+
+    // Data is written before the handshake completes.
+    auto client = io_factory::get_socktcp(family::ipv4);
+    client->set_tcp_fastopen_connect();
+    EXPECT_TRUE(client->get_tcp_fastopen_connect());
+    ASSERT_TRUE(client->connect("127.0.0.1", port));
+    client->wbuffer().put_string(str);
+    for (int i = 0; i < 100 && client->wbuffer().size(); ++i)
+    {
+        client->write_all();
+        usleep(1000);
+    }
+    EXPECT_EQ(client->wbuffer().size(), 0);
+
+    // Connection is accepted only after its data arrives.
+    std::vector<std::shared_ptr<socktcp>> conns;
+    for (int i = 0; i < 100 && conns.empty(); ++i)
+    {
+        conns = listener->accept();
+        usleep(1000);
+    }
+    ASSERT_EQ(conns.size(), 1);
+    std::string received;
+    for (int i = 0; i < 100 && received.size() < strlen(str); ++i)
+    {
+        conns[0]->read_all();
+        received += conns[0]->rbuffer().get_string();
+        usleep(1000);
+    }
+    EXPECT_EQ(received, str);
+}
+#endif
+
+TEST(TestIO, test_sockudp_batch)
+{
+    int port = 8893;
+    auto receiver = io_factory::get_sockudp(family::ipv4);
+    auto sender = io_factory::get_sockudp(family::ipv4);
+    receiver->bind(port);
+
+    int count = 40;
+    datagram_ring out(64);
+    datagram_ring in(64);
+    for (int i = 0; i < count; ++i)
+    {
+        std::string msg = str + std::to_string(i);
+        ASSERT_TRUE(out.push(msg.data(), msg.size(), "127.0.0.1", port,
+                             family::ipv4));
+    }
+    EXPECT_EQ(sender->send_batch(out), count);
+    EXPECT_EQ(receiver->recv_batch(in), count);
+    for (int i = 0; i < count; ++i)
+    {
+        EXPECT_EQ(std::string(in.data(i), in.length(i)),
+                  str + std::to_string(i));
+        EXPECT_EQ(in.peer(i).ip(), "127.0.0.1");
+    }
+    in.clear();
+    EXPECT_EQ(receiver->recv_batch(in), 0);
+
+#ifdef __linux__
+    // GSO splits one buffer into datagrams of segment size.
+    out.clear();
+    std::string payload(3 * 100, 'c');
+    ASSERT_TRUE(out.push(payload.data(), payload.size(), "127.0.0.1", port,
+                         family::ipv4, 100));
+    EXPECT_EQ(sender->send_batch(out), 1);
+    EXPECT_EQ(receiver->recv_batch(in), 3);
+    for (int i = 0; i < 3; ++i)
+    {
+        EXPECT_EQ(in.length(i), 100);
+    }
+
+    // More segments than GSO allows fails with EINVAL, the buffer is split
+    // by sendto then.
+    int segments = 200;
+    datagram_ring many(2 * segments);
+    for (int round = 0; round < 2; ++round)
+    {
+        out.clear();
+        many.clear();
+        std::string small(segments * 4, 's');
+        ASSERT_TRUE(out.push(small.data(), small.size(), "127.0.0.1", port,
+                             family::ipv4, 4));
+        EXPECT_EQ(sender->send_batch(out), 1);
+        EXPECT_EQ(receiver->recv_batch(many), segments);
+        for (int i = 0; i < segments; ++i)
+        {
+            EXPECT_EQ(many.length(i), 4);
+        }
+    }
+#endif
+}
+
+TEST(TestIO, test_endpoint)
+{
+    endpoint ep4("127.0.0.1", 8897, family::ipv4);
+    EXPECT_EQ(ep4.sockfamily(), family::ipv4);
+    EXPECT_EQ(ep4.port(), 8897);
+    EXPECT_EQ(ep4.ip(), "127.0.0.1");
+    EXPECT_EQ(ep4.to_string(), "127.0.0.1:8897");
+    EXPECT_EQ(ep4.length(), sizeof(sockaddr_in));
+
+    endpoint ep6("::1", 8897, family::ipv6);
+    EXPECT_EQ(ep6.to_string(), "[::1]:8897");
+    EXPECT_EQ(ep6.length(), sizeof(sockaddr_in6));
+
+    EXPECT_EQ(ep4, endpoint(std::string("127.0.0.1"), 8897, family::ipv4));
+    EXPECT_EQ(ep4.hash(), endpoint("127.0.0.1", 8897, family::ipv4).hash());
+    EXPECT_NE(ep4, endpoint("127.0.0.1", 8898, family::ipv4));
+    EXPECT_NE(ep4, ep6);
+    EXPECT_NE(ep4, endpoint());
+    EXPECT_THROW(endpoint("127.0.0.256", 8897, family::ipv4),
+                 std::logic_error);
+
+    std::unordered_set<endpoint, endpoint_hash> eps{ep4, ep6};
+    EXPECT_EQ(eps.count(endpoint("::1", 8897, family::ipv6)), 1);
+
+    // Link local address on different interfaces.
+    sockaddr_storage scoped = endpoint("fe80::1", 8897, family::ipv6).storage();
+    reinterpret_cast<sockaddr_in6 *>(&scoped)->sin6_scope_id = 1;
+    endpoint on_if1(scoped);
+    reinterpret_cast<sockaddr_in6 *>(&scoped)->sin6_scope_id = 2;
+    endpoint on_if2(scoped);
+    EXPECT_NE(on_if1, on_if2);
+    EXPECT_NE(on_if1.hash(), on_if2.hash());
+    EXPECT_EQ(on_if1, endpoint(on_if1.storage()));
+
+    auto receiver = io_factory::get_sockudp(family::ipv4);
+    auto sender = io_factory::get_sockudp(family::ipv4);
+    receiver->bind(ep4.port());
+    sender->bind("127.0.0.1", 8898);
+    sender->wbuffer().put_string(str);
+    sender->send(ep4);
+    endpoint peer = receiver->recv_from();
+    EXPECT_EQ(receiver->rbuffer().get_string(), str);
+    EXPECT_EQ(peer, endpoint("127.0.0.1", 8898, family::ipv4));
+
+    // Reply to the address returned by recv_from.
+    receiver->wbuffer().put_string(str);
+    receiver->send(peer);
+    EXPECT_EQ(sender->recv_from(), ep4);
+    EXPECT_EQ(sender->rbuffer().get_string(), str);
+}
+
+TEST(TestIO, test_sock_fd_passing)
+{
+    const char *path = "./cppev_test_fd_passing";
+    auto listener = io_factory::get_socktcp(family::local);
+    listener->bind_unix(path, true);
+    listener->listen();
+    auto client = io_factory::get_socktcp(family::local);
+    ASSERT_TRUE(client->connect_unix(path));
+    std::vector<std::shared_ptr<socktcp>> conns;
+    while (conns.empty())
+    {
+        conns = listener->accept(1);
+    }
+    auto server = conns[0];
+
+    peer_credentials cred = server->get_peer_credentials();
+#ifdef __linux__
+    EXPECT_EQ(cred.pid, getpid());
+#endif
+    EXPECT_EQ(cred.uid, getuid());
+    EXPECT_EQ(cred.gid, getgid());
+
+    int pfds[2];
+    ASSERT_EQ(pipe(pfds), 0);
+
+    // Plain socket api.
+    EXPECT_EQ(client->send_fds({pfds[0], pfds[1]}, "x", 1), 1);
+    std::vector<int> fds;
+    EXPECT_EQ(server->recv_fds(fds), 1);
+    EXPECT_EQ(server->rbuffer().get_string(), "x");
+    ASSERT_EQ(fds.size(), 2);
+    ASSERT_EQ(write(fds[1], str, strlen(str)), strlen(str));
+    char buf[64] = {0};
+    ASSERT_EQ(read(pfds[0], buf, sizeof(buf)), strlen(str));
+    EXPECT_STREQ(buf, str);
+    close(fds[0]);
+    close(fds[1]);
+
+    // Descriptors queued with write buffer, as used by reactor.
+    EXPECT_THROW(client->queue_fds({pfds[1]}), std::logic_error);
+    client->wbuffer().put_string(str);
+    client->queue_fds({pfds[1]});
+    EXPECT_TRUE(client->write_fds());
+    EXPECT_EQ(client->wbuffer().size(), 0);
+    server->set_fd_passing();
+    EXPECT_EQ(server->read_all_fds(), strlen(str));
+    EXPECT_EQ(server->rbuffer().get_string(), str);
+    fds = server->take_fds();
+    ASSERT_EQ(fds.size(), 1);
+    EXPECT_TRUE(server->take_fds().empty());
+    ASSERT_EQ(write(fds[0], "y", 1), 1);
+    ASSERT_EQ(read(pfds[0], buf, sizeof(buf)), 1);
+    EXPECT_EQ(buf[0], 'y');
+    close(fds[0]);
+
+    client->close();
+    server->read_all_fds();
+    EXPECT_TRUE(server->eof());
+    close(pfds[0]);
+    close(pfds[1]);
+    unlink(path);
+}
+
 INSTANTIATE_TEST_SUITE_P(
     CppevTest, TestIOSocket,
     testing::Combine(
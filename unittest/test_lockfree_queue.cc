@@ -0,0 +1,288 @@
+#include <gtest/gtest.h>
+
+#include <sys/wait.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "cppev/event_loop.h"
+#include "cppev/ipc.h"
+#include "cppev/lockfree_queue.h"
+
+namespace cppev
+{
+
+TEST(TestLockfreeQueue, test_spsc_queue)
+{
+    int count = 100000;
+    auto q = std::make_unique<spsc_queue<int, 64>>();
+    ASSERT_TRUE(q->empty());
+    ASSERT_EQ(q->capacity(), 64);
+
+    std::thread producer(
+        [&]
+        {
+            int batch[8];
+            for (int i = 0; i < count;)
+            {
+                int n = std::min(8, count - i);
+                for (int j = 0; j < n; ++j)
+                {
+                    batch[j] = i + j;
+                }
+                int done = 0;
+                while (done < n)
+                {
+                    int pushed = q->try_push(batch + done, n - done);
+                    if (pushed == 0)
+                    {
+                        std::this_thread::yield();
+                    }
+                    done += pushed;
+                }
+                i += n;
+            }
+        });
+
+    int expected = 0;
+    int batch[5];
+    while (expected < count)
+    {
+        size_t n = q->try_pop(batch, 5);
+        if (n == 0)
+        {
+            std::this_thread::yield();
+        }
+        for (size_t j = 0; j < n; ++j)
+        {
+            ASSERT_EQ(batch[j], expected++);
+        }
+    }
+    producer.join();
+    ASSERT_TRUE(q->empty());
+}
+
+TEST(TestLockfreeQueue, test_mpmc_queue)
+{
+    int producers = 4;
+    int consumers = 4;
+    int64_t count = 50000;
+    auto q = std::make_unique<mpmc_queue<int64_t, 256>>();
+    std::atomic<int64_t> sum(0);
+    std::atomic<int64_t> popped(0);
+
+    std::vector<std::thread> thrs;
+    for (int i = 0; i < producers; ++i)
+    {
+        thrs.emplace_back(
+            [&, i]
+            {
+                for (int64_t j = 1; j <= count; ++j)
+                {
+                    while (!q->try_push(j * producers + i))
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+    }
+    for (int i = 0; i < consumers; ++i)
+    {
+        thrs.emplace_back(
+            [&]
+            {
+                int64_t item;
+                while (popped.load() < producers * count)
+                {
+                    if (q->try_pop(item))
+                    {
+                        sum += item;
+                        ++popped;
+                    }
+                    else
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+    }
+    for (auto &thr : thrs)
+    {
+        thr.join();
+    }
+    int64_t expected = 0;
+    for (int i = 0; i < producers; ++i)
+    {
+        expected += producers * count * (count + 1) / 2 + i * count;
+    }
+    ASSERT_EQ(sum.load(), expected);
+    ASSERT_TRUE(q->empty());
+}
+
+TEST(TestLockfreeQueue, test_full_and_lifetime)
+{
+    auto item = std::make_shared<int>(0);
+    {
+        spsc_queue<std::shared_ptr<int>, 4> spsc;
+        mpmc_queue<std::shared_ptr<int>, 4> mpmc;
+        for (int i = 0; i < 4; ++i)
+        {
+            ASSERT_TRUE(spsc.try_push(item));
+            ASSERT_TRUE(mpmc.try_push(item));
+        }
+        ASSERT_FALSE(spsc.try_push(item));
+        ASSERT_FALSE(mpmc.try_push(item));
+        ASSERT_EQ(item.use_count(), 9);
+
+        std::shared_ptr<int> out;
+        ASSERT_TRUE(spsc.try_pop(out));
+        ASSERT_TRUE(mpmc.try_pop(out));
+        out.reset();
+        ASSERT_EQ(item.use_count(), 7);
+    }
+    // Items left are destroyed with queue.
+    ASSERT_EQ(item.use_count(), 1);
+}
+
+TEST(TestLockfreeQueue, test_blocking_queue)
+{
+    int count = 10000;
+    blocking_queue<mpmc_queue<int, 16>> q;
+    std::vector<std::thread> thrs;
+    for (int i = 0; i < 2; ++i)
+    {
+        thrs.emplace_back(
+            [&]
+            {
+                for (int j = 0; j < count; ++j)
+                {
+                    q.push(1);
+                }
+            });
+    }
+    int sum = 0;
+    int batch[4];
+    while (sum < 2 * count)
+    {
+        size_t n = q.pop(batch, 4);
+        ASSERT_GT(n, 0);
+        for (size_t j = 0; j < n; ++j)
+        {
+            sum += batch[j];
+        }
+    }
+    for (auto &thr : thrs)
+    {
+        thr.join();
+    }
+    ASSERT_EQ(sum, 2 * count);
+    ASSERT_TRUE(q.empty());
+}
+
+TEST(TestLockfreeQueue, test_event_loop_queue)
+{
+    int count = 10000;
+    event_loop evlp;
+    std::atomic<int> sum(0);
+    std::thread::id loop_id;
+    bool on_loop = true;
+    auto q = std::make_unique<event_loop_queue<mpmc_queue<int, 1024>>>(
+        evlp,
+        [&](int &&item)
+        {
+            on_loop = on_loop && std::this_thread::get_id() == loop_id;
+            sum += item;
+        },
+        64);
+
+    std::thread thr(
+        [&]
+        {
+            loop_id = std::this_thread::get_id();
+            evlp.loop_forever();
+        });
+    for (int i = 0; i < count; ++i)
+    {
+        while (!q->try_push(1))
+        {
+            std::this_thread::yield();
+        }
+    }
+    while (sum.load() != count)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    evlp.stop_loop();
+    thr.join();
+    ASSERT_TRUE(on_loop);
+}
+
+#ifdef __linux__
+TEST(TestLockfreeQueue, test_spsc_queue_by_fork)
+{
+    using queue_type = spsc_queue<int, 128>;
+    std::string name = "/cppev_test_lockfree_queue";
+    int count = 100000;
+
+    semaphore sem(name);
+    shared_memory shm(name, sizeof(queue_type));
+    ASSERT_TRUE(shm.creator());
+    queue_type *q = shm.construct<queue_type>();
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        throw_system_error("fork error");
+    }
+    else if (pid == 0)
+    {
+        semaphore child_sem(name);
+        child_sem.acquire();
+        shared_memory child_shm(name, sizeof(queue_type));
+        queue_type *cq = static_cast<queue_type *>(child_shm.ptr());
+        int expected = 0;
+        int item;
+        while (expected < count)
+        {
+            if (!cq->try_pop(item))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            if (item != expected)
+            {
+                _exit(1);
+            }
+            ++expected;
+        }
+        _exit(0);
+    }
+    else
+    {
+        sem.release();
+        for (int i = 0; i < count; ++i)
+        {
+            while (!q->try_push(i))
+            {
+                std::this_thread::yield();
+            }
+        }
+        int ret = -1;
+        waitpid(pid, &ret, 0);
+        EXPECT_EQ(ret, 0);
+        q->~queue_type();
+        shm.unlink();
+        sem.unlink();
+    }
+}
+#endif
+
+}  // namespace cppev
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
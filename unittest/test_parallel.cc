@@ -0,0 +1,184 @@
+#include <gtest/gtest.h>
+
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cppev/parallel.h"
+
+namespace cppev
+{
+
+TEST(TestParallel, test_parallel_for)
+{
+    thread_pool_task_queue tp(4);
+    tp.run();
+
+    std::vector<int> hits(100000, 0);
+    parallel_for(tp, 0, static_cast<int>(hits.size()), 0,
+                 [&](int i) { ++hits[i]; });
+    ASSERT_TRUE(std::all_of(hits.begin(), hits.end(),
+                            [](int h) { return h == 1; }));
+
+    // Grain of one and empty range.
+    std::atomic<int> count(0);
+    parallel_for(tp, 10, 20, 1, [&](int) { ++count; });
+    parallel_for(tp, 5, 5, 1, [&](int) { ++count; });
+    ASSERT_EQ(count.load(), 10);
+
+    // Nested in tasks of the same pool, workers wait by helping.
+    std::atomic<int64_t> sum(0);
+    parallel_for(tp, 0, 64, 1,
+                 [&](int i)
+                 {
+                     parallel_for(tp, 0, 100, 7, [&](int j) { sum += i * j; });
+                 });
+    ASSERT_EQ(sum.load(), int64_t(63 * 64 / 2) * (99 * 100 / 2));
+    tp.stop();
+}
+
+TEST(TestParallel, test_parallel_for_caller_only)
+{
+    // Pool not running, calling thread runs all parts.
+    thread_pool_task_queue tp(2);
+    std::vector<int> hits(1000, 0);
+    parallel_for(tp, size_t(0), hits.size(), 10, [&](size_t i) { ++hits[i]; });
+    ASSERT_EQ(std::count(hits.begin(), hits.end(), 1), 1000);
+}
+
+TEST(TestParallel, test_parallel_exception)
+{
+    thread_pool_task_queue tp(4);
+    tp.run();
+    std::atomic<int> count(0);
+    ASSERT_THROW(parallel_for(tp, 0, 100000, 10,
+                              [&](int i)
+                              {
+                                  if (i == 500)
+                                  {
+                                      throw std::runtime_error("part");
+                                  }
+                                  ++count;
+                              }),
+                 std::runtime_error);
+    ASSERT_LT(count.load(), 100000);
+    tp.stop();
+}
+
+static int64_t thread_cpu_us()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return int64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+TEST(TestParallel, test_parallel_wait_sleeps)
+{
+    thread_pool_task_queue tp(1);
+    tp.run();
+    parallel_group group(tp);
+    std::atomic<bool> started(false);
+    group.run(
+        [&]
+        {
+            started = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        });
+    while (!started.load())
+    {
+        std::this_thread::yield();
+    }
+    // Task runs on worker, waiter sleeps instead of spinning.
+    int64_t begin = thread_cpu_us();
+    group.wait();
+    ASSERT_LT(thread_cpu_us() - begin, 50000);
+    tp.stop();
+}
+
+TEST(TestParallel, test_parallel_reduce)
+{
+    thread_pool_task_queue tp(4);
+    tp.run();
+
+    int64_t sum = parallel_reduce(
+        tp, int64_t(1), int64_t(1000001), 0, int64_t(0),
+        [](int64_t i) { return i; },
+        [](int64_t a, int64_t b) { return a + b; });
+    ASSERT_EQ(sum, int64_t(1000000) * 1000001 / 2);
+
+    // Concatenation is associative but not commutative.
+    std::string s = parallel_reduce(
+        tp, 0, 26, 3, std::string(),
+        [](int i) { return std::string(1, static_cast<char>('a' + i)); },
+        [](std::string a, const std::string &b) { return a + b; });
+    ASSERT_EQ(s, "abcdefghijklmnopqrstuvwxyz");
+
+    ASSERT_EQ(parallel_reduce(
+                  tp, 3, 3, 0, 42, [](int i) { return i; },
+                  [](int a, int b) { return a + b; }),
+              42);
+    tp.stop();
+}
+
+TEST(TestParallel, test_parallel_transform)
+{
+    thread_pool_task_queue tp(4);
+    tp.run();
+    std::vector<int> in(50000);
+    std::iota(in.begin(), in.end(), 0);
+    std::vector<int64_t> out(in.size());
+    auto it = parallel_transform(tp, in.begin(), in.end(), out.begin(),
+                                 [](int x) { return int64_t(x) * x; });
+    ASSERT_EQ(it, out.end());
+    for (size_t i = 0; i < in.size(); ++i)
+    {
+        ASSERT_EQ(out[i], int64_t(i) * i);
+    }
+    tp.stop();
+}
+
+TEST(TestParallel, test_parallel_sort)
+{
+    thread_pool_task_queue tp(4);
+    tp.run();
+
+    std::mt19937 rng(7);
+    std::vector<int> v(200000);
+    for (auto &x : v)
+    {
+        x = rng() % 1000;
+    }
+    std::vector<int> expected = v;
+    std::sort(expected.begin(), expected.end());
+    parallel_sort(tp, v.begin(), v.end());
+    ASSERT_EQ(v, expected);
+
+    std::reverse(expected.begin(), expected.end());
+    parallel_sort(tp, v.begin(), v.end(), std::greater<int>(), 100);
+    ASSERT_EQ(v, expected);
+
+    // All equal and already sorted.
+    std::vector<int> same(50000, 3);
+    parallel_sort(tp, same.begin(), same.end(), std::less<int>(), 64);
+    ASSERT_TRUE(std::is_sorted(same.begin(), same.end()));
+    std::iota(same.begin(), same.end(), 0);
+    parallel_sort(tp, same.begin(), same.end(), std::less<int>(), 64);
+    ASSERT_TRUE(std::is_sorted(same.begin(), same.end()));
+    tp.stop();
+}
+
+}  // namespace cppev
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "cppev/resolver.h"
+
+namespace cppev
+{
+
+TEST(TestResolver, test_is_ip_literal)
+{
+    ASSERT_TRUE(is_ip_literal("127.0.0.1", family::ipv4));
+    ASSERT_TRUE(is_ip_literal("::1", family::ipv6));
+    ASSERT_TRUE(is_ip_literal("/tmp/cppev_test.sock", family::local));
+    ASSERT_FALSE(is_ip_literal("::1", family::ipv4));
+    ASSERT_FALSE(is_ip_literal("localhost", family::ipv4));
+    ASSERT_FALSE(is_ip_literal("localhost", family::ipv6));
+}
+
+TEST(TestResolver, test_interleave_addresses)
+{
+    std::vector<resolved_address> addrs = {
+        {"10.0.0.1", family::ipv4}, {"10.0.0.2", family::ipv4},
+        {"10.0.0.3", family::ipv4}, {"fd00::1", family::ipv6},
+        {"fd00::2", family::ipv6},
+    };
+    std::vector<resolved_address> expected = {
+        {"fd00::1", family::ipv6}, {"10.0.0.1", family::ipv4},
+        {"fd00::2", family::ipv6}, {"10.0.0.2", family::ipv4},
+        {"10.0.0.3", family::ipv4},
+    };
+    ASSERT_EQ(interleave_addresses(addrs, family::ipv6), expected);
+    ASSERT_EQ(interleave_addresses(addrs, family::ipv4)[0], addrs[0]);
+    ASSERT_EQ(interleave_addresses(addrs, family::ipv4)[1], expected[0]);
+}
+
+class TestResolverLookup : public testing::Test
+{
+protected:
+    // Wait until resolve handler is triggered and return addresses.
+    std::vector<resolved_address> resolve_and_wait(resolver &dns,
+                                                   const std::string &host)
+    {
+        std::mutex lock;
+        std::condition_variable cond;
+        bool done = false;
+        std::vector<resolved_address> ret;
+        dns.resolve(host,
+                    [&](const std::vector<resolved_address> &addrs)
+                    {
+                        std::unique_lock<std::mutex> _(lock);
+                        ret = addrs;
+                        done = true;
+                        cond.notify_all();
+                    });
+        std::unique_lock<std::mutex> _(lock);
+        cond.wait(_, [&] { return done; });
+        return ret;
+    }
+};
+
+TEST_F(TestResolverLookup, test_cache_and_ttl)
+{
+    int ttl = 200;
+    resolver dns(1, ttl);
+    std::atomic<int> lookups(0);
+    dns.set_lookup(
+        [&](const std::string &host) -> std::vector<resolved_address>
+        {
+            ++lookups;
+            if (host == "backend.test")
+            {
+                return {{"::1", family::ipv6}, {"127.0.0.1", family::ipv4}};
+            }
+            return {};
+        });
+
+    auto addrs = resolve_and_wait(dns, "backend.test");
+    ASSERT_EQ(addrs.size(), 2);
+    ASSERT_EQ(lookups.load(), 1);
+
+    // Cache hit
+    ASSERT_EQ(resolve_and_wait(dns, "backend.test"), addrs);
+    ASSERT_EQ(lookups.load(), 1);
+
+    // Expired
+    std::this_thread::sleep_for(std::chrono::milliseconds(ttl + 50));
+    ASSERT_EQ(resolve_and_wait(dns, "backend.test"), addrs);
+    ASSERT_EQ(lookups.load(), 2);
+
+    // Invalidated
+    dns.invalidate("backend.test");
+    ASSERT_EQ(resolve_and_wait(dns, "backend.test"), addrs);
+    ASSERT_EQ(lookups.load(), 3);
+
+    // Failure is not cached
+    ASSERT_TRUE(resolve_and_wait(dns, "unknown.test").empty());
+    ASSERT_TRUE(resolve_and_wait(dns, "unknown.test").empty());
+    ASSERT_EQ(lookups.load(), 5);
+}
+
+TEST_F(TestResolverLookup, test_concurrent_requests_share_lookup)
+{
+    resolver dns(2);
+    std::atomic<int> lookups(0);
+    dns.set_lookup(
+        [&](const std::string &) -> std::vector<resolved_address>
+        {
+            ++lookups;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            return {{"127.0.0.1", family::ipv4}};
+        });
+
+    int count = 10;
+    std::atomic<int> received(0);
+    for (int i = 0; i < count; ++i)
+    {
+        dns.resolve("backend.test",
+                    [&](const std::vector<resolved_address> &addrs)
+                    {
+                        if (addrs.size() == 1)
+                        {
+                            ++received;
+                        }
+                    });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    ASSERT_EQ(received.load(), count);
+    ASSERT_EQ(lookups.load(), 1);
+}
+
+TEST_F(TestResolverLookup, test_getaddrinfo_hosts_file)
+{
+    resolver dns;
+    auto addrs = resolve_and_wait(dns, "localhost");
+    ASSERT_FALSE(addrs.empty());
+    for (const auto &addr : addrs)
+    {
+        ASSERT_TRUE(is_ip_literal(std::get<0>(addr), std::get<1>(addr)));
+    }
+}
+
+}  // namespace cppev
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -1,6 +1,10 @@
 #include <gtest/gtest.h>
+#include <sched.h>
 
+#include <algorithm>
 #include <chrono>
+#include <set>
+#include <string>
 #include <thread>
 
 #include "cppev/runnable.h"
@@ -65,6 +69,84 @@ TEST(TestRunnable, test_wait_for_ok)
     tester.join();
 }
 
+#ifdef __linux__
+class runnable_tester_options : public runnable
+{
+public:
+    void run_impl() override
+    {
+        char buf[16];
+        pthread_getname_np(pthread_self(), buf, sizeof(buf));
+        name = buf;
+        cpu = sched_getcpu();
+        pthread_attr_t attr;
+        pthread_getattr_np(pthread_self(), &attr);
+        pthread_attr_getstacksize(&attr, &stack_size);
+        pthread_attr_destroy(&attr);
+    }
+
+    std::string name;
+
+    int cpu = -1;
+
+    size_t stack_size = 0;
+};
+
+TEST(TestRunnable, test_thread_options)
+{
+    std::vector<std::vector<int>> cores = physical_cores();
+    ASSERT_GT(cores.size(), 0);
+    std::set<int> cpus;
+    for (auto &core : cores)
+    {
+        ASSERT_GT(core.size(), 0);
+        cpus.insert(core.begin(), core.end());
+    }
+#ifdef __linux__
+    cpu_set_t allowed;
+    ASSERT_EQ(sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+    ASSERT_EQ(static_cast<int>(cpus.size()), CPU_COUNT(&allowed));
+    for (int cpu : cpus)
+    {
+        ASSERT_TRUE(CPU_ISSET(cpu, &allowed));
+    }
+
+    // Cores are limited to CPUs allowed for the process.
+    cpu_set_t one;
+    CPU_ZERO(&one);
+    CPU_SET(*cpus.begin(), &one);
+    ASSERT_EQ(sched_setaffinity(0, sizeof(one), &one), 0);
+    std::vector<std::vector<int>> limited = physical_cores();
+    ASSERT_EQ(sched_setaffinity(0, sizeof(allowed), &allowed), 0);
+    ASSERT_EQ(limited.size(), 1);
+    ASSERT_EQ(limited[0], std::vector<int>{*cpus.begin()});
+#else
+    ASSERT_EQ(cpus.size(), sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+
+    std::vector<thread_options> opts = spread_physical_cores(2, "cppev");
+    ASSERT_EQ(opts.size(), 2);
+    ASSERT_EQ(opts[1].name, "cppev-1");
+    ASSERT_EQ(opts[0].cpus, cores[0]);
+
+    runnable_tester_options tester;
+    thread_options opt = opts[0];
+    opt.name = "cppev-test-name-too-long";
+    opt.stack_size = 4 << 20;
+    tester.set_thread_options(opt);
+    for (int i = 0; i < 2; ++i)
+    {
+        tester.run();
+        tester.join();
+        EXPECT_EQ(tester.name, "cppev-test-name");
+        // Cached stacks of exited threads may be larger.
+        EXPECT_GE(tester.stack_size, 4 << 20);
+        EXPECT_NE(std::find(cores[0].begin(), cores[0].end(), tester.cpu),
+                  cores[0].end());
+    }
+}
+#endif
+
 TEST(TestRunnable, test_send_signal)
 {
     runnable_tester_wait_for_signal tester;
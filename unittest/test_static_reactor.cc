@@ -0,0 +1,236 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "cppev/static_reactor.h"
+
+namespace cppev
+{
+
+const char *str = "Cppev is a C++ event driven library";
+
+struct echo_server_handler : public reactor::static_handler
+{
+    explicit echo_server_handler(std::atomic<int> &accepted)
+        : accepted(accepted)
+    {
+    }
+
+    void on_accept(const std::shared_ptr<socktcp> &)
+    {
+        ++accepted;
+    }
+
+    void on_read_complete(const std::shared_ptr<socktcp> &iopt)
+    {
+        iopt->wbuffer().put_string(iopt->rbuffer().get_string());
+        reactor::static_reactor<echo_server_handler>::async_write(iopt);
+    }
+
+    std::atomic<int> &accepted;
+};
+
+struct echo_client_handler : public reactor::static_handler
+{
+    using reactor_type = reactor::static_reactor<echo_client_handler>;
+
+    void on_connect(const std::shared_ptr<socktcp> &iopt)
+    {
+        ++connected;
+        iopt->wbuffer().put_string(str);
+        reactor_type::async_write(iopt);
+    }
+
+    void on_connect_failed(const std::shared_ptr<socktcp> &)
+    {
+        ++failed;
+    }
+
+    void on_read_complete(const std::shared_ptr<socktcp> &iopt)
+    {
+        if (iopt->rbuffer().size() == static_cast<int>(strlen(str)))
+        {
+            if (iopt->rbuffer().get_string() == str)
+            {
+                ++echoed;
+            }
+            reactor_type::safely_close(iopt);
+        }
+    }
+
+    std::atomic<int> connected{0};
+    std::atomic<int> failed{0};
+    std::atomic<int> echoed{0};
+};
+
+struct bulk_server_handler : public reactor::static_handler
+{
+    static const int size = 4 << 20;
+
+    void on_accept(const std::shared_ptr<socktcp> &iopt)
+    {
+        iopt->wbuffer().put_string(std::string(size, 'c'));
+        reactor::static_reactor<bulk_server_handler>::async_write(iopt);
+    }
+
+    void on_write_complete(const std::shared_ptr<socktcp> &)
+    {
+        ++completed;
+    }
+
+    std::atomic<int> completed{0};
+};
+
+struct bulk_client_handler : public reactor::static_handler
+{
+    void on_read_complete(const std::shared_ptr<socktcp> &iopt)
+    {
+        received += iopt->rbuffer().get_string().size();
+    }
+
+    std::atomic<long> received{0};
+};
+
+// Check that on_accept runs by the worker thread before any read.
+struct order_server_handler : public reactor::static_handler
+{
+    void on_accept(const std::shared_ptr<socktcp> &iopt)
+    {
+        std::unique_lock<std::mutex> lock(this->lock);
+        accept_threads[iopt.get()] = std::this_thread::get_id();
+    }
+
+    void on_read_complete(const std::shared_ptr<socktcp> &iopt)
+    {
+        iopt->rbuffer().clear();
+        {
+            std::unique_lock<std::mutex> lock(this->lock);
+            auto iter = accept_threads.find(iopt.get());
+            if (iter != accept_threads.end() &&
+                iter->second == std::this_thread::get_id())
+            {
+                ++ordered;
+            }
+            else
+            {
+                ++misordered;
+            }
+            accept_threads.erase(iopt.get());
+        }
+        reactor::static_reactor<order_server_handler>::safely_close(iopt);
+    }
+
+    std::mutex lock;
+    std::unordered_map<const socktcp *, std::thread::id> accept_threads;
+    std::atomic<int> ordered{0};
+    std::atomic<int> misordered{0};
+};
+
+// Send data right on connect, so that it is already readable when the
+// connection is accepted.
+struct hello_client_handler : public reactor::static_handler
+{
+    void on_connect(const std::shared_ptr<socktcp> &iopt)
+    {
+        iopt->wbuffer().put_string(str);
+        reactor::static_reactor<hello_client_handler>::async_write(iopt);
+    }
+};
+
+TEST(TestStaticReactor, test_accept_before_read)
+{
+    int port = 8903;
+    int conns = 20;
+
+    reactor::static_tcp_server<order_server_handler> server(2);
+    server.listen(port, family::ipv4);
+    server.run();
+
+    reactor::static_tcp_client<hello_client_handler> client(1);
+    client.run();
+    client.add("127.0.0.1", port, family::ipv4, conns);
+
+    auto &handler = server.handler();
+    for (int i = 0;
+         i < 200 && handler.ordered.load() + handler.misordered.load() < conns;
+         ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    client.shutdown();
+    server.shutdown();
+
+    ASSERT_EQ(handler.ordered.load(), conns);
+    ASSERT_EQ(handler.misordered.load(), 0);
+}
+
+TEST(TestStaticReactor, test_edge_trigger_bulk)
+{
+    int port = 8902;
+    int conns = 4;
+    int budget = sysconfig::reactor_read_budget;
+    // Small budget requeues connections on every readable edge.
+    sysconfig::reactor_edge_trigger = true;
+    sysconfig::reactor_read_budget = 4096;
+
+    reactor::static_tcp_server<bulk_server_handler> server(2);
+    server.listen(port, family::ipv4);
+    server.run();
+
+    reactor::static_tcp_client<bulk_client_handler> client(2);
+    client.run();
+    client.add("127.0.0.1", port, family::ipv4, conns);
+
+    long total = static_cast<long>(conns) * bulk_server_handler::size;
+    for (int i = 0; i < 100 && client.handler().received.load() < total; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    client.shutdown();
+    server.shutdown();
+    sysconfig::reactor_read_budget = budget;
+
+    ASSERT_EQ(client.handler().received.load(), total);
+    ASSERT_EQ(server.handler().completed.load(), conns);
+}
+
+TEST(TestStaticReactor, test_echo)
+{
+    int port4 = 8890;
+    int port6 = 8892;
+    int conns = 50;
+
+    std::atomic<int> accepted(0);
+    reactor::static_tcp_server<echo_server_handler> server(3, accepted);
+    server.listen(port4, family::ipv4);
+    server.listen(port6, family::ipv6);
+    server.run();
+
+    reactor::static_tcp_client<echo_client_handler> client(2);
+    client.run();
+    client.add("127.0.0.1", port4, family::ipv4, conns);
+    client.add("::1", port6, family::ipv6, conns);
+    client.add("127.0.0.1", port4 + 1, family::ipv4, 1);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    client.shutdown();
+    server.shutdown();
+
+    ASSERT_EQ(accepted.load(), 2 * conns);
+    ASSERT_EQ(client.handler().connected.load(), 2 * conns);
+    ASSERT_EQ(client.handler().echoed.load(), 2 * conns);
+    ASSERT_EQ(client.handler().failed.load(), 1);
+}
+
+}  // namespace cppev
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,241 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "cppev/event_loop.h"
+#include "cppev/runnable.h"
+#include "cppev/scheduler.h"
+#include "cppev/stop_token.h"
+#include "cppev/thread_pool.h"
+
+namespace cppev
+{
+
+using clock_type = std::chrono::steady_clock;
+
+TEST(TestStopToken, test_callback)
+{
+    stop_source src;
+    stop_token token = src.token();
+    ASSERT_TRUE(token.stop_possible());
+    ASSERT_FALSE(token.stop_requested());
+    ASSERT_FALSE(stop_token().stop_possible());
+
+    int count = 0;
+    stop_callback cb(token, [&] { ++count; });
+    {
+        // Removed before stop.
+        stop_callback removed(token, [&] { count += 100; });
+    }
+    ASSERT_TRUE(src.request_stop());
+    ASSERT_FALSE(src.request_stop());
+    ASSERT_EQ(count, 1);
+    ASSERT_TRUE(token.stop_requested());
+
+    // Stopped already, runs at once.
+    stop_callback late(token, [&] { ++count; });
+    ASSERT_EQ(count, 2);
+}
+
+TEST(TestStopToken, test_parent)
+{
+    stop_source parent;
+    stop_source child(parent.token());
+    stop_source grandchild(child.token());
+    {
+        // Unlinked by destruction.
+        stop_source gone(parent.token());
+    }
+
+    child.request_stop();
+    ASSERT_FALSE(parent.stop_requested());
+    ASSERT_TRUE(grandchild.stop_requested());
+
+    stop_source sibling(parent.token());
+    parent.request_stop();
+    ASSERT_TRUE(sibling.stop_requested());
+
+    // Parent stopped already.
+    stop_source late(parent.token());
+    ASSERT_TRUE(late.stop_requested());
+}
+
+TEST(TestStopToken, test_wait)
+{
+    ASSERT_FALSE(stop_token().wait_for(std::chrono::milliseconds(1)));
+
+    stop_source src;
+    ASSERT_FALSE(src.token().wait_for(std::chrono::milliseconds(1)));
+
+    auto start = clock_type::now();
+    std::thread thr(
+        [&]
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            src.request_stop();
+        });
+    ASSERT_TRUE(src.token().wait_for(std::chrono::seconds(10)));
+    ASSERT_LT(clock_type::now() - start, std::chrono::seconds(5));
+    thr.join();
+}
+
+TEST(TestStopToken, test_callback_concurrent_removal)
+{
+    // Callback destroyed while stop runs it waits for it to return.
+    for (int i = 0; i < 50; ++i)
+    {
+        stop_source src;
+        std::atomic<int> state(0);
+        auto cb = std::make_unique<stop_callback>(
+            src.token(),
+            [&]
+            {
+                state = 1;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                state = 2;
+            });
+        std::thread thr([&] { src.request_stop(); });
+        while (state.load() == 0 && !src.stop_requested())
+        {
+            std::this_thread::yield();
+        }
+        cb.reset();
+        int observed = state.load();
+        ASSERT_TRUE(observed == 0 || observed == 2);
+        thr.join();
+    }
+}
+
+class runnable_until_stop : public runnable
+{
+public:
+    void run_impl() override
+    {
+        get_stop_token().wait_for(std::chrono::seconds(10));
+    }
+};
+
+class runnable_ignoring_stop : public runnable
+{
+public:
+    void run_impl() override
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    }
+};
+
+TEST(TestStopToken, test_runnable)
+{
+    runnable_until_stop tester;
+    tester.run();
+    ASSERT_FALSE(tester.wait_for(std::chrono::milliseconds(10)));
+    tester.request_stop();
+    ASSERT_TRUE(tester.wait_for(std::chrono::seconds(5)));
+    tester.join();
+
+    // Stop of the previous run is reset.
+    tester.run();
+    ASSERT_FALSE(tester.get_stop_token().stop_requested());
+    ASSERT_FALSE(tester.wait_for(std::chrono::milliseconds(10)));
+    tester.request_stop();
+    tester.join();
+}
+
+TEST(TestStopToken, test_thread_pool)
+{
+    thread_pool<runnable_until_stop> tp(16);
+    tp.run();
+    auto start = clock_type::now();
+    tp.request_stop();
+    ASSERT_TRUE(tp.join_for(std::chrono::seconds(5)).empty());
+    ASSERT_LT(clock_type::now() - start, std::chrono::seconds(5));
+
+    // Pool runs again after stop.
+    tp.run();
+    ASSERT_FALSE(tp[0].get_stop_token().stop_requested());
+    tp.request_stop();
+    ASSERT_TRUE(tp.join_for(std::chrono::seconds(5)).empty());
+}
+
+TEST(TestStopToken, test_join_for_reports_running)
+{
+    runnable_until_stop cooperative;
+    runnable_ignoring_stop stubborn;
+    cooperative.run();
+    stubborn.run();
+    cooperative.request_stop();
+    stubborn.request_stop();
+
+    // Deadline is shared, not per thread.
+    auto start = clock_type::now();
+    std::vector<int> running =
+        join_for({&stubborn, &cooperative}, std::chrono::milliseconds(50));
+    ASSERT_LT(clock_type::now() - start, std::chrono::milliseconds(250));
+    ASSERT_EQ(running, std::vector<int>({0}));
+    ASSERT_TRUE(join_reporting({&stubborn}, std::chrono::seconds(5),
+                               "stubborn")
+                    .empty());
+
+}
+
+TEST(TestStopToken, test_event_loop)
+{
+    event_loop evlp;
+    stop_source src;
+    evlp.set_stop_token(src.token());
+    std::thread thr([&] { evlp.loop_forever(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    auto start = clock_type::now();
+    src.request_stop();
+    thr.join();
+    ASSERT_LT(clock_type::now() - start, std::chrono::seconds(1));
+
+    // Stopped before loop starts.
+    evlp.loop_forever();
+
+    // Token replaced.
+    stop_source next;
+    evlp.set_stop_token(next.token());
+    std::thread thr2([&] { evlp.loop_forever(); });
+    next.request_stop();
+    thr2.join();
+}
+
+TEST(TestStopToken, test_timed_scheduler)
+{
+    std::atomic<int> exits(0);
+    auto start = clock_type::now();
+    {
+        // Period of 10s, destructor does not wait for the sleep.
+        timed_scheduler<> ts({{0.1, priority::p0, [](const auto &) {}}}, {},
+                             {[&] { ++exits; }}, false);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(exits.load(), 1);
+    ASSERT_LT(clock_type::now() - start, std::chrono::seconds(5));
+
+    // Stopped by parent.
+    stop_source parent;
+    timed_scheduler<> ts({{0.1, priority::p0, [](const auto &) {}}}, {},
+                         {[&] { ++exits; }}, false, parent.token());
+    parent.request_stop();
+    ASSERT_TRUE(ts.get_stop_token().stop_requested());
+    while (exits.load() != 2 &&
+           clock_type::now() - start < std::chrono::seconds(5))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(exits.load(), 2);
+}
+
+}  // namespace cppev
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
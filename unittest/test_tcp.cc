@@ -0,0 +1,743 @@
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "cppev/tcp.h"
+
+namespace cppev
+{
+
+TEST(TestTcp, test_edge_trigger_bulk_and_sendfile)
+{
+    int port = 8910;
+    int conns = 2;
+    const int upload = 4 << 20;
+    const int chunk = 64 << 10;
+    const int chunks = 16;
+    bool edge_trigger = sysconfig::reactor_edge_trigger;
+    int budget = sysconfig::reactor_read_budget;
+    // Small budget requeues connections on every readable edge.
+    sysconfig::reactor_edge_trigger = true;
+    sysconfig::reactor_read_budget = 4096;
+
+    std::mutex lock;
+    std::vector<std::thread> feeders;
+    std::vector<int> sources;
+    std::atomic<long> uploaded(0);
+    std::atomic<long> downloaded(0);
+    std::atomic<int> sent(0);
+
+    reactor::tcp_server server(2);
+    server.set_on_accept(
+        [&](const std::shared_ptr<socktcp> &iopt)
+        {
+            // Pipe fed slowly, so that splice from it would block while the
+            // socket is still writable.
+            int fds[2];
+            ASSERT_EQ(pipe(fds), 0);
+            {
+                std::unique_lock<std::mutex> lk(lock);
+                sources.push_back(fds[0]);
+                feeders.emplace_back(
+                    [fd = fds[1], chunk, chunks]
+                    {
+                        std::string data(chunk, 'f');
+                        for (int i = 0; i < chunks; ++i)
+                        {
+                            std::this_thread::sleep_for(
+                                std::chrono::milliseconds(5));
+                            ASSERT_EQ(write(fd, data.data(), data.size()),
+                                      chunk);
+                        }
+                        close(fd);
+                    });
+            }
+            reactor::async_sendfile(iopt, fds[0], 0, chunk * chunks);
+        });
+    server.set_on_read_complete(
+        [&](const std::shared_ptr<socktcp> &iopt)
+        { uploaded += iopt->rbuffer().get_string().size(); });
+    server.set_on_write_complete([&](const std::shared_ptr<socktcp> &)
+                                 { ++sent; });
+    server.listen(port, family::ipv4);
+    server.run();
+
+    reactor::tcp_client client(2);
+    client.set_on_connect(
+        [&](const std::shared_ptr<socktcp> &iopt)
+        {
+            iopt->wbuffer().put_string(std::string(upload, 'c'));
+            reactor::async_write(iopt);
+        });
+    client.set_on_read_complete(
+        [&](const std::shared_ptr<socktcp> &iopt)
+        { downloaded += iopt->rbuffer().get_string().size(); });
+    client.run();
+    client.add("127.0.0.1", port, family::ipv4, conns);
+
+    long up = static_cast<long>(conns) * upload;
+    long down = static_cast<long>(conns) * chunk * chunks;
+    for (int i = 0; i < 200 && (uploaded.load() < up ||
+                                downloaded.load() < down);
+         ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    client.shutdown();
+    server.shutdown();
+    sysconfig::reactor_edge_trigger = edge_trigger;
+    sysconfig::reactor_read_budget = budget;
+    for (auto &feeder : feeders)
+    {
+        feeder.join();
+    }
+    for (int fd : sources)
+    {
+        close(fd);
+    }
+
+    ASSERT_EQ(uploaded.load(), up);
+    ASSERT_EQ(downloaded.load(), down);
+    ASSERT_EQ(sent.load(), conns);
+}
+
+// Server closing connections on request, counting accepted ones.
+class pool_server
+{
+public:
+    explicit pool_server(int port) : server_(1)
+    {
+        server_.set_on_accept([this](const std::shared_ptr<socktcp> &)
+                              { ++accepted; });
+        server_.set_on_read_complete(
+            [](const std::shared_ptr<socktcp> &iopt)
+            {
+                if (iopt->rbuffer().get_string() == "close")
+                {
+                    reactor::safely_close(iopt);
+                }
+            });
+        server_.listen(port, family::ipv4);
+        server_.run();
+    }
+
+    ~pool_server()
+    {
+        server_.shutdown();
+    }
+
+    std::atomic<int> accepted{0};
+
+private:
+    reactor::tcp_server server_;
+};
+
+// Checkout synchronously, the connection shall not be used by caller.
+static std::shared_ptr<socktcp> checkout(reactor::tcp_client &client,
+                                         int port, std::thread::id &owner)
+{
+    std::promise<std::shared_ptr<socktcp>> conn;
+    client.checkout("127.0.0.1", port, family::ipv4,
+                    [&](const std::shared_ptr<socktcp> &iopt)
+                    {
+                        owner = std::this_thread::get_id();
+                        conn.set_value(iopt);
+                    });
+    auto fut = conn.get_future();
+    if (fut.wait_for(std::chrono::seconds(5)) != std::future_status::ready)
+    {
+        return nullptr;
+    }
+    return fut.get();
+}
+
+template <typename Pred>
+static bool wait_for(Pred pred)
+{
+    for (int i = 0; i < 200 && !pred(); ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return pred();
+}
+
+TEST(TestTcp, test_pool_reuse)
+{
+    int port = 8911;
+    pool_server server(port);
+
+    reactor::tcp_client client(2);
+    client.set_pool("127.0.0.1", port, family::ipv4, 1, 2);
+    client.run();
+
+    std::thread::id owner;
+    std::shared_ptr<socktcp> first = checkout(client, port, owner);
+    ASSERT_NE(first, nullptr);
+    ASSERT_NE(owner, std::this_thread::get_id());
+    client.checkin(first);
+    std::shared_ptr<socktcp> second = checkout(client, port, owner);
+    // Handler of idle connection runs by worker thread too.
+    EXPECT_NE(owner, std::this_thread::get_id());
+    client.checkin(second);
+    client.shutdown();
+
+    ASSERT_EQ(first, second);
+    ASSERT_EQ(server.accepted.load(), 1);
+}
+
+TEST(TestTcp, test_pool_evict_and_refill)
+{
+    int port = 8912;
+    pool_server server(port);
+
+    std::atomic<int> closed(0);
+    reactor::tcp_client client(2);
+    client.set_on_closed([&](const std::shared_ptr<socktcp> &)
+                         { ++closed; });
+    client.set_pool("127.0.0.1", port, family::ipv4, 1, 2);
+    client.run();
+
+    // Connection closed by server while idle is dropped from pool.
+    std::shared_ptr<socktcp> first;
+    client.checkout("127.0.0.1", port, family::ipv4,
+                    [&](const std::shared_ptr<socktcp> &iopt)
+                    {
+                        iopt->wbuffer().put_string("close");
+                        reactor::async_write(iopt);
+                        client.checkin(iopt);
+                        first = iopt;
+                    });
+    ASSERT_TRUE(wait_for([&] { return closed.load() == 1; }));
+
+    // Pool is refilled to min size once closed, without checkout.
+    ASSERT_TRUE(wait_for([&] { return server.accepted.load() == 2; }));
+
+    std::thread::id owner;
+    std::shared_ptr<socktcp> second = checkout(client, port, owner);
+    ASSERT_NE(second, nullptr);
+    client.checkin(second);
+    client.shutdown();
+
+    ASSERT_NE(first, second);
+    ASSERT_FALSE(second->is_closed());
+    ASSERT_EQ(server.accepted.load(), 2);
+}
+
+TEST(TestTcp, test_pool_skips_added)
+{
+    int port = 8922;
+    pool_server server(port);
+
+    std::atomic<int> connected(0);
+    reactor::tcp_client client(1);
+    client.set_on_connect([&](const std::shared_ptr<socktcp> &)
+                          { ++connected; });
+    client.set_pool("127.0.0.1", port, family::ipv4, 1, 1);
+    client.run();
+    ASSERT_TRUE(wait_for([&] { return server.accepted.load() == 1; }));
+
+    // Connections added to the pooled target are handed to on_connect.
+    client.add("127.0.0.1", port, family::ipv4, 2);
+    ASSERT_TRUE(wait_for([&] { return connected.load() == 2; }));
+
+    std::thread::id owner;
+    std::shared_ptr<socktcp> pooled = checkout(client, port, owner);
+    ASSERT_NE(pooled, nullptr);
+    client.checkin(pooled);
+    client.shutdown();
+
+    ASSERT_EQ(server.accepted.load(), 3);
+}
+
+TEST(TestTcp, test_accept_before_read)
+{
+    int port = 8916;
+    int conns = 20;
+
+    // Thread triggering on_accept of each connection.
+    std::mutex lock;
+    std::unordered_map<const socktcp *, std::thread::id> accept_threads;
+    std::atomic<int> ordered(0);
+    std::atomic<int> misordered(0);
+
+    reactor::tcp_server server(2);
+    server.set_on_accept(
+        [&](const std::shared_ptr<socktcp> &iopt)
+        {
+            std::unique_lock<std::mutex> lk(lock);
+            accept_threads[iopt.get()] = std::this_thread::get_id();
+        });
+    server.set_on_read_complete(
+        [&](const std::shared_ptr<socktcp> &iopt)
+        {
+            iopt->rbuffer().clear();
+            std::unique_lock<std::mutex> lk(lock);
+            auto iter = accept_threads.find(iopt.get());
+            if (iter != accept_threads.end() &&
+                iter->second == std::this_thread::get_id())
+            {
+                ++ordered;
+            }
+            else
+            {
+                ++misordered;
+            }
+            accept_threads.erase(iopt.get());
+            reactor::safely_close(iopt);
+        });
+    server.listen(port, family::ipv4);
+    server.run();
+
+    // Data is sent right on connect, so that it is already readable when
+    // the connection is accepted.
+    reactor::tcp_client client(1);
+    client.set_on_connect(
+        [](const std::shared_ptr<socktcp> &iopt)
+        {
+            iopt->wbuffer().put_string("hello");
+            reactor::async_write(iopt);
+        });
+    client.run();
+    client.add("127.0.0.1", port, family::ipv4, conns);
+
+    ASSERT_TRUE(wait_for(
+        [&] { return ordered.load() + misordered.load() == conns; }));
+    client.shutdown();
+    server.shutdown();
+
+    ASSERT_EQ(ordered.load(), conns);
+    ASSERT_EQ(misordered.load(), 0);
+}
+
+TEST(TestTcp, test_drain)
+{
+    int port = 8913;
+    int conns = 2;
+
+    std::atomic<int> accepted(0);
+    reactor::tcp_server server(2);
+    server.set_on_accept([&](const std::shared_ptr<socktcp> &)
+                         { ++accepted; });
+    server.listen(port, family::ipv4);
+    server.run();
+
+    // The first connection is closed by client while draining, the other is
+    // kept open.
+    std::atomic<int> connected(0);
+    reactor::tcp_client client(1);
+    client.set_on_connect(
+        [&](const std::shared_ptr<socktcp> &iopt)
+        {
+            if (++connected == 1)
+            {
+                iopt->evlp().post_after(
+                    300, [iopt] { reactor::safely_close(iopt); });
+            }
+        });
+    client.run();
+    client.add("127.0.0.1", port, family::ipv4, conns);
+    ASSERT_TRUE(wait_for([&] { return accepted.load() == conns; }));
+
+    std::vector<int> progress;
+    auto start = std::chrono::steady_clock::now();
+    bool drained = server.drain(
+        800, [&](int remaining) { progress.push_back(remaining); });
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    client.shutdown();
+
+    ASSERT_FALSE(drained);
+    ASSERT_GE(elapsed, 800);
+    // Reported every reactor_drain_interval and once more at deadline.
+    ASSERT_GE(progress.size(), 3u);
+    ASSERT_EQ(progress.front(), conns);
+    ASSERT_EQ(progress.back(), conns - 1);
+    for (size_t i = 1; i < progress.size(); ++i)
+    {
+        ASSERT_LE(progress[i], progress[i - 1]);
+    }
+}
+
+TEST(TestTcp, test_drain_finished)
+{
+    int port = 8914;
+
+    std::atomic<int> accepted(0);
+    reactor::tcp_server server(1);
+    server.set_on_accept([&](const std::shared_ptr<socktcp> &)
+                         { ++accepted; });
+    server.listen(port, family::ipv4);
+    server.run();
+
+    reactor::tcp_client client(1);
+    client.set_on_connect(
+        [](const std::shared_ptr<socktcp> &iopt)
+        {
+            iopt->evlp().post_after(
+                200, [iopt] { reactor::safely_close(iopt); });
+        });
+    client.run();
+    client.add("127.0.0.1", port, family::ipv4);
+    ASSERT_TRUE(wait_for([&] { return accepted.load() == 1; }));
+
+    std::vector<int> progress;
+    bool drained = server.drain(
+        5000, [&](int remaining) { progress.push_back(remaining); });
+    client.shutdown();
+
+    ASSERT_TRUE(drained);
+    ASSERT_EQ(progress.front(), 1);
+    ASSERT_EQ(progress.back(), 0);
+}
+
+TEST(TestTcp, test_handover_takeover)
+{
+    int port = 8915;
+    std::string path = "/tmp/cppev_test_tcp_handover.sock";
+
+    std::atomic<int> old_accepted(0);
+    reactor::tcp_server old_server(1);
+    old_server.set_on_accept([&](const std::shared_ptr<socktcp> &)
+                             { ++old_accepted; });
+    old_server.listen(port, family::ipv4);
+    old_server.run();
+
+    bool handed = false;
+    std::thread handover([&] { handed = old_server.handover(path, 5000); });
+
+    std::atomic<int> new_accepted(0);
+    reactor::tcp_server new_server(1);
+    new_server.set_on_accept([&](const std::shared_ptr<socktcp> &)
+                             { ++new_accepted; });
+    new_server.set_on_read_complete(
+        [](const std::shared_ptr<socktcp> &iopt)
+        {
+            iopt->wbuffer().put_string(iopt->rbuffer().get_string());
+            reactor::async_write(iopt);
+        });
+    // Wait for old server to listen in path.
+    int taken = 0;
+    for (int i = 0; i < 200 && taken == 0; ++i)
+    {
+        try
+        {
+            taken = new_server.takeover(path);
+        }
+        catch (const std::system_error &)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    handover.join();
+    ASSERT_TRUE(handed);
+    ASSERT_EQ(taken, 1);
+    new_server.run();
+    ASSERT_TRUE(old_server.drain(1000));
+
+    // Listening socket taken over keeps accepting.
+    std::atomic<int> echoed(0);
+    reactor::tcp_client client(1);
+    client.set_on_connect(
+        [](const std::shared_ptr<socktcp> &iopt)
+        {
+            iopt->wbuffer().put_string("takeover");
+            reactor::async_write(iopt);
+        });
+    client.set_on_read_complete(
+        [&](const std::shared_ptr<socktcp> &iopt)
+        {
+            if (iopt->rbuffer().get_string() == "takeover")
+            {
+                ++echoed;
+            }
+        });
+    client.run();
+    client.add("127.0.0.1", port, family::ipv4, 2);
+    ASSERT_TRUE(wait_for([&] { return echoed.load() == 2; }));
+    client.shutdown();
+    new_server.shutdown();
+
+    ASSERT_EQ(old_accepted.load(), 0);
+    ASSERT_EQ(new_accepted.load(), 2);
+}
+
+TEST(TestTcp, test_handover_rejected)
+{
+    int port = 8920;
+    std::string path = "/tmp/cppev_test_tcp_handover_rejected.sock";
+
+    reactor::tcp_server old_server(1);
+    old_server.listen(port, family::ipv4);
+    old_server.run();
+
+    std::atomic<int> checked(0);
+    bool handed = true;
+    std::thread handover(
+        [&]
+        {
+            handed = old_server.handover(
+                path, 500,
+                [&](const peer_credentials &cred)
+                {
+                    EXPECT_EQ(cred.uid, geteuid());
+                    ++checked;
+                    return false;
+                });
+        });
+
+    // Path is accessible only by owner.
+    struct stat st;
+    ASSERT_TRUE(wait_for([&] { return stat(path.c_str(), &st) == 0; }));
+    ASSERT_EQ(st.st_mode & 0777, 0600);
+
+    // Rejected peer is closed without listening sockets.
+    reactor::tcp_server new_server(1);
+    ASSERT_EQ(new_server.takeover(path), 0);
+    handover.join();
+    ASSERT_FALSE(handed);
+    ASSERT_EQ(checked.load(), 1);
+    ASSERT_TRUE(old_server.drain(1000));
+}
+
+TEST(TestTcp, test_close_in_on_closed)
+{
+    int port = 8921;
+
+    std::atomic<int> closed(0);
+    reactor::tcp_server server(1);
+    server.set_on_closed(
+        [&](const std::shared_ptr<socktcp> &iopt)
+        {
+            reactor::safely_close(iopt);
+            ++closed;
+        });
+    server.listen(port, family::ipv4);
+    server.run();
+
+    reactor::tcp_client client(1);
+    client.set_on_connect([](const std::shared_ptr<socktcp> &iopt)
+                          { reactor::safely_close(iopt); });
+    client.run();
+    client.add("127.0.0.1", port, family::ipv4);
+    ASSERT_TRUE(wait_for([&] { return closed.load() == 1; }));
+
+    // Connection is counted off once.
+    std::vector<int> progress;
+    ASSERT_TRUE(server.drain(
+        1000, [&](int remaining) { progress.push_back(remaining); }));
+    client.shutdown();
+    ASSERT_EQ(progress, std::vector<int>{0});
+}
+
+// Connect accounting of target on local host.
+static reactor::connect_stats target_stats(reactor::tcp_client &client,
+                                           int port)
+{
+    auto stats = client.stats();
+    auto iter = stats.find(std::make_tuple("127.0.0.1", port, family::ipv4));
+    return iter == stats.end() ? reactor::connect_stats() : iter->second;
+}
+
+TEST(TestTcp, test_connect_backoff)
+{
+    // Nothing listens on port.
+    int port = 8917;
+    std::atomic<int> connected(0);
+    std::atomic<int> failed(0);
+    reactor::tcp_client client(1);
+    client.set_on_connect([&](const std::shared_ptr<socktcp> &)
+                          { ++connected; });
+    client.set_on_connect_failed(
+        [&](const std::tuple<std::string, int, family> &h)
+        {
+            EXPECT_EQ(std::get<1>(h), port);
+            ++failed;
+        });
+    reactor::retry_policy policy;
+    policy.max_retries = 3;
+    policy.base_backoff = 50;
+    policy.multiplier = 2;
+    policy.jitter = 0.5;
+    client.set_retry_policy(policy);
+    client.run();
+
+    auto start = std::chrono::steady_clock::now();
+    client.add("127.0.0.1", port, family::ipv4);
+    EXPECT_TRUE(wait_for([&] { return failed.load() == 1; }));
+    // Backoffs are at least 25, 50 and 100 ms with jitter.
+    EXPECT_GE(std::chrono::steady_clock::now() - start,
+              std::chrono::milliseconds(175));
+    client.shutdown();
+
+    reactor::connect_stats stats = target_stats(client, port);
+    EXPECT_EQ(connected.load(), 0);
+    EXPECT_EQ(failed.load(), 1);
+    EXPECT_EQ(stats.failures, 4);
+    EXPECT_EQ(stats.consecutive_failures, 4);
+    EXPECT_EQ(stats.rejects, 0);
+    EXPECT_EQ(stats.successes, 0);
+    EXPECT_EQ(stats.state, reactor::breaker_state::closed);
+}
+
+TEST(TestTcp, test_connect_breaker_open)
+{
+    int port = 8918;
+    std::atomic<int> failed(0);
+    reactor::tcp_client client(1);
+    client.set_on_connect_failed(
+        [&](const std::tuple<std::string, int, family> &) { ++failed; });
+    reactor::retry_policy policy;
+    policy.max_retries = 3;
+    policy.base_backoff = 10;
+    policy.breaker_threshold = 2;
+    policy.breaker_cooldown = 100;
+    client.set_retry_policy("127.0.0.1", port, family::ipv4, policy);
+    client.run();
+
+    auto start = std::chrono::steady_clock::now();
+    client.add("127.0.0.1", port, family::ipv4, 2);
+    EXPECT_TRUE(wait_for([&] { return failed.load() == 2; }));
+    // Retries wait for the trials of open circuit.
+    EXPECT_GE(std::chrono::steady_clock::now() - start,
+              std::chrono::milliseconds(200));
+    client.shutdown();
+
+    // Every attempt either fails or is rejected, trials fail too.
+    reactor::connect_stats stats = target_stats(client, port);
+    EXPECT_EQ(failed.load(), 2);
+    EXPECT_EQ(stats.failures + stats.rejects, 8);
+    EXPECT_GE(stats.failures, 4);
+    EXPECT_EQ(stats.state, reactor::breaker_state::open);
+}
+
+TEST(TestTcp, test_connect_breaker_recover)
+{
+    int port = 8919;
+    std::atomic<int> connected(0);
+    std::atomic<int> failed(0);
+    reactor::tcp_client client(1);
+    client.set_on_connect([&](const std::shared_ptr<socktcp> &)
+                          { ++connected; });
+    client.set_on_connect_failed(
+        [&](const std::tuple<std::string, int, family> &) { ++failed; });
+    reactor::retry_policy policy;
+    policy.max_retries = 10;
+    policy.base_backoff = 10;
+    policy.breaker_threshold = 1;
+    policy.breaker_cooldown = 200;
+    client.set_retry_policy(policy);
+    client.run();
+
+    client.add("127.0.0.1", port, family::ipv4);
+    EXPECT_TRUE(wait_for(
+        [&]
+        {
+            return target_stats(client, port).state ==
+                   reactor::breaker_state::open;
+        }));
+
+    // Target comes back while the circuit is open, the trial closes it.
+    reactor::tcp_server server(1);
+    server.listen(port, family::ipv4);
+    server.run();
+    EXPECT_TRUE(wait_for([&] { return connected.load() == 1; }));
+    client.shutdown();
+    server.shutdown();
+
+    reactor::connect_stats stats = target_stats(client, port);
+    EXPECT_EQ(connected.load(), 1);
+    EXPECT_EQ(failed.load(), 0);
+    EXPECT_GE(stats.failures, 1);
+    EXPECT_EQ(stats.successes, 1);
+    EXPECT_EQ(stats.consecutive_failures, 0);
+    EXPECT_EQ(stats.state, reactor::breaker_state::closed);
+    EXPECT_GT(stats.last_latency, 0);
+    EXPECT_EQ(stats.max_latency, stats.last_latency);
+    EXPECT_EQ(stats.total_latency, stats.last_latency);
+}
+
+TEST(TestTcp, test_connect_happy_eyeballs)
+{
+    int port = 8923;
+
+    // Listener with full accept queue drops SYN, so connecting to it stays
+    // pending.
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.2", &addr.sin_addr);
+    ASSERT_EQ(bind(lfd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)), 0);
+    ASSERT_EQ(listen(lfd, 0), 0);
+    int filler = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_EQ(
+        connect(filler, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)), 0);
+
+    reactor::tcp_server server(1);
+    server.listen(port, family::ipv4, "127.0.0.1");
+    server.run();
+
+    std::atomic<int> connected(0);
+    std::atomic<int> failed(0);
+    std::atomic<int64_t> elapsed(0);
+    auto start = std::chrono::steady_clock::now();
+    reactor::tcp_client client(1);
+    client.set_lookup(
+        [](const std::string &)
+        {
+            return std::vector<resolved_address>{
+                resolved_address("127.0.0.2", family::ipv4),
+                resolved_address("127.0.0.1", family::ipv4)};
+        });
+    client.set_on_connect(
+        [&](const std::shared_ptr<socktcp> &)
+        {
+            elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+            ++connected;
+        });
+    client.set_on_connect_failed(
+        [&](const std::tuple<std::string, int, family> &) { ++failed; });
+    client.run();
+    start = std::chrono::steady_clock::now();
+    client.add("eyeballs.test", port, family::ipv4);
+
+    // The second address is tried once the first one is still pending after
+    // the connection attempt delay, and wins.
+    ASSERT_TRUE(wait_for([&] { return connected.load() == 1; }));
+    EXPECT_GE(elapsed.load(), sysconfig::connection_attempt_delay);
+    EXPECT_LT(elapsed.load(), sysconfig::connection_attempt_delay + 1000);
+
+    // Pending attempt to the first address is not reported.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    client.shutdown();
+    server.shutdown();
+    close(filler);
+    close(lfd);
+
+    ASSERT_EQ(connected.load(), 1);
+    ASSERT_EQ(failed.load(), 0);
+}
+
+}  // namespace cppev
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -1,7 +1,10 @@
 #include <gtest/gtest.h>
 
+#include <atomic>
 #include <chrono>
+#include <functional>
 #include <mutex>
+#include <thread>
 
 #include "cppev/logger.h"
 #include "cppev/runnable.h"
@@ -109,6 +112,240 @@ TEST(TestThreadPool, test_thread_pool_task_queue)
     ASSERT_EQ(sum, count);
 }
 
+TEST(TestThreadPool, test_thread_pool_task_queue_spawn)
+{
+    // Binary tree of tasks, each spawned by a worker to its own deque.
+    int depth = 14;
+    std::atomic<int> leaves(0);
+    thread_pool_task_queue tp(8);
+
+    std::function<void(int)> spawn = [&](int level)
+    {
+        if (level == depth)
+        {
+            ++leaves;
+            return;
+        }
+        tp.add_task([&, level] { spawn(level + 1); });
+        tp.add_task([&, level] { spawn(level + 1); });
+    };
+
+    tp.run();
+    tp.add_task([&] { spawn(0); });
+    tp.stop();
+    ASSERT_EQ(leaves.load(), 1 << depth);
+}
+
+TEST(TestThreadPool, test_thread_pool_task_queue_submitters)
+{
+    int submitters = 8;
+    int count = 10000;
+    std::atomic<int> sum(0);
+    thread_pool_task_queue tp(4);
+    tp.run();
+
+    std::vector<std::thread> thrs;
+    for (int i = 0; i < submitters; ++i)
+    {
+        thrs.emplace_back(
+            [&]
+            {
+                thread_pool_task_handler batch[10];
+                for (int j = 0; j < count; j += 10)
+                {
+                    for (auto &task : batch)
+                    {
+                        task = [&] { ++sum; };
+                    }
+                    tp.add_task(batch, 10);
+                }
+            });
+    }
+    for (auto &thr : thrs)
+    {
+        thr.join();
+    }
+    tp.stop();
+    ASSERT_EQ(sum.load(), submitters * count);
+}
+
+TEST(TestThreadPool, test_thread_pool_task_queue_priority)
+{
+    int count = 100;
+    std::vector<priority> order;
+    std::atomic<bool> release(false);
+    thread_pool_task_queue tp(1);
+    tp.run();
+
+    // Single worker is held so that both lanes fill up before dequeue.
+    tp.add_task(
+        [&]
+        {
+            while (!release.load())
+            {
+                std::this_thread::yield();
+            }
+        });
+    for (int i = 0; i < count; ++i)
+    {
+        tp.add_task([&] { order.push_back(priority::p6); }, priority::p6);
+        tp.add_task([&] { order.push_back(priority::p0); }, priority::p0);
+    }
+    ASSERT_EQ(tp.lane_stats(priority::p6).depth, count);
+    release = true;
+    tp.stop();
+
+    ASSERT_EQ(order.size(), 2 * count);
+    int p0_first = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        p0_first += order[i] == priority::p0;
+    }
+    // Weights are 64 to 1, p6 still gets its share.
+    ASSERT_GE(p0_first, count - 3);
+    ASSERT_LT(p0_first, count);
+
+    thread_pool_lane_stats stats = tp.lane_stats(priority::p6);
+    ASSERT_EQ(stats.depth, 0);
+    ASSERT_EQ(stats.dequeued, count);
+    ASSERT_EQ(stats.expired, 0);
+    ASSERT_GT(stats.max_wait.count(), 0);
+}
+
+TEST(TestThreadPool, test_thread_pool_task_queue_deadline)
+{
+    std::atomic<bool> release(false);
+    std::atomic<bool> dropped_run(false);
+    std::atomic<bool> flagged(false);
+    std::atomic<bool> on_time(true);
+    thread_pool_task_queue tp(1);
+    tp.run();
+
+    tp.add_task(
+        [&]
+        {
+            while (!release.load())
+            {
+                std::this_thread::yield();
+            }
+        });
+    auto deadline = std::chrono::steady_clock::now();
+    tp.add_task([&] { dropped_run = true; }, priority::p1, deadline);
+    tp.add_task([&] { flagged = thread_pool_task_queue::deadline_missed(); },
+                priority::p1, deadline, deadline_policy::flag);
+    tp.add_task([&] { on_time = thread_pool_task_queue::deadline_missed(); },
+                priority::p1,
+                std::chrono::steady_clock::now() + std::chrono::hours(1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    release = true;
+    tp.stop();
+
+    ASSERT_FALSE(dropped_run.load());
+    ASSERT_TRUE(flagged.load());
+    ASSERT_FALSE(on_time.load());
+    thread_pool_lane_stats stats = tp.lane_stats(priority::p1);
+    ASSERT_EQ(stats.dequeued, 3);
+    ASSERT_EQ(stats.expired, 2);
+}
+
+TEST(TestThreadPool, test_thread_pool_task_queue_elastic)
+{
+    int count = 8;
+    std::atomic<int> done(0);
+    thread_pool_task_queue tp(1, 4, std::chrono::milliseconds(1),
+                              std::chrono::milliseconds(100));
+    tp.run();
+    ASSERT_EQ(tp.size(), 1);
+
+    // Tasks waiting behind a busy worker spawn workers.
+    for (int i = 0; i < count; ++i)
+    {
+        tp.add_task(
+            [&]
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                ++done;
+            });
+    }
+    while (done.load() != count)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_GT(tp.size(), 1);
+    ASSERT_LE(tp.size(), 4);
+
+    // Idle workers retire down to min.
+    std::this_thread::sleep_for(std::chrono::milliseconds(400));
+    ASSERT_EQ(tp.size(), 1);
+
+    // Blocked workers are compensated, all tasks block at the same time.
+    std::atomic<int> blocked(0);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i)
+    {
+        tp.add_task(
+            [&]
+            {
+                thread_pool_task_queue::enter_blocking();
+                ++blocked;
+                while (blocked.load() < count &&
+                       std::chrono::steady_clock::now() - start <
+                           std::chrono::seconds(5))
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                thread_pool_task_queue::leave_blocking();
+            });
+    }
+    tp.stop();
+    ASSERT_EQ(blocked.load(), count);
+    ASSERT_LT(std::chrono::steady_clock::now() - start,
+              std::chrono::seconds(5));
+}
+
+TEST(TestThreadPool, test_thread_pool_task_queue_elastic_local)
+{
+    thread_pool_task_queue tp(1, 2, std::chrono::milliseconds(5),
+                              std::chrono::milliseconds(100));
+    tp.run();
+
+    // Task spawned to the local deque of the only worker, which then waits
+    // for it. Adding another one after spawn wait grows the pool.
+    std::atomic<bool> inner(false);
+    std::atomic<bool> ran(false);
+    tp.add_task(
+        [&]
+        {
+            tp.add_task([&] { inner = true; });
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            tp.add_task([] {});
+            auto start = std::chrono::steady_clock::now();
+            while (!inner.load() && std::chrono::steady_clock::now() - start <
+                                        std::chrono::seconds(2))
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            ran = inner.load();
+        });
+    tp.stop();
+    ASSERT_TRUE(ran.load());
+}
+
+TEST(TestThreadPool, test_thread_pool_task_queue_destroy_running)
+{
+    std::atomic<int> count(0);
+    {
+        // Destroyed without stop, queued tasks still run.
+        thread_pool_task_queue tp(4);
+        tp.run();
+        for (int i = 0; i < 100; ++i)
+        {
+            tp.add_task([&count] { ++count; });
+        }
+    }
+    ASSERT_EQ(count.load(), 100);
+}
+
 }  // namespace cppev
 
 int main(int argc, char **argv)
@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "cppev/udp.h"
+
+namespace cppev
+{
+
+const std::string str = "Cppev is a C++ event driven library";
+
+TEST(TestUdp, test_echo)
+{
+    int port4 = 8894;
+    int port6 = 8895;
+    int count = 100;
+
+    reactor::udp_server server(3);
+    server.set_on_datagram(
+        [](const std::shared_ptr<sockudp> &sock, std::string_view payload,
+           const endpoint &peer)
+        { reactor::async_send(sock, payload.data(), payload.size(), peer); });
+    server.listen(port4, family::ipv4);
+    server.listen(port6, family::ipv6);
+    server.run();
+
+    std::atomic<int> echoed(0);
+    reactor::udp_client client(2, &echoed);
+    client.set_on_datagram(
+        [](const std::shared_ptr<sockudp> &sock, std::string_view payload,
+           const endpoint &)
+        {
+            if (payload == str)
+            {
+                ++*reinterpret_cast<std::atomic<int> *>(
+                    reactor::external_data(sock));
+            }
+        });
+    client.run();
+    for (int i = 0; i < count; ++i)
+    {
+        client.send(str.data(), str.size(), "127.0.0.1", port4, family::ipv4);
+        client.send(str.data(), str.size(), "::1", port6, family::ipv6);
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    client.shutdown();
+    server.shutdown();
+
+    ASSERT_EQ(echoed.load(), 2 * count);
+    ASSERT_EQ(server.dropped(), 0);
+    ASSERT_EQ(client.dropped(), 0);
+}
+
+#ifdef __linux__
+TEST(TestUdp, test_peer_affinity)
+{
+    int port = 8896;
+    int clients = 4;
+
+    std::mutex lock;
+    std::set<std::thread::id> workers;
+    std::atomic<int> received(0);
+
+    reactor::udp_server server(4);
+    server.set_on_datagram(
+        [&](const std::shared_ptr<sockudp> &, std::string_view,
+            const endpoint &)
+        {
+            std::unique_lock<std::mutex> lk(lock);
+            workers.insert(std::this_thread::get_id());
+            ++received;
+        });
+    server.listen(port, family::ipv4, "127.0.0.1", true);
+    server.run();
+
+    // Each client sends from a different source port of the same address.
+    std::vector<std::unique_ptr<reactor::udp_client>> cs;
+    for (int i = 0; i < clients; ++i)
+    {
+        cs.push_back(std::make_unique<reactor::udp_client>(1));
+        cs.back()->run();
+        for (int j = 0; j < 10; ++j)
+        {
+            cs.back()->send(str.data(), str.size(), "127.0.0.1", port,
+                            family::ipv4);
+        }
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    for (auto &c : cs)
+    {
+        c->shutdown();
+    }
+    server.shutdown();
+
+    ASSERT_EQ(received.load(), 10 * clients);
+    ASSERT_EQ(workers.size(), 1);
+}
+#endif
+
+}  // namespace cppev
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "cppev/unique_function.h"
+
+namespace cppev
+{
+
+class counted
+{
+public:
+    explicit counted(int *alive) : alive_(alive)
+    {
+        ++*alive_;
+    }
+
+    counted(const counted &other) : alive_(other.alive_)
+    {
+        ++*alive_;
+    }
+
+    ~counted()
+    {
+        --*alive_;
+    }
+
+    int operator()(int x) const
+    {
+        return x + 1;
+    }
+
+private:
+    int *alive_;
+};
+
+TEST(TestUniqueFunction, test_invoke)
+{
+    unique_function<int(int, int)> add = [](int a, int b) { return a + b; };
+    ASSERT_TRUE(add);
+    ASSERT_EQ(add(1, 2), 3);
+
+    std::string s = "cppev";
+    unique_function<size_t(const std::string &)> len = &std::string::size;
+    ASSERT_EQ(len(s), 5);
+
+    unique_function<void()> empty;
+    ASSERT_FALSE(empty);
+    ASSERT_THROW(empty(), std::bad_function_call);
+
+    unique_function<void()> null_std = std::function<void()>();
+    ASSERT_FALSE(null_std);
+
+    void (*null_ptr)() = nullptr;
+    unique_function<void()> null_fptr = null_ptr;
+    ASSERT_FALSE(null_fptr);
+}
+
+TEST(TestUniqueFunction, test_discard_result)
+{
+    // Result of callable is discarded by void signature, inline and heap.
+    int calls = 0;
+    unique_function<void()> small = [&calls]() { return ++calls; };
+    small();
+    ASSERT_EQ(calls, 1);
+
+    std::array<char, 256> pad{};
+    unique_function<void(int)> large = [&calls, pad](int x)
+    { return calls += x + pad[0]; };
+    large(2);
+    ASSERT_EQ(calls, 3);
+}
+
+TEST(TestUniqueFunction, test_move_only)
+{
+    auto p = std::make_unique<int>(42);
+    unique_function<int()> f = [p = std::move(p)]() { return *p; };
+    ASSERT_EQ(f(), 42);
+
+    unique_function<int()> g = std::move(f);
+    ASSERT_FALSE(f);
+    ASSERT_EQ(g(), 42);
+
+    f = std::move(g);
+    ASSERT_FALSE(g);
+    ASSERT_EQ(f(), 42);
+
+    f = nullptr;
+    ASSERT_FALSE(f);
+}
+
+TEST(TestUniqueFunction, test_lifetime)
+{
+    int alive = 0;
+    {
+        // Small callable stored inline.
+        unique_function<int(int)> small = counted(&alive);
+        ASSERT_EQ(alive, 1);
+        unique_function<int(int)> moved = std::move(small);
+        ASSERT_EQ(alive, 1);
+        ASSERT_EQ(moved(1), 2);
+    }
+    ASSERT_EQ(alive, 0);
+    {
+        // Large callable allocated on heap, moved by pointer.
+        std::array<char, 256> pad{};
+        counted c(&alive);
+        unique_function<int(int)> large = [pad, c](int x)
+        { return c(x) + pad[0]; };
+        ASSERT_EQ(alive, 2);
+        unique_function<int(int)> moved = std::move(large);
+        ASSERT_EQ(alive, 2);
+        ASSERT_EQ(moved(1), 2);
+    }
+    ASSERT_EQ(alive, 0);
+    {
+        unique_function<int(int), 16> f = counted(&alive);
+        f = [](int x) { return x; };
+        ASSERT_EQ(alive, 0);
+        ASSERT_EQ(f(7), 7);
+    }
+}
+
+}  // namespace cppev
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}